@@ -22,6 +22,7 @@ BuildRequires:  cmake
 BuildRequires:  pkgconfig(libsystemd) >= 222
 BuildRequires:  pkgconfig(openssl)
 BuildRequires:  pkgconfig(uuid)
+BuildRequires:  pkgconfig(zlib)
 BuildRequires:  libgcrypt-devel
 BuildRequires:  pkgconfig(gnutls)
 BuildRequires:  pkgconfig(json-c)
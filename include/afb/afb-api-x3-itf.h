@@ -265,6 +265,18 @@ struct afb_api_x3_itf
 	/** settings of the api */
 	struct json_object *(*settings)(
 		struct afb_api_x3 *api);
+
+	/** set the cache policy of a verb */
+	int (*api_set_verb_cache)(
+		struct afb_api_x3 *api,
+		const char *verb,
+		uint32_t ttl,
+		int session);
+
+	/** drop the cached replies of a verb */
+	void (*api_invalidate_cache)(
+		struct afb_api_x3 *api,
+		const char *verb);
 };
 
 /** @} */
@@ -959,4 +959,52 @@ struct json_object *afb_api_x3_settings(
 	return api->itf->settings(api);
 }
 
+/**
+ * Set the cache policy of the verb of name 'verb'.
+ *
+ * The successful replies of the verb are kept during 'ttl' milliseconds
+ * and given to the requests having the same arguments, whatever is the
+ * order of the fields of the objects, without calling the verb.
+ * The authorization and session requirements of the verb are still
+ * checked. This policy replaces the one set by the fields **cache_ttl**
+ * and **cache_session** of the description of the verb.
+ *
+ * This function is only valid for dynamic apis not sealed.
+ *
+ * @param api the api that defines the verb
+ * @param verb the name of the verb
+ * @param ttl the time to live of the replies in milliseconds, 0 for no cache
+ * @param session not zero if the replies are only given to the same session
+ *
+ * @returns 0 in case of success or a negative value in case of error.
+ *
+ * @see afb_api_x3_invalidate_cache
+ */
+static inline
+int afb_api_x3_set_verb_cache(
+			struct afb_api_x3 *api,
+			const char *verb,
+			uint32_t ttl,
+			int session)
+{
+	return api->itf->api_set_verb_cache(api, verb, ttl, session);
+}
+
+/**
+ * Drop the replies of the verb of name 'verb' kept in cache,
+ * for example because the state that they read changed.
+ *
+ * @param api the api that defines the verb
+ * @param verb the name of the verb or NULL for all the verbs of the api
+ *
+ * @see afb_api_x3_set_verb_cache
+ */
+static inline
+void afb_api_x3_invalidate_cache(
+			struct afb_api_x3 *api,
+			const char *verb)
+{
+	api->itf->api_invalidate_cache(api, verb);
+}
+
 /** @} */
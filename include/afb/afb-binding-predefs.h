@@ -254,6 +254,8 @@
 #define afb_req_x2_reply		afb_req_reply
 #define afb_req_x2_reply_f		afb_req_reply_f
 #define afb_req_x2_reply_v		afb_req_reply_v
+#define afb_req_x2_reply_buffer		afb_req_reply_buffer
+#define afb_req_x2_reply_string		afb_req_reply_string
 #define afb_req_success(r,o,i)		afb_req_reply(r,o,0,i)
 #define afb_req_success_f(r,o,...)	afb_req_reply_f(r,o,0,__VA_ARGS__)
 #define afb_req_success_v(r,o,f,v)	afb_req_reply_v(r,o,0,f,v)
@@ -281,6 +283,8 @@
 #define afb_req_x2_get_application_id	afb_req_get_application_id
 #define afb_req_x2_get_uid		afb_req_get_uid
 #define afb_req_x2_get_client_info	afb_req_get_client_info
+#define afb_req_x2_alloc		afb_req_alloc
+#define afb_req_x2_remaining_time	afb_req_remaining_time
 
 #define afb_req_x2_subcall_flags	afb_req_subcall_flags
 #define afb_req_x2_subcall_catch_events	afb_req_subcall_catch_events
@@ -332,6 +336,8 @@
 #define afb_api_x3_require_class	afb_api_require_class
 #define afb_api_x3_provide_class	afb_api_provide_class
 #define afb_api_x3_settings		afb_api_settings
+#define afb_api_x3_set_verb_cache	afb_api_set_verb_cache
+#define afb_api_x3_invalidate_cache	afb_api_invalidate_cache
 
 #define AFB_API_ERROR			AFB_API_ERROR_V3
 #define AFB_API_WARNING			AFB_API_WARNING_V3
@@ -83,6 +83,12 @@ struct afb_verb_v3
 
 	/** is the verb glob name */
 	uint16_t glob: 1;
+
+	/** are the cached replies of the verb specific to the session */
+	uint16_t cache_session: 1;
+
+	/** time to live in seconds of the cached replies, 0 for no cache */
+	uint16_t cache_ttl: 14;
 };
 
 /**
@@ -125,6 +131,9 @@ struct afb_binding_v3
 
 	/** avoids concurrent requests to verbs */
 	unsigned noconcurrency: 1;
+
+	/** priority of the requests: 0 normal, 1 critical, 2 bulk */
+	unsigned priority: 2;
 };
 
 /**
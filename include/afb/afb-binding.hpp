@@ -169,6 +169,8 @@ public:
 	void reply(json_object *obj = nullptr, const char *error = nullptr, const char *info = nullptr) const;
 	void replyf(json_object *obj, const char *error, const char *info, ...) const;
 	void replyv(json_object *obj, const char *error, const char *info, va_list args) const;
+	void reply_buffer(const char *buffer, size_t size, const char *error = nullptr, const char *info = nullptr) const;
+	void reply_string(const char *json, const char *error = nullptr, const char *info = nullptr) const;
 
 	void success(json_object *obj = nullptr, const char *info = nullptr) const;
 	void successf(json_object *obj, const char *info, ...) const;
@@ -216,6 +218,10 @@ public:
 	int get_uid() const;
 
 	json_object *get_client_info() const;
+
+	void *alloc(size_t size) const;
+
+	int remaining_time() const;
 };
 
 /*************************************************************************/
@@ -305,6 +311,8 @@ inline json_object *req::json() const { return afb_req_json(req_); }
 
 inline void req::reply(json_object *obj, const char *error, const char *info) const { afb_req_reply(req_, obj, error, info); }
 inline void req::replyv(json_object *obj, const char *error, const char *info, va_list args) const { afb_req_reply_v(req_, obj, error, info, args); }
+inline void req::reply_buffer(const char *buffer, size_t size, const char *error, const char *info) const { afb_req_reply_buffer(req_, buffer, size, error, info); }
+inline void req::reply_string(const char *json, const char *error, const char *info) const { afb_req_reply_string(req_, json, error, info); }
 inline void req::replyf(json_object *obj, const char *error, const char *info, ...) const
 {
 	va_list args;
@@ -444,6 +452,16 @@ inline json_object *req::get_client_info() const
 	return afb_req_get_client_info(req_);
 }
 
+inline void *req::alloc(size_t size) const
+{
+	return afb_req_alloc(req_, size);
+}
+
+inline int req::remaining_time() const
+{
+	return afb_req_remaining_time(req_);
+}
+
 /* commons */
 inline int broadcast_event(const char *name, json_object *object)
 	{ return afb_daemon_broadcast_event(name, object); }
@@ -620,12 +638,14 @@ constexpr afb_verb_t verb(
 #if AFB_BINDING_VERSION >= 3
 	,
 	bool glob = false,
-	void *vcbdata = nullptr
+	void *vcbdata = nullptr,
+	uint16_t cache_ttl = 0,
+	bool cache_session = false
 #endif
 )
 {
 #if AFB_BINDING_VERSION >= 3
-	afb_verb_t r = { 0, 0, 0, 0, 0, 0, 0 };
+	afb_verb_t r = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 #else
 	afb_verb_t r = { 0, 0, 0, 0, 0 };
 #endif
@@ -637,6 +657,8 @@ constexpr afb_verb_t verb(
 #if AFB_BINDING_VERSION >= 3
 	r.glob = (unsigned)glob;
 	r.vcbdata = vcbdata;
+	r.cache_ttl = cache_ttl;
+	r.cache_session = (unsigned)cache_session;
 #endif
 	return r;
 }
@@ -668,7 +690,7 @@ constexpr afb_binding_t binding(
 )
 {
 #if AFB_BINDING_VERSION >= 3
-	afb_binding_t r = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	afb_binding_t r = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 #else
 	afb_binding_t r = { 0, 0, 0, 0, 0, 0, 0, 0 };
 #endif
@@ -686,6 +708,171 @@ constexpr afb_binding_t binding(
 	return r;
 };
 
+/*************************************************************************/
+/* compile time check of the descriptors of wrap_json                    */
+/*************************************************************************/
+
+namespace wrap_json {
+
+constexpr bool has(const char *set, char c)
+{
+	while (*set)
+		if (*set++ == c)
+			return true;
+	return false;
+}
+
+constexpr const char *skip(const char *d)
+{
+	while (*d && has(" \t\n\r,:", *d))
+		d++;
+	return d;
+}
+
+/* is 'desc' a valid descriptor for wrap_json_pack? */
+constexpr bool valid_pack(const char *desc)
+{
+	char types[32] = { 0 }; /* 0, ']', '}' (key) or ':' (value) */
+	int depth = 0, nstr = 0;
+	const char *d = skip(desc);
+	char c = 0;
+
+	for (;;) {
+		c = *d;
+		if (!c || !has(types[depth] == ']' ? "][{snbiIfoOyY" : types[depth] == '}' ? "s}" : "[{snbiIfoOyY", c))
+			return false;
+		d = skip(d + 1);
+		switch (c) {
+		case 's':
+			for (nstr = 1 ; ; nstr++) {
+				if (*d == '?')
+					d = skip(d + 1);
+				if (*d == '%' || *d == '#')
+					d = skip(d + 1);
+				if (*d == '?')
+					d = skip(d + 1);
+				if (*d != '+')
+					break;
+				if (nstr >= 8)
+					return false;
+				d = skip(d + 1);
+			}
+			break;
+		case 'o':
+		case 'O':
+		case 'y':
+		case 'Y':
+			if (*d == '?')
+				d = skip(d + 1);
+			break;
+		case '[':
+		case '{':
+			if (++depth >= 32)
+				return false;
+			types[depth] = c == '[' ? ']' : '}';
+			continue;
+		case ']':
+		case '}':
+			depth--;
+			break;
+		default:
+			break;
+		}
+		switch (types[depth]) {
+		case 0:
+			return !*d;
+		case '}':
+			types[depth] = ':';
+			break;
+		case ':':
+			types[depth] = '}';
+			/*@fallthrough@*/
+		default:
+			if (*d == '*')
+				d = skip(d + 1);
+			break;
+		}
+	}
+}
+
+/* is 'desc' a valid descriptor for wrap_json_unpack? */
+constexpr bool valid_unpack(const char *desc)
+{
+	char accs[32] = { 0 }, types[32] = { 0 };
+	char acc = 'v', xacc = 0; /* acc: 'v' value, 'a' array, 'k' key, 'c' closing */
+	int depth = -1;
+	const char *d = skip(desc);
+	char c = 0;
+
+	for (;;) {
+		c = *d;
+		if (!c || !(acc == 'c' ? c == xacc : has(acc == 'v' ? "[{snbiIfFoOyY" : acc == 'a' ? "*!][{snbiIfFoOyY" : "*!s}", c)))
+			return false;
+		d = skip(d + 1);
+		switch (c) {
+		case 's':
+			if (xacc == '}') {
+				if (*d == '?')
+					d = skip(d + 1);
+				xacc = ':';
+				acc = 'v';
+				continue;
+			}
+			if (*d == '%')
+				d = skip(d + 1);
+			break;
+		case '[':
+		case '{':
+			if (++depth >= 32)
+				return false;
+			accs[depth] = acc;
+			types[depth] = xacc;
+			xacc = c == '[' ? ']' : '}';
+			acc = c == '[' ? 'a' : 'k';
+			if (c == '{')
+				continue;
+			break;
+		case ']':
+		case '}':
+			acc = accs[depth];
+			xacc = types[depth--];
+			break;
+		case '!':
+			if (*d != xacc)
+				return false;
+			/*@fallthrough@*/
+		case '*':
+			acc = 'c';
+			continue;
+		default:
+			break;
+		}
+		if (!xacc)
+			return !*d;
+		if (xacc == ':') {
+			acc = 'k';
+			xacc = '}';
+		}
+	}
+}
+
+template <bool valid>
+constexpr const char *checked(const char *desc)
+{
+	static_assert(valid, "invalid descriptor of wrap_json");
+	return desc;
+}
+
+}
+
+/*
+ * Use the descriptors of wrap_json through these macros to check them at compile time:
+ *
+ *   wrap_json_unpack(args, AFB_WRAP_JSON_UNPACK("{ss si s?o}"), ...);
+ */
+#define AFB_WRAP_JSON_PACK(desc)   (::afb::wrap_json::checked<::afb::wrap_json::valid_pack(desc)>(desc))
+#define AFB_WRAP_JSON_UNPACK(desc) (::afb::wrap_json::checked<::afb::wrap_json::valid_unpack(desc)>(desc))
+
 /*************************************************************************/
 /***                         E N D                                     ***/
 /*************************************************************************/
@@ -306,6 +306,23 @@ struct afb_req_x2_itf
 			struct json_object **object,
 			char **error,
 			char **info);
+
+	/** allocation of memory released with the request */
+	void *(*alloc)(
+			struct afb_req_x2 *req,
+			size_t size);
+
+	/** reply to the request with a serialized object */
+	void (*reply_buffer)(
+			struct afb_req_x2 *req,
+			const char *buffer,
+			size_t size,
+			const char *error,
+			const char *info);
+
+	/** time remaining before the deadline of the request */
+	int (*remaining_time)(
+			struct afb_req_x2 *req);
 };
 
 
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <string.h>
+
 #include "afb-req-x2-itf.h"
 #include "afb-api-x3.h"
 
@@ -250,6 +252,58 @@ void afb_req_x2_reply(
 	req->itf->reply(req, obj, error, info);
 }
 
+/**
+ * Sends a reply to the request 'req' with an object already serialized.
+ *
+ * Same as 'afb_req_x2_reply' but the object is given by its JSON text
+ * of 'size' bytes in 'buffer' (can be NULL). The text is used as is,
+ * without being parsed, so it must be a valid JSON text. The buffer is
+ * no more used when the function returns.
+ *
+ * @param req the request
+ * @param buffer the JSON text of the replied object or NULL
+ * @param size the size in bytes of the text
+ * @param error the error message if it is a reply error or NULL
+ * @param info an informative text or NULL
+ *
+ * @see afb_req_x2_reply
+ * @see afb_req_x2_reply_string
+ */
+static inline
+void afb_req_x2_reply_buffer(
+			struct afb_req_x2 *req,
+			const char *buffer,
+			size_t size,
+			const char *error,
+			const char *info)
+{
+	req->itf->reply_buffer(req, buffer, size, error, info);
+}
+
+/**
+ * Sends a reply to the request 'req' with an object already serialized.
+ *
+ * Same as 'afb_req_x2_reply_buffer' but the JSON text 'json' is
+ * terminated by a zero.
+ *
+ * @param req the request
+ * @param json the JSON text of the replied object or NULL
+ * @param error the error message if it is a reply error or NULL
+ * @param info an informative text or NULL
+ *
+ * @see afb_req_x2_reply
+ * @see afb_req_x2_reply_buffer
+ */
+static inline
+void afb_req_x2_reply_string(
+			struct afb_req_x2 *req,
+			const char *json,
+			const char *error,
+			const char *info)
+{
+	req->itf->reply_buffer(req, json, json ? strlen(json) : 0, error, info);
+}
+
 /**
  * Same as 'afb_req_x2_reply_f' but the arguments to the format 'info'
  * are given as a variable argument list instance.
@@ -801,5 +855,48 @@ int afb_req_x2_subcall_sync(
 	return req->itf->subcallsync(req, api, verb, args, flags, object, error, info);
 }
 
+/**
+ * Allocates 'size' bytes of memory released automatically
+ * when the request 'req' is released.
+ *
+ * The returned memory is aligned for any kind of data. It must not
+ * be freed explicitely and must not be used after the request is
+ * released. The function must not be called concurrently for the same
+ * request.
+ *
+ * @param req      The request
+ * @param size     The size to allocate
+ *
+ * @return the allocated memory or NULL when out of memory
+ */
+static inline
+void *afb_req_x2_alloc(
+			struct afb_req_x2 *req,
+			size_t size)
+{
+	return req->itf->alloc(req, size);
+}
+
+/**
+ * Get the time remaining before the deadline of the request 'req'.
+ *
+ * The deadline of a request is set when it is received from the
+ * apiset timeout and subcalls inherit the deadline of their caller,
+ * also when calling remote apis. A request is not processed when its
+ * deadline is reached before it starts and the execution of its verb
+ * is limited to the time remaining.
+ *
+ * @param req      The request
+ *
+ * @return the remaining time in milliseconds, 0 if the deadline
+ * is reached, or -1 if the request has no deadline
+ */
+static inline
+int afb_req_x2_remaining_time(
+			struct afb_req_x2 *req)
+{
+	return req->itf->remaining_time(req);
+}
+
 
 /** @} */
@@ -44,6 +44,9 @@
 #include "afb-cred.h"
 #include "afb-evt.h"
 #include "afb-xreq.h"
+#include "idmap.h"
+#include "jobs.h"
+#include "slab.h"
 #include "verbose.h"
 
 
@@ -70,7 +73,7 @@ struct api_dbus
 			struct sd_bus_slot *slot_broadcast;
 			struct sd_bus_slot *slot_event;
 			struct dbus_event *events;
-			struct dbus_memo *memos;
+			struct idmap memos;	/* pending calls by cookie */
 		} client;
 		struct {
 			struct sd_bus_slot *slot_call;
@@ -219,7 +222,6 @@ static void destroy_api_dbus(struct api_dbus *api)
  * structure for recording query data
  */
 struct dbus_memo {
-	struct dbus_memo *next;		/* the next memo */
 	struct api_dbus *api;		/* the dbus api */
 	struct afb_xreq *xreq;		/* the request */
 	uint64_t msgid;			/* the message identifier */
@@ -244,25 +246,29 @@ static struct dbus_memo *api_dbus_client_memo_make(struct api_dbus *api, struct
 		memo->xreq = xreq;
 		memo->msgid = 0;
 		memo->api = api;
-		memo->next = api->client.memos;
-		api->client.memos = memo;
 	}
 	return memo;
 }
 
+/*
+ * records the memo under the cookie of its message
+ * sd-bus allocates increasing cookies of 32 bits
+ */
+static int api_dbus_client_memo_record(struct dbus_memo *memo, uint64_t msgid)
+{
+	int rc;
+
+	rc = idmap_set(&memo->api->client.memos, (uint32_t)msgid, memo);
+	if (rc >= 0)
+		memo->msgid = msgid;
+	return rc;
+}
+
 /* free and release the memorizing data */
 static void api_dbus_client_memo_destroy(struct dbus_memo *memo)
 {
-	struct dbus_memo **prv;
-
-	prv = &memo->api->client.memos;
-	while (*prv != NULL) {
-		if (*prv == memo) {
-			*prv = memo->next;
-			break;
-		}
-		prv = &(*prv)->next;
-	}
+	if (memo->msgid)
+		idmap_remove(&memo->api->client.memos, (uint32_t)memo->msgid);
 
 	afb_xreq_unhooked_unref(memo->xreq);
 	free(memo);
@@ -273,9 +279,9 @@ static struct dbus_memo *api_dbus_client_memo_search(struct api_dbus *api, uint6
 {
 	struct dbus_memo *memo;
 
-	memo = api->client.memos;
-	while (memo != NULL && memo->msgid != msgid)
-		memo = memo->next;
+	memo = idmap_get(&api->client.memos, (uint32_t)msgid);
+	if (memo != NULL && memo->msgid != msgid)
+		memo = NULL;
 
 	return memo;
 }
@@ -321,11 +327,13 @@ static void api_dbus_client_call(void *closure, struct afb_xreq *xreq)
 	struct dbus_memo *memo;
 	struct sd_bus_message *msg;
 	const char *creds;
+	uint64_t msgid;
+	uint32_t budget;
 
 	/* create the recording data */
 	memo = api_dbus_client_memo_make(api, xreq);
 	if (memo == NULL) {
-		afb_xreq_reply(memo->xreq, NULL, "error", "out of memory");
+		afb_xreq_reply(xreq, NULL, "error", "out of memory");
 		return;
 	}
 
@@ -344,14 +352,26 @@ static void api_dbus_client_call(void *closure, struct afb_xreq *xreq)
 	if (rc < 0)
 		goto error;
 
+	/* the budget is optional */
+	budget = afb_xreq_budget(xreq);
+	if (budget) {
+		rc = sd_bus_message_append(msg, "u", budget);
+		if (rc < 0)
+			goto error;
+	}
+
 	/* makes the call */
 	rc = sd_bus_call_async(api->sdbus, NULL, msg, api_dbus_client_on_reply, memo, (uint64_t)-1);
 	if (rc < 0)
 		goto error;
 
-	rc = sd_bus_message_get_cookie(msg, &memo->msgid);
-	if (rc >= 0)
+	rc = sd_bus_message_get_cookie(msg, &msgid);
+	if (rc >= 0) {
+		/* the reply is still routed when recording fails, not the subscriptions */
+		if (api_dbus_client_memo_record(memo, msgid) < 0)
+			ERROR("can't record the call %llu: %m", (unsigned long long)msgid);
 		goto end;
+	}
 
 error:
 	/* if there was an error report it directly */
@@ -618,6 +638,7 @@ int afb_api_dbus_add_client(const char *path, struct afb_apiset *declare_set, st
 	afb_api.closure = api;
 	afb_api.itf = &dbus_api_itf;
 	afb_api.group = NULL;
+	afb_api.priority = JOBS_PRIORITY_NORMAL;
 	if (afb_apiset_add(declare_set, api->api, afb_api) < 0)
 		goto error2;
 
@@ -812,7 +833,7 @@ static void dbus_req_destroy(struct afb_xreq *xreq)
 	afb_context_disconnect(&dreq->xreq.context);
 	json_object_put(dreq->json);
 	sd_bus_message_unref(dreq->message);
-	free(dreq);
+	slab_free(dreq, sizeof *dreq);
 }
 
 /* get the object of the request */
@@ -823,6 +844,24 @@ static struct json_object *dbus_req_json(struct afb_xreq *xreq)
 	return dreq->json;
 }
 
+static void dbus_req_raw_reply_buffer(struct afb_xreq *xreq, const char *buffer, size_t size, const char *error, const char *info)
+{
+	struct dbus_req *dreq = CONTAINER_OF_XREQ(struct dbus_req, xreq);
+	char *text;
+	int rc;
+
+	/* the string of the message must be terminated by a zero */
+	text = strndup(buffer, size);
+	if (text == NULL) {
+		ERROR("out of memory");
+		return;
+	}
+	rc = sd_bus_reply_method_return(dreq->message, "sss", text, error ? : "", info ? : "");
+	if (rc < 0)
+		ERROR("sending the reply failed");
+	free(text);
+}
+
 void dbus_req_raw_reply(struct afb_xreq *xreq, struct json_object *obj, const char *error, const char *info)
 {
 	struct dbus_req *dreq = CONTAINER_OF_XREQ(struct dbus_req, xreq);
@@ -865,6 +904,7 @@ static int dbus_req_unsubscribe(struct afb_xreq *xreq, struct afb_event_x2 *even
 const struct afb_xreq_query_itf afb_api_dbus_xreq_itf = {
 	.json = dbus_req_json,
 	.reply = dbus_req_raw_reply,
+	.reply_buffer = dbus_req_raw_reply_buffer,
 	.unref = dbus_req_destroy,
 	.subscribe = dbus_req_subscribe,
 	.unsubscribe = dbus_req_unsubscribe,
@@ -938,7 +978,7 @@ static int api_dbus_server_on_object_called(sd_bus_message *message, void *userd
 	const char *creds;
 	struct dbus_req *dreq;
 	struct api_dbus *api = userdata;
-	uint32_t flags;
+	uint32_t flags, budget;
 	struct afb_session *session;
 	struct listener *listener;
 	enum json_tokener_error jerr;
@@ -951,12 +991,15 @@ static int api_dbus_server_on_object_called(sd_bus_message *message, void *userd
 	method = sd_bus_message_get_member(message);
 
 	/* create the request */
-	dreq = calloc(1 , sizeof *dreq);
+	dreq = slab_calloc(sizeof *dreq);
 	if (dreq == NULL)
 		goto out_of_memory;
 
 	/* get the data */
 	rc = sd_bus_message_read(message, "ssus", &dreq->request, &uuid, &flags, &creds);
+	budget = 0;
+	if (rc >= 0 && sd_bus_message_at_end(message, 0) == 0)
+		rc = sd_bus_message_read(message, "u", &budget);
 	if (rc < 0) {
 		sd_bus_reply_method_errorf(message, SD_BUS_ERROR_INVALID_SIGNATURE, "invalid signature");
 		goto error;
@@ -985,13 +1028,15 @@ static int api_dbus_server_on_object_called(sd_bus_message *message, void *userd
 	dreq->listener = listener;
 	dreq->xreq.request.called_api = api->api;
 	dreq->xreq.request.called_verb = method;
+	if (budget)
+		afb_xreq_set_budget(&dreq->xreq, budget);
 	afb_xreq_process(&dreq->xreq, api->server.apiset);
 	return 1;
 
 out_of_memory:
 	sd_bus_reply_method_errorf(message, SD_BUS_ERROR_NO_MEMORY, "out of memory");
 error:
-	free(dreq);
+	slab_free(dreq, sizeof *dreq);
 	return 1;
 }
 
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <json-c/json.h>
+
+#include "afb-api-so-cache.h"
+#include "wrap-json.h"
+#include "verbose.h"
+
+#define MANIFEST_VERSION	1
+
+/* name of the file of the manifest or NULL when not active */
+static char *manifest_file;
+
+/* entries read from the manifest */
+static struct json_object *manifest;
+
+/* entries used or recorded since the load */
+static struct json_object *updated;
+
+/* was an entry recorded? */
+static int changed;
+
+/*
+ * Makes the entry of 'version' and 'apis' for the file of status 'st'
+ */
+static struct json_object *make_entry(const struct stat *st, const char *version, struct json_object *apis)
+{
+	struct json_object *entry;
+
+	wrap_json_pack(&entry, "{sI sI sI sI sI ss so*}",
+			"dev", (int64_t)st->st_dev,
+			"ino", (int64_t)st->st_ino,
+			"size", (int64_t)st->st_size,
+			"mtime", (int64_t)st->st_mtim.tv_sec,
+			"mtime-ns", (int64_t)st->st_mtim.tv_nsec,
+			"version", version,
+			"apis", apis);
+	return entry;
+}
+
+/*
+ * Loads the manifest of 'filename' and activates the recording.
+ * A missing file is an empty manifest. A manifest that can't be
+ * read is discarded.
+ * @return 0 on success or -1 on error
+ */
+int afb_api_so_cache_load(const char *filename)
+{
+	struct json_object *root, *entries;
+	int version;
+
+	free(manifest_file);
+	json_object_put(manifest);
+	json_object_put(updated);
+	manifest_file = strdup(filename);
+	manifest = json_object_new_object();
+	updated = json_object_new_object();
+	changed = 0;
+	if (!manifest_file || !manifest || !updated) {
+		ERROR("out of memory");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (access(filename, F_OK) < 0 && errno == ENOENT) {
+		INFO("binding manifest %s doesn't exist yet", filename);
+		return 0;
+	}
+
+	root = json_object_from_file(filename);
+	if (wrap_json_unpack(root, "{si so}", "version", &version, "entries", &entries)
+	 || version != MANIFEST_VERSION
+	 || !json_object_is_type(entries, json_type_object)) {
+		WARNING("binding manifest %s ignored: invalid content", filename);
+		changed = 1;
+	} else {
+		json_object_put(manifest);
+		manifest = json_object_get(entries);
+	}
+	json_object_put(root);
+	return 0;
+}
+
+/*
+ * Writes the manifest if it changed
+ * @return 0 on success or -1 on error
+ */
+int afb_api_so_cache_save()
+{
+	struct json_object *root;
+	char *tmp;
+	int rc;
+
+	if (!manifest_file)
+		return 0;
+	if (!changed && json_object_object_length(manifest) == json_object_object_length(updated))
+		return 0;
+
+	rc = asprintf(&tmp, "%s.tmp", manifest_file);
+	if (rc < 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	wrap_json_pack(&root, "{si sO}", "version", MANIFEST_VERSION, "entries", updated);
+	rc = json_object_to_file_ext(tmp, root, JSON_C_TO_STRING_PLAIN);
+	if (rc >= 0)
+		rc = rename(tmp, manifest_file);
+	if (rc < 0) {
+		ERROR("can't write the binding manifest %s: %m", manifest_file);
+		unlink(tmp);
+	} else
+		changed = 0;
+	json_object_put(root);
+	free(tmp);
+	return rc < 0 ? -1 : 0;
+}
+
+/*
+ * Tells whether a manifest is loaded
+ */
+int afb_api_so_cache_is_active()
+{
+	return manifest_file != NULL;
+}
+
+/*
+ * Get the recorded state of the file of 'path' and status 'st'.
+ * @param apis where to store the array of the names of the apis of
+ *             the binding, valid until the next put or load
+ * @return -1 if nothing valid is recorded, 0 if the file isn't a binding,
+ * 1 if it is a binding
+ */
+int afb_api_so_cache_get(const char *path, const struct stat *st, struct json_object **apis)
+{
+	struct json_object *entry, *expected;
+	const char *version;
+	int rc;
+
+	*apis = NULL;
+	if (!manifest_file || !json_object_object_get_ex(manifest, path, &entry))
+		return -1;
+
+	if (wrap_json_unpack(entry, "{ss s?o}", "version", &version, "apis", apis))
+		return -1;
+
+	expected = make_entry(st, version, json_object_get(*apis));
+	rc = wrap_json_equal(entry, expected);
+	json_object_put(expected);
+	if (!rc) {
+		*apis = NULL;
+		return -1;
+	}
+
+	json_object_object_add(updated, path, json_object_get(entry));
+	return strcmp(version, "none") != 0;
+}
+
+/*
+ * Records the file of 'path' and status 'st'
+ * @param version the version of the binding or "none" if not a binding
+ * @param apis array of the names of the apis of the binding or NULL,
+ *             the reference is taken
+ */
+void afb_api_so_cache_put(const char *path, const struct stat *st, const char *version, struct json_object *apis)
+{
+	if (!manifest_file)
+		json_object_put(apis);
+	else {
+		json_object_object_add(updated, path, make_entry(st, version, apis));
+		changed = 1;
+	}
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Manifest of the shared objects found when scanning for bindings.
+ *
+ * For each path, it records whether the file is a binding and, if
+ * it is, the names of the apis that it declared when loaded. An entry
+ * is valid while the device, the inode, the size and the modification
+ * time of the file are unchanged.
+ *
+ * The manifest is a JSON file read by 'afb_api_so_cache_load' and
+ * written back by 'afb_api_so_cache_save' with the entries used since.
+ * Without a loaded manifest, nothing is recorded.
+ */
+struct stat;
+struct json_object;
+
+extern int afb_api_so_cache_load(const char *filename);
+extern int afb_api_so_cache_save();
+extern int afb_api_so_cache_is_active();
+
+extern int afb_api_so_cache_get(const char *path, const struct stat *st, struct json_object **apis);
+extern void afb_api_so_cache_put(const char *path, const struct stat *st, const char *version, struct json_object *apis);
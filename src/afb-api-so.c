@@ -22,11 +22,18 @@
 #include <string.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#include <json-c/json.h>
+
 #include "afb-api-so.h"
+#include "afb-api-so-cache.h"
 #include "afb-api-so-v2.h"
 #include "afb-api-so-v3.h"
+#include "afb-apiset.h"
 #include "verbose.h"
 #include "sig-monitor.h"
 
@@ -65,13 +72,19 @@ static void *safe_dlopen(const char *filename, int flags)
 	return sd.handle;
 }
 
-static int load_binding(const char *path, int force, struct afb_apiset *declare_set, struct afb_apiset * call_set)
+/*
+ * Loads the binding of 'path'. On return, 'version' is set to the version
+ * of the loaded binding, to "none" when the file isn't a binding or to NULL
+ * when the file can't be loaded.
+ */
+static int load_binding(const char *path, int force, struct afb_apiset *declare_set, struct afb_apiset * call_set, const char **version)
 {
 	int obsolete = 0;
 	int rc;
 	void *handle;
 
 	// This is a loadable library let's check if it's a binding
+	*version = NULL;
 	rc = -!!force;
 	handle = safe_dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
 	if (handle == NULL) {
@@ -88,8 +101,10 @@ static int load_binding(const char *path, int force, struct afb_apiset *declare_
 		/* error when loading a valid v3 binding */
 		goto error2;
 	}
-	if (rc)
+	if (rc) {
+		*version = "v3";
 		return 0; /* yes version 3 */
+	}
 
 	/* try the version 2 */
 	rc = afb_api_so_v2_add(path, handle, declare_set, call_set);
@@ -97,8 +112,10 @@ static int load_binding(const char *path, int force, struct afb_apiset *declare_
 		/* error when loading a valid v2 binding */
 		goto error2;
 	}
-	if (rc)
+	if (rc) {
+		*version = "v2";
 		return 0; /* yes version 2 */
+	}
 
 #if defined(WITH_LEGACY_BINDING_VDYN)
 	/* try the version dyn */
@@ -107,8 +124,10 @@ static int load_binding(const char *path, int force, struct afb_apiset *declare_
 		/* error when loading a valid dyn binding */
 		goto error2;
 	}
-	if (rc)
+	if (rc) {
+		*version = "vdyn";
 		return 0; /* yes version dyn */
+	}
 #else
 	if (dlsym(handle, "afbBindingVdyn")) {
 		WARNING("binding [%s]: version DYN not supported", path);
@@ -123,8 +142,10 @@ static int load_binding(const char *path, int force, struct afb_apiset *declare_
 		/* error when loading a valid v1 binding */
 		goto error2;
 	}
-	if (rc)
+	if (rc) {
+		*version = "v1";
 		return 0; /* yes version 1 */
+	}
 #else
 	if (dlsym(handle, "afbBindingV1Register")) {
 		WARNING("binding [%s]: version 1 not supported", path);
@@ -133,6 +154,7 @@ static int load_binding(const char *path, int force, struct afb_apiset *declare_
 #endif
 
 	/* not a valid binding */
+	*version = "none";
 	_VERBOSE_(force ? Log_Level_Error : Log_Level_Info, "binding [%s] %s",
 			path, obsolete ? "is obsolete" : "isn't an AFB binding");
 
@@ -145,10 +167,179 @@ error:
 
 int afb_api_so_add_binding(const char *path, struct afb_apiset *declare_set, struct afb_apiset * call_set)
 {
-	return load_binding(path, 1, declare_set, call_set);
+	const char *version;
+
+	return load_binding(path, 1, declare_set, call_set, &version);
+}
+
+/*
+ * A binding whose loading is delayed until one of its apis is required
+ */
+struct lazy_binding
+{
+	struct lazy_binding *next;	/* next binding */
+	struct json_object *apis;	/* names of its apis */
+	int loaded;			/* is its loading done? */
+	char path[];			/* path of the binding */
+};
+
+/*
+ * The delayed bindings of a set
+ */
+struct lazy
+{
+	pthread_mutex_t mutex;		/* recursive for loading apis at preinit */
+	struct afb_apiset *call_set;	/* the call set of the bindings */
+	struct lazy_binding *bindings;	/* the delayed bindings */
+};
+
+static int lazy_has_api(struct lazy_binding *binding, const char *name)
+{
+	int i, n;
+
+	n = (int)json_object_array_length(binding->apis);
+	for (i = 0 ; i < n ; i++)
+		if (!strcasecmp(name, json_object_get_string(json_object_array_get_idx(binding->apis, i))))
+			return 1;
+	return 0;
+}
+
+static int lazy_onlack(void *closure, struct afb_apiset *set, const char *name)
+{
+	struct lazy *lazy = closure;
+	struct lazy_binding *binding;
+	const char *version;
+	int rc = 0;
+
+	pthread_mutex_lock(&lazy->mutex);
+	for (binding = lazy->bindings ; binding ; binding = binding->next) {
+		if (!binding->loaded && lazy_has_api(binding, name)) {
+			binding->loaded = 1;
+			NOTICE("loading binding [%s] for api %s", binding->path, name);
+			rc = load_binding(binding->path, 1, set, lazy->call_set, &version) >= 0 && version;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lazy->mutex);
+	return rc;
+}
+
+static void lazy_cleanup(void *closure)
+{
+	struct lazy *lazy = closure;
+	struct lazy_binding *binding;
+
+	while ((binding = lazy->bindings)) {
+		lazy->bindings = binding->next;
+		json_object_put(binding->apis);
+		free(binding);
+	}
+	afb_apiset_unref(lazy->call_set);
+	pthread_mutex_destroy(&lazy->mutex);
+	free(lazy);
+}
+
+static int lazy_add(struct lazy *lazy, const char *path, struct json_object *apis)
+{
+	struct lazy_binding *binding;
+	size_t len;
+
+	len = strlen(path);
+	binding = malloc(len + 1 + sizeof *binding);
+	if (!binding) {
+		ERROR("out of memory");
+		errno = ENOMEM;
+		return -1;
+	}
+	binding->apis = json_object_get(apis);
+	binding->loaded = 0;
+	memcpy(binding->path, path, len + 1);
+	binding->next = lazy->bindings;
+	lazy->bindings = binding;
+	INFO("binding [%s] delayed until use of its apis", path);
+	return 0;
+}
+
+/*
+ * Get the array of the names of the apis of 'set' that are not in 'before'
+ */
+static struct json_object *added_apis(struct afb_apiset *set, const char **before)
+{
+	struct json_object *result;
+	const char **after;
+	int i, j;
+
+	result = json_object_new_array();
+	after = afb_apiset_get_names(set, 0, 1);
+	for (i = 0 ; after && after[i] ; i++) {
+		for (j = 0 ; before && before[j] && strcasecmp(before[j], after[i]) ; j++);
+		if (!before || !before[j])
+			json_object_array_add(result, json_object_new_string(after[i]));
+	}
+	free(after);
+	return result;
+}
+
+/*
+ * Loads the file of 'path' and status 'st' found while scanning,
+ * using the manifest of bindings when active: files that aren't
+ * bindings are skipped and, when 'lazy' isn't NULL, the loading of
+ * bindings is delayed until one of their apis is looked up.
+ */
+static int load_file(const char *path, const struct stat *st, struct afb_apiset *declare_set, struct afb_apiset * call_set, struct lazy *lazy)
+{
+	struct json_object *apis;
+	const char **before;
+	const char *version;
+	int rc;
+
+	rc = afb_api_so_cache_get(path, st, &apis);
+	if (rc == 0) {
+		INFO("binding [%s] skipped, not an AFB binding", path);
+		return 0;
+	}
+	if (rc > 0 && lazy && json_object_array_length(apis))
+		return lazy_add(lazy, path, apis);
+
+	if (rc > 0 || !afb_api_so_cache_is_active())
+		return load_binding(path, 0, declare_set, call_set, &version);
+
+	/* record the loading */
+	before = afb_apiset_get_names(declare_set, 0, 1);
+	rc = load_binding(path, 0, declare_set, call_set, &version);
+	if (version)
+		afb_api_so_cache_put(path, st, version, added_apis(declare_set, before));
+	free(before);
+	return rc;
+}
+
+/*
+ * Asks the kernel to read ahead the binding files of the directory 'dir'
+ * whose path of 'end' characters is in 'path' (ended with a slash).
+ * Reading is asynchronous and fills the page cache of all the files
+ * meanwhile they are loaded one after the other.
+ */
+static void prefetch(DIR *dir, char path[PATH_MAX], size_t end)
+{
+	struct dirent *dent;
+	size_t len;
+	int fd;
+
+	while ((dent = readdir(dir)) != NULL) {
+		len = strlen(dent->d_name);
+		if (len < 3 || len + end >= PATH_MAX || memcmp(&dent->d_name[len - 3], ".so", 4))
+			continue;
+		memcpy(&path[end], dent->d_name, len + 1);
+		fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+		if (fd >= 0) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+			close(fd);
+		}
+	}
+	rewinddir(dir);
 }
 
-static int adddirs(char path[PATH_MAX], size_t end, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops)
+static int adddirs(char path[PATH_MAX], size_t end, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops, struct lazy *lazy)
 {
 	DIR *dir;
 	struct dirent *dent;
@@ -167,6 +358,7 @@ static int adddirs(char path[PATH_MAX], size_t end, struct afb_apiset *declare_s
 	/* scan each entry */
 	if (end)
 		path[end++] = '/';
+	prefetch(dir, path, end);
 	for (;;) {
 		errno = 0;
 		dent = readdir(dir);
@@ -238,12 +430,12 @@ See https://sourceware.org/bugzilla/show_bug.cgi?id=22101
 #endif
 #endif
 			}
-			rc = adddirs(path, end+len, declare_set, call_set, failstops);
+			rc = adddirs(path, end+len, declare_set, call_set, failstops, lazy);
 		} else if (S_ISREG(st.st_mode)) {
 			/* case of files */
 			if (memcmp(&dent->d_name[len - 3], ".so", 4))
 				continue;
-			rc = load_binding(path, 0, declare_set, call_set);
+			rc = load_file(path, &st, declare_set, call_set, lazy);
 		}
 		if (rc < 0 && failstops) {
 			closedir(dir);
@@ -254,7 +446,7 @@ See https://sourceware.org/bugzilla/show_bug.cgi?id=22101
 	return 0;
 }
 
-int afb_api_so_add_directory(const char *path, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops)
+static int add_directory(const char *path, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops, struct lazy *lazy)
 {
 	size_t length;
 	char buffer[PATH_MAX];
@@ -266,10 +458,10 @@ int afb_api_so_add_directory(const char *path, struct afb_apiset *declare_set, s
 	}
 
 	memcpy(buffer, path, length + 1);
-	return adddirs(buffer, length, declare_set, call_set, failstops);
+	return adddirs(buffer, length, declare_set, call_set, failstops, lazy);
 }
 
-int afb_api_so_add_path(const char *path, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops)
+static int add_path(const char *path, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops, struct lazy *lazy)
 {
 	struct stat st;
 	int rc;
@@ -278,15 +470,15 @@ int afb_api_so_add_path(const char *path, struct afb_apiset *declare_set, struct
 	if (rc < 0)
 		ERROR("Invalid binding path [%s]: %m", path);
 	else if (S_ISDIR(st.st_mode))
-		rc = afb_api_so_add_directory(path, declare_set, call_set, failstops);
+		rc = add_directory(path, declare_set, call_set, failstops, lazy);
 	else if (strstr(path, ".so"))
-		rc = load_binding(path, 0, declare_set, call_set);
+		rc = load_file(path, &st, declare_set, call_set, lazy);
 	else
 		INFO("not a binding [%s], skipped", path);
 	return rc;
 }
 
-int afb_api_so_add_pathset(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops)
+static int add_pathset(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops, struct lazy *lazy)
 {
 	static char sep[] = ":";
 	char *ps, *p;
@@ -297,12 +489,27 @@ int afb_api_so_add_pathset(const char *pathset, struct afb_apiset *declare_set,
 		p = strsep(&ps, sep);
 		if (!p)
 			return 0;
-		rc = afb_api_so_add_path(p, declare_set, call_set, failstops);
+		rc = add_path(p, declare_set, call_set, failstops, lazy);
 		if (rc < 0)
 			return rc;
 	}
 }
 
+int afb_api_so_add_directory(const char *path, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops)
+{
+	return add_directory(path, declare_set, call_set, failstops, NULL);
+}
+
+int afb_api_so_add_path(const char *path, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops)
+{
+	return add_path(path, declare_set, call_set, failstops, NULL);
+}
+
+int afb_api_so_add_pathset(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set, int failstops)
+{
+	return add_pathset(pathset, declare_set, call_set, failstops, NULL);
+}
+
 int afb_api_so_add_pathset_fails(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set)
 {
 	return afb_api_so_add_pathset(pathset, declare_set, call_set, 1);
@@ -313,3 +520,39 @@ int afb_api_so_add_pathset_nofails(const char *pathset, struct afb_apiset *decla
 	return afb_api_so_add_pathset(pathset, declare_set, call_set, 0);
 }
 
+/*
+ * Adds the bindings of 'pathset' as for 'afb_api_so_add_pathset_nofails'
+ * but in a subset of 'declare_set' and, for the bindings known by the
+ * manifest of bindings, delaying their loading until the lookup of one
+ * of the apis that they declare.
+ */
+int afb_api_so_add_pathset_lazy(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set)
+{
+	struct afb_apiset *ownset;
+	struct lazy *lazy;
+	pthread_mutexattr_t attr;
+
+	lazy = malloc(sizeof *lazy);
+	if (!lazy) {
+		ERROR("out of memory");
+		errno = ENOMEM;
+		return -1;
+	}
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lazy->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	lazy->call_set = afb_apiset_addref(call_set);
+	lazy->bindings = NULL;
+
+	/* create a sub-apiset */
+	ownset = afb_apiset_create_subset_last(declare_set, pathset, afb_apiset_timeout_get(declare_set));
+	if (!ownset) {
+		ERROR("Can't create apiset of lazy bindings %s", pathset);
+		lazy_cleanup(lazy);
+		return -1;
+	}
+	afb_apiset_onlack_set(ownset, lazy_onlack, lazy, lazy_cleanup);
+
+	return add_pathset(pathset, ownset, call_set, 0, lazy);
+}
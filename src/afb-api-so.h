@@ -30,5 +30,6 @@ extern int afb_api_so_add_pathset(const char *pathset, struct afb_apiset *declar
 
 extern int afb_api_so_add_pathset_fails(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set);
 extern int afb_api_so_add_pathset_nofails(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set);
+extern int afb_api_so_add_pathset_lazy(const char *pathset, struct afb_apiset *declare_set, struct afb_apiset * call_set);
 
 
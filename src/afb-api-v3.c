@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fnmatch.h>
+#include <pthread.h>
 
 #include <json-c/json.h>
 
@@ -32,11 +33,26 @@
 #include "afb-api-v3.h"
 #include "afb-apiset.h"
 #include "afb-auth.h"
+#include "afb-cache.h"
+#include "afb-context.h"
 #include "afb-export.h"
 #include "afb-xreq.h"
+#include "afb-session.h"
 #include "verbose.h"
 #include "sig-monitor.h"
 
+#define CACHE_CAPACITY	256	/* count of replies cached per api */
+
+/*
+ * Cache policy of a verb set by 'afb_api_v3_set_verb_cache'
+ */
+struct verb_cache {
+	struct verb_cache *next;
+	uint32_t ttl;
+	int session;
+	char verb[];
+};
+
 /*
  * Description of a binding
  */
@@ -48,6 +64,9 @@ struct afb_api_v3 {
 	const struct afb_verb_v3 *verbsv3;
 	struct afb_export *export;
 	const char *info;
+	struct afb_cache *cache;
+	struct verb_cache *policies;
+	pthread_mutex_t mutex;	/* protection of the policies */
 };
 
 static const char nulchar = 0;
@@ -74,13 +93,9 @@ static struct afb_verb_v3 *search_dynamic_verb(struct afb_api_v3 *api, const cha
 	return 0;
 }
 
-void afb_api_v3_process_call(struct afb_api_v3 *api, struct afb_xreq *xreq)
+static const struct afb_verb_v3 *search_verb_v3(struct afb_api_v3 *api, const char *name)
 {
 	const struct afb_verb_v3 *verbsv3;
-	const struct afb_verb_v2 *verbsv2;
-	const char *name;
-
-	name = xreq->request.called_verb;
 
 	/* look first in dynamic set */
 	verbsv3 = search_dynamic_verb(api, name);
@@ -96,7 +111,19 @@ void afb_api_v3_process_call(struct afb_api_v3 *api, struct afb_xreq *xreq)
 				verbsv3++;
 		}
 	}
+	return verbsv3;
+}
+
+void afb_api_v3_process_call(struct afb_api_v3 *api, struct afb_xreq *xreq)
+{
+	const struct afb_verb_v3 *verbsv3;
+	const struct afb_verb_v2 *verbsv2;
+	const char *name;
+
+	name = xreq->request.called_verb;
+
 	/* is it a v3 verb ? */
+	verbsv3 = search_verb_v3(api, name);
 	if (verbsv3) {
 		/* yes */
 		xreq->request.vcbdata = verbsv3->vcbdata;
@@ -120,6 +147,134 @@ void afb_api_v3_process_call(struct afb_api_v3 *api, struct afb_xreq *xreq)
 	afb_xreq_reply_unknown_verb(xreq);
 }
 
+/*
+ * Replies to 'xreq' with the reply kept in cache if any and returns 1.
+ * Otherwise, returns 0 after having prepared 'xreq' for recording
+ * its reply when the verb has a cache policy.
+ */
+int afb_api_v3_process_cached(struct afb_api_v3 *api, struct afb_xreq *xreq)
+{
+	const struct afb_verb_v3 *verb;
+	const struct verb_cache *policy;
+	struct afb_cache_entry *entry;
+	struct afb_cache *cache;
+	const char *name, *session, *buffer;
+	uint32_t ttl, generation;
+	size_t size;
+	int scoped;
+
+	/* the cache is created at most once, see ensure_cache */
+	cache = __atomic_load_n(&api->cache, __ATOMIC_ACQUIRE);
+	if (!cache)
+		return 0;
+
+	/* a reply computed from now is dropped if invalidated meanwhile */
+	generation = afb_cache_generation(cache);
+
+	/* get the cache policy of the verb */
+	name = xreq->request.called_verb;
+	verb = search_verb_v3(api, name);
+	if (!verb)
+		return 0;
+	pthread_mutex_lock(&api->mutex);
+	policy = api->policies;
+	while (policy && strcasecmp(policy->verb, verb->verb))
+		policy = policy->next;
+	ttl = policy ? policy->ttl : (uint32_t)verb->cache_ttl * 1000;
+	scoped = policy ? policy->session : verb->cache_session;
+	pthread_mutex_unlock(&api->mutex);
+	if (!ttl)
+		return 0;
+
+	/* search the reply */
+	session = NULL;
+	if (scoped) {
+		if (!xreq->context.session)
+			return 0;
+		session = afb_session_uuid(xreq->context.session);
+	}
+	entry = afb_cache_get(cache, name, session, afb_xreq_unhooked_json(xreq));
+	if (!entry) {
+		/* the request keeps the cache until its end, maybe after the api */
+		xreq->cache = afb_cache_addref(cache);
+		xreq->cachettl = ttl;
+		xreq->cachesession = scoped;
+		xreq->cachegen = generation;
+		return 0;
+	}
+
+	xreq->request.vcbdata = verb->vcbdata;
+	buffer = afb_cache_entry_buffer(entry, &size);
+	afb_xreq_reply_cached_v3(xreq, verb, buffer, size, afb_cache_entry_info(entry));
+	afb_cache_entry_unref(entry);
+	return 1;
+}
+
+/*
+ * creates the cache of replies of 'api' if needed,
+ * the mutex of 'api' must be locked
+ */
+static int ensure_cache(struct afb_api_v3 *api)
+{
+	struct afb_cache *cache;
+
+	if (!api->cache) {
+		cache = afb_cache_create(CACHE_CAPACITY);
+		if (!cache)
+			return -1;
+		/* publish it initialised to the lockless readers */
+		__atomic_store_n(&api->cache, cache, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+int afb_api_v3_set_verb_cache(
+		struct afb_api_v3 *api,
+		const char *verb,
+		uint32_t ttl,
+		int session)
+{
+	struct verb_cache *policy;
+	int rc;
+
+	pthread_mutex_lock(&api->mutex);
+	rc = ensure_cache(api);
+	if (rc >= 0) {
+		policy = api->policies;
+		while (policy && strcasecmp(policy->verb, verb))
+			policy = policy->next;
+		if (!policy) {
+			policy = malloc(sizeof *policy + 1 + strlen(verb));
+			if (!policy) {
+				errno = ENOMEM;
+				rc = -1;
+			} else {
+				strcpy(policy->verb, verb);
+				policy->next = api->policies;
+				api->policies = policy;
+			}
+		}
+		if (policy) {
+			policy->ttl = ttl;
+			policy->session = !!session;
+			afb_cache_invalidate(api->cache, NULL);
+		}
+	}
+	pthread_mutex_unlock(&api->mutex);
+	return rc;
+}
+
+void afb_api_v3_invalidate_cache(
+		struct afb_api_v3 *api,
+		const char *verb)
+{
+	struct afb_cache *cache;
+
+	cache = __atomic_load_n(&api->cache, __ATOMIC_ACQUIRE);
+	if (cache)
+		afb_cache_invalidate(cache, verb);
+}
+
 static struct json_object *describe_verb_v3(const struct afb_verb_v3 *verb)
 {
 	struct json_object *f, *a, *g;
@@ -199,6 +354,7 @@ struct afb_api_v3 *afb_api_v3_create(struct afb_apiset *declare_set,
 		goto oom;
 	}
 	api->refcount = 1;
+	pthread_mutex_init(&api->mutex, NULL);
 	if (!info)
 		api->info = &nulchar;
 	else if (copy_info)
@@ -223,6 +379,7 @@ oom4:
 oom3:
 	afb_export_unref(api->export);
 oom2:
+	pthread_mutex_destroy(&api->mutex);
 	free(api);
 oom:
 	return NULL;
@@ -237,11 +394,20 @@ struct afb_api_v3 *afb_api_v3_addref(struct afb_api_v3 *api)
 
 void afb_api_v3_unref(struct afb_api_v3 *api)
 {
+	struct verb_cache *policy;
+
 	if (api && !__atomic_sub_fetch(&api->refcount, 1, __ATOMIC_RELAXED)) {
 		afb_export_destroy(api->export);
 		while (api->count)
 			free(api->verbs[--api->count]);
 		free(api->verbs);
+		while (api->policies) {
+			policy = api->policies;
+			api->policies = policy->next;
+			free(policy);
+		}
+		afb_cache_destroy(api->cache);
+		pthread_mutex_destroy(&api->mutex);
 		free(api);
 	}
 }
@@ -262,7 +428,15 @@ void afb_api_v3_set_verbs_v3(
 		struct afb_api_v3 *api,
 		const struct afb_verb_v3 *verbs)
 {
+	const struct afb_verb_v3 *verb;
+
 	api->verbsv3 = verbs;
+	pthread_mutex_lock(&api->mutex);
+	for (verb = verbs ; verb && verb->verb ; verb++)
+		if (verb->cache_ttl && ensure_cache(api) < 0)
+			ERROR("can't create the cache of replies: %m");
+	pthread_mutex_unlock(&api->mutex);
+	afb_api_v3_invalidate_cache(api, NULL);
 }
 
 int afb_api_v3_add_verb(
@@ -302,6 +476,8 @@ int afb_api_v3_add_verb(
 	v->auth = auth;
 	v->session = session;
 	v->glob = !!glob;
+	v->cache_session = 0;
+	v->cache_ttl = 0;
 
 	txt = (char*)(v + 1);
 	v->verb = txt;
@@ -334,6 +510,7 @@ int afb_api_v3_del_verb(
 			api->verbs[i] = api->verbs[--api->count];
 			if (vcbdata)
 				*vcbdata = v->vcbdata;
+			afb_api_v3_invalidate_cache(api, v->glob ? NULL : v->verb);
 			free(v);
 			return 0;
 		}
@@ -358,6 +535,8 @@ int afb_api_v3_set_binding_fields(const struct afb_binding_v3 *desc, struct afb_
 		rc =  afb_api_x3_require_class(api, desc->require_class);
 	if (!rc && desc->require_api)
 		rc =  afb_api_x3_require_api(api, desc->require_api, 1);
+	if (!rc && desc->priority)
+		rc =  afb_export_set_priority(afb_export_from_api_x3(api), desc->priority);
 	return rc;
 }
 
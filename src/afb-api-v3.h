@@ -80,6 +80,17 @@ extern int afb_api_v3_del_verb(
 		const char *verb,
 		void **vcbdata);
 
+extern int afb_api_v3_set_verb_cache(
+		struct afb_api_v3 *api,
+		const char *verb,
+		uint32_t ttl,
+		int session);
+
+extern void afb_api_v3_invalidate_cache(
+		struct afb_api_v3 *api,
+		const char *verb);
+
 extern void afb_api_v3_process_call(struct afb_api_v3 *api, struct afb_xreq *xreq);
+extern int afb_api_v3_process_cached(struct afb_api_v3 *api, struct afb_xreq *xreq);
 extern struct json_object *afb_api_v3_make_description_openAPIv3(struct afb_api_v3 *api, const char *apiname);
 
@@ -35,6 +35,8 @@
 #include "afb-fdev.h"
 #include "afb-socket.h"
 #include "afb-stub-ws.h"
+#include "afb-systemd.h"
+#include "afb-ws-client.h"
 #include "verbose.h"
 #include "fdev.h"
 
@@ -43,38 +45,87 @@ struct api_ws_server
 	struct afb_apiset *apiset;	/* the apiset for calling */
 	struct fdev *fdev;		/* fdev handler */
 	uint16_t offapi;		/* api name of the interface */
+	uint8_t listapi;		/* is the api name a list of names? */
+	uint8_t shm;			/* are messages exchanged through shared memory? */
 	char uri[1];			/* the uri of the server socket */
 };
 
+/******************************************************************************/
+/***       C O M M O N                                                      ***/
+/******************************************************************************/
+
+/*
+ * Checks that the comma separated list of 'apis' is made of valid names.
+ * If 'apiset' isn't NULL, also checks that the apis exist in it.
+ * Returns 1 if valid or 0 otherwise.
+ */
+static int check_api_list(const char *uri, const char *apis, struct afb_apiset *apiset)
+{
+	char *names, *name, *next;
+
+	names = strdupa(apis);
+	for (name = names ; name ; name = next) {
+		next = strchr(name, ',');
+		if (next)
+			*next++ = 0;
+		if (!afb_api_is_valid_name(name)) {
+			ERROR("invalid api name %s in ws uri %s", name, uri);
+			errno = EINVAL;
+			return 0;
+		}
+		if (apiset && !afb_apiset_lookup(apiset, name, 1)) {
+			ERROR("Can't provide ws-server for URI %s: API %s doesn't exist", uri, name);
+			errno = ENOENT;
+			return 0;
+		}
+	}
+	return 1;
+}
+
 /******************************************************************************/
 /***       C L I E N T                                                      ***/
 /******************************************************************************/
 
-static struct fdev *reopen_client(void *closure)
+static int reopen_client(void *closure, void (*onreopen)(void*, struct fdev*), void *arg)
 {
 	const char *uri = closure;
-	return afb_socket_open_fdev(uri, 0);
+	return afb_ws_client_connect_fdev_async(afb_systemd_get_event_loop(), uri, arg, onreopen);
 }
 
 int afb_api_ws_add_client(const char *uri, struct afb_apiset *declare_set, struct afb_apiset *call_set, int strong)
 {
 	struct afb_stub_ws *stubws;
 	struct fdev *fdev;
-	const char *api;
+	const char *api, *apis;
+	size_t length;
 
-	/* check the api name */
-	api = afb_socket_api(uri);
-	if (api == NULL || !afb_api_is_valid_name(api)) {
-		ERROR("invalid (too long) ws client uri %s", uri);
-		errno = EINVAL;
-		goto error;
+	/* check the api name or the list of names */
+	apis = afb_socket_apis(uri, &length);
+	if (apis) {
+		apis = strndupa(apis, length);
+		if (!check_api_list(uri, apis, NULL))
+			goto error;
+		api = NULL;
+	} else {
+		api = afb_socket_api(uri, &length);
+		if (api != NULL)
+			api = strndupa(api, length);
+		if (api == NULL || !afb_api_is_valid_name(api)) {
+			ERROR("invalid (too long) ws client uri %s", uri);
+			errno = EINVAL;
+			goto error;
+		}
 	}
 
 	/* open the socket */
 	fdev = afb_socket_open_fdev(uri, 0);
 	if (fdev) {
 		/* create the client stub */
-		stubws = afb_stub_ws_create_client(fdev, api, call_set);
+		if (afb_socket_is_shm(uri))
+			stubws = afb_stub_ws_create_client_shm(fdev, api ?: apis, call_set);
+		else
+			stubws = api ? afb_stub_ws_create_client(fdev, api, call_set)
+				     : afb_stub_ws_create_client_apis(fdev, apis, call_set);
 		if (!stubws) {
 			ERROR("can't setup client ws service to %s", uri);
 			fdev_unref(fdev);
@@ -111,29 +162,43 @@ int afb_api_ws_add_client_weak(const char *uri, struct afb_apiset *declare_set,
 /***       S E R V E R                                                      ***/
 /******************************************************************************/
 
-static void api_ws_server_accept(struct api_ws_server *apiws)
+/* accepts the pending connections, returns 0 when no more connection is pending */
+static int api_ws_server_accept(struct api_ws_server *apiws)
 {
-	int fd;
+	int fd, err;
 	struct sockaddr addr;
 	socklen_t lenaddr;
 	struct fdev *fdev;
 	struct afb_stub_ws *server;
 
 	lenaddr = (socklen_t)sizeof addr;
-	fd = accept(fdev_fd(apiws->fdev), &addr, &lenaddr);
+	fd = accept4(fdev_fd(apiws->fdev), &addr, &lenaddr, SOCK_NONBLOCK|SOCK_CLOEXEC);
 	if (fd < 0) {
+		/* ERROR may change errno */
+		err = errno;
+		if (err == EAGAIN || err == EWOULDBLOCK)
+			return 0;
 		ERROR("can't accept connection to %s: %m", apiws->uri);
+		/* stop on errors of the listening socket */
+		if (err != ECONNABORTED && err != EINTR)
+			return 0;
 	} else {
 		fdev = afb_fdev_create(fd);
 		if (!fdev) {
 			ERROR("can't hold accepted connection to %s: %m", apiws->uri);
 			close(fd);
 		} else {
-			server = afb_stub_ws_create_server(fdev, &apiws->uri[apiws->offapi], apiws->apiset);
+			if (apiws->shm)
+				server = afb_stub_ws_create_server_shm(fdev, &apiws->uri[apiws->offapi], apiws->apiset);
+			else
+				server = apiws->listapi
+					? afb_stub_ws_create_server_apis(fdev, &apiws->uri[apiws->offapi], apiws->apiset)
+					: afb_stub_ws_create_server(fdev, &apiws->uri[apiws->offapi], apiws->apiset);
 			if (!server)
 				ERROR("can't serve accepted connection to %s: %m", apiws->uri);
 		}
 	}
+	return 1;
 }
 
 static int api_ws_server_connect(struct api_ws_server *apiws);
@@ -143,7 +208,7 @@ static void api_ws_server_listen_callback(void *closure, uint32_t revents, struc
 	struct api_ws_server *apiws = closure;
 
 	if ((revents & EPOLLIN) != 0)
-		api_ws_server_accept(apiws);
+		while (api_ws_server_accept(apiws));
 	if ((revents & EPOLLHUP) != 0)
 		api_ws_server_connect(apiws);
 }
@@ -178,7 +243,8 @@ int afb_api_ws_add_server(const char *uri, struct afb_apiset *declare_set, struc
 	int rc;
 	const char *api;
 	struct api_ws_server *apiws;
-	size_t luri, lapi, extra;
+	size_t luri, lapi;
+	uint8_t listapi;
 
 	/* check the size */
 	luri = strlen(uri);
@@ -188,25 +254,34 @@ int afb_api_ws_add_server(const char *uri, struct afb_apiset *declare_set, struc
 		return -1;
 	}
 
-	/* check the api name */
-	api = afb_socket_api(uri);
-	if (api == NULL || !afb_api_is_valid_name(api)) {
-		ERROR("invalid api name in ws uri %s", uri);
-		errno = EINVAL;
-		goto error;
-	}
+	/* check the api names */
+	api = afb_socket_apis(uri, &lapi);
+	listapi = api != NULL;
+	if (listapi) {
+		api = strndupa(api, lapi);
+		if (!check_api_list(uri, api, call_set))
+			goto error;
+	} else {
+		/* check the api name */
+		api = afb_socket_api(uri, &lapi);
+		if (api != NULL)
+			api = strndupa(api, lapi);
+		if (api == NULL || !afb_api_is_valid_name(api)) {
+			ERROR("invalid api name in ws uri %s", uri);
+			errno = EINVAL;
+			goto error;
+		}
 
-	/* check api name */
-	if (!afb_apiset_lookup(call_set, api, 1)) {
-		ERROR("Can't provide ws-server for URI %s: API %s doesn't exist", uri, api);
-		errno = ENOENT;
-		goto error;
+		/* check api name */
+		if (!afb_apiset_lookup(call_set, api, 1)) {
+			ERROR("Can't provide ws-server for URI %s: API %s doesn't exist", uri, api);
+			errno = ENOENT;
+			goto error;
+		}
 	}
 
 	/* make the structure */
-	lapi = strlen(api);
-	extra = luri == (api - uri) + lapi ? 0 : lapi + 1;
-	apiws = malloc(sizeof * apiws + luri + extra);
+	apiws = malloc(sizeof * apiws + luri + lapi + 1);
 	if (!apiws) {
 		ERROR("out of memory");
 		errno = ENOMEM;
@@ -215,13 +290,11 @@ int afb_api_ws_add_server(const char *uri, struct afb_apiset *declare_set, struc
 
 	apiws->apiset = afb_apiset_addref(call_set);
 	apiws->fdev = 0;
+	apiws->listapi = listapi;
+	apiws->shm = (uint8_t)afb_socket_is_shm(uri);
 	strcpy(apiws->uri, uri);
-	if (!extra)
-		apiws->offapi = (uint16_t)(api - uri);
-	else {
-		apiws->offapi = (uint16_t)(luri + 1);
-		strcpy(&apiws->uri[apiws->offapi], api);
-	}
+	apiws->offapi = (uint16_t)(luri + 1);
+	strcpy(&apiws->uri[apiws->offapi], api);
 
 	/* connect for serving */
 	rc = api_ws_server_connect(apiws);
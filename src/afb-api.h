@@ -30,6 +30,7 @@ struct afb_api_itf
 	void (*set_logmask)(void *closure, int level);
 	struct json_object *(*describe)(void *closure);
 	void (*unref)(void *closure);
+	int (*call_cached)(void *closure, struct afb_xreq *xreq); /* optional, returns 1 when replied from a cache */
 };
 
 struct afb_api_item
@@ -37,6 +38,7 @@ struct afb_api_item
 	void *closure;
 	struct afb_api_itf *itf;
 	const void *group;
+	int priority;
 };
 
 extern int afb_api_is_valid_name(const char *name);
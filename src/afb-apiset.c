@@ -21,6 +21,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <json-c/json.h>
 
 #include "afb-session.h"
 #include "verbose.h"
@@ -28,6 +33,7 @@
 #include "afb-apiset.h"
 #include "afb-context.h"
 #include "afb-xreq.h"
+#include "jobs.h"
 
 #define INCR 8		/* CAUTION: must be a power of 2 */
 
@@ -59,6 +65,9 @@ struct api_desc
 	struct api_desc *next;
 	const char *name;		/**< name of the api */
 	int status;			/**< initialisation status */
+	struct api_desc *waits;		/**< api whose start is awaited during the start */
+	unsigned init_us;		/**< duration of the init in microseconds */
+	unsigned ready_us;		/**< end of the start in microseconds after the first start */
 	struct afb_api_item api;	/**< handler of the api */
 	struct {
 		struct api_array classes;
@@ -123,6 +132,24 @@ static struct api_desc *all_apis;
  */
 static struct api_class *all_classes;
 
+/**
+ * protection of the apis and aliases of the sets: written by the
+ * additions and deletions, read by the searches. Readers can nest
+ * because the lock prefers readers.
+ */
+static pthread_rwlock_t apis_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * synchronisation of the starts of apis
+ */
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * time of the first start in microseconds
+ */
+static uint64_t start_origin;
+
 /**
  * Ensure enough room in 'array' for 'count' items
  */
@@ -227,12 +254,12 @@ static struct api_class *class_search(const char *name, int create)
 }
 
 /**
- * Search the api of 'name'.
+ * Search the api of 'name', the lock 'apis_lock' being held.
  * @param set the api set
  * @param name the api name to search
  * @return the descriptor if found or NULL otherwise
  */
-static struct api_desc *search(struct afb_apiset *set, const char *name)
+static struct api_desc *search_unlocked(struct afb_apiset *set, const char *name)
 {
 	int i, c, up, lo;
 	struct api_desc *a;
@@ -273,6 +300,22 @@ static struct api_desc *search(struct afb_apiset *set, const char *name)
 	return NULL;
 }
 
+/**
+ * Search the api of 'name'.
+ * @param set the api set
+ * @param name the api name to search
+ * @return the descriptor if found or NULL otherwise
+ */
+static struct api_desc *search(struct afb_apiset *set, const char *name)
+{
+	struct api_desc *result;
+
+	pthread_rwlock_rdlock(&apis_lock);
+	result = search_unlocked(set, name);
+	pthread_rwlock_unlock(&apis_lock);
+	return result;
+}
+
 /**
  * Search the api of 'name' in the apiset and in its subsets.
  * @param set the api set
@@ -470,8 +513,10 @@ int afb_apiset_add(struct afb_apiset *set, const char *name, struct afb_api_item
 	struct api_desc *desc;
 	int i, c;
 
+	pthread_rwlock_wrlock(&apis_lock);
+
 	/* check whether it exists already */
-	if (search(set, name)) {
+	if (search_unlocked(set, name)) {
 		ERROR("api of name %s already exists", name);
 		errno = EEXIST;
 		goto error;
@@ -501,6 +546,8 @@ int afb_apiset_add(struct afb_apiset *set, const char *name, struct afb_api_item
 	desc->next = all_apis;
 	all_apis = desc;
 
+	pthread_rwlock_unlock(&apis_lock);
+
 	if (afb_api_is_public(name))
 		INFO("API %s added", name);
 
@@ -510,6 +557,7 @@ oom:
 	ERROR("out of memory");
 	errno = ENOMEM;
 error:
+	pthread_rwlock_unlock(&apis_lock);
 	return -1;
 }
 
@@ -529,15 +577,17 @@ int afb_apiset_add_alias(struct afb_apiset *set, const char *name, const char *a
 	struct api_desc *api;
 	struct api_alias *ali, **pali;
 
+	pthread_rwlock_wrlock(&apis_lock);
+
 	/* check alias doesn't already exist */
-	if (search(set, alias)) {
+	if (search_unlocked(set, alias)) {
 		ERROR("api of name %s already exists", alias);
 		errno = EEXIST;
 		goto error;
 	}
 
 	/* check aliased api exists */
-	api = search(set, name);
+	api = search_unlocked(set, name);
 	if (api == NULL) {
 		ERROR("api of name %s doesn't exists", name);
 		errno = ENOENT;
@@ -560,8 +610,10 @@ int afb_apiset_add_alias(struct afb_apiset *set, const char *name, const char *a
 		pali = &(*pali)->next;
 	ali->next = *pali;
 	*pali = ali;
+	pthread_rwlock_unlock(&apis_lock);
 	return 0;
 error:
+	pthread_rwlock_unlock(&apis_lock);
 	return -1;
 }
 
@@ -590,12 +642,15 @@ int afb_apiset_del(struct afb_apiset *set, const char *name)
 	struct api_desc *desc, **pdesc, *odesc;
 	int i, c;
 
+	pthread_rwlock_wrlock(&apis_lock);
+
 	/* search the alias */
 	pali = &set->aliases;
 	while ((ali = *pali)) {
 		c = strcasecmp(ali->name, name);
 		if (!c) {
 			*pali = ali->next;
+			pthread_rwlock_unlock(&apis_lock);
 			free(ali);
 			return 0;
 		}
@@ -637,21 +692,23 @@ int afb_apiset_del(struct afb_apiset *set, const char *name)
 				}
 			}
 
-			/* unref the api */
-			if (desc->api.itf->unref)
-				desc->api.itf->unref(desc->api.closure);
-
 			set->apis.count--;
 			while(i < set->apis.count) {
 				set->apis.apis[i] = set->apis.apis[i + 1];
 				i++;
 			}
+			pthread_rwlock_unlock(&apis_lock);
+
+			/* unref the api */
+			if (desc->api.itf->unref)
+				desc->api.itf->unref(desc->api.closure);
 			free(desc);
 			return 0;
 		}
 		if (c > 0)
 			break;
 	}
+	pthread_rwlock_unlock(&apis_lock);
 	errno = ENOENT;
 	return -1;
 }
@@ -768,24 +825,66 @@ static int start_array_depends(struct api_array *array)
 	return rc;
 }
 
+/**
+ * Get the current monotonic time in microseconds
+ */
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
+}
+
 /**
  * Starts the service 'api'.
+ *
+ * The start can happen concurrently in several flows of execution
+ * (jobs), the api being started by a flow is its local value of jobs.
+ * An api being started by an other flow is waited, except if that
+ * flow waits for an api being started by the current one: that is a
+ * dependency cycle reported as EBUSY, as are the cycles within a flow.
+ *
  * @param api the api
  * @return a positive number on success
  */
 static int start_api(struct api_desc *api)
 {
+	struct api_desc *upper, *w;
+	uint64_t t0, t1;
 	int rc;
 
-	if (api->status == 0)
+	upper = jobs_get_local();
+	pthread_mutex_lock(&start_mutex);
+	while ((rc = api->status) == EBUSY) {
+		for (w = api ; w && w != upper ; w = w->waits);
+		if (w)
+			break;
+		if (upper)
+			upper->waits = api;
+		pthread_cond_wait(&start_cond, &start_mutex);
+		if (upper)
+			upper->waits = NULL;
+	}
+	if (rc < 0) {
+		api->status = EBUSY;
+		api->waits = NULL;
+		if (upper)
+			upper->waits = api;
+		jobs_set_local(api);
+		if (!start_origin)
+			start_origin = now_us();
+	}
+	pthread_mutex_unlock(&start_mutex);
+
+	if (rc == 0)
 		return 0;
-	else if (api->status > 0) {
-		errno = api->status;
+	else if (rc > 0) {
+		errno = rc;
 		return -1;
 	}
 
 	NOTICE("API %s starting...", api->name);
-	api->status = EBUSY;
 	rc = start_array_classes(&api->require.classes);
 	if (rc < 0)
 		ERROR("Cannot start classes needed by api %s", api->name);
@@ -794,17 +893,30 @@ static int start_api(struct api_desc *api)
 		if (rc < 0)
 			ERROR("Cannot start apis needed by api %s", api->name);
 		else if (api->api.itf->service_start) {
+			t0 = now_us();
 			rc = api->api.itf->service_start(api->api.closure);
+			t1 = now_us();
+			api->init_us = (unsigned)(t1 - t0);
 			if (rc < 0)
 				ERROR("The api %s failed to start", api->name);
 		}
 	}
-	if (rc < 0) {
-		api->status = errno ?: ECANCELED;
+
+	rc = rc < 0 ? errno ?: ECANCELED : 0;
+	pthread_mutex_lock(&start_mutex);
+	api->status = rc == EBUSY ? ECANCELED : rc; /* EBUSY means starting */
+	api->ready_us = (unsigned)(now_us() - start_origin);
+	jobs_set_local(upper);
+	if (upper)
+		upper->waits = NULL;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_mutex);
+
+	if (rc) {
+		errno = rc;
 		return -1;
 	}
-	INFO("API %s started", api->name);
-	api->status = 0;
+	INFO("API %s started, init took %u.%03u ms", api->name, api->init_us / 1000, api->init_us % 1000);
 	return 0;
 }
 
@@ -853,14 +965,21 @@ int afb_apiset_start_service(struct afb_apiset *set, const char *name)
  */
 int afb_apiset_start_all_services(struct afb_apiset *set)
 {
+	struct api_desc *api;
 	int rc, ret;
 	int i;
 
 	ret = 0;
 	while (set) {
+		/* apis can be added by the starts */
 		i = 0;
-		while (i < set->apis.count) {
-			rc = start_api(set->apis.apis[i]);
+		for (;;) {
+			pthread_rwlock_rdlock(&apis_lock);
+			api = i < set->apis.count ? set->apis.apis[i] : NULL;
+			pthread_rwlock_unlock(&apis_lock);
+			if (!api)
+				break;
+			rc = start_api(api);
 			if (rc < 0)
 				ret = rc;
 			i++;
@@ -870,6 +989,258 @@ int afb_apiset_start_all_services(struct afb_apiset *set)
 	return ret;
 }
 
+/**
+ * A node of the graph of the parallel start
+ */
+struct start_node
+{
+	struct start_dag *dag;		/**< the graph */
+	struct api_desc *api;		/**< the api to start */
+	int pending;			/**< count of its dependencies not yet started */
+	int queued;			/**< is its start queued? */
+};
+
+/**
+ * Graph of the dependencies of the apis for their parallel start
+ */
+struct start_dag
+{
+	pthread_mutex_t mutex;		/**< protection of the graph */
+	struct jobloop *jobloop;	/**< the flow waiting the end */
+	int count;			/**< count of nodes */
+	int running;			/**< count of queued starts not terminated */
+	struct start_node *nodes;	/**< the nodes */
+	char *edges;			/**< edges[d * count + i] is set if i depends on d */
+};
+
+/**
+ * Records in 'dag' that the node 'i' depends on 'api'
+ */
+static void start_dag_depends(struct start_dag *dag, int i, struct api_desc *api)
+{
+	int d;
+
+	for (d = 0 ; d < dag->count && dag->nodes[d].api != api ; d++);
+	if (d < dag->count && !dag->edges[d * dag->count + i]) {
+		dag->edges[d * dag->count + i] = 1;
+		dag->nodes[i].pending++;
+	}
+}
+
+/**
+ * Builds in 'dag' the graph of the apis of 'set' and its subsets
+ * that are not started, with the dependencies of their requirements.
+ * Requirements outside of the graph are left to 'start_api'.
+ * @return 0 on success or -1 when out of memory
+ */
+static int start_dag_build(struct start_dag *dag, struct afb_apiset *set)
+{
+	struct afb_apiset *s;
+	struct api_desc *api, *required;
+	struct api_depend *depend;
+	struct api_array *providers;
+	int i, j, k, n;
+
+	pthread_rwlock_rdlock(&apis_lock);
+	for (n = 0, s = set ; s ; s = s->subset)
+		for (i = 0 ; i < s->apis.count ; i++)
+			n += s->apis.apis[i]->status < 0;
+
+	dag->count = n;
+	dag->running = 0;
+	dag->nodes = calloc((size_t)n, sizeof *dag->nodes);
+	dag->edges = calloc((size_t)n * (size_t)n, 1);
+	if (!dag->nodes || !dag->edges) {
+		pthread_rwlock_unlock(&apis_lock);
+		free(dag->nodes);
+		free(dag->edges);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (n = 0, s = set ; s ; s = s->subset)
+		for (i = 0 ; i < s->apis.count ; i++)
+			if (s->apis.apis[i]->status < 0) {
+				dag->nodes[n].dag = dag;
+				dag->nodes[n++].api = s->apis.apis[i];
+			}
+
+	for (i = 0 ; i < n ; i++) {
+		api = dag->nodes[i].api;
+		for (j = 0 ; j < api->require.classes.count ; j++) {
+			providers = &api->require.classes.classes[j]->providers;
+			for (k = 0 ; k < providers->count ; k++)
+				start_dag_depends(dag, i, providers->apis[k]);
+		}
+		for (j = 0 ; j < api->require.apis.count ; j++) {
+			depend = api->require.apis.depends[j];
+			required = searchrec(depend->set, depend->name);
+			if (required)
+				start_dag_depends(dag, i, required);
+		}
+	}
+	pthread_rwlock_unlock(&apis_lock);
+	return 0;
+}
+
+static void start_dag_job(int signum, void *closure);
+
+/**
+ * Queues the starts of the nodes of 'dag' whose dependencies are
+ * all started and leaves the waiting flow when none remains running.
+ * Nodes that can't be queued and nodes of dependency cycles are never
+ * queued: they are left to the sequential start that follows.
+ * Must be called with the mutex of 'dag' locked.
+ */
+static void start_dag_queue(struct start_dag *dag)
+{
+	struct start_node *node;
+	int i;
+
+	for (i = 0 ; i < dag->count ; i++) {
+		node = &dag->nodes[i];
+		if (!node->queued && !node->pending) {
+			node->queued = 1;
+			if (jobs_queue(node->api->api.group, 0, start_dag_job, node) == 0)
+				dag->running++;
+		}
+	}
+	if (!dag->running)
+		jobs_leave(dag->jobloop);
+}
+
+/**
+ * Job starting the api of the node 'closure'
+ */
+static void start_dag_job(int signum, void *closure)
+{
+	struct start_node *node = closure;
+	struct start_dag *dag = node->dag;
+	struct api_desc *api, *next, *starting;
+	int i, d;
+
+	if (!signum)
+		start_api(node->api);
+	else {
+		/* cancel the starts interrupted in this job */
+		ERROR("start of api %s interrupted by signal %s", node->api->name, strsignal(signum));
+		starting = jobs_get_local();
+		pthread_mutex_lock(&start_mutex);
+		for (api = starting ? node->api : NULL ; api ; api = next) {
+			next = api == starting ? NULL : api->waits;
+			if (api->status == EBUSY)
+				api->status = ECANCELED;
+			api->waits = NULL;
+		}
+		jobs_set_local(NULL);
+		pthread_cond_broadcast(&start_cond);
+		pthread_mutex_unlock(&start_mutex);
+	}
+
+	pthread_mutex_lock(&dag->mutex);
+	d = (int)(node - dag->nodes);
+	for (i = 0 ; i < dag->count ; i++)
+		if (dag->edges[d * dag->count + i])
+			dag->nodes[i].pending--;
+	dag->running--;
+	start_dag_queue(dag);
+	pthread_mutex_unlock(&dag->mutex);
+}
+
+/**
+ * Entry of the flow waiting the end of the parallel start
+ */
+static void start_dag_enter(int signum, void *closure, struct jobloop *jobloop)
+{
+	struct start_dag *dag = closure;
+
+	pthread_mutex_lock(&dag->mutex);
+	dag->jobloop = jobloop;
+	if (signum)
+		jobs_leave(jobloop);
+	else
+		start_dag_queue(dag);
+	pthread_mutex_unlock(&dag->mutex);
+}
+
+/**
+ * Starts all possible services, the independent ones concurrently.
+ *
+ * The starts are scheduled as jobs following the graph of the
+ * required apis and classes: an api is queued when all the apis
+ * it requires are started. The calling flow processes jobs until
+ * the graph is done. Then the apis not started, because of a
+ * failure or of a dependency cycle, are processed in sequence as
+ * by 'afb_apiset_start_all_services'.
+ *
+ * It must be called from a job.
+ *
+ * @param set the api set
+ * @return 0 on success or a negative number when an error is found
+ */
+int afb_apiset_start_all_services_parallel(struct afb_apiset *set)
+{
+	struct start_dag dag;
+	uint64_t t0;
+	unsigned ms;
+	int rc;
+
+	t0 = now_us();
+	if (start_dag_build(&dag, set) < 0)
+		ERROR("can't schedule the parallel start of apis: %m");
+	else {
+		pthread_mutex_init(&dag.mutex, NULL);
+		if (dag.count && jobs_enter(NULL, 0, start_dag_enter, &dag) < 0)
+			ERROR("can't start apis in parallel: %m");
+
+		/* ensure that the last job released the graph */
+		pthread_mutex_lock(&dag.mutex);
+		pthread_mutex_unlock(&dag.mutex);
+		pthread_mutex_destroy(&dag.mutex);
+		free(dag.nodes);
+		free(dag.edges);
+	}
+	rc = afb_apiset_start_all_services(set);
+	ms = (unsigned)((now_us() - t0) / 1000);
+	NOTICE("APIs started in %u ms", ms);
+	return rc;
+}
+
+/**
+ * Get the report of the starts of the apis of 'set'
+ * @param set the api set
+ * @param rec if not zero look also recursively in subsets
+ * @return an object mapping the names of the apis that are started or
+ * whose start failed to an object giving their status, the duration
+ * of their init and the time when they were ready, in microseconds
+ * since the first start
+ */
+struct json_object *afb_apiset_get_start_report(struct afb_apiset *set, int rec)
+{
+	struct json_object *result, *item;
+	struct api_desc *api;
+	int i;
+
+	result = json_object_new_object();
+	pthread_rwlock_rdlock(&apis_lock);
+	while (set) {
+		for (i = 0 ; i < set->apis.count ; i++) {
+			api = set->apis.apis[i];
+			if (api->status < 0 || api->status == EBUSY)
+				continue;
+			item = json_object_new_object();
+			json_object_object_add(item, "status",
+				json_object_new_string(api->status ? strerror(api->status) : "started"));
+			json_object_object_add(item, "init-us", json_object_new_int64(api->init_us));
+			json_object_object_add(item, "ready-us", json_object_new_int64(api->ready_us));
+			json_object_object_add(result, api->name, item);
+		}
+		set = rec ? set->subset : NULL;
+	}
+	pthread_rwlock_unlock(&apis_lock);
+	return result;
+}
+
 /**
  * Ask to update the hook flags of the 'api'
  * @param set the api set
@@ -917,6 +1288,30 @@ void afb_apiset_set_logmask(struct afb_apiset *set, const char *name, int mask)
 	}
 }
 
+/**
+ * Set the priority of the jobs of the 'api' to 'priority'
+ * @param set the api set
+ * @param name the api to set
+ * @param priority the priority (see JOBS_PRIORITY_...)
+ * @return 0 in case of success or -1 in case of error
+ */
+int afb_apiset_set_priority(struct afb_apiset *set, const char *name, int priority)
+{
+	struct api_desc *d;
+
+	if (priority < 0 || priority >= JOBS_PRIORITY_COUNT) {
+		errno = EINVAL;
+		return -1;
+	}
+	d = name ? searchrec(set, name) : NULL;
+	if (!d) {
+		errno = ENOENT;
+		return -1;
+	}
+	d->api.priority = priority;
+	return 0;
+}
+
 /**
  * Get the logmask level of the 'api'
  * @param set the api set
@@ -53,10 +53,13 @@ extern const struct afb_api_item *afb_apiset_lookup_started(struct afb_apiset *s
 
 extern int afb_apiset_start_service(struct afb_apiset *set, const char *name);
 extern int afb_apiset_start_all_services(struct afb_apiset *set);
+extern int afb_apiset_start_all_services_parallel(struct afb_apiset *set);
+extern struct json_object *afb_apiset_get_start_report(struct afb_apiset *set, int rec);
 
 extern void afb_apiset_update_hooks(struct afb_apiset *set, const char *name);
 extern void afb_apiset_set_logmask(struct afb_apiset *set, const char *name, int mask);
 extern int afb_apiset_get_logmask(struct afb_apiset *set, const char *name);
+extern int afb_apiset_set_priority(struct afb_apiset *set, const char *name, int priority);
 
 extern struct json_object *afb_apiset_describe(struct afb_apiset *set, const char *name);
 
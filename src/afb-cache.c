@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <json-c/json.h>
+
+#include "afb-cache.h"
+#include "wrap-json.h"
+
+#define CACHE_BUCKETS	64	/* count of hash buckets, a power of 2 */
+
+/*
+ * A cached reply
+ */
+struct afb_cache_entry
+{
+	struct afb_cache_entry *next;	/**< next entry of the bucket */
+	struct afb_cache_entry *older;	/**< previous entry in the order of insertion */
+	struct afb_cache_entry *newer;	/**< next entry in the order of insertion */
+	uint64_t hash;			/**< hash of the key */
+	uint64_t expire;		/**< expiration time in ms of the monotonic clock */
+	int refcount;			/**< count of references */
+	const char *verb;		/**< name of the verb */
+	const char *session;		/**< session identifier or NULL */
+	const char *info;		/**< info of the reply or NULL */
+	struct json_object *args;	/**< copy of the arguments */
+	size_t size;			/**< size of the text of the reply */
+	char buffer[];			/**< text of the reply followed by the strings */
+};
+
+/*
+ * The cache
+ */
+struct afb_cache
+{
+	pthread_mutex_t mutex;		/**< protection of the entries */
+	int refcount;			/**< count of references */
+	unsigned count;			/**< count of entries */
+	unsigned capacity;		/**< maximum count of entries */
+	uint32_t generation;		/**< count of invalidations */
+	struct afb_cache_entry *oldest;	/**< the entry inserted first */
+	struct afb_cache_entry *newest;	/**< the entry inserted last */
+	struct afb_cache_entry *buckets[CACHE_BUCKETS];
+};
+
+/* current time in ms of the monotonic clock */
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* mixes the 'value' in the hash 'h' */
+static uint64_t hmix(uint64_t h, uint64_t value)
+{
+	h ^= value;
+	h *= UINT64_C(0x100000001b3);
+	return h ^ (h >> 29);
+}
+
+/* hash of the key, the verb being case insensitive */
+static uint64_t hash_key(const char *verb, const char *session, struct json_object *args)
+{
+	uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+	while (*verb)
+		h = hmix(h, (uint64_t)tolower((unsigned char)*verb++));
+	h = hmix(h, 0);
+	if (session) {
+		while (*session)
+			h = hmix(h, (uint64_t)(unsigned char)*session++);
+		h = hmix(h, 0);
+	}
+	return hmix(h, wrap_json_hash(args));
+}
+
+/* is the key of 'entry' the given one? */
+static int match(struct afb_cache_entry *entry, uint64_t hash, const char *verb, const char *session, struct json_object *args)
+{
+	return entry->hash == hash
+		&& !strcasecmp(entry->verb, verb)
+		&& (entry->session == session
+			|| (entry->session && session && !strcmp(entry->session, session)))
+		&& wrap_json_equal(entry->args, args);
+}
+
+/* unlinks 'entry' from 'cache', the mutex being locked */
+static void unlink_entry(struct afb_cache *cache, struct afb_cache_entry *entry)
+{
+	struct afb_cache_entry **prv;
+
+	prv = &cache->buckets[entry->hash & (CACHE_BUCKETS - 1)];
+	while (*prv != entry)
+		prv = &(*prv)->next;
+	*prv = entry->next;
+
+	if (entry->older)
+		entry->older->newer = entry->newer;
+	else
+		cache->oldest = entry->newer;
+	if (entry->newer)
+		entry->newer->older = entry->older;
+	else
+		cache->newest = entry->older;
+	cache->count--;
+}
+
+/**
+ * Creates a cache
+ * @param capacity the maximum count of cached replies
+ * @return the created cache or NULL with errno set
+ */
+struct afb_cache *afb_cache_create(unsigned capacity)
+{
+	struct afb_cache *cache;
+
+	cache = calloc(1, sizeof *cache);
+	if (cache == NULL)
+		errno = ENOMEM;
+	else {
+		pthread_mutex_init(&cache->mutex, NULL);
+		cache->refcount = 1;
+		cache->capacity = capacity ?: 1;
+	}
+	return cache;
+}
+
+/**
+ * Adds a reference to the 'cache'
+ * @param cache the cache (can be NULL)
+ * @return the cache
+ */
+struct afb_cache *afb_cache_addref(struct afb_cache *cache)
+{
+	if (cache)
+		__atomic_add_fetch(&cache->refcount, 1, __ATOMIC_RELAXED);
+	return cache;
+}
+
+/**
+ * Releases a reference to the 'cache', freeing it on the last one
+ * @param cache the cache (can be NULL)
+ */
+void afb_cache_unref(struct afb_cache *cache)
+{
+	if (cache && !__atomic_sub_fetch(&cache->refcount, 1, __ATOMIC_ACQ_REL)) {
+		afb_cache_invalidate(cache, NULL);
+		pthread_mutex_destroy(&cache->mutex);
+		free(cache);
+	}
+}
+
+/**
+ * Destroys the 'cache' for its creator: its replies are dropped at once,
+ * the entries not released being kept until released, and it is freed
+ * when the other references are released
+ * @param cache the cache to destroy (can be NULL)
+ */
+void afb_cache_destroy(struct afb_cache *cache)
+{
+	if (cache) {
+		afb_cache_invalidate(cache, NULL);
+		afb_cache_unref(cache);
+	}
+}
+
+/**
+ * Search the reply cached for the given key
+ * @param cache the cache
+ * @param verb the name of the verb
+ * @param session the identifier of the session or NULL when not scoped
+ * @param args the arguments of the request
+ * @return the not expired entry found, to be released with 'afb_cache_entry_unref',
+ * or NULL when not found
+ */
+struct afb_cache_entry *afb_cache_get(struct afb_cache *cache, const char *verb, const char *session, struct json_object *args)
+{
+	uint64_t hash;
+	struct afb_cache_entry *entry, *expired;
+
+	hash = hash_key(verb, session, args);
+	expired = NULL;
+	pthread_mutex_lock(&cache->mutex);
+	entry = cache->buckets[hash & (CACHE_BUCKETS - 1)];
+	while (entry && !match(entry, hash, verb, session, args))
+		entry = entry->next;
+	if (entry) {
+		if (entry->expire > now_ms())
+			__atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+		else {
+			unlink_entry(cache, entry);
+			expired = entry;
+			entry = NULL;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	afb_cache_entry_unref(expired);
+	return entry;
+}
+
+/**
+ * Records a reply in the cache, replacing any reply of the same key
+ * @param cache the cache
+ * @param verb the name of the verb
+ * @param session the identifier of the session or NULL when not scoped
+ * @param args the arguments of the request
+ * @param buffer the JSON text of the reply
+ * @param size the size of the text
+ * @param info the info of the reply or NULL
+ * @param ttl the time to live of the reply in milliseconds
+ * @param generation the generation of the cache when the reply was missed
+ * @return 0 on success or -1 with errno set. The reply is not recorded,
+ * without error, when the cache was invalidated since 'generation'
+ */
+int afb_cache_put(struct afb_cache *cache, const char *verb, const char *session, struct json_object *args, const char *buffer, size_t size, const char *info, uint32_t ttl, uint32_t generation)
+{
+	size_t lverb, lsession, linfo;
+	struct afb_cache_entry *entry, *iter, *dropped, **prv;
+	uint64_t now;
+	char *text;
+
+	/* allocates the entry */
+	lverb = 1 + strlen(verb);
+	lsession = session ? 1 + strlen(session) : 0;
+	linfo = info ? 1 + strlen(info) : 0;
+	entry = malloc(sizeof *entry + size + lverb + lsession + linfo);
+	if (entry == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	entry->args = args ? wrap_json_clone_deep(args) : NULL;
+	if (args && entry->args == NULL) {
+		free(entry);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* initialises it */
+	now = now_ms();
+	entry->hash = hash_key(verb, session, args);
+	entry->expire = now + ttl;
+	entry->refcount = 1;
+	entry->size = size;
+	text = mempcpy(entry->buffer, buffer, size);
+	entry->verb = text;
+	text = mempcpy(text, verb, lverb);
+	entry->session = session ? text : NULL;
+	if (session)
+		text = mempcpy(text, session, lsession);
+	entry->info = info ? text : NULL;
+	if (info)
+		memcpy(text, info, linfo);
+
+	/* records it unless it may be stale */
+	dropped = NULL;
+	pthread_mutex_lock(&cache->mutex);
+	if (generation != cache->generation) {
+		pthread_mutex_unlock(&cache->mutex);
+		afb_cache_entry_unref(entry);
+		return 0;
+	}
+	prv = &cache->buckets[entry->hash & (CACHE_BUCKETS - 1)];
+	for (iter = *prv ; iter ; iter = iter->next) {
+		if (match(iter, entry->hash, verb, session, args)) {
+			unlink_entry(cache, iter);
+			iter->next = dropped;
+			dropped = iter;
+			break;
+		}
+	}
+	entry->next = *prv;
+	*prv = entry;
+	entry->newer = NULL;
+	entry->older = cache->newest;
+	if (entry->older)
+		entry->older->newer = entry;
+	else
+		cache->oldest = entry;
+	cache->newest = entry;
+	cache->count++;
+
+	/* drops the expired replies then the oldest ones when full */
+	if (cache->count > cache->capacity) {
+		for (iter = cache->oldest ; iter ; iter = iter->newer) {
+			if (iter->expire <= now) {
+				unlink_entry(cache, iter);
+				iter->next = dropped;
+				dropped = iter;
+			}
+		}
+		while (cache->count > cache->capacity) {
+			iter = cache->oldest;
+			unlink_entry(cache, iter);
+			iter->next = dropped;
+			dropped = iter;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	/* releases the dropped entries */
+	while (dropped) {
+		iter = dropped;
+		dropped = iter->next;
+		afb_cache_entry_unref(iter);
+	}
+	return 0;
+}
+
+/**
+ * Get the current generation of 'cache', to be given to 'afb_cache_put'
+ * for recording a reply missed now
+ * @param cache the cache
+ * @return the generation
+ */
+uint32_t afb_cache_generation(struct afb_cache *cache)
+{
+	uint32_t generation;
+
+	pthread_mutex_lock(&cache->mutex);
+	generation = cache->generation;
+	pthread_mutex_unlock(&cache->mutex);
+	return generation;
+}
+
+/**
+ * Drops the cached replies of the 'verb' and the replies being computed
+ * @param cache the cache
+ * @param verb the name of the verb or NULL for dropping all the replies
+ */
+void afb_cache_invalidate(struct afb_cache *cache, const char *verb)
+{
+	struct afb_cache_entry *iter, *next, *dropped;
+
+	dropped = NULL;
+	pthread_mutex_lock(&cache->mutex);
+	cache->generation++;
+	for (iter = cache->oldest ; iter ; iter = next) {
+		next = iter->newer;
+		if (verb == NULL || !strcasecmp(iter->verb, verb)) {
+			unlink_entry(cache, iter);
+			iter->next = dropped;
+			dropped = iter;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	while (dropped) {
+		iter = dropped;
+		dropped = iter->next;
+		afb_cache_entry_unref(iter);
+	}
+}
+
+/**
+ * Get the JSON text of the reply of 'entry'
+ * @param entry the entry
+ * @param size where to store the size of the text
+ * @return the text, not terminated by a zero
+ */
+const char *afb_cache_entry_buffer(struct afb_cache_entry *entry, size_t *size)
+{
+	*size = entry->size;
+	return entry->buffer;
+}
+
+/**
+ * Get the info of the reply of 'entry'
+ * @param entry the entry
+ * @return the info or NULL
+ */
+const char *afb_cache_entry_info(struct afb_cache_entry *entry)
+{
+	return entry->info;
+}
+
+/**
+ * Releases the 'entry'
+ * @param entry the entry to release (can be NULL)
+ */
+void afb_cache_entry_unref(struct afb_cache_entry *entry)
+{
+	if (entry && !__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL)) {
+		json_object_put(entry->args);
+		free(entry);
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Cache of the successful replies of verbs.
+ *
+ * The replies are recorded as JSON text, keyed by the name of the verb,
+ * an optional session identifier and the arguments of the request.
+ * Arguments are equal as for 'wrap_json_equal', so the order of the
+ * fields of objects doesn't matter.
+ *
+ * Each reply has a time to live. When the cache is full, the oldest
+ * replies are dropped. The cache is thread safe and the entries
+ * returned by 'afb_cache_get' stay valid until their release.
+ *
+ * Each invalidation increments the generation of the cache. Replies
+ * are only recorded if the generation didn't change since their miss,
+ * so replies computed before an invalidation are not kept.
+ *
+ * The cache is counted by references, so that the requests waiting
+ * for their reply to be recorded can keep it after its destruction.
+ */
+struct afb_cache;
+struct afb_cache_entry;
+struct json_object;
+
+extern struct afb_cache *afb_cache_create(unsigned capacity);
+extern void afb_cache_destroy(struct afb_cache *cache);
+extern struct afb_cache *afb_cache_addref(struct afb_cache *cache);
+extern void afb_cache_unref(struct afb_cache *cache);
+
+extern struct afb_cache_entry *afb_cache_get(struct afb_cache *cache, const char *verb, const char *session, struct json_object *args);
+extern int afb_cache_put(struct afb_cache *cache, const char *verb, const char *session, struct json_object *args, const char *buffer, size_t size, const char *info, uint32_t ttl, uint32_t generation);
+extern uint32_t afb_cache_generation(struct afb_cache *cache);
+extern void afb_cache_invalidate(struct afb_cache *cache, const char *verb);
+
+extern const char *afb_cache_entry_buffer(struct afb_cache_entry *entry, size_t *size);
+extern const char *afb_cache_entry_info(struct afb_cache_entry *entry);
+extern void afb_cache_entry_unref(struct afb_cache_entry *entry);
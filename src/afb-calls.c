@@ -36,6 +36,7 @@
 #include "afb-xreq.h"
 
 #include "jobs.h"
+#include "slab.h"
 #include "verbose.h"
 
 #define CALLFLAGS            (afb_req_x2_subcall_api_session|afb_req_x2_subcall_catch_events)
@@ -85,6 +86,8 @@ struct callreq
 
 	int flags;
 
+	size_t size;
+
 	union {
 		struct {
 			struct jobloop *jobloop;
@@ -170,7 +173,7 @@ static void callreq_destroy_cb(struct afb_xreq *xreq)
 	afb_context_disconnect(&callreq->xreq.context);
 	json_object_put(callreq->xreq.json);
 	afb_cred_unref(callreq->xreq.cred);
-	free(callreq);
+	slab_free(callreq, callreq->size);
 }
 
 static void callreq_reply_cb(struct afb_xreq *xreq, struct json_object *object, const char *error, const char *info)
@@ -273,13 +276,14 @@ static struct callreq *callreq_create(
 
 	lenapi = 1 + strlen(api);
 	lenverb = 1 + strlen(verb);
-	callreq = malloc(lenapi + lenverb + sizeof *callreq);
+	callreq = slab_alloc(lenapi + lenverb + sizeof *callreq);
 	if (!callreq) {
 		ERROR("out of memory");
 		json_object_put(args);
 		errno = ENOMEM;
 	} else {
 		afb_xreq_init(&callreq->xreq, &afb_calls_xreq_itf);
+		callreq->size = lenapi + lenverb + sizeof *callreq;
 		callreq->xreq.context.validated = 1;
 		api2 = (char*)&callreq[1];
 		callreq->xreq.request.called_api = memcpy(api2, api, lenapi);;
@@ -292,6 +296,7 @@ static struct callreq *callreq_create(
 			if (flags & afb_req_x2_subcall_on_behalf)
 				callreq->xreq.cred = afb_cred_addref(caller->cred);
 			callreq->xreq.caller = caller;
+			callreq->xreq.deadline = caller->deadline;
 			afb_xreq_unhooked_addref(caller);
 		}
 		if (caller && (flags & afb_req_x2_subcall_api_session))
@@ -0,0 +1,615 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <systemd/sd-event.h>
+#include <json-c/json.h>
+#if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
+#define JSON_C_TO_STRING_NOSLASHESCAPE 0
+#endif
+
+#include "afb-wsj1.h"
+#include "afb-ws-client.h"
+#include "afb-proto-ws.h"
+#include "afb-client-bench.h"
+
+/* time in µs left to the connections and subscriptions at start */
+#define SETUP_TIME	15000000
+
+/* time in µs left to the pending calls at end */
+#define DRAIN_TIME	5000000
+
+/*
+ * The histograms of latencies in µs record the values with a
+ * precision of 6 bits: values below 128 are exact, the others are
+ * counted in buckets of width 2^shift for a mantissa between 64
+ * and 127.
+ */
+#define HISTO_BITS	6
+#define HISTO_SIZE	((65 - HISTO_BITS) << HISTO_BITS)
+
+struct histogram
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HISTO_SIZE];
+};
+
+/* kinds of connection */
+enum kind
+{
+	Kind_WSJ1,
+	Kind_Direct,
+	Kind_Count
+};
+
+static const char *kind_names[Kind_Count] = { "wsj1", "direct" };
+
+/* a connection */
+struct conn
+{
+	/* kind of the connection */
+	enum kind kind;
+
+	/* the wsj1 or the pws of the connection */
+	struct afb_wsj1 *wsj1;
+	struct afb_proto_ws *pws;
+
+	/* is the connection alive? */
+	int alive;
+
+	/* count of calls in flight */
+	int inflight;
+
+	/* planned time of the next call in µs and period of calls or 0 */
+	uint64_t next;
+	uint64_t period;
+
+	/* timer for sending the next call */
+	sd_event_source *timer;
+};
+
+/* a call */
+struct call
+{
+	struct conn *conn;
+	uint64_t start;
+	int subscribe;
+};
+
+/* counters */
+struct counters
+{
+	uint64_t sent;
+	uint64_t success;
+	uint64_t error;
+	uint64_t failed;
+	uint64_t events;
+	uint64_t hangups;
+};
+
+static const struct afb_client_bench *bench;
+static struct sd_event *loop;
+static struct conn *conns;
+static int nconns;
+static int setting_up;
+static int setup_failed;
+static int running;
+static uint64_t inflight;
+static struct json_object *data_j;
+static struct json_object *subscribe_data_j;
+static const char *data_s;
+static const char *subscribe_data_s;
+static struct counters counters;
+static struct histogram histos[Kind_Count];
+
+/* current time in µs of the monotonic clock */
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/******************* histograms *****************************/
+
+/* index of the bucket of 'value' */
+static int histo_index(uint64_t value)
+{
+	int shift;
+
+	shift = value < (2 << HISTO_BITS) ? 0 : 63 - __builtin_clzll(value) - HISTO_BITS;
+	return (shift << HISTO_BITS) + (int)(value >> shift);
+}
+
+/* middle value of the bucket of 'index' */
+static uint64_t histo_value(int index)
+{
+	int shift;
+
+	if (index < (2 << HISTO_BITS))
+		return (uint64_t)index;
+	shift = (index >> HISTO_BITS) - 1;
+	return ((uint64_t)(index - (shift << HISTO_BITS)) << shift) + ((uint64_t)1 << (shift - 1));
+}
+
+static void histo_add(struct histogram *h, uint64_t value)
+{
+	if (!h->count || value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+	h->count++;
+	h->sum += value;
+	h->buckets[histo_index(value)]++;
+}
+
+static void histo_merge(struct histogram *to, const struct histogram *from)
+{
+	int i;
+
+	if (from->count) {
+		if (!to->count || from->min < to->min)
+			to->min = from->min;
+		if (from->max > to->max)
+			to->max = from->max;
+		to->count += from->count;
+		to->sum += from->sum;
+		for (i = 0 ; i < HISTO_SIZE ; i++)
+			to->buckets[i] += from->buckets[i];
+	}
+}
+
+/* value of the 'percent' percentile */
+static uint64_t histo_percentile(const struct histogram *h, double percent)
+{
+	uint64_t rank, acc;
+	int i;
+
+	rank = (uint64_t)(percent * (double)h->count / 100.0 + 0.5);
+	if (rank == 0)
+		rank = 1;
+	for (acc = 0, i = 0 ; i < HISTO_SIZE ; i++) {
+		acc += h->buckets[i];
+		if (acc >= rank)
+			break;
+	}
+	if (i == HISTO_SIZE)
+		return h->max;
+	rank = histo_value(i);
+	return rank < h->min ? h->min : rank > h->max ? h->max : rank;
+}
+
+static struct json_object *histo_json(const struct histogram *h)
+{
+	static const struct { const char *name; double percent; } percentiles[] = {
+		{ "p50", 50.0 }, { "p90", 90.0 }, { "p99", 99.0 },
+		{ "p99.9", 99.9 }, { "p99.99", 99.99 }
+	};
+	struct json_object *result;
+	int i;
+
+	result = json_object_new_object();
+	json_object_object_add(result, "count", json_object_new_int64((int64_t)h->count));
+	if (h->count) {
+		json_object_object_add(result, "min", json_object_new_int64((int64_t)h->min));
+		json_object_object_add(result, "mean", json_object_new_int64((int64_t)(h->sum / h->count)));
+		for (i = 0 ; i < (int)(sizeof percentiles / sizeof *percentiles) ; i++)
+			json_object_object_add(result, percentiles[i].name,
+				json_object_new_int64((int64_t)histo_percentile(h, percentiles[i].percent)));
+		json_object_object_add(result, "max", json_object_new_int64((int64_t)h->max));
+	}
+	return result;
+}
+
+/******************* calls *****************************/
+
+static void pump(struct conn *conn);
+static void hangup(struct conn *conn);
+
+/* end of the setup of a connection */
+static void setup_done(int failed)
+{
+	setting_up--;
+	setup_failed |= failed;
+}
+
+/* records the end of the 'call' */
+static void call_end(struct call *call, int success)
+{
+	struct conn *conn = call->conn;
+
+	if (call->subscribe) {
+		if (!success)
+			fprintf(stderr, "subscription call failed\n");
+		setup_done(!success);
+	} else {
+		histo_add(&histos[conn->kind], now_us() - call->start);
+		if (success)
+			counters.success++;
+		else
+			counters.error++;
+		conn->inflight--;
+		inflight--;
+		pump(conn);
+	}
+	free(call);
+}
+
+/*
+ * records the loss of the 'call' by the hangup of its connection:
+ * it is neither a success nor an error and its latency is meaningless
+ */
+static void call_lost(struct call *call)
+{
+	if (call->subscribe) {
+		fprintf(stderr, "subscription call failed: disconnected\n");
+		setup_done(1);
+	}
+	hangup(call->conn);
+	free(call);
+}
+
+/*
+ * is 'status' the one given to the pending calls on hangup?
+ * (a server replying it itself is also taken for a hangup)
+ */
+static int is_disconnected(const char *status)
+{
+	return status != NULL && !strcmp(status, "disconnected");
+}
+
+static void on_wsj1_reply(void *closure, struct afb_wsj1_msg *msg)
+{
+	struct json_object *request, *status;
+
+	if (afb_wsj1_msg_is_reply_ok(msg))
+		call_end(closure, 1);
+	else if (json_object_object_get_ex(afb_wsj1_msg_object_j(msg), "request", &request)
+	      && json_object_object_get_ex(request, "status", &status)
+	      && is_disconnected(json_object_get_string(status)))
+		call_lost(closure);
+	else
+		call_end(closure, 0);
+}
+
+static void on_pws_reply(void *closure, void *request, struct json_object *result, const char *error, const char *info)
+{
+	if (is_disconnected(error))
+		call_lost(request);
+	else
+		call_end(request, !error);
+}
+
+/* sends a call on 'conn' planned at 'start', returns 0 on success or -1 on error */
+static int send_call(struct conn *conn, uint64_t start, int subscribe)
+{
+	struct call *call;
+	int rc;
+
+	call = malloc(sizeof *call);
+	if (!call)
+		return -1;
+	call->conn = conn;
+	call->start = start;
+	call->subscribe = subscribe;
+	if (conn->kind == Kind_WSJ1)
+		rc = afb_wsj1_call_s(conn->wsj1, bench->api,
+				subscribe ? bench->subscribe : bench->verb,
+				subscribe ? subscribe_data_s : data_s,
+				on_wsj1_reply, call);
+	else
+		rc = afb_proto_ws_client_call(conn->pws,
+				subscribe ? bench->subscribe : bench->verb,
+				subscribe ? subscribe_data_j : data_j,
+				"afb-client-bench", call, NULL);
+	if (rc < 0) {
+		free(call);
+		return -1;
+	}
+	return 0;
+}
+
+static int on_timer(sd_event_source *s, uint64_t usec, void *closure)
+{
+	pump(closure);
+	return 0;
+}
+
+/* arms the timer of 'conn' for 'time' */
+static void arm_timer(struct conn *conn, uint64_t time)
+{
+	if (conn->timer) {
+		sd_event_source_set_time(conn->timer, time);
+		sd_event_source_set_enabled(conn->timer, SD_EVENT_ONESHOT);
+	} else if (sd_event_add_time(loop, &conn->timer, CLOCK_MONOTONIC, time, 0, on_timer, conn) < 0)
+		conn->timer = NULL;
+}
+
+/*
+ * Sends the calls of 'conn' that are due. With a target rate, the
+ * latency is measured from the planned time of the call, not from
+ * the time it could be sent, in order to account the delays caused
+ * by a saturated server.
+ */
+static void pump(struct conn *conn)
+{
+	uint64_t now, start;
+
+	now = now_us();
+	while (running && conn->alive && conn->inflight < bench->inflight) {
+		if (!conn->period)
+			start = now;
+		else if (conn->next > now) {
+			arm_timer(conn, conn->next);
+			break;
+		} else {
+			start = conn->next;
+			conn->next += conn->period;
+		}
+		if (send_call(conn, start, 0) < 0) {
+			counters.failed++;
+			break;
+		}
+		counters.sent++;
+		conn->inflight++;
+		inflight++;
+	}
+}
+
+/******************* connections *****************************/
+
+static void hangup(struct conn *conn)
+{
+	if (conn->alive) {
+		conn->alive = 0;
+		counters.hangups++;
+		inflight -= (uint64_t)conn->inflight;
+		conn->inflight = 0;
+	}
+}
+
+static void on_wsj1_hangup(void *closure, struct afb_wsj1 *wsj1)
+{
+	hangup(closure);
+}
+
+static void on_wsj1_call(void *closure, const char *api, const char *verb, struct afb_wsj1_msg *msg)
+{
+	afb_wsj1_reply_error_s(msg, "\"unimplemented\"", NULL);
+}
+
+static void on_wsj1_event(void *closure, const char *event, struct afb_wsj1_msg *msg)
+{
+	counters.events++;
+}
+
+static void on_pws_hangup(void *closure)
+{
+	hangup(closure);
+}
+
+static void on_pws_event_push(void *closure, const char *event_name, int event_id, struct json_object *data)
+{
+	counters.events++;
+}
+
+static void on_pws_event_broadcast(void *closure, const char *event_name, struct json_object *data)
+{
+	counters.events++;
+}
+
+static struct afb_wsj1_itf wsj1_itf = {
+	.on_hangup = on_wsj1_hangup,
+	.on_call = on_wsj1_call,
+	.on_event = on_wsj1_event
+};
+
+static struct afb_proto_ws_client_itf pws_itf = {
+	.on_reply = on_pws_reply,
+	.on_event_push = on_pws_event_push,
+	.on_event_broadcast = on_pws_event_broadcast,
+};
+
+/* the connection is established, subscribes if required */
+static void connected(struct conn *conn, int ok)
+{
+	if (!ok) {
+		fprintf(stderr, "connection to %s failed: %m\n", conn->kind == Kind_WSJ1 ? bench->uri : bench->direct_uri);
+		setup_done(1);
+	} else {
+		conn->alive = 1;
+		if (!bench->subscribe)
+			setup_done(0);
+		else if (send_call(conn, 0, 1) < 0) {
+			fprintf(stderr, "subscription call failed: %m\n");
+			setup_done(1);
+		}
+	}
+}
+
+static void on_wsj1_connect(void *closure, struct afb_wsj1 *wsj1)
+{
+	struct conn *conn = closure;
+
+	conn->wsj1 = wsj1;
+	connected(conn, wsj1 != NULL);
+}
+
+static void on_pws_connect(void *closure, struct afb_proto_ws *pws)
+{
+	struct conn *conn = closure;
+
+	conn->pws = pws;
+	if (pws)
+		afb_proto_ws_on_hangup(pws, on_pws_hangup);
+	connected(conn, pws != NULL);
+}
+
+/* starts the connection of 'conn' */
+static void connect_conn(struct conn *conn, enum kind kind)
+{
+	int rc;
+
+	conn->kind = kind;
+	setting_up++;
+	if (kind == Kind_WSJ1)
+		rc = afb_ws_client_connect_wsj1_async(loop, bench->uri, &wsj1_itf, conn, on_wsj1_connect);
+	else
+		rc = afb_ws_client_connect_api_async(loop, bench->direct_uri, &pws_itf, conn, on_pws_connect);
+	if (rc < 0)
+		connected(conn, 0);
+}
+
+/******************* main *****************************/
+
+/* parse the data 'text' as in afb-client-demo */
+static struct json_object *parse_data(const char *text)
+{
+	struct json_object *o;
+	enum json_tokener_error jerr;
+
+	if (text == NULL || text[0] == 0)
+		return NULL;
+	o = json_tokener_parse_verbose(text, &jerr);
+	return jerr == json_tokener_success ? o : json_object_new_string(text);
+}
+
+/* prints the report */
+static void report(uint64_t elapsed)
+{
+	struct json_object *result, *obj;
+	struct histogram all;
+	double seconds;
+	int i, counts[Kind_Count];
+
+	seconds = (double)elapsed / 1000000.0;
+	memset(&all, 0, sizeof all);
+	memset(counts, 0, sizeof counts);
+	for (i = 0 ; i < nconns ; i++)
+		counts[conns[i].kind]++;
+
+	result = json_object_new_object();
+	json_object_object_add(result, "duration", json_object_new_double(seconds));
+
+	obj = json_object_new_object();
+	for (i = 0 ; i < Kind_Count ; i++)
+		json_object_object_add(obj, kind_names[i], json_object_new_int(counts[i]));
+	json_object_object_add(obj, "hangups", json_object_new_int64((int64_t)counters.hangups));
+	json_object_object_add(result, "connections", obj);
+
+	json_object_object_add(result, "inflight", json_object_new_int(bench->inflight));
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "target", json_object_new_double(bench->rate));
+	json_object_object_add(obj, "achieved", json_object_new_double((double)(counters.success + counters.error) / seconds));
+	json_object_object_add(result, "rate", obj);
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "sent", json_object_new_int64((int64_t)counters.sent));
+	json_object_object_add(obj, "success", json_object_new_int64((int64_t)counters.success));
+	json_object_object_add(obj, "error", json_object_new_int64((int64_t)counters.error));
+	json_object_object_add(obj, "failed", json_object_new_int64((int64_t)counters.failed));
+	json_object_object_add(obj, "lost", json_object_new_int64((int64_t)(counters.sent - counters.success - counters.error)));
+	json_object_object_add(result, "calls", obj);
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "received", json_object_new_int64((int64_t)counters.events));
+	json_object_object_add(obj, "rate", json_object_new_double((double)counters.events / seconds));
+	json_object_object_add(result, "events", obj);
+
+	obj = json_object_new_object();
+	for (i = 0 ; i < Kind_Count ; i++) {
+		histo_merge(&all, &histos[i]);
+		if (counts[i])
+			json_object_object_add(obj, kind_names[i], histo_json(&histos[i]));
+	}
+	json_object_object_add(obj, "all", histo_json(&all));
+	json_object_object_add(result, "latency-us", obj);
+
+	printf("%s\n", json_object_to_json_string_ext(result,
+			(bench->pretty ? JSON_C_TO_STRING_PRETTY : JSON_C_TO_STRING_PLAIN)
+				| JSON_C_TO_STRING_NOSLASHESCAPE));
+	fflush(stdout);
+	json_object_put(result);
+}
+
+int afb_client_bench_run(struct sd_event *eloop, const struct afb_client_bench *settings)
+{
+	int i, n;
+	uint64_t start, end, now;
+
+	bench = settings;
+	loop = eloop;
+	data_j = parse_data(bench->data);
+	subscribe_data_j = parse_data(bench->subscribe_data);
+	data_s = json_object_to_json_string_ext(data_j, JSON_C_TO_STRING_PLAIN|JSON_C_TO_STRING_NOSLASHESCAPE);
+	subscribe_data_s = json_object_to_json_string_ext(subscribe_data_j, JSON_C_TO_STRING_PLAIN|JSON_C_TO_STRING_NOSLASHESCAPE);
+
+	/* connect */
+	n = bench->connections;
+	nconns = (bench->uri ? n : 0) + (bench->direct_uri ? n : 0);
+	conns = calloc((size_t)nconns, sizeof *conns);
+	if (!conns) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	start = now_us();
+	for (i = 0 ; i < nconns ; i++)
+		connect_conn(&conns[i], bench->uri && i < n ? Kind_WSJ1 : Kind_Direct);
+	while (setting_up && (now = now_us()) < start + SETUP_TIME)
+		sd_event_run(loop, start + SETUP_TIME - now);
+	if (setting_up)
+		fprintf(stderr, "setup of the connections timed out\n");
+	if (setting_up || setup_failed)
+		return -1;
+
+	/* spread the calls of the connections over the period */
+	start = now_us();
+	end = start + (uint64_t)(bench->duration * 1000000.0);
+	running = 1;
+	for (i = 0 ; i < nconns ; i++) {
+		if (bench->rate > 0) {
+			conns[i].period = (uint64_t)(1000000.0 * nconns / bench->rate);
+			if (!conns[i].period)
+				conns[i].period = 1;
+			conns[i].next = start + conns[i].period * (uint64_t)i / (uint64_t)nconns;
+		}
+		pump(&conns[i]);
+	}
+
+	/* run the load then let the pending calls end */
+	while ((now = now_us()) < end)
+		sd_event_run(loop, end - now);
+	running = 0;
+	while (inflight && (now = now_us()) < end + DRAIN_TIME)
+		sd_event_run(loop, end + DRAIN_TIME - now);
+
+	report(end - start);
+	return 0;
+}
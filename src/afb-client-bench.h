@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+struct sd_event;
+
+/*
+ * Settings of a benchmark
+ */
+struct afb_client_bench
+{
+	/* uri of the wsj1 connections or NULL */
+	const char *uri;
+
+	/* uri of the direct connections or NULL */
+	const char *direct_uri;
+
+	/* api of the calls of wsj1 connections */
+	const char *api;
+
+	/* verb and data of the calls */
+	const char *verb;
+	const char *data;
+
+	/* verb and data of a call made on each connection before the load or NULL */
+	const char *subscribe;
+	const char *subscribe_data;
+
+	/* count of connections for each uri */
+	int connections;
+
+	/* count of calls in flight for each connection */
+	int inflight;
+
+	/* total rate of calls per second or 0 for calling as fast as possible */
+	double rate;
+
+	/* duration of the load in seconds */
+	double duration;
+
+	/* is the report pretty printed? */
+	int pretty;
+};
+
+/*
+ * Runs the benchmark of 'bench' in the event loop 'loop' and prints
+ * its report in JSON on the standard output.
+ * Returns 0 on success or -1 when a connection failed.
+ */
+extern int afb_client_bench_run(struct sd_event *loop, const struct afb_client_bench *bench);
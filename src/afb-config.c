@@ -70,6 +70,16 @@
  */
 #define DEFAULT_HTTP_PORT		1234
 
+/**
+ * The default backlog of the listening sockets of ws servers
+ */
+#define DEFAULT_WS_BACKLOG		5
+
+/**
+ * The default count of threads of the HTTP server (0: run by the event loop)
+ */
+#define DEFAULT_HTTP_THREADS		0
+
 // Define command line option
 #define SET_BACKGROUND       1
 #define SET_FOREGROUND       2
@@ -109,10 +119,17 @@
 #endif
 #define SET_TRAP_FAULTS     27
 #define ADD_CALL            28
+#define SET_WS_BACKLOG      29
 #if defined(WITH_DBUS_TRANSPARENCY)
 #   define ADD_DBUS_CLIENT  30
 #   define ADD_DBUS_SERVICE 31
 #endif
+#define SET_LOG_ASYNC       32
+#define SET_LOG_RATELIMIT   33
+#define SET_PARALLEL_INIT   34
+#define SET_BINDING_CACHE   35
+#define ADD_LAZY_LDPATH     36
+#define SET_HTTP_THREADS    37
 
 #define ADD_AUTO_API       'A'
 #define ADD_BINDING        'b'
@@ -153,6 +170,8 @@ static struct option_desc optdefs[] = {
 	{SET_COLOR,           0, "color",       "Colorize the ouput"},
 	{SET_QUIET,           0, "quiet",       "Quiet Mode, repeat to decrease verbosity"},
 	{SET_LOG,             1, "log",         "Tune log level"},
+	{SET_LOG_ASYNC,       1, "log-async",   "Write logs from a background thread: on, off, yes, no, true, false, 1, 0 (default: true when supported)"},
+	{SET_LOG_RATELIMIT,   1, "log-ratelimit", "Maximum count of messages per second of each log call site [default = 0, no limit]"},
 
 	{SET_FOREGROUND,      0, "foreground",  "Get all in foreground mode"},
 	{SET_BACKGROUND,      0, "background",  "Get all in background mode"},
@@ -169,6 +188,7 @@ static struct option_desc optdefs[] = {
 	{SET_API_TIMEOUT,     1, "apitimeout",  "Binding API timeout in seconds [default " d2s(DEFAULT_API_TIMEOUT) "]"},
 	{SET_SESSION_TIMEOUT, 1, "cntxtimeout", "Client Session Context Timeout [default " d2s(DEFAULT_SESSION_TIMEOUT) "]"},
 	{SET_CACHE_TIMEOUT,   1, "cache-eol",   "Client cache end of live [default " d2s(DEFAULT_CACHE_TIMEOUT) "]"},
+	{SET_HTTP_THREADS,    1, "http-threads","Count of threads of the HTTP server [default " d2s(DEFAULT_HTTP_THREADS) ", run by the event loop]"},
 
 	{SET_WORK_DIR,        1, "workdir",     "Set the working directory [default: $PWD or current working directory]"},
 	{SET_UPLOAD_DIR,      1, "uploaddir",   "Directory for uploading files [default: workdir] relative to workdir"},
@@ -178,6 +198,9 @@ static struct option_desc optdefs[] = {
 	{ADD_BINDING,         1, "binding",     "Load the binding of path"},
 	{ADD_WEAK_LDPATH,     1, "weak-ldpaths","Same as --ldpaths but ignore errors"},
 	{SET_NO_LDPATH,       0, "no-ldpaths",  "Discard default ldpaths loading"},
+	{ADD_LAZY_LDPATH,     1, "lazy-ldpaths","Same as --weak-ldpaths but load the bindings known by the binding cache on first use"},
+	{SET_BINDING_CACHE,   1, "binding-cache", "File recording the bindings found in ldpaths, for skipping other files and for lazy loading"},
+	{SET_PARALLEL_INIT,   1, "parallel-init", "Start independent apis concurrently: on, off, yes, no, true, false, 1, 0 (default: true)"},
 
 	{SET_TOKEN,           1, "token",       "Initial Secret [default=random, use --token="" to allow any token]"},
 	{SET_RANDOM_TOKEN,    0, "random-token","Enforce a random token"},
@@ -191,6 +214,7 @@ static struct option_desc optdefs[] = {
 #endif
 	{ADD_WS_CLIENT,       1, "ws-client",   "Bind to an afb service through websocket"},
 	{ADD_WS_SERVICE,      1, "ws-server",   "Provide an afb service through websockets"},
+	{SET_WS_BACKLOG,      1, "ws-backlog",  "Backlog of the listening sockets of ws servers [default " d2s(DEFAULT_WS_BACKLOG) "]"},
 
 	{ADD_AUTO_API,        1, "auto-api",    "Automatic load of api of the given directory"},
 
@@ -239,7 +263,9 @@ static const struct {
 	{ SET_API_TIMEOUT,	DEFAULT_API_TIMEOUT },
 	{ SET_CACHE_TIMEOUT,	DEFAULT_CACHE_TIMEOUT },
 	{ SET_SESSION_TIMEOUT,	DEFAULT_SESSION_TIMEOUT },
-	{ SET_SESSIONMAX,	DEFAULT_MAX_SESSION_COUNT }
+	{ SET_SESSIONMAX,	DEFAULT_MAX_SESSION_COUNT },
+	{ SET_WS_BACKLOG,	DEFAULT_WS_BACKLOG },
+	{ SET_HTTP_THREADS,	DEFAULT_HTTP_THREADS }
 };
 
 static const struct {
@@ -778,10 +804,19 @@ static void parse_arguments_inner(int argc, char **argv, struct json_object *con
 			config_set_optint(config, optid, 0, INT_MAX);
 			break;
 
+		case SET_HTTP_THREADS:
+			config_set_optint(config, optid, 0, 1024);
+			break;
+
 		case SET_SESSIONMAX:
+		case SET_WS_BACKLOG:
 			config_set_optint(config, optid, 1, INT_MAX);
 			break;
 
+		case SET_LOG_RATELIMIT:
+			config_set_optint(config, optid, 0, INT_MAX);
+			break;
+
 		case SET_ROOT_DIR:
 		case SET_ROOT_HTTP:
 		case SET_ROOT_BASE:
@@ -790,6 +825,7 @@ static void parse_arguments_inner(int argc, char **argv, struct json_object *con
 		case SET_UPLOAD_DIR:
 		case SET_WORK_DIR:
 		case SET_NAME:
+		case SET_BINDING_CACHE:
 			config_set_optstr(config, optid);
 			break;
 
@@ -800,6 +836,7 @@ static void parse_arguments_inner(int argc, char **argv, struct json_object *con
 		case ADD_ALIAS:
 		case ADD_LDPATH:
 		case ADD_WEAK_LDPATH:
+		case ADD_LAZY_LDPATH:
 		case ADD_CALL:
 		case ADD_WS_CLIENT:
 		case ADD_WS_SERVICE:
@@ -831,6 +868,8 @@ static void parse_arguments_inner(int argc, char **argv, struct json_object *con
 			break;
 
 		case SET_TRAP_FAULTS:
+		case SET_LOG_ASYNC:
+		case SET_PARALLEL_INIT:
 			config_set_bool(config, optid, get_arg_bool(optid));
 			break;
 
@@ -949,7 +988,8 @@ static void fulfill_config(struct json_object *config)
 	if (config_has_bool(config, SET_RANDOM_TOKEN))
 		config_del(config, SET_TOKEN);
 
-	if (!config_has(config, ADD_LDPATH) && !config_has(config, ADD_WEAK_LDPATH) && !config_has_bool(config, SET_NO_LDPATH))
+	if (!config_has(config, ADD_LDPATH) && !config_has(config, ADD_WEAK_LDPATH)
+	 && !config_has(config, ADD_LAZY_LDPATH) && !config_has_bool(config, SET_NO_LDPATH))
 		config_add_str(config, ADD_LDPATH, BINDING_INSTALL_DIR);
 
 #if defined(WITH_MONITORING_OPTION)
@@ -1015,6 +1055,8 @@ static void parse_environment(struct json_object *config)
 	on_environment_enum(config, SET_TRACESVC, "AFB_TRACESVC", afb_hook_flags_legacy_svc_from_text);
 #endif
 	on_environment_bool(config, SET_TRAP_FAULTS, "AFB_TRAP_FAULTS");
+	on_environment_bool(config, SET_LOG_ASYNC, "AFB_LOG_ASYNC");
+	on_environment_bool(config, SET_PARALLEL_INIT, "AFB_PARALLEL_INIT");
 }
 
 struct json_object *afb_config_parse_arguments(int argc, char **argv)
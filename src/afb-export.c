@@ -271,7 +271,9 @@ static void vverbose_cb(struct afb_api_x3 *closure, int level, const char *file,
 	char *p;
 	struct afb_export *export = from_api_x3(closure);
 
-	if (!fmt || vasprintf(&p, fmt, args) < 0)
+	if (fmt && !strchr(fmt, '%'))
+		verbose(level, file, line, function, (verbose_is_colorized() == 0 ? "[API %s] %s" : COLOR_API "[API %s]" COLOR_DEFAULT " %s"), export->api.apiname, fmt);
+	else if (!fmt || vasprintf(&p, fmt, args) < 0)
 		vverbose(level, file, line, function, fmt, args);
 	else {
 		verbose(level, file, line, function, (verbose_is_colorized() == 0 ? "[API %s] %s" : COLOR_API "[API %s]" COLOR_DEFAULT " %s"), export->api.apiname, p);
@@ -943,6 +945,32 @@ static struct json_object *settings_cb(struct afb_api_x3 *api)
 	return result;
 }
 
+static int api_set_verb_cache_cb(
+		struct afb_api_x3 *api,
+		const char *verb,
+		uint32_t ttl,
+		int session)
+{
+	struct afb_export *export = from_api_x3(api);
+
+	if (!export->unsealed) {
+		errno = EPERM;
+		return -1;
+	}
+
+	return afb_api_v3_set_verb_cache(export->desc.v3, verb, ttl, session);
+}
+
+static void api_invalidate_cache_cb(
+		struct afb_api_x3 *api,
+		const char *verb)
+{
+	struct afb_export *export = from_api_x3(api);
+
+	if (export->version == Api_Version_3)
+		afb_api_v3_invalidate_cache(export->desc.v3, verb);
+}
+
 static int hooked_api_set_verbs_v2_cb(
 		struct afb_api_x3 *api,
 		const struct afb_verb_v2 *verbs)
@@ -1103,6 +1131,9 @@ static const struct afb_api_x3_itf api_x3_itf = {
 
 	.delete_api = delete_api_cb,
 	.settings = settings_cb,
+
+	.api_set_verb_cache = api_set_verb_cache_cb,
+	.api_invalidate_cache = api_invalidate_cache_cb,
 };
 
 static const struct afb_api_x3_itf hooked_api_x3_itf = {
@@ -1144,6 +1175,9 @@ static const struct afb_api_x3_itf hooked_api_x3_itf = {
 
 	.delete_api = hooked_delete_api_cb,
 	.settings = hooked_settings_cb,
+
+	.api_set_verb_cache = api_set_verb_cache_cb,
+	.api_invalidate_cache = api_invalidate_cache_cb,
 };
 
 /******************************************************************************
@@ -1594,6 +1628,11 @@ void afb_export_logmask_set(struct afb_export *export, int mask)
 	}
 }
 
+int afb_export_set_priority(struct afb_export *export, int priority)
+{
+	return afb_apiset_set_priority(export->declare_set, export->api.apiname, priority);
+}
+
 void *afb_export_userdata_get(const struct afb_export *export)
 {
 	return export->api.userdata;
@@ -1739,6 +1778,17 @@ static void api_call_cb(void *closure, struct afb_xreq *xreq)
 	}
 }
 
+static int api_call_cached_cb(void *closure, struct afb_xreq *xreq)
+{
+	struct afb_export *export = closure;
+
+	if (export->version != Api_Version_3)
+		return 0;
+
+	xreq->request.api = to_api_x3(export);
+	return afb_api_v3_process_cached(export->desc.v3, xreq);
+}
+
 static struct json_object *api_describe_cb(void *closure)
 {
 	struct afb_export *export = closure;
@@ -1806,7 +1856,8 @@ static struct afb_api_itf export_api_itf =
 	.get_logmask = api_get_logmask_cb,
 	.set_logmask = api_set_logmask_cb,
 	.describe = api_describe_cb,
-	.unref = api_unref_cb
+	.unref = api_unref_cb,
+	.call_cached = api_call_cached_cb
 };
 
 int afb_export_declare(struct afb_export *export,
@@ -1822,6 +1873,7 @@ int afb_export_declare(struct afb_export *export,
 		afb_api.closure = afb_export_addref(export);
 		afb_api.itf = &export_api_itf;
 		afb_api.group = noconcurrency ? export : NULL;
+		afb_api.priority = JOBS_PRIORITY_NORMAL;
 
 		/* records the binding */
 		rc = afb_apiset_add(export->declare_set, export->api.apiname, afb_api);
@@ -93,6 +93,7 @@ extern int afb_export_start(struct afb_export *export);
 
 extern int afb_export_logmask_get(const struct afb_export *export);
 extern void afb_export_logmask_set(struct afb_export *export, int mask);
+extern int afb_export_set_priority(struct afb_export *export, int priority);
 
 extern void *afb_export_userdata_get(const struct afb_export *export);
 extern void afb_export_userdata_set(struct afb_export *export, void *data);
@@ -19,10 +19,14 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #include <microhttpd.h>
@@ -44,6 +48,11 @@
 #include "afb-cred.h"
 #include "verbose.h"
 #include "locale-root.h"
+#include "http-cond.h"
+
+#if !defined(MHD_HTTP_RANGE_NOT_SATISFIABLE)
+#define MHD_HTTP_RANGE_NOT_SATISFIABLE MHD_HTTP_REQUESTED_RANGE_NOT_SATISFIABLE
+#endif
 
 #define SIZE_RESPONSE_BUFFER   8192
 
@@ -78,12 +87,14 @@ struct hreq_data {
 static struct json_object *req_json(struct afb_xreq *xreq);
 static struct afb_arg req_get(struct afb_xreq *xreq, const char *name);
 static void req_reply(struct afb_xreq *xreq, struct json_object *object, const char *error, const char *info);
+static void req_reply_buffer(struct afb_xreq *xreq, const char *buffer, size_t size, const char *error, const char *info);
 static void req_destroy(struct afb_xreq *xreq);
 
 const struct afb_xreq_query_itf afb_hreq_xreq_query_itf = {
 	.json = req_json,
 	.get = req_get,
 	.reply = req_reply,
+	.reply_buffer = req_reply_buffer,
 	.unref = req_destroy
 };
 
@@ -153,8 +164,10 @@ static void afb_hreq_reply_v(struct afb_hreq *hreq, unsigned status, struct MHD_
 	char *cookie;
 	const char *k, *v;
 
-	if (hreq->replied != 0)
+	if (hreq->replied != 0) {
+		MHD_destroy_response(response);
 		return;
+	}
 
 	k = va_arg(args, const char *);
 	while (k != NULL) {
@@ -167,17 +180,59 @@ static void afb_hreq_reply_v(struct afb_hreq *hreq, unsigned status, struct MHD_
 		MHD_add_response_header(response, MHD_HTTP_HEADER_SET_COOKIE, cookie);
 		free(cookie);
 	}
-	MHD_queue_response(hreq->connection, status, response);
-	MHD_destroy_response(response);
 
+	/*
+	 * The response can only be queued while the access handler runs
+	 * or when the connection is suspended. Replies that occur while the
+	 * access handler runs, possibly from an other thread, are recorded
+	 * and queued by afb_hreq_end_access.
+	 */
+	pthread_mutex_lock(&hreq->mutex);
+	if (hreq->replied != 0) {
+		pthread_mutex_unlock(&hreq->mutex);
+		MHD_destroy_response(response);
+		return;
+	}
 	hreq->replied = 1;
-	if (hreq->suspended != 0) {
-		MHD_resume_connection (hreq->connection);
+	if (hreq->suspended == 0) {
+		hreq->status = status;
+		hreq->response = response;
+		pthread_mutex_unlock(&hreq->mutex);
+	} else {
+		MHD_queue_response(hreq->connection, status, response);
+		MHD_destroy_response(response);
 		hreq->suspended = 0;
+		pthread_mutex_unlock(&hreq->mutex);
+		MHD_resume_connection(hreq->connection);
 		afb_hsrv_run(hreq->hsrv);
 	}
 }
 
+/*
+ * Called at the end of each call to the access handler of 'hreq':
+ * queues the recorded response or suspends the connection if the
+ * request is processed but not yet replied.
+ */
+void afb_hreq_end_access(struct afb_hreq *hreq)
+{
+	struct MHD_Response *response;
+
+	pthread_mutex_lock(&hreq->mutex);
+	response = hreq->response;
+	if (response != NULL) {
+		hreq->response = NULL;
+		pthread_mutex_unlock(&hreq->mutex);
+		MHD_queue_response(hreq->connection, hreq->status, response);
+		MHD_destroy_response(response);
+	} else {
+		if (hreq->scanned != 0 && hreq->replied == 0 && hreq->suspended == 0) {
+			MHD_suspend_connection(hreq->connection);
+			hreq->suspended = 1;
+		}
+		pthread_mutex_unlock(&hreq->mutex);
+	}
+}
+
 void afb_hreq_reply(struct afb_hreq *hreq, unsigned status, struct MHD_Response *response, ...)
 {
 	va_list args;
@@ -319,6 +374,8 @@ static void req_destroy(struct afb_xreq *xreq)
 	struct afb_hreq *hreq = CONTAINER_OF_XREQ(struct afb_hreq, xreq);
 	struct hreq_data *data;
 
+	if (hreq->response != NULL)
+		MHD_destroy_response(hreq->response);
 	if (hreq->postform != NULL)
 		MHD_destroy_post_processor(hreq->postform);
 	if (hreq->tokener != NULL)
@@ -339,6 +396,7 @@ static void req_destroy(struct afb_xreq *xreq)
 	free((char*)hreq->xreq.request.called_api);
 	free((char*)hreq->xreq.request.called_verb);
 	afb_cred_unref(hreq->xreq.cred);
+	pthread_mutex_destroy(&hreq->mutex);
 	free(hreq);
 }
 
@@ -402,16 +460,100 @@ int afb_hreq_redirect_to_ending_slash_if_needed(struct afb_hreq *hreq)
 	return 1;
 }
 
-int afb_hreq_reply_file_if_exist(struct afb_hreq *hreq, int dirfd, const char *filename)
+/*
+ * Replies the content of the regular file 'fd' of status 'st' named 'filename'.
+ * Handles the conditional requests and the requests of a single range.
+ * The file 'fd' is consumed.
+ */
+static int reply_regular_file(struct afb_hreq *hreq, int fd, struct stat *st, const char *filename)
 {
-	int rc;
-	int fd;
 	unsigned int status;
-	struct stat st;
 	char etag[1 + 2 * 8];
-	const char *inm;
+	char lastmod[40];
+	char contrange[80];
+	const char *inm, *ims, *range, *ifrange;
 	struct MHD_Response *response;
 	const char *mimetype;
+	off_t first, last;
+	int rc;
+
+	/* Check the method */
+	if ((hreq->method & (afb_method_get | afb_method_head)) == 0) {
+		close(fd);
+		afb_hreq_reply_error(hreq, MHD_HTTP_METHOD_NOT_ALLOWED);
+		return 1;
+	}
+
+	/* computes the etag and the date of last modification */
+	sprintf(etag, "%08X%08X", ((int)(st->st_mtim.tv_sec) ^ (int)(st->st_mtim.tv_nsec)), (int)(st->st_size));
+	http_cond_date(lastmod, sizeof lastmod, st->st_mtim.tv_sec);
+
+	/* checks the etag or else the date */
+	inm = MHD_lookup_connection_value(hreq->connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
+	ims = inm ? NULL : MHD_lookup_connection_value(hreq->connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_MODIFIED_SINCE);
+	if ((inm && 0 == strcmp(inm, etag)) || (ims && http_cond_not_modified_since(ims, st->st_mtim.tv_sec))) {
+		/* etag or date ok, return NOT MODIFIED */
+		close(fd);
+		DEBUG("Not Modified: [%s]", filename);
+		response = MHD_create_response_from_buffer(0, empty_string, MHD_RESPMEM_PERSISTENT);
+		status = MHD_HTTP_NOT_MODIFIED;
+	} else {
+		/* check the size */
+		if (st->st_size != (off_t) (size_t) st->st_size) {
+			close(fd);
+			afb_hreq_reply_error(hreq, MHD_HTTP_INTERNAL_SERVER_ERROR);
+			return 1;
+		}
+
+		/* checks the range, ignored if the file changed */
+		range = MHD_lookup_connection_value(hreq->connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_RANGE);
+		ifrange = range ? MHD_lookup_connection_value(hreq->connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_RANGE) : NULL;
+		rc = http_cond_range(range, ifrange, etag, lastmod, st->st_size, &first, &last);
+
+		if (rc < 0) {
+			/* out of the file */
+			close(fd);
+			DEBUG("Range Not Satisfiable: [%s] %s", filename, range);
+			snprintf(contrange, sizeof contrange, "bytes */%lld", (long long)st->st_size);
+			afb_hreq_reply_empty(hreq, MHD_HTTP_RANGE_NOT_SATISFIABLE,
+					MHD_HTTP_HEADER_CONTENT_RANGE, contrange,
+					NULL);
+			return 1;
+		}
+
+		/* create the response */
+		if (rc > 0) {
+			response = MHD_create_response_from_fd_at_offset64((uint64_t)(last - first + 1), fd, (uint64_t)first);
+			status = MHD_HTTP_PARTIAL_CONTENT;
+			snprintf(contrange, sizeof contrange, "bytes %lld-%lld/%lld",
+					(long long)first, (long long)last, (long long)st->st_size);
+			MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_RANGE, contrange);
+		} else {
+			response = MHD_create_response_from_fd((size_t) st->st_size, fd);
+			status = MHD_HTTP_OK;
+		}
+		MHD_add_response_header(response, MHD_HTTP_HEADER_ACCEPT_RANGES, "bytes");
+
+		/* set the type */
+		mimetype = mimetype_fd_name(fd, filename);
+		if (mimetype != NULL)
+			MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, mimetype);
+	}
+
+	/* fills the value and send */
+	afb_hreq_reply(hreq, status, response,
+			MHD_HTTP_HEADER_CACHE_CONTROL, hreq->cacheTimeout,
+			MHD_HTTP_HEADER_ETAG, etag,
+			MHD_HTTP_HEADER_LAST_MODIFIED, lastmod,
+			NULL);
+	return 1;
+}
+
+int afb_hreq_reply_file_if_exist(struct afb_hreq *hreq, int dirfd, const char *filename)
+{
+	int rc;
+	int fd;
+	struct stat st;
 
 	/* Opens the file or directory */
 	if (filename[0]) {
@@ -462,48 +604,7 @@ int afb_hreq_reply_file_if_exist(struct afb_hreq *hreq, int dirfd, const char *f
 		return 1;
 	}
 
-	/* Check the method */
-	if ((hreq->method & (afb_method_get | afb_method_head)) == 0) {
-		close(fd);
-		afb_hreq_reply_error(hreq, MHD_HTTP_METHOD_NOT_ALLOWED);
-		return 1;
-	}
-
-	/* computes the etag */
-	sprintf(etag, "%08X%08X", ((int)(st.st_mtim.tv_sec) ^ (int)(st.st_mtim.tv_nsec)), (int)(st.st_size));
-
-	/* checks the etag */
-	inm = MHD_lookup_connection_value(hreq->connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
-	if (inm && 0 == strcmp(inm, etag)) {
-		/* etag ok, return NOT MODIFIED */
-		close(fd);
-		DEBUG("Not Modified: [%s]", filename);
-		response = MHD_create_response_from_buffer(0, empty_string, MHD_RESPMEM_PERSISTENT);
-		status = MHD_HTTP_NOT_MODIFIED;
-	} else {
-		/* check the size */
-		if (st.st_size != (off_t) (size_t) st.st_size) {
-			close(fd);
-			afb_hreq_reply_error(hreq, MHD_HTTP_INTERNAL_SERVER_ERROR);
-			return 1;
-		}
-
-		/* create the response */
-		response = MHD_create_response_from_fd((size_t) st.st_size, fd);
-		status = MHD_HTTP_OK;
-
-		/* set the type */
-		mimetype = mimetype_fd_name(fd, filename);
-		if (mimetype != NULL)
-			MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, mimetype);
-	}
-
-	/* fills the value and send */
-	afb_hreq_reply(hreq, status, response,
-			MHD_HTTP_HEADER_CACHE_CONTROL, hreq->cacheTimeout,
-			MHD_HTTP_HEADER_ETAG, etag,
-			NULL);
-	return 1;
+	return reply_regular_file(hreq, fd, &st, filename);
 }
 
 int afb_hreq_reply_file(struct afb_hreq *hreq, int dirfd, const char *filename)
@@ -518,12 +619,7 @@ int afb_hreq_reply_locale_file_if_exist(struct afb_hreq *hreq, struct locale_sea
 {
 	int rc;
 	int fd;
-	unsigned int status;
 	struct stat st;
-	char etag[1 + 2 * 8];
-	const char *inm;
-	struct MHD_Response *response;
-	const char *mimetype;
 
 	/* Opens the file or directory */
 	fd = locale_search_open(search, filename[0] ? filename : ".", O_RDONLY);
@@ -568,48 +664,7 @@ int afb_hreq_reply_locale_file_if_exist(struct afb_hreq *hreq, struct locale_sea
 		return 1;
 	}
 
-	/* Check the method */
-	if ((hreq->method & (afb_method_get | afb_method_head)) == 0) {
-		close(fd);
-		afb_hreq_reply_error(hreq, MHD_HTTP_METHOD_NOT_ALLOWED);
-		return 1;
-	}
-
-	/* computes the etag */
-	sprintf(etag, "%08X%08X", ((int)(st.st_mtim.tv_sec) ^ (int)(st.st_mtim.tv_nsec)), (int)(st.st_size));
-
-	/* checks the etag */
-	inm = MHD_lookup_connection_value(hreq->connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
-	if (inm && 0 == strcmp(inm, etag)) {
-		/* etag ok, return NOT MODIFIED */
-		close(fd);
-		DEBUG("Not Modified: [%s]", filename);
-		response = MHD_create_response_from_buffer(0, empty_string, MHD_RESPMEM_PERSISTENT);
-		status = MHD_HTTP_NOT_MODIFIED;
-	} else {
-		/* check the size */
-		if (st.st_size != (off_t) (size_t) st.st_size) {
-			close(fd);
-			afb_hreq_reply_error(hreq, MHD_HTTP_INTERNAL_SERVER_ERROR);
-			return 1;
-		}
-
-		/* create the response */
-		response = MHD_create_response_from_fd((size_t) st.st_size, fd);
-		status = MHD_HTTP_OK;
-
-		/* set the type */
-		mimetype = mimetype_fd_name(fd, filename);
-		if (mimetype != NULL)
-			MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, mimetype);
-	}
-
-	/* fills the value and send */
-	afb_hreq_reply(hreq, status, response,
-			MHD_HTTP_HEADER_CACHE_CONTROL, hreq->cacheTimeout,
-			MHD_HTTP_HEADER_ETAG, etag,
-			NULL);
-	return 1;
+	return reply_regular_file(hreq, fd, &st, filename);
 }
 
 int afb_hreq_reply_locale_file(struct afb_hreq *hreq, struct locale_search *search, const char *filename)
@@ -904,6 +959,17 @@ static ssize_t send_json_cb(json_object *obj, uint64_t pos, char *buf, size_t ma
 	return len ? : (ssize_t)MHD_CONTENT_READER_END_OF_STREAM;
 }
 
+/* get the req id given by the client or NULL */
+static const char *req_reqid(struct afb_hreq *hreq)
+{
+	const char *reqid;
+
+	reqid = afb_hreq_get_argument(hreq, long_key_for_reqid);
+	if (reqid == NULL)
+		reqid = afb_hreq_get_argument(hreq, short_key_for_reqid);
+	return reqid;
+}
+
 static void req_reply(struct afb_xreq *xreq, struct json_object *object, const char *error, const char *info)
 {
 	struct afb_hreq *hreq = CONTAINER_OF_XREQ(struct afb_hreq, xreq);
@@ -915,9 +981,7 @@ static void req_reply(struct afb_xreq *xreq, struct json_object *object, const c
 	reply = afb_msg_json_reply(object, error, info, &xreq->context);
 
 	/* append the req id on need */
-	reqid = afb_hreq_get_argument(hreq, long_key_for_reqid);
-	if (reqid == NULL)
-		reqid = afb_hreq_get_argument(hreq, short_key_for_reqid);
+	reqid = req_reqid(hreq);
 	if (reqid != NULL && json_object_object_get_ex(reply, "request", &sub))
 		json_object_object_add(sub, "reqid", json_object_new_string(reqid));
 
@@ -925,6 +989,30 @@ static void req_reply(struct afb_xreq *xreq, struct json_object *object, const c
 	afb_hreq_reply(hreq, MHD_HTTP_OK, response, NULL);
 }
 
+static void req_reply_buffer(struct afb_xreq *xreq, const char *buffer, size_t size, const char *error, const char *info)
+{
+	struct afb_hreq *hreq = CONTAINER_OF_XREQ(struct afb_hreq, xreq);
+	char *head, *text;
+	size_t length;
+	struct MHD_Response *response;
+
+	/* splice the buffer in the reply */
+	head = afb_msg_json_reply_head(error, info, &xreq->context, req_reqid(hreq), 1, &length);
+	text = head == NULL ? NULL : realloc(head, length + size + 1);
+	if (text == NULL) {
+		free(head);
+		ERROR("out of memory");
+		afb_hreq_reply_error(hreq, MHD_HTTP_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	memcpy(&text[length], buffer, size);
+	length += size;
+	text[length++] = '}';
+
+	response = MHD_create_response_from_buffer(length, text, MHD_RESPMEM_MUST_FREE);
+	afb_hreq_reply(hreq, MHD_HTTP_OK, response, NULL);
+}
+
 void afb_hreq_call(struct afb_hreq *hreq, struct afb_apiset *apiset, const char *api, size_t lenapi, const char *verb, size_t lenverb)
 {
 	hreq->xreq.request.called_api = strndup(api, lenapi);
@@ -996,7 +1084,8 @@ struct afb_hreq *afb_hreq_create()
 	if (hreq) {
 		/* init the request */
 		afb_xreq_init(&hreq->xreq, &afb_hreq_xreq_query_itf);
-		hreq->reqid = ++global_reqids;
+		pthread_mutex_init(&hreq->mutex, NULL);
+		hreq->reqid = __atomic_add_fetch(&global_reqids, 1, __ATOMIC_RELAXED);
 	}
 	return hreq;
 }
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <pthread.h>
+
 #include "afb-xreq.h"
 
 struct json_object;
@@ -35,8 +37,11 @@ struct afb_hreq {
 	int method;
 	int reqid;
 	int scanned;
+	pthread_mutex_t mutex;	/* protects suspended, replied and response */
 	int suspended;
 	int replied;
+	unsigned status;
+	struct MHD_Response *response;
 	const char *version;
 	const char *lang;
 	const char *url;
@@ -55,6 +60,8 @@ extern int afb_hreq_valid_tail(struct afb_hreq *request);
 
 extern void afb_hreq_reply_error(struct afb_hreq *request, unsigned int status);
 
+extern void afb_hreq_end_access(struct afb_hreq *hreq);
+
 extern int afb_hreq_reply_file_if_exist(struct afb_hreq *request, int dirfd, const char *filename);
 
 extern int afb_hreq_reply_file(struct afb_hreq *request, int dirfd, const char *filename);
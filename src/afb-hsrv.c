@@ -70,6 +70,7 @@ struct afb_hsrv {
 	struct MHD_Daemon *httpd;
 	struct fdev *fdev;
 	char *cache_to;
+	int threads;
 };
 
 static void reply_error(struct MHD_Connection *connection, unsigned int status)
@@ -96,7 +97,7 @@ static int postproc(void *cls,
 		return afb_hreq_post_add(hreq, key, data, size);
 }
 
-static int access_handler(
+static int access_request(
 		void *cls,
 		struct MHD_Connection *connection,
 		const char *url,
@@ -213,26 +214,16 @@ static int access_handler(
 		hreq->tokener = NULL;
 	}
 
-	if (hreq->scanned != 0) {
-		if (hreq->replied == 0 && hreq->suspended == 0) {
-			MHD_suspend_connection (connection);
-			hreq->suspended = 1;
-		}
+	if (hreq->scanned != 0)
 		return MHD_YES;
-	}
 
 	/* search an handler for the request */
 	hreq->scanned = 1;
 	iter = hsrv->handlers;
 	while (iter) {
 		if (afb_hreq_unprefix(hreq, iter->prefix, iter->length)) {
-			if (iter->handler(hreq, iter->data)) {
-				if (hreq->replied == 0 && hreq->suspended == 0) {
-					MHD_suspend_connection (connection);
-					hreq->suspended = 1;
-				}
+			if (iter->handler(hreq, iter->data))
 				return MHD_YES;
-			}
 			hreq->tail = hreq->url;
 			hreq->lentail = hreq->lenurl;
 		}
@@ -245,6 +236,24 @@ static int access_handler(
 	return MHD_YES;
 }
 
+static int access_handler(
+		void *cls,
+		struct MHD_Connection *connection,
+		const char *url,
+		const char *methodstr,
+		const char *version,
+		const char *upload_data,
+		size_t *upload_data_size,
+		void **recordreq)
+{
+	int rc;
+
+	rc = access_request(cls, connection, url, methodstr, version, upload_data, upload_data_size, recordreq);
+	if (*recordreq != NULL)
+		afb_hreq_end_access(*recordreq);
+	return rc;
+}
+
 /* Because of POST call multiple time requestApi we need to free POST handle here */
 static void end_handler(void *cls, struct MHD_Connection *connection, void **recordreq,
 			enum MHD_RequestTerminationCode toe)
@@ -270,6 +279,9 @@ static void do_run(int signum, void *arg)
 
 void afb_hsrv_run(struct afb_hsrv *hsrv)
 {
+	/* when threads of the daemon are running it, there is nothing to do */
+	if (hsrv->fdev == NULL)
+		return;
 	fdev_set_events(hsrv->fdev, 0);
 	if (jobs_queue(hsrv, 0, do_run, hsrv) < 0)
 		do_run(0, hsrv);
@@ -413,12 +425,52 @@ int afb_hsrv_set_cache_timeout(struct afb_hsrv *hsrv, int duration)
 	return 1;
 }
 
+int afb_hsrv_set_threads(struct afb_hsrv *hsrv, int count)
+{
+	if (count < 0 || hsrv->httpd != NULL)
+		return 0;
+
+	hsrv->threads = count;
+	return 1;
+}
+
+/*
+ * Starts the daemon with its own pool of threads. The connections
+ * are spread over the threads, each of them parsing the requests of
+ * its connections.
+ */
+static int start_threads(struct afb_hsrv *hsrv, uint16_t port, unsigned int connection_timeout)
+{
+	struct MHD_Daemon *httpd;
+
+	httpd = MHD_start_daemon(
+		MHD_USE_EPOLL | MHD_USE_INTERNAL_POLLING_THREAD | MHD_ALLOW_UPGRADE | MHD_USE_TCP_FASTOPEN | MHD_USE_DEBUG | MHD_ALLOW_SUSPEND_RESUME,
+		port,				/* port */
+		new_client_handler, NULL,	/* Tcp Accept call back + extra attribute */
+		access_handler, hsrv,	/* Http Request Call back + extra attribute */
+		MHD_OPTION_NOTIFY_COMPLETED, end_handler, hsrv,
+		MHD_OPTION_CONNECTION_TIMEOUT, connection_timeout,
+		MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)hsrv->threads,
+		MHD_OPTION_END);	/* options-end */
+
+	if (httpd == NULL) {
+		ERROR("httpStart invalid httpd port: %d", (int)port);
+		return 0;
+	}
+
+	hsrv->httpd = httpd;
+	return 1;
+}
+
 int afb_hsrv_start(struct afb_hsrv *hsrv, uint16_t port, unsigned int connection_timeout)
 {
 	struct fdev *fdev;
 	struct MHD_Daemon *httpd;
 	const union MHD_DaemonInfo *info;
 
+	if (hsrv->threads > 0)
+		return start_threads(hsrv, port, connection_timeout);
+
 	httpd = MHD_start_daemon(
 		MHD_USE_EPOLL | MHD_ALLOW_UPGRADE | MHD_USE_TCP_FASTOPEN | MHD_USE_DEBUG | MHD_ALLOW_SUSPEND_RESUME,
 		port,				/* port */
@@ -28,6 +28,7 @@ extern void afb_hsrv_put(struct afb_hsrv *hsrv);
 extern void afb_hsrv_stop(struct afb_hsrv *hsrv);
 extern int afb_hsrv_start(struct afb_hsrv *hsrv, uint16_t port, unsigned int connection_timeout);
 extern int afb_hsrv_set_cache_timeout(struct afb_hsrv *hsrv, int duration);
+extern int afb_hsrv_set_threads(struct afb_hsrv *hsrv, int count);
 extern int afb_hsrv_add_alias(struct afb_hsrv *hsrv, const char *prefix, int dirfd, const char *alias, int priority, int relax);
 extern int afb_hsrv_add_alias_root(struct afb_hsrv *hsrv, const char *prefix, struct locale_root *root, int priority, int relax);
 extern int afb_hsrv_add_handler(struct afb_hsrv *hsrv, const char *prefix, int (*handler) (struct afb_hreq *, void *), void *data, int priority);
@@ -31,6 +31,7 @@
 #include "afb-xreq.h"
 #include "afb-trace.h"
 #include "afb-session.h"
+#include "jobs.h"
 #include "verbose.h"
 #include "wrap-json.h"
 
@@ -41,7 +42,9 @@ static struct afb_apiset *target_set;
 int afb_monitor_init(struct afb_apiset *declare_set, struct afb_apiset *call_set)
 {
 	target_set = call_set;
-	return -!afb_api_v3_from_binding(&_afb_binding_monitor, declare_set, call_set);
+	if (!afb_api_v3_from_binding(&_afb_binding_monitor, declare_set, call_set))
+		return -1;
+	return afb_apiset_set_priority(declare_set, _afb_binding_monitor.api, JOBS_PRIORITY_CRITICAL);
 }
 
 /******************************************************************************
@@ -291,12 +294,53 @@ static struct json_object *get_apis(struct json_object *spec)
 	return resu;
 }
 
+/******************************************************************************
+**** Monitoring jobs
+******************************************************************************/
+
+static const char *const priority_names[JOBS_PRIORITY_COUNT] = {
+	[JOBS_PRIORITY_NORMAL] = "normal",
+	[JOBS_PRIORITY_CRITICAL] = "critical",
+	[JOBS_PRIORITY_BULK] = "bulk"
+};
+
+/**
+ * get the statistics of the job queue for each priority
+ * @return the json object describing the statistics
+ */
+static struct json_object *get_jobs()
+{
+	int p;
+	uint64_t mean;
+	struct jobs_stats st;
+	struct json_object *resu, *item;
+
+	resu = json_object_new_object();
+	for (p = 0 ; p < JOBS_PRIORITY_COUNT ; p++) {
+		if (jobs_get_stats(p, &st) < 0)
+			continue;
+		mean = st.started ? st.wait_total_us / st.started : 0;
+		wrap_json_pack(&item, "{sI sI sI si si sI sI}",
+			"queued", (int64_t)st.queued,
+			"rejected", (int64_t)st.rejected,
+			"started", (int64_t)st.started,
+			"waiting", st.waiting,
+			"limit", st.limit,
+			"wait-mean-us", (int64_t)mean,
+			"wait-max-us", (int64_t)st.wait_max_us);
+		json_object_object_add(resu, priority_names[p], item);
+	}
+	return resu;
+}
+
 /******************************************************************************
 **** Implementation monitoring verbs
 ******************************************************************************/
 
 static const char _verbosity_[] = "verbosity";
 static const char _apis_[] = "apis";
+static const char _jobs_[] = "jobs";
+static const char _starts_[] = "starts";
 static const char _refresh_token_[] = "refresh-token";
 
 static void f_get(afb_req_t req)
@@ -304,14 +348,18 @@ static void f_get(afb_req_t req)
 	struct json_object *r;
 	struct json_object *apis = NULL;
 	struct json_object *verbosity = NULL;
+	struct json_object *jobs = NULL;
+	struct json_object *starts = NULL;
 
-	wrap_json_unpack(afb_req_json(req), "{s?:o,s?:o}", _verbosity_, &verbosity, _apis_, &apis);
+	wrap_json_unpack(afb_req_json(req), "{s?:o,s?:o,s?:o,s?:o}", _verbosity_, &verbosity, _apis_, &apis, _jobs_, &jobs, _starts_, &starts);
 	if (verbosity)
 		verbosity = get_verbosity(verbosity);
 	if (apis)
 		apis = get_apis(apis);
+	jobs = json_object_get_boolean(jobs) ? get_jobs() : NULL;
+	starts = json_object_get_boolean(starts) ? afb_apiset_get_start_report(target_set, 1) : NULL;
 
-	wrap_json_pack(&r, "{s:o*,s:o*}", _verbosity_, verbosity, _apis_, apis);
+	wrap_json_pack(&r, "{s:o*,s:o*,s:o*,s:o*}", _verbosity_, verbosity, _apis_, apis, _jobs_, jobs, _starts_, starts);
 	afb_req_success(req, r, NULL);
 }
 
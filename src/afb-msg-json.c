@@ -17,6 +17,9 @@
 
 #define _GNU_SOURCE
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <json-c/json.h>
 
 #include "afb-msg-json.h"
@@ -57,6 +60,98 @@ struct json_object *afb_msg_json_reply(struct json_object *resp, const char *err
 	return msg;
 }
 
+/* appends to 'dst' the JSON string of 'src' and returns the end of 'dst' */
+static char *put_string(char *dst, const char *src)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned char c;
+
+	*dst++ = '"';
+	while ((c = (unsigned char)*src++)) {
+		switch (c) {
+		case '"': *dst++ = '\\'; *dst++ = '"'; break;
+		case '\\': *dst++ = '\\'; *dst++ = '\\'; break;
+		case '\b': *dst++ = '\\'; *dst++ = 'b'; break;
+		case '\f': *dst++ = '\\'; *dst++ = 'f'; break;
+		case '\n': *dst++ = '\\'; *dst++ = 'n'; break;
+		case '\r': *dst++ = '\\'; *dst++ = 'r'; break;
+		case '\t': *dst++ = '\\'; *dst++ = 't'; break;
+		default:
+			if (c >= ' ')
+				*dst++ = (char)c;
+			else {
+				dst = stpcpy(dst, "\\u00");
+				*dst++ = hex[c >> 4];
+				*dst++ = hex[c & 15];
+			}
+			break;
+		}
+	}
+	*dst++ = '"';
+	return dst;
+}
+
+/* appends to 'dst' the field of 'name' and string 'value' if not NULL */
+static char *put_field(char *dst, const char *name, const char *value)
+{
+	if (value != NULL) {
+		*dst++ = ',';
+		dst = put_string(dst, name);
+		*dst++ = ':';
+		dst = put_string(dst, value);
+	}
+	return dst;
+}
+
+/* size needed by put_field */
+static size_t size_field(const char *name, const char *value)
+{
+	return value == NULL ? 0 : 6 + strlen(name) + 6 * strlen(value);
+}
+
+/*
+ * Creates the head of the text of a reply whose response is already
+ * serialized in JSON. When 'response' is not zero, the head ends with
+ * the key of the response and the complete reply is the head followed
+ * by the text of the response and a closing brace. Otherwise, the head
+ * is the complete reply. The optional 'reqid' is added to the
+ * description of the request.
+ * Returns the head to be freed by the caller, and its length in 'length',
+ * or NULL when out of memory.
+ */
+char *afb_msg_json_reply_head(const char *error, const char *info, struct afb_context *context, const char *reqid, int response, size_t *length)
+{
+	const char *token, *uuid;
+	char *head, *end;
+
+	if (context != NULL) {
+		token = afb_context_sent_token(context);
+		uuid = afb_context_sent_uuid(context);
+	} else {
+		token = uuid = NULL;
+	}
+	if (error == NULL)
+		error = _success_;
+
+	head = malloc(64 + 6 * strlen(error)
+			+ size_field("info", info)
+			+ size_field("token", token)
+			+ size_field("uuid", uuid)
+			+ size_field("reqid", reqid));
+	if (head == NULL)
+		return NULL;
+
+	end = stpcpy(head, "{\"jtype\":\"afb-reply\",\"request\":{\"status\":");
+	end = put_string(end, error);
+	end = put_field(end, "info", info);
+	end = put_field(end, "token", token);
+	end = put_field(end, "uuid", uuid);
+	end = put_field(end, "reqid", reqid);
+	end = stpcpy(end, response ? "},\"response\":" : "}}");
+	*length = (size_t)(end - head);
+	return head;
+}
+
 struct json_object *afb_msg_json_event(const char *event, struct json_object *object)
 {
 	json_object *msg;
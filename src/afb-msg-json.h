@@ -17,11 +17,15 @@
 
 #pragma once
 
+#include <stddef.h>
+
 struct json_object;
 struct afb_context;
 struct afb_arg;
 
 extern struct json_object *afb_msg_json_reply(struct json_object *resp, const char *status, const char *info, struct afb_context *context);
 
+extern char *afb_msg_json_reply_head(const char *status, const char *info, struct afb_context *context, const char *reqid, int response, size_t *length);
+
 extern struct json_object *afb_msg_json_event(const char *event, struct json_object *object);
 
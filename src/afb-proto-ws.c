@@ -33,9 +33,13 @@
 #include <json-c/json.h>
 
 #include "afb-ws.h"
+#include "afb-shm.h"
 #include "afb-msg-json.h"
 #include "afb-proto-ws.h"
+#include "cbor-json.h"
+#include "idmap.h"
 #include "jobs.h"
+#include "slab.h"
 #include "fdev.h"
 
 struct afb_proto_ws;
@@ -51,6 +55,10 @@ The client can require the following actions:
 
   - ask for description
 
+The calls and the descriptions can optionally name the api when the
+server serves many apis over the same connection. When the api isn't
+named, the default api of the server is used.
+
 The server must reply to the previous actions by
 
   - answering success or failure of the call
@@ -67,6 +75,28 @@ For the purpose of handling events the server can:
 
   - push or brodcast data as an event
 
+The client and the server can negotiate the version of the protocol:
+
+  - the client offers the versions it supports at connection
+
+  - the server answers with the version it selected
+
+Peers that don't know the negotiation ignore it and so stay in version 1.
+
+In version 1, the json objects are always transmitted as JSON strings.
+In version 2, the json objects can be transmitted encoded in CBOR.
+The encoding of each object is self described so that messages sent
+before the end of the negotiation are always understood.
+In version 3, the client can define handles of contexts, a context
+being a session identifier and optional user credentials. The calls
+can then designate their context by its handle instead of repeating
+the strings. The definition of a context is sent before any call using
+it and the server processes it in the order of reception. The client
+defines a handle again for an other context only when all the calls
+using it were replied.
+In version 4, the calls can be enclosed in a message giving their
+budget, the time in milliseconds remaining before their deadline.
+
 */
 /************** constants for protocol definition *************************/
 
@@ -80,6 +110,30 @@ For the purpose of handling events the server can:
 #define CHAR_FOR_EVT_UNSUBSCRIBE  'U'
 #define CHAR_FOR_DESCRIBE         'D'
 #define CHAR_FOR_DESCRIPTION      'd'
+#define CHAR_FOR_VERSION_OFFER    'V'
+#define CHAR_FOR_VERSION_SET      'v'
+#define CHAR_FOR_CONTEXT          'T'
+#define CHAR_FOR_CONTEXT_CALL     'K'
+#define CHAR_FOR_BUDGET           'B'
+
+/* identification of the protocol in version messages */
+#define WSAPI_IDENTIFIER          02723012011  /* wsapi: 23.19.1.16.9 */
+
+/* the known versions */
+#define WSAPI_VERSION_UNSET       0
+#define WSAPI_VERSION_1           1	/* objects are JSON strings */
+#define WSAPI_VERSION_2           2	/* objects can be CBOR encoded */
+#define WSAPI_VERSION_3           3	/* calls can use handles of contexts */
+#define WSAPI_VERSION_4           4	/* calls can have a time budget */
+
+#define WSAPI_VERSION_MIN         WSAPI_VERSION_1
+#define WSAPI_VERSION_MAX         WSAPI_VERSION_4
+
+/* maximum count of context handles defined by a client, recycled when reached */
+#define CLIENT_CONTEXT_MAX        256
+
+/* count of slots for hashing the contexts of a client, twice the maximum */
+#define CLIENT_CONTEXT_SLOTS      512
 
 /******************* handling calls *****************************/
 
@@ -87,9 +141,9 @@ For the purpose of handling events the server can:
  * structure for recording calls on client side
  */
 struct client_call {
-	struct client_call *next;	/* the next call */
 	struct afb_proto_ws *protows;	/* the proto_ws */
 	void *request;			/* the request closure */
+	struct client_context *context;	/* the context used or NULL */
 	uint32_t callid;		/* the message identifier */
 };
 
@@ -101,6 +155,7 @@ struct afb_proto_ws_call {
 	struct afb_proto_ws *protows;	/* the client of the request */
 	uint32_t refcount;		/* reference count */
 	uint32_t callid;		/* the incoming request callid */
+	uint32_t budget;		/* the time budget in ms or 0 */
 	char *buffer;			/* the incoming buffer */
 };
 
@@ -109,7 +164,6 @@ struct afb_proto_ws_call {
  */
 struct client_describe
 {
-	struct client_describe *next;
 	struct afb_proto_ws *protows;
 	void (*callback)(void*, struct json_object*);
 	void *closure;
@@ -125,6 +179,30 @@ struct afb_proto_ws_describe
 	uint32_t descid;
 };
 
+/*
+ * structure for recording contexts on client side
+ */
+struct client_context
+{
+	uint32_t handle;		/* the handle of the context */
+	uint32_t hash;			/* hash of the strings */
+	uint32_t pending;		/* count of calls waiting a reply */
+	uint32_t stamp;			/* stamp of the last use */
+	uint8_t ready;			/* is the definition sent? */
+	const char *user_creds;		/* the user credentials or NULL */
+	char sessionid[];		/* the session identifier */
+};
+
+/*
+ * structure for messages waiting to be written
+ */
+struct send_item
+{
+	struct send_item *next;
+	size_t length;
+	char data[];
+};
+
 /******************* proto description for client or servers ******************/
 
 struct afb_proto_ws
@@ -132,15 +210,27 @@ struct afb_proto_ws
 	/* count of references */
 	int refcount;
 
+	/* negotiated version of the protocol */
+	uint8_t version;
+
 	/* file descriptor */
 	struct fdev *fdev;
 
 	/* resource control */
 	pthread_mutex_t mutex;
 
+	/* serialisation of writes */
+	pthread_mutex_t wrmutex;
+
+	/* messages waiting to be written (protected by mutex) */
+	struct send_item *sendq_head, *sendq_tail;
+
 	/* websocket */
 	struct afb_ws *ws;
 
+	/* shared memory channel, used in place of the websocket when not NULL */
+	struct afb_shm *shm;
+
 	/* the client closure */
 	void *closure;
 
@@ -150,11 +240,20 @@ struct afb_proto_ws
 	/* the server side interface */
 	const struct afb_proto_ws_server_itf *server_itf;
 
-	/* emitted calls (client side) */
-	struct client_call *calls;
+	/* emitted calls (client side) indexed by callid */
+	struct idmap calls;
+
+	/* pending description (client side) indexed by descid */
+	struct idmap describes;
+
+	/* defined contexts (client side) hashed in CLIENT_CONTEXT_SLOTS */
+	struct client_context **contexts;
+	uint32_t context_count;
+	uint32_t context_stamp;
 
-	/* pending description (client side) */
-	struct client_describe *describes;
+	/* handles of contexts given back, at most CLIENT_CONTEXT_MAX */
+	uint32_t *context_handles;
+	uint32_t context_nhandles;
 
 	/* on hangup callback */
 	void (*on_hangup)(void *closure);
@@ -184,18 +283,6 @@ struct binary
 	struct readbuf rb;
 };
 
-/******************* common useful tools **********************************/
-
-/**
- * translate a pointer to some integer
- * @param ptr the pointer to translate
- * @return an integer
- */
-static inline uint32_t ptr2id(void *ptr)
-{
-	return (uint32_t)(((intptr_t)ptr) >> 6);
-}
-
 /******************* serialisation part **********************************/
 
 static char *readbuf_get(struct readbuf *rb, uint32_t length)
@@ -208,7 +295,6 @@ static char *readbuf_get(struct readbuf *rb, uint32_t length)
 	return before;
 }
 
-__attribute__((unused))
 static int readbuf_char(struct readbuf *rb, char *value)
 {
 	if (rb->head >= rb->end)
@@ -260,9 +346,22 @@ static int readbuf_nullstring(struct readbuf *rb, const char **value, size_t *le
 static int readbuf_object(struct readbuf *rb, struct json_object **object)
 {
 	const char *string;
+	uint32_t length;
 	struct json_object *o;
 	enum json_tokener_error jerr;
-	int rc = readbuf_string(rb, &string, NULL);
+	int rc;
+
+	/* a null length introduces an object encoded in CBOR */
+	if (!readbuf_uint32(rb, &length))
+		return 0;
+	if (length == 0)
+		return readbuf_uint32(rb, &length)
+			&& (string = readbuf_get(rb, length)) != NULL
+			&& cbor_json_decode(string, length, object) >= 0;
+
+	/* otherwise it is a JSON string */
+	rb->head -= sizeof length;
+	rc = readbuf_string(rb, &string, NULL);
 	if (rc) {
 		o = json_tokener_parse_verbose(string, &jerr);
 		if (jerr != json_tokener_success)
@@ -323,12 +422,245 @@ static int writebuf_nullstring(struct writebuf *wb, const char *value)
 	return value ? writebuf_string_length(wb, value, strlen(value)) : writebuf_uint32(wb, 0);
 }
 
-static int writebuf_object(struct writebuf *wb, struct json_object *object)
+/* writes the 'length' bytes of 'text' that are not terminated by a zero */
+static int writebuf_text(struct writebuf *wb, const char *text, size_t length)
+{
+	uint32_t len = (uint32_t)++length;
+	return (size_t)len == length && writebuf_uint32(wb, len) && writebuf_put(wb, text, length - 1) && writebuf_put(wb, "", 1);
+}
+
+/*
+ * Buffer for encoding objects in CBOR. There is at most one object per
+ * message and the messages are sent by the thread that builds them,
+ * so a buffer per thread is enough. It is released at the exit of its
+ * thread by the destructor of 'cbor_buffer_key' and after sending
+ * messages when it grew bigger than CBOR_BUFFER_MAX.
+ */
+#define CBOR_BUFFER_MAX	65536
+
+static _Thread_local struct cbor_json_buffer *cbor_buffer;
+static pthread_key_t cbor_buffer_key;
+static pthread_once_t cbor_buffer_once = PTHREAD_ONCE_INIT;
+
+static void cbor_buffer_destroy(void *buffer)
+{
+	cbor_json_buffer_release(buffer);
+	free(buffer);
+}
+
+static void cbor_buffer_init()
+{
+	pthread_key_create(&cbor_buffer_key, cbor_buffer_destroy);
+}
+
+/* get the buffer of the current thread */
+static struct cbor_json_buffer *cbor_buffer_get()
+{
+	struct cbor_json_buffer *buffer = cbor_buffer;
+
+	if (buffer == NULL) {
+		pthread_once(&cbor_buffer_once, cbor_buffer_init);
+		buffer = calloc(1, sizeof *buffer);
+		if (buffer != NULL && pthread_setspecific(cbor_buffer_key, buffer) != 0) {
+			free(buffer);
+			buffer = NULL;
+		}
+		cbor_buffer = buffer;
+	}
+	return buffer;
+}
+
+/* don't keep big buffers */
+static void cbor_buffer_shrink()
+{
+	struct cbor_json_buffer *buffer = cbor_buffer;
+
+	if (buffer != NULL && buffer->capacity > CBOR_BUFFER_MAX)
+		cbor_json_buffer_release(buffer);
+}
+
+static int writebuf_object(struct writebuf *wb, struct json_object *object, uint8_t version)
 {
-	const char *string = json_object_to_json_string_ext(object, JSON_C_TO_STRING_PLAIN);
+	struct cbor_json_buffer *buffer;
+	const char *string;
+
+	if (version >= WSAPI_VERSION_2) {
+		buffer = cbor_buffer_get();
+		return buffer != NULL
+			&& cbor_json_encode(buffer, object) >= 0
+			&& (size_t)(uint32_t)buffer->length == buffer->length
+			&& writebuf_uint32(wb, 0)
+			&& writebuf_uint32(wb, (uint32_t)buffer->length)
+			&& writebuf_put(wb, buffer->base, buffer->length);
+	}
+
+	string = json_object_to_json_string_ext(object, JSON_C_TO_STRING_PLAIN);
 	return string != NULL && writebuf_string(wb, string);
 }
 
+/******************* transport of messages *****************/
+
+static inline int transport_binary(struct afb_proto_ws *protows, const void *data, size_t length)
+{
+	return protows->shm ? afb_shm_binary(protows->shm, data, length) : afb_ws_binary(protows->ws, data, length);
+}
+
+static inline int transport_binary_v(struct afb_proto_ws *protows, const struct iovec *iovec, int count)
+{
+	return protows->shm ? afb_shm_binary_v(protows->shm, iovec, count) : afb_ws_binary_v(protows->ws, iovec, count);
+}
+
+static inline void transport_cork(struct afb_proto_ws *protows)
+{
+	if (protows->shm)
+		afb_shm_cork(protows->shm);
+	else
+		afb_ws_cork(protows->ws);
+}
+
+static inline int transport_uncork(struct afb_proto_ws *protows)
+{
+	return protows->shm ? afb_shm_uncork(protows->shm) : afb_ws_uncork(protows->ws);
+}
+
+/******************* sending of messages *****************/
+
+/* queue a copy of the message of 'wb' */
+static int send_queue_put(struct afb_proto_ws *protows, struct writebuf *wb)
+{
+	struct send_item *item;
+	size_t length;
+	char *data;
+	int i;
+
+	length = 0;
+	for (i = 0 ; i < wb->count ; i++)
+		length += wb->iovec[i].iov_len;
+
+	item = slab_alloc(sizeof *item + length);
+	if (item == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	item->next = NULL;
+	item->length = length;
+	data = item->data;
+	for (i = 0 ; i < wb->count ; i++)
+		data = mempcpy(data, wb->iovec[i].iov_base, wb->iovec[i].iov_len);
+
+	pthread_mutex_lock(&protows->mutex);
+	if (protows->sendq_tail)
+		protows->sendq_tail->next = item;
+	else
+		protows->sendq_head = item;
+	protows->sendq_tail = item;
+	pthread_mutex_unlock(&protows->mutex);
+	return 0;
+}
+
+/* writes the queued messages, wrmutex must be held */
+static void send_queue_write(struct afb_proto_ws *protows)
+{
+	struct send_item *item, *next;
+
+	pthread_mutex_lock(&protows->mutex);
+	item = protows->sendq_head;
+	protows->sendq_head = protows->sendq_tail = NULL;
+	pthread_mutex_unlock(&protows->mutex);
+
+	while (item) {
+		next = item->next;
+		transport_binary(protows, item->data, item->length);
+		slab_free(item, sizeof *item + item->length);
+		item = next;
+	}
+}
+
+/* is the queue of messages empty? */
+static int send_queue_is_empty(struct afb_proto_ws *protows)
+{
+	int result;
+
+	pthread_mutex_lock(&protows->mutex);
+	result = protows->sendq_head == NULL;
+	pthread_mutex_unlock(&protows->mutex);
+	return result;
+}
+
+/*
+ * Releases wrmutex. Because messages queued while it was held
+ * may have been seen too late, check the queue again and write it
+ * if no other thread got wrmutex.
+ */
+static void send_release(struct afb_proto_ws *protows)
+{
+	for (;;) {
+		pthread_mutex_unlock(&protows->wrmutex);
+		if (send_queue_is_empty(protows)
+		 || pthread_mutex_trylock(&protows->wrmutex) != 0)
+			return;
+		transport_cork(protows);
+		send_queue_write(protows);
+		transport_uncork(protows);
+	}
+}
+
+/*
+ * Sends the message of 'wb'.
+ *
+ * When an other thread is writing, the message is queued and the
+ * writing thread will write it with the other queued messages in
+ * one 'writev' when it ends its write. Otherwise, the message is
+ * written after the queued messages, the websocket being corked
+ * for writing them together.
+ *
+ * Returns 0 on success or -1 on error. Errors of writing
+ * queued messages are not reported.
+ */
+static int send_message(struct afb_proto_ws *protows, struct writebuf *wb)
+{
+	int rc;
+
+	if (pthread_mutex_trylock(&protows->wrmutex) != 0) {
+		if (send_queue_put(protows, wb) >= 0) {
+			if (pthread_mutex_trylock(&protows->wrmutex) == 0) {
+				transport_cork(protows);
+				send_queue_write(protows);
+				transport_uncork(protows);
+				send_release(protows);
+			}
+			cbor_buffer_shrink();
+			return 0;
+		}
+		pthread_mutex_lock(&protows->wrmutex);
+	}
+
+	if (send_queue_is_empty(protows))
+		rc = transport_binary_v(protows, wb->iovec, wb->count);
+	else {
+		transport_cork(protows);
+		send_queue_write(protows);
+		rc = transport_binary_v(protows, wb->iovec, wb->count);
+		if (transport_uncork(protows) < 0)
+			rc = -1;
+	}
+	send_release(protows);
+	cbor_buffer_shrink();
+	return rc < 0 ? -1 : 0;
+}
+
+/* drops the messages remaining in the queue */
+static void send_queue_drop(struct afb_proto_ws *protows)
+{
+	struct send_item *item;
+
+	while ((item = protows->sendq_head)) {
+		protows->sendq_head = item->next;
+		slab_free(item, sizeof *item + item->length);
+	}
+	protows->sendq_tail = NULL;
+}
+
 /******************* queuing of messages *****************/
 
 /* queue the processing of the received message (except if size=0 cause it's not a valid message) */
@@ -337,7 +669,7 @@ static void queue_message_processing(struct afb_proto_ws *protows, char *data, s
 	struct binary *binary;
 
 	if (size) {
-		binary = malloc(sizeof *binary);
+		binary = slab_alloc(sizeof *binary);
 		if (!binary) {
 			/* TODO process the problem */
 			errno = ENOMEM;
@@ -369,7 +701,13 @@ void afb_proto_ws_call_unref(struct afb_proto_ws_call *call)
 
 	afb_proto_ws_unref(call->protows);
 	free(call->buffer);
-	free(call);
+	slab_free(call, sizeof *call);
+}
+
+/* get the time budget in milliseconds given by the client or 0 if none */
+uint32_t afb_proto_ws_call_budget(struct afb_proto_ws_call *call)
+{
+	return call->budget;
 }
 
 int afb_proto_ws_call_reply(struct afb_proto_ws_call *call, struct json_object *obj, const char *error, const char *info)
@@ -382,10 +720,8 @@ int afb_proto_ws_call_reply(struct afb_proto_ws_call *call, struct json_object *
 	 && writebuf_uint32(&wb, call->callid)
 	 && writebuf_nullstring(&wb, error)
 	 && writebuf_nullstring(&wb, info)
-	 && writebuf_object(&wb, obj)) {
-		pthread_mutex_lock(&protows->mutex);
-		rc = afb_ws_binary_v(protows->ws, wb.iovec, wb.count);
-		pthread_mutex_unlock(&protows->mutex);
+	 && writebuf_object(&wb, obj, protows->version)) {
+		rc = send_message(protows, &wb);
 		if (rc >= 0) {
 			rc = 0;
 			goto success;
@@ -395,6 +731,26 @@ success:
 	return rc;
 }
 
+/* replies with the object whose JSON text is the 'size' bytes of 'buffer' */
+int afb_proto_ws_call_reply_buffer(struct afb_proto_ws_call *call, const char *buffer, size_t size, const char *error, const char *info)
+{
+	int rc = -1;
+	struct writebuf wb = { .count = 0 };
+	struct afb_proto_ws *protows = call->protows;
+
+	/* the text of the object is valid for any version */
+	if (writebuf_char(&wb, CHAR_FOR_REPLY)
+	 && writebuf_uint32(&wb, call->callid)
+	 && writebuf_nullstring(&wb, error)
+	 && writebuf_nullstring(&wb, info)
+	 && writebuf_text(&wb, buffer, size)) {
+		rc = send_message(protows, &wb);
+		if (rc >= 0)
+			rc = 0;
+	}
+	return rc;
+}
+
 int afb_proto_ws_call_subscribe(struct afb_proto_ws_call *call, const char *event_name, int event_id)
 {
 	int rc = -1;
@@ -405,9 +761,7 @@ int afb_proto_ws_call_subscribe(struct afb_proto_ws_call *call, const char *even
 	 && writebuf_uint32(&wb, call->callid)
 	 && writebuf_uint32(&wb, (uint32_t)event_id)
 	 && writebuf_string(&wb, event_name)) {
-		pthread_mutex_lock(&protows->mutex);
-		rc = afb_ws_binary_v(protows->ws, wb.iovec, wb.count);
-		pthread_mutex_unlock(&protows->mutex);
+		rc = send_message(protows, &wb);
 		if (rc >= 0) {
 			rc = 0;
 			goto success;
@@ -427,9 +781,7 @@ int afb_proto_ws_call_unsubscribe(struct afb_proto_ws_call *call, const char *ev
 	 && writebuf_uint32(&wb, call->callid)
 	 && writebuf_uint32(&wb, (uint32_t)event_id)
 	 && writebuf_string(&wb, event_name)) {
-		pthread_mutex_lock(&protows->mutex);
-		rc = afb_ws_binary_v(protows->ws, wb.iovec, wb.count);
-		pthread_mutex_unlock(&protows->mutex);
+		rc = send_message(protows, &wb);
 		if (rc >= 0) {
 			rc = 0;
 			goto success;
@@ -442,23 +794,12 @@ success:
 /******************* client part **********************************/
 
 /* search a memorized call */
-static struct client_call *client_call_search_locked(struct afb_proto_ws *protows, uint32_t callid)
-{
-	struct client_call *call;
-
-	call = protows->calls;
-	while (call != NULL && call->callid != callid)
-		call = call->next;
-
-	return call;
-}
-
 static struct client_call *client_call_search_unlocked(struct afb_proto_ws *protows, uint32_t callid)
 {
 	struct client_call *result;
 
 	pthread_mutex_lock(&protows->mutex);
-	result = client_call_search_locked(protows, callid);
+	result = idmap_get(&protows->calls, callid);
 	pthread_mutex_unlock(&protows->mutex);
 	return result;
 }
@@ -466,20 +807,14 @@ static struct client_call *client_call_search_unlocked(struct afb_proto_ws *prot
 /* free and release the memorizing call */
 static void client_call_destroy(struct client_call *call)
 {
-	struct client_call **prv;
 	struct afb_proto_ws *protows = call->protows;
 
 	pthread_mutex_lock(&protows->mutex);
-	prv = &call->protows->calls;
-	while (*prv != NULL) {
-		if (*prv == call) {
-			*prv = call->next;
-			break;
-		}
-		prv = &(*prv)->next;
-	}
+	idmap_remove(&protows->calls, call->callid);
+	if (call->context)
+		call->context->pending--;
 	pthread_mutex_unlock(&protows->mutex);
-	free(call);
+	slab_free(call, sizeof *call);
 }
 
 /* get event data from the message */
@@ -590,19 +925,14 @@ static void client_on_reply(struct afb_proto_ws *protows, struct readbuf *rb)
 static void client_on_description(struct afb_proto_ws *protows, struct readbuf *rb)
 {
 	uint32_t descid;
-	struct client_describe *desc, **prv;
+	struct client_describe *desc;
 	struct json_object *object;
 
 	if (readbuf_uint32(rb, &descid)) {
 		pthread_mutex_lock(&protows->mutex);
-		prv = &protows->describes;
-		while ((desc = *prv) && desc->descid != descid)
-			prv = &desc->next;
-		if (!desc)
-			pthread_mutex_unlock(&protows->mutex);
-		else {
-			*prv = desc->next;
-			pthread_mutex_unlock(&protows->mutex);
+		desc = idmap_remove(&protows->describes, descid);
+		pthread_mutex_unlock(&protows->mutex);
+		if (desc) {
 			if (!readbuf_object(rb, &object))
 				object = NULL;
 			desc->callback(desc->closure, object);
@@ -611,6 +941,20 @@ static void client_on_description(struct afb_proto_ws *protows, struct readbuf *
 	}
 }
 
+/* receives the version selected by the server */
+static void client_on_version_set(struct afb_proto_ws *protows, struct readbuf *rb)
+{
+	uint32_t id;
+	char version;
+
+	if (readbuf_uint32(rb, &id)
+	 && id == WSAPI_IDENTIFIER
+	 && readbuf_char(rb, &version)
+	 && version >= WSAPI_VERSION_MIN
+	 && version <= WSAPI_VERSION_MAX)
+		protows->version = (uint8_t)version;
+}
+
 /* callback when receiving binary data */
 static void client_on_binary_job(int sig, void *closure)
 {
@@ -642,13 +986,16 @@ static void client_on_binary_job(int sig, void *closure)
 		case CHAR_FOR_DESCRIPTION: /* description */
 			client_on_description(binary->protows, &binary->rb);
 			break;
+		case CHAR_FOR_VERSION_SET: /* set the version */
+			client_on_version_set(binary->protows, &binary->rb);
+			break;
 		default: /* unexpected message */
 			/* TODO: close the connection */
 			break;
 		}
 	}
 	free(binary->rb.base);
-	free(binary);
+	slab_free(binary, sizeof *binary);
 }
 
 /* callback when receiving binary data */
@@ -659,13 +1006,214 @@ static void client_on_binary(void *closure, char *data, size_t size)
 	queue_message_processing(protows, data, size, client_on_binary_job);
 }
 
-int afb_proto_ws_client_call(
+/* hash of the context of 'sessionid' and 'user_creds' */
+static uint32_t client_context_hash(const char *sessionid, const char *user_creds)
+{
+	uint32_t h = 2166136261U;
+
+	while (*sessionid)
+		h = (h ^ (uint8_t)*sessionid++) * 16777619U;
+	if (user_creds) {
+		h = (h ^ 1) * 16777619U;
+		while (*user_creds)
+			h = (h ^ (uint8_t)*user_creds++) * 16777619U;
+	}
+	return h;
+}
+
+/* sends the definition of the context */
+static int client_context_send(struct afb_proto_ws *protows, struct client_context *context)
+{
+	struct writebuf wb = { .count = 0 };
+
+	if (!writebuf_char(&wb, CHAR_FOR_CONTEXT)
+	 || !writebuf_uint32(&wb, context->handle)
+	 || !writebuf_string(&wb, context->sessionid)
+	 || !writebuf_nullstring(&wb, context->user_creds)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return send_message(protows, &wb);
+}
+
+/* removes the context of 'slot' from the open addressing table 'slots' */
+static void client_context_unlink(struct client_context **slots, uint32_t slot)
+{
+	uint32_t next, home;
+
+	slots[slot] = NULL;
+	next = slot;
+	for (;;) {
+		next = (next + 1) & (CLIENT_CONTEXT_SLOTS - 1);
+		if (slots[next] == NULL)
+			return;
+		/* moves back the entries that can't be reached anymore */
+		home = slots[next]->hash & (CLIENT_CONTEXT_SLOTS - 1);
+		if (((next - home) & (CLIENT_CONTEXT_SLOTS - 1)) >= ((next - slot) & (CLIENT_CONTEXT_SLOTS - 1))) {
+			slots[slot] = slots[next];
+			slots[next] = NULL;
+			slot = next;
+		}
+	}
+}
+
+/*
+ * Search the least recently used context having no call waiting a reply.
+ * When found, removes it from 'slots' and returns its handle.
+ * Otherwise returns 0. As the server processed the calls using it
+ * before replying, its handle can then be defined again.
+ */
+static uint32_t client_context_recycle(struct client_context **slots)
+{
+	struct client_context *context, *victim;
+	uint32_t i, slot, handle;
+
+	victim = NULL;
+	slot = 0;
+	for (i = 0 ; i < CLIENT_CONTEXT_SLOTS ; i++) {
+		context = slots[i];
+		if (context != NULL && context->ready && context->pending == 0
+		 && (victim == NULL || (int32_t)(context->stamp - victim->stamp) < 0)) {
+			victim = context;
+			slot = i;
+		}
+	}
+	if (victim == NULL)
+		return 0;
+	handle = victim->handle;
+	client_context_unlink(slots, slot);
+	free(victim);
+	return handle;
+}
+
+/*
+ * Get the context for 'sessionid' and 'user_creds', defining it on
+ * first use. The returned context is counted as pending until the
+ * reply of the call using it: see client_call_destroy.
+ * Returns NULL if the context must be sent in full because the server
+ * doesn't handle contexts, because all the handles are used by
+ * pending calls or because its definition is being sent.
+ */
+static struct client_context *client_context_get(struct afb_proto_ws *protows, const char *sessionid, const char *user_creds)
+{
+	struct client_context *context, **slots;
+	uint32_t hash, handle, i;
+	size_t lensid, lencreds;
+
+	if (protows->version < WSAPI_VERSION_3)
+		return NULL;
+
+	/* search the context */
+	hash = client_context_hash(sessionid, user_creds);
+	pthread_mutex_lock(&protows->mutex);
+	slots = protows->contexts;
+	if (slots == NULL) {
+		slots = calloc(CLIENT_CONTEXT_SLOTS, sizeof *slots);
+		if (slots == NULL)
+			goto unavailable;
+		protows->context_handles = malloc(CLIENT_CONTEXT_MAX * sizeof *protows->context_handles);
+		if (protows->context_handles == NULL) {
+			free(slots);
+			goto unavailable;
+		}
+		protows->contexts = slots;
+	}
+	i = hash & (CLIENT_CONTEXT_SLOTS - 1);
+	while ((context = slots[i]) != NULL) {
+		if (context->hash == hash
+		 && !strcmp(context->sessionid, sessionid)
+		 && (context->user_creds == user_creds
+		  || (context->user_creds && user_creds && !strcmp(context->user_creds, user_creds)))) {
+			if (!context->ready)
+				goto unavailable;
+			context->pending++;
+			context->stamp = ++protows->context_stamp;
+			pthread_mutex_unlock(&protows->mutex);
+			return context;
+		}
+		i = (i + 1) & (CLIENT_CONTEXT_SLOTS - 1);
+	}
+
+	/* create the context */
+	lensid = 1 + strlen(sessionid);
+	lencreds = user_creds ? 1 + strlen(user_creds) : 0;
+	context = malloc(sizeof *context + lensid + lencreds);
+	if (context == NULL)
+		goto unavailable;
+
+	/* get a handle for it */
+	if (protows->context_nhandles > 0)
+		handle = protows->context_handles[--protows->context_nhandles];
+	else if (protows->context_count < CLIENT_CONTEXT_MAX)
+		handle = ++protows->context_count;
+	else {
+		handle = client_context_recycle(slots);
+		if (handle == 0) {
+			free(context);
+			goto unavailable;
+		}
+		/* the slot may have changed */
+		i = hash & (CLIENT_CONTEXT_SLOTS - 1);
+		while (slots[i] != NULL)
+			i = (i + 1) & (CLIENT_CONTEXT_SLOTS - 1);
+	}
+	context->handle = handle;
+	context->hash = hash;
+	context->pending = 1;
+	context->stamp = ++protows->context_stamp;
+	context->ready = 0;
+	memcpy(context->sessionid, sessionid, lensid);
+	context->user_creds = user_creds ? memcpy(&context->sessionid[lensid], user_creds, lencreds) : NULL;
+	slots[i] = context;
+	pthread_mutex_unlock(&protows->mutex);
+
+	/* define it, the calls using it are sent after */
+	if (client_context_send(protows, context) < 0) {
+		/* not defined, forget it and give back its handle */
+		pthread_mutex_lock(&protows->mutex);
+		i = hash & (CLIENT_CONTEXT_SLOTS - 1);
+		while (slots[i] != context)
+			i = (i + 1) & (CLIENT_CONTEXT_SLOTS - 1);
+		client_context_unlink(slots, i);
+		protows->context_handles[protows->context_nhandles++] = context->handle;
+		pthread_mutex_unlock(&protows->mutex);
+		free(context);
+		return NULL;
+	}
+	pthread_mutex_lock(&protows->mutex);
+	context->ready = 1;
+	pthread_mutex_unlock(&protows->mutex);
+	return context;
+
+unavailable:
+	pthread_mutex_unlock(&protows->mutex);
+	return NULL;
+}
+
+/* release the contexts of the client */
+static void client_context_release(struct afb_proto_ws *protows)
+{
+	uint32_t i;
+
+	if (protows->contexts) {
+		for (i = 0 ; i < CLIENT_CONTEXT_SLOTS ; i++)
+			free(protows->contexts[i]);
+		free(protows->contexts);
+		free(protows->context_handles);
+		protows->contexts = NULL;
+		protows->context_handles = NULL;
+	}
+}
+
+int afb_proto_ws_client_api_call(
 		struct afb_proto_ws *protows,
+		const char *api,
 		const char *verb,
 		struct json_object *args,
 		const char *sessionid,
 		void *request,
-		const char *user_creds
+		const char *user_creds,
+		uint32_t budget
 )
 {
 	int rc = -1;
@@ -673,42 +1221,56 @@ int afb_proto_ws_client_call(
 	struct writebuf wb = { .count = 0 };
 
 	/* allocate call data */
-	call = malloc(sizeof *call);
+	call = slab_alloc(sizeof *call);
 	if (call == NULL) {
 		errno = ENOMEM;
 		return -1;
 	}
 	call->request = request;
+	call->context = NULL;
 
 	/* init call data */
-	pthread_mutex_lock(&protows->mutex);
-	call->callid = ptr2id(call);
-	while(client_call_search_locked(protows, call->callid) != NULL)
-		call->callid++;
 	call->protows = protows;
-	call->next = protows->calls;
-	protows->calls = call;
+	pthread_mutex_lock(&protows->mutex);
+	rc = idmap_add(&protows->calls, call, &call->callid);
 	pthread_mutex_unlock(&protows->mutex);
+	if (rc < 0) {
+		slab_free(call, sizeof *call);
+		return -1;
+	}
 
-	/* creates the call message */
-	if (!writebuf_char(&wb, CHAR_FOR_CALL)
+	/* creates the call message, enclosed in its budget if any */
+	if (budget && protows->version >= WSAPI_VERSION_4
+	 && (!writebuf_char(&wb, CHAR_FOR_BUDGET) || !writebuf_uint32(&wb, budget))) {
+		errno = EINVAL;
+		goto clean;
+	}
+	call->context = client_context_get(protows, sessionid, user_creds);
+	if (call->context != NULL) {
+		if (!writebuf_char(&wb, CHAR_FOR_CONTEXT_CALL)
+		 || !writebuf_uint32(&wb, call->callid)
+		 || !writebuf_string(&wb, verb)
+		 || !writebuf_uint32(&wb, call->context->handle)
+		 || !writebuf_object(&wb, args, protows->version)
+		 || (api && !writebuf_string(&wb, api))) {
+			errno = EINVAL;
+			goto clean;
+		}
+	} else if (!writebuf_char(&wb, CHAR_FOR_CALL)
 	 || !writebuf_uint32(&wb, call->callid)
 	 || !writebuf_string(&wb, verb)
 	 || !writebuf_string(&wb, sessionid)
-	 || !writebuf_object(&wb, args)
-	 || !writebuf_nullstring(&wb, user_creds)) {
+	 || !writebuf_object(&wb, args, protows->version)
+	 || !writebuf_nullstring(&wb, user_creds)
+	 || (api && !writebuf_string(&wb, api))) {
 		errno = EINVAL;
 		goto clean;
 	}
 
 	/* send */
-	pthread_mutex_lock(&protows->mutex);
-	rc = afb_ws_binary_v(protows->ws, wb.iovec, wb.count);
-	pthread_mutex_unlock(&protows->mutex);
-	if (rc >= 0) {
-		rc = 0;
+	rc = send_message(protows, &wb);
+	if (rc >= 0)
 		goto end;
-	}
 
 clean:
 	client_call_destroy(call);
@@ -716,10 +1278,23 @@ end:
 	return rc;
 }
 
+int afb_proto_ws_client_call(
+		struct afb_proto_ws *protows,
+		const char *verb,
+		struct json_object *args,
+		const char *sessionid,
+		void *request,
+		const char *user_creds
+)
+{
+	return afb_proto_ws_client_api_call(protows, NULL, verb, args, sessionid, request, user_creds, 0);
+}
+
 /* get the description */
-int afb_proto_ws_client_describe(struct afb_proto_ws *protows, void (*callback)(void*, struct json_object*), void *closure)
+int afb_proto_ws_client_api_describe(struct afb_proto_ws *protows, const char *api, void (*callback)(void*, struct json_object*), void *closure)
 {
-	struct client_describe *desc, *d;
+	int rc;
+	struct client_describe *desc;
 	struct writebuf wb = { .count = 0 };
 
 	desc = malloc(sizeof *desc);
@@ -729,40 +1304,26 @@ int afb_proto_ws_client_describe(struct afb_proto_ws *protows, void (*callback)(
 	}
 
 	/* fill in stack the description of the task */
-	pthread_mutex_lock(&protows->mutex);
-	desc->descid = ptr2id(desc);
-	d = protows->describes;
-	while (d) {
-		if (d->descid != desc->descid)
-			d = d->next;
-		else {
-			desc->descid++;
-			d = protows->describes;
-		}
-	}
 	desc->callback = callback;
 	desc->closure = closure;
 	desc->protows = protows;
-	desc->next = protows->describes;
-	protows->describes = desc;
+	pthread_mutex_lock(&protows->mutex);
+	rc = idmap_add(&protows->describes, desc, &desc->descid);
+	pthread_mutex_unlock(&protows->mutex);
+	if (rc < 0) {
+		free(desc);
+		goto error;
+	}
 
 	/* send */
 	if (writebuf_char(&wb, CHAR_FOR_DESCRIBE)
 	 && writebuf_uint32(&wb, desc->descid)
-	 && afb_ws_binary_v(protows->ws, wb.iovec, wb.count) >= 0) {
-		pthread_mutex_unlock(&protows->mutex);
+	 && (!api || writebuf_string(&wb, api))
+	 && send_message(protows, &wb) >= 0)
 		return 0;
-	}
 
-	d = protows->describes;
-	if (d == desc)
-		protows->describes = desc->next;
-	else {
-		while(d && d->next != desc)
-			d = d->next;
-		if (d)
-			d->next = desc->next;
-	}
+	pthread_mutex_lock(&protows->mutex);
+	idmap_remove(&protows->describes, desc->descid);
 	pthread_mutex_unlock(&protows->mutex);
 	free(desc);
 error:
@@ -770,13 +1331,54 @@ error:
 	return -1;
 }
 
+/* get the description of the default api */
+int afb_proto_ws_client_describe(struct afb_proto_ws *protows, void (*callback)(void*, struct json_object*), void *closure)
+{
+	return afb_proto_ws_client_api_describe(protows, NULL, callback, closure);
+}
+
+/* offers the known versions to the server */
+static int client_send_version_offer(struct afb_proto_ws *protows)
+{
+	int rc = -1;
+	struct writebuf wb = { .count = 0 };
+
+	if (writebuf_char(&wb, CHAR_FOR_VERSION_OFFER)
+	 && writebuf_uint32(&wb, WSAPI_IDENTIFIER)
+	 && writebuf_char(&wb, 4)
+	 && writebuf_char(&wb, WSAPI_VERSION_1)
+	 && writebuf_char(&wb, WSAPI_VERSION_2)
+	 && writebuf_char(&wb, WSAPI_VERSION_3)
+	 && writebuf_char(&wb, WSAPI_VERSION_4)) {
+		rc = send_message(protows, &wb);
+	}
+	return rc;
+}
+
 /******************* client description part for server *****************************/
 
+/* creates the call of 'callid' that takes the buffer of 'rb' */
+static struct afb_proto_ws_call *server_call_create(struct afb_proto_ws *protows, uint32_t callid, uint32_t budget, struct readbuf *rb)
+{
+	struct afb_proto_ws_call *call;
+
+	call = slab_alloc(sizeof *call);
+	if (call != NULL) {
+		call->protows = protows;
+		call->callid = callid;
+		call->budget = budget;
+		call->refcount = 1;
+		call->buffer = rb->base;
+		rb->base = NULL; /* don't free the buffer */
+	}
+	return call;
+}
+
 /* on call, propagate it to the ws service */
-static void server_on_call(struct afb_proto_ws *protows, struct readbuf *rb)
+static void server_on_call(struct afb_proto_ws *protows, struct readbuf *rb, uint32_t budget)
 {
 	struct afb_proto_ws_call *call;
-	const char *uuid, *verb, *user_creds;
+	const char *uuid, *verb, *user_creds, *api;
 	uint32_t callid;
 	size_t lenverb;
 	struct json_object *object;
@@ -791,18 +1393,22 @@ static void server_on_call(struct afb_proto_ws *protows, struct readbuf *rb)
 	 || !readbuf_nullstring(rb, &user_creds, NULL))
 		goto overflow;
 
+	/* the api is optional */
+	api = NULL;
+	if (rb->head < rb->end && !readbuf_string(rb, &api, NULL)) {
+		json_object_put(object);
+		goto overflow;
+	}
+
 	/* create the request */
-	call = malloc(sizeof *call);
+	call = server_call_create(protows, callid, budget, rb);
 	if (call == NULL)
 		goto out_of_memory;
 
-	call->protows = protows;
-	call->callid = callid;
-	call->refcount = 1;
-	call->buffer = rb->base;
-	rb->base = NULL; /* don't free the buffer */
-
-	protows->server_itf->on_call(protows->closure, call, verb, object, uuid, user_creds);
+	if (protows->server_itf->on_api_call)
+		protows->server_itf->on_api_call(protows->closure, call, api, verb, object, uuid, user_creds);
+	else
+		protows->server_itf->on_call(protows->closure, call, verb, object, uuid, user_creds);
 	return;
 
 out_of_memory:
@@ -812,6 +1418,80 @@ overflow:
 	afb_proto_ws_unref(protows);
 }
 
+/* on call designating its context, propagate it to the ws service */
+static void server_on_context_call(struct afb_proto_ws *protows, struct readbuf *rb, uint32_t budget)
+{
+	struct afb_proto_ws_call *call;
+	const char *verb, *api;
+	uint32_t callid, handle;
+	struct json_object *object;
+
+	if (!protows->server_itf->on_context_call)
+		return;
+
+	afb_proto_ws_addref(protows);
+
+	/* reads the call message data */
+	if (!readbuf_uint32(rb, &callid)
+	 || !readbuf_string(rb, &verb, NULL)
+	 || !readbuf_uint32(rb, &handle)
+	 || !readbuf_object(rb, &object))
+		goto overflow;
+
+	/* the api is optional */
+	api = NULL;
+	if (rb->head < rb->end && !readbuf_string(rb, &api, NULL)) {
+		json_object_put(object);
+		goto overflow;
+	}
+
+	/* create the request */
+	call = server_call_create(protows, callid, budget, rb);
+	if (call == NULL) {
+		json_object_put(object);
+		goto overflow;
+	}
+
+	protows->server_itf->on_context_call(protows->closure, call, api, verb, object, handle);
+	return;
+
+overflow:
+	afb_proto_ws_unref(protows);
+}
+
+/* on call enclosed in its budget, propagate it to the ws service */
+static void server_on_budget(struct afb_proto_ws *protows, struct readbuf *rb)
+{
+	uint32_t budget;
+	char order;
+
+	if (readbuf_uint32(rb, &budget) && readbuf_char(rb, &order)) {
+		switch (order) {
+		case CHAR_FOR_CALL:
+			server_on_call(protows, rb, budget);
+			break;
+		case CHAR_FOR_CONTEXT_CALL:
+			server_on_context_call(protows, rb, budget);
+			break;
+		default: /* unexpected message */
+			break;
+		}
+	}
+}
+
+/* on definition of a context, record it */
+static void server_on_context(struct afb_proto_ws *protows, struct readbuf *rb)
+{
+	uint32_t handle;
+	const char *sessionid, *user_creds;
+
+	if (protows->server_itf->on_context_set
+	 && readbuf_uint32(rb, &handle)
+	 && readbuf_string(rb, &sessionid, NULL)
+	 && readbuf_nullstring(rb, &user_creds, NULL))
+		protows->server_itf->on_context_set(protows->closure, handle, sessionid, user_creds);
+}
+
 static int server_send_description(struct afb_proto_ws *protows, uint32_t descid, struct json_object *descobj)
 {
 	int rc;
@@ -819,10 +1499,8 @@ static int server_send_description(struct afb_proto_ws *protows, uint32_t descid
 
 	if (writebuf_char(&wb, CHAR_FOR_DESCRIPTION)
 	 && writebuf_uint32(&wb, descid)
-	 && writebuf_object(&wb, descobj)) {
-		pthread_mutex_lock(&protows->mutex);
-		rc = afb_ws_binary_v(protows->ws, wb.iovec, wb.count);
-		pthread_mutex_unlock(&protows->mutex);
+	 && writebuf_object(&wb, descobj, protows->version)) {
+		rc = send_message(protows, &wb);
 		if (rc >= 0)
 			return 0;
 	}
@@ -841,18 +1519,24 @@ int afb_proto_ws_describe_put(struct afb_proto_ws_describe *describe, struct jso
 static void server_on_describe(struct afb_proto_ws *protows, struct readbuf *rb)
 {
 	uint32_t descid;
+	const char *api;
 	struct afb_proto_ws_describe *desc;
 
-	/* reads the descid */
-	if (readbuf_uint32(rb, &descid)) {
-		if (protows->server_itf->on_describe) {
+	/* reads the descid and the optional api */
+	api = NULL;
+	if (readbuf_uint32(rb, &descid)
+	 && (rb->head >= rb->end || readbuf_string(rb, &api, NULL))) {
+		if (protows->server_itf->on_describe || protows->server_itf->on_api_describe) {
 			/* create asynchronous job */
 			desc = malloc(sizeof *desc);
 			if (desc) {
 				desc->descid = descid;
 				desc->protows = protows;
 				afb_proto_ws_addref(protows);
-				protows->server_itf->on_describe(protows->closure, desc);
+				if (protows->server_itf->on_api_describe)
+					protows->server_itf->on_api_describe(protows->closure, desc, api);
+				else
+					protows->server_itf->on_describe(protows->closure, desc);
 				return;
 			}
 		}
@@ -860,6 +1544,37 @@ static void server_on_describe(struct afb_proto_ws *protows, struct readbuf *rb)
 	}
 }
 
+/* on version offer, select the version and send it back */
+static void server_on_version_offer(struct afb_proto_ws *protows, struct readbuf *rb)
+{
+	uint32_t id;
+	char count, version, selected, max;
+	struct writebuf wb = { .count = 0 };
+
+	if (!readbuf_uint32(rb, &id) || id != WSAPI_IDENTIFIER || !readbuf_char(rb, &count))
+		return;
+
+	/* contexts, and the versions after, are only possible if the server handles them */
+	max = protows->server_itf->on_context_set && protows->server_itf->on_context_call
+		? WSAPI_VERSION_4 : WSAPI_VERSION_2;
+
+	/* select the highest common version */
+	selected = WSAPI_VERSION_UNSET;
+	while (count-- > 0 && readbuf_char(rb, &version))
+		if (version >= WSAPI_VERSION_MIN && version <= max && version > selected)
+			selected = version;
+	if (selected == WSAPI_VERSION_UNSET)
+		selected = WSAPI_VERSION_1;
+
+	/* send it */
+	if (writebuf_char(&wb, CHAR_FOR_VERSION_SET)
+	 && writebuf_uint32(&wb, WSAPI_IDENTIFIER)
+	 && writebuf_char(&wb, selected)) {
+		if (send_message(protows, &wb) >= 0)
+			protows->version = (uint8_t)selected;
+	}
+}
+
 /* callback when receiving binary data */
 static void server_on_binary_job(int sig, void *closure)
 {
@@ -868,23 +1583,43 @@ static void server_on_binary_job(int sig, void *closure)
 	if (!sig) {
 		switch (*binary->rb.head++) {
 		case CHAR_FOR_CALL:
-			server_on_call(binary->protows, &binary->rb);
+			server_on_call(binary->protows, &binary->rb, 0);
+			break;
+		case CHAR_FOR_CONTEXT_CALL:
+			server_on_context_call(binary->protows, &binary->rb, 0);
+			break;
+		case CHAR_FOR_BUDGET:
+			server_on_budget(binary->protows, &binary->rb);
 			break;
 		case CHAR_FOR_DESCRIBE:
 			server_on_describe(binary->protows, &binary->rb);
 			break;
+		case CHAR_FOR_VERSION_OFFER:
+			server_on_version_offer(binary->protows, &binary->rb);
+			break;
 		default: /* unexpected message */
 			/* TODO: close the connection */
 			break;
 		}
 	}
 	free(binary->rb.base);
-	free(binary);
+	slab_free(binary, sizeof *binary);
 }
 
 static void server_on_binary(void *closure, char *data, size_t size)
 {
 	struct afb_proto_ws *protows = closure;
+	struct readbuf rb;
+
+	/* contexts are defined in order, before processing the calls using them */
+	if (size && *data == CHAR_FOR_CONTEXT) {
+		rb.base = data;
+		rb.head = data + 1;
+		rb.end = data + size;
+		server_on_context(protows, &rb);
+		free(data);
+		return;
+	}
 
 	queue_message_processing(protows, data, size, server_on_binary_job);
 }
@@ -899,10 +1634,8 @@ static int server_event_send(struct afb_proto_ws *protows, char order, const cha
 	if (writebuf_char(&wb, order)
 	 && (order == CHAR_FOR_EVT_BROADCAST || writebuf_uint32(&wb, event_id))
 	 && writebuf_string(&wb, event_name)
-	 && (order == CHAR_FOR_EVT_ADD || order == CHAR_FOR_EVT_DEL || writebuf_object(&wb, data))) {
-		pthread_mutex_lock(&protows->mutex);
-		rc = afb_ws_binary_v(protows->ws, wb.iovec, wb.count);
-		pthread_mutex_unlock(&protows->mutex);
+	 && (order == CHAR_FOR_EVT_ADD || order == CHAR_FOR_EVT_DEL || writebuf_object(&wb, data, protows->version))) {
+		rc = send_message(protows, &wb);
 		if (rc >= 0)
 			return 0;
 	}
@@ -931,29 +1664,41 @@ int afb_proto_ws_server_event_broadcast(struct afb_proto_ws *protows, const char
 
 /*****************************************************/
 
+/* terminates a pending call on hangup */
+static void on_hangup_call(void *closure, uint32_t callid, void *value)
+{
+	struct afb_proto_ws *protows = closure;
+	struct client_call *call = value;
+
+	protows->client_itf->on_reply(protows->closure, call->request, NULL, "disconnected", "server hung up");
+	slab_free(call, sizeof *call);
+}
+
+/* terminates a pending describe on hangup */
+static void on_hangup_describe(void *closure, uint32_t descid, void *value)
+{
+	struct client_describe *cd = value;
+
+	cd->callback(cd->closure, NULL);
+	free(cd);
+}
+
 /* callback when receiving a hangup */
 static void on_hangup(void *closure)
 {
 	struct afb_proto_ws *protows = closure;
-	struct client_describe *cd, *ncd;
-	struct client_call *call, *ncall;
+	struct idmap calls, describes;
 
-	ncd = __atomic_exchange_n(&protows->describes, NULL, __ATOMIC_RELAXED);
-	ncall = __atomic_exchange_n(&protows->calls, NULL, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&protows->mutex);
+	idmap_move(&describes, &protows->describes);
+	idmap_move(&calls, &protows->calls);
+	pthread_mutex_unlock(&protows->mutex);
 
-	while (ncall) {
-		call= ncall;
-		ncall = call->next;
-		protows->client_itf->on_reply(protows->closure, call->request, NULL, "disconnected", "server hung up");
-		free(call);
-	}
+	idmap_for_all(&calls, on_hangup_call, protows);
+	idmap_release(&calls);
 
-	while (ncd) {
-		cd= ncd;
-		ncd = cd->next;
-		cd->callback(cd->closure, NULL);
-		free(cd);
-	}
+	idmap_for_all(&describes, on_hangup_describe, protows);
+	idmap_release(&describes);
 
 	if (protows->fdev) {
 		fdev_unref(protows->fdev);
@@ -985,7 +1730,7 @@ static const struct afb_ws_itf server_ws_itf =
 
 /*****************************************************/
 
-static struct afb_proto_ws *afb_proto_ws_create(struct fdev *fdev, const struct afb_proto_ws_server_itf *itfs, const struct afb_proto_ws_client_itf *itfc, void *closure, const struct afb_ws_itf *itf)
+static struct afb_proto_ws *afb_proto_ws_create(struct fdev *fdev, const struct afb_proto_ws_server_itf *itfs, const struct afb_proto_ws_client_itf *itfc, void *closure, const struct afb_ws_itf *itf, int shm)
 {
 	struct afb_proto_ws *protows;
 
@@ -995,36 +1740,82 @@ static struct afb_proto_ws *afb_proto_ws_create(struct fdev *fdev, const struct
 	else {
 		fcntl(fdev_fd(fdev), F_SETFD, FD_CLOEXEC);
 		fcntl(fdev_fd(fdev), F_SETFL, O_NONBLOCK);
-		protows->ws = afb_ws_create(fdev, itf, protows);
-		if (protows->ws != NULL) {
+		fdev_addref(fdev);
+		if (!shm)
+			protows->ws = afb_ws_create(fdev, itf, protows, NULL);
+		else if (itfc)
+			protows->shm = afb_shm_create_client(fdev, itf, protows);
+		else
+			protows->shm = afb_shm_create_server(fdev, itf, protows);
+		if (protows->ws != NULL || protows->shm != NULL) {
 			protows->fdev = fdev;
 			protows->refcount = 1;
 			protows->closure = closure;
 			protows->server_itf = itfs;
 			protows->client_itf = itfc;
 			pthread_mutex_init(&protows->mutex, NULL);
+			pthread_mutex_init(&protows->wrmutex, NULL);
 			return protows;
 		}
+		fdev_unref(fdev);
 		free(protows);
 	}
 	return NULL;
 }
 
+static struct afb_proto_ws *create_client(struct fdev *fdev, const struct afb_proto_ws_client_itf *itf, void *closure, int shm)
+{
+	struct afb_proto_ws *protows;
+
+	protows = afb_proto_ws_create(fdev, NULL, itf, closure, &proto_ws_client_ws_itf, shm);
+	if (protows)
+		client_send_version_offer(protows);
+	return protows;
+}
+
 struct afb_proto_ws *afb_proto_ws_create_client(struct fdev *fdev, const struct afb_proto_ws_client_itf *itf, void *closure)
 {
-	return afb_proto_ws_create(fdev, NULL, itf, closure, &proto_ws_client_ws_itf);
+	return create_client(fdev, itf, closure, 0);
 }
 
 struct afb_proto_ws *afb_proto_ws_create_server(struct fdev *fdev, const struct afb_proto_ws_server_itf *itf, void *closure)
 {
-	return afb_proto_ws_create(fdev, itf, NULL, closure, &server_ws_itf);
+	return afb_proto_ws_create(fdev, itf, NULL, closure, &server_ws_itf, 0);
+}
+
+/*
+ * Creates the client of a shared memory channel (see afb-shm.h)
+ * on the socket 'fdev' connected to a server created with
+ * afb_proto_ws_create_server_shm.
+ */
+struct afb_proto_ws *afb_proto_ws_create_client_shm(struct fdev *fdev, const struct afb_proto_ws_client_itf *itf, void *closure)
+{
+	return create_client(fdev, itf, closure, 1);
+}
+
+/*
+ * Creates the server of a shared memory channel (see afb-shm.h)
+ * on the socket 'fdev' accepted from a client created with
+ * afb_proto_ws_create_client_shm.
+ */
+struct afb_proto_ws *afb_proto_ws_create_server_shm(struct fdev *fdev, const struct afb_proto_ws_server_itf *itf, void *closure)
+{
+	return afb_proto_ws_create(fdev, itf, NULL, closure, &server_ws_itf, 1);
 }
 
 void afb_proto_ws_unref(struct afb_proto_ws *protows)
 {
 	if (protows && !__atomic_sub_fetch(&protows->refcount, 1, __ATOMIC_RELAXED)) {
 		afb_proto_ws_hangup(protows);
-		afb_ws_destroy(protows->ws);
+		if (protows->shm)
+			afb_shm_destroy(protows->shm);
+		else
+			afb_ws_destroy(protows->ws);
+		idmap_release(&protows->calls);
+		idmap_release(&protows->describes);
+		send_queue_drop(protows);
+		client_context_release(protows);
+		pthread_mutex_destroy(&protows->wrmutex);
 		pthread_mutex_destroy(&protows->mutex);
 		free(protows);
 	}
@@ -1047,7 +1838,10 @@ int afb_proto_ws_is_server(struct afb_proto_ws *protows)
 
 void afb_proto_ws_hangup(struct afb_proto_ws *protows)
 {
-	afb_ws_hangup(protows->ws);
+	if (protows->shm)
+		afb_shm_hangup(protows->shm);
+	else
+		afb_ws_hangup(protows->ws);
 }
 
 void afb_proto_ws_on_hangup(struct afb_proto_ws *protows, void (*on_hangup)(void *closure))
@@ -22,7 +22,7 @@
  * Defined since version 3, the value AFB_PROTO_WS_VERSION can be used to
  * track versions of afb-proto-ws.
  */
-#define AFB_PROTO_WS_VERSION	3
+#define AFB_PROTO_WS_VERSION	7
 
 struct fdev;
 struct afb_proto_ws;
@@ -47,11 +47,22 @@ struct afb_proto_ws_server_itf
 {
 	void (*on_call)(void *closure, struct afb_proto_ws_call *call, const char *verb, struct json_object *args, const char *sessionid, const char *user_creds);
 	void (*on_describe)(void *closure, struct afb_proto_ws_describe *describe);
+
+	/* can be NULL, when set, used in place of the above with api being NULL for the default api */
+	void (*on_api_call)(void *closure, struct afb_proto_ws_call *call, const char *api, const char *verb, struct json_object *args, const char *sessionid, const char *user_creds);
+	void (*on_api_describe)(void *closure, struct afb_proto_ws_describe *describe, const char *api);
+
+	/* can be NULL, when both are set, the client can designate the session and credentials of calls by handles */
+	void (*on_context_set)(void *closure, uint32_t handle, const char *sessionid, const char *user_creds);
+	void (*on_context_call)(void *closure, struct afb_proto_ws_call *call, const char *api, const char *verb, struct json_object *args, uint32_t handle);
 };
 
 extern struct afb_proto_ws *afb_proto_ws_create_client(struct fdev *fdev, const struct afb_proto_ws_client_itf *itf, void *closure);
 extern struct afb_proto_ws *afb_proto_ws_create_server(struct fdev *fdev, const struct afb_proto_ws_server_itf *itf, void *closure);
 
+extern struct afb_proto_ws *afb_proto_ws_create_client_shm(struct fdev *fdev, const struct afb_proto_ws_client_itf *itf, void *closure);
+extern struct afb_proto_ws *afb_proto_ws_create_server_shm(struct fdev *fdev, const struct afb_proto_ws_server_itf *itf, void *closure);
+
 extern void afb_proto_ws_unref(struct afb_proto_ws *protows);
 extern void afb_proto_ws_addref(struct afb_proto_ws *protows);
 
@@ -66,6 +77,8 @@ extern void afb_proto_ws_set_queuing(struct afb_proto_ws *protows, int (*queuing
 
 extern int afb_proto_ws_client_call(struct afb_proto_ws *protows, const char *verb, struct json_object *args, const char *sessionid, void *request, const char *user_creds);
 extern int afb_proto_ws_client_describe(struct afb_proto_ws *protows, void (*callback)(void*, struct json_object*), void *closure);
+extern int afb_proto_ws_client_api_call(struct afb_proto_ws *protows, const char *api, const char *verb, struct json_object *args, const char *sessionid, void *request, const char *user_creds, uint32_t budget);
+extern int afb_proto_ws_client_api_describe(struct afb_proto_ws *protows, const char *api, void (*callback)(void*, struct json_object*), void *closure);
 
 extern int afb_proto_ws_server_event_create(struct afb_proto_ws *protows, const char *event_name, int event_id);
 extern int afb_proto_ws_server_event_remove(struct afb_proto_ws *protows, const char *event_name, int event_id);
@@ -74,8 +87,10 @@ extern int afb_proto_ws_server_event_broadcast(struct afb_proto_ws *protows, con
 
 extern void afb_proto_ws_call_addref(struct afb_proto_ws_call *call);
 extern void afb_proto_ws_call_unref(struct afb_proto_ws_call *call);
+extern uint32_t afb_proto_ws_call_budget(struct afb_proto_ws_call *call);
 
 extern int afb_proto_ws_call_reply(struct afb_proto_ws_call *call, struct json_object *obj, const char *error, const char *info);
+extern int afb_proto_ws_call_reply_buffer(struct afb_proto_ws_call *call, const char *buffer, size_t size, const char *error, const char *info);
 
 extern int afb_proto_ws_call_subscribe(struct afb_proto_ws_call *call, const char *event_name, int event_id);
 extern int afb_proto_ws_call_unsubscribe(struct afb_proto_ws_call *call, const char *event_name, int event_id);
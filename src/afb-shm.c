@@ -0,0 +1,777 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "afb-ws.h"
+#include "afb-shm.h"
+#include "fdev.h"
+
+#define SHM_MAGIC		"afb-shm1"
+#define SHM_RING_SIZE		(256 * 1024)		/* size of the rings */
+#define SHM_RING_SIZE_MIN	4096
+#define SHM_RING_SIZE_MAX	(64 * 1024 * 1024)
+#define SHM_CONTROL_SIZE	4096			/* size of the control part of rings */
+#define SHM_MESSAGE_MAX		(256 * 1024 * 1024)	/* size of the biggest message */
+#define SHM_WAIT_TIMEOUT	10			/* milliseconds between checks of full rings */
+#define SHM_SEALS		(F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL)	/* required seals of the memory */
+
+/*
+ * Control part of a ring in the shared memory. The members written
+ * by the reader and by the writer are in distinct cache lines.
+ * The indexes are free running: the count of bytes in the ring is
+ * tail - head.
+ */
+struct ring
+{
+	/* written by the reader */
+	uint32_t head __attribute__((aligned(64)));	/**< read index */
+	uint32_t sleeping;				/**< the reader needs a wake up */
+
+	/* written by the writer */
+	uint32_t tail __attribute__((aligned(64)));	/**< write index */
+	uint32_t blocked;				/**< the writer waits for room */
+
+	/* written by any side */
+	uint32_t closed __attribute__((aligned(64)));	/**< a side hung up */
+};
+
+/*
+ * Hello message sent by the client with the memory file and the eventfds.
+ * The memory file must be sealed with SHM_SEALS.
+ */
+struct hello
+{
+	char magic[8];		/**< SHM_MAGIC */
+	uint32_t size;		/**< size of the rings */
+};
+
+/*
+ * The afb_shm structure
+ */
+struct afb_shm
+{
+	const struct afb_ws_itf *itf;	/**< the callback interface */
+	void *closure;		/**< closure of the callbacks */
+	struct fdev *fdev;	/**< the fdev of the socket */
+	struct fdev *efdev;	/**< the fdev of the eventfd of rx */
+	int sockfd;		/**< the socket for checking hangups of writers */
+	int txefd;		/**< the eventfd for waking the reader of tx */
+	int hungup;		/**< is hung up? */
+	unsigned corked;	/**< count of corks */
+	int notify;		/**< is a notification pending? */
+
+	void *map;		/**< the shared memory or NULL until the hello */
+	size_t mapsize;		/**< size of the shared memory */
+	uint32_t mask;		/**< size of the rings minus one */
+
+	/* reading */
+	struct ring *rx;	/**< the ring for reading */
+	char *rxdata;		/**< the data of rx */
+	uint32_t rxhead;	/**< local copy of rx->head */
+	char *msg;		/**< the message being received */
+	uint32_t msglen;	/**< length of msg */
+	uint32_t msgpos;	/**< count of bytes of msg received */
+	uint32_t lenpos;	/**< count of bytes of the length received */
+	char lenbuf[4];		/**< the length being received */
+
+	/* writing */
+	struct ring *tx;	/**< the ring for writing */
+	char *txdata;		/**< the data of tx */
+	uint32_t txtail;	/**< local copy of tx->tail */
+};
+
+/******************************************************************************/
+
+static inline void futex_wait(uint32_t *addr, uint32_t value, int timeout_ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+	syscall(SYS_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+static inline void futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* get the ring of 'index' and its data */
+static inline struct ring *ring_at(void *map, uint32_t size, int index, char **data)
+{
+	char *base = (char*)map + (size_t)index * (SHM_CONTROL_SIZE + size);
+	*data = base + SHM_CONTROL_SIZE;
+	return (struct ring*)base;
+}
+
+/* size of the shared memory for rings of 'size' */
+static inline size_t map_size(uint32_t size)
+{
+	return 2 * ((size_t)SHM_CONTROL_SIZE + size);
+}
+
+/******************************************************************************/
+
+/*
+ * Disconnect 'shm' and calls on_hangup if 'call_on_hangup' is not null.
+ * The memory and the eventfd of tx are kept until destruction
+ * because writers can still use them.
+ */
+static void shm_disconnect(struct afb_shm *shm, int call_on_hangup)
+{
+	if (!shm->hungup) {
+		shm->hungup = 1;
+		if (shm->map != NULL) {
+			__atomic_store_n(&shm->rx->closed, 1, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&shm->tx->closed, 1, __ATOMIC_SEQ_CST);
+			futex_wake(&shm->rx->head);
+			futex_wake(&shm->tx->head);
+		}
+		fdev_unref(shm->efdev);
+		fdev_unref(shm->fdev);
+		shm->efdev = shm->fdev = NULL;
+		free(shm->msg);
+		shm->msg = NULL;
+		if (call_on_hangup && shm->itf->on_hangup)
+			shm->itf->on_hangup(shm->closure);
+	}
+}
+
+/*
+ * Wakes up the reader of tx if it sleeps
+ */
+static void shm_notify(struct afb_shm *shm)
+{
+	uint64_t one = 1;
+	ssize_t rc;
+
+	shm->notify = 0;
+	if (__atomic_load_n(&shm->tx->sleeping, __ATOMIC_SEQ_CST)) {
+		do {
+			rc = write(shm->txefd, &one, sizeof one);
+		} while (rc < 0 && errno == EINTR);
+	}
+}
+
+/*
+ * Checks if the peer hung up the socket.
+ * It is used by writers that can't rely on the event loop
+ * because it may be blocked.
+ */
+static int shm_peer_gone(struct afb_shm *shm)
+{
+	struct pollfd pfd;
+
+	pfd.fd = shm->sockfd;
+	pfd.events = POLLRDHUP;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP|POLLRDHUP|POLLERR)) != 0;
+}
+
+/*
+ * Waits until the ring tx has room.
+ * Returns 0 on success or -1 when hung up.
+ */
+static int shm_wait_room(struct afb_shm *shm, uint32_t head)
+{
+	struct ring *tx = shm->tx;
+
+	/* the reader must drain the ring */
+	shm_notify(shm);
+
+	__atomic_store_n(&tx->blocked, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&tx->head, __ATOMIC_SEQ_CST) == head
+	 && !__atomic_load_n(&tx->closed, __ATOMIC_RELAXED))
+		futex_wait(&tx->head, head, SHM_WAIT_TIMEOUT);
+	__atomic_store_n(&tx->blocked, 0, __ATOMIC_RELAXED);
+
+	/* a dead reader never sets closed: check its socket when stuck */
+	if (shm->hungup
+	 || __atomic_load_n(&tx->closed, __ATOMIC_RELAXED)
+	 || (__atomic_load_n(&tx->head, __ATOMIC_ACQUIRE) == head && shm_peer_gone(shm))) {
+		errno = EPIPE;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Writes the 'length' bytes of 'data' to the ring tx.
+ * Returns 0 on success or -1 in case of error.
+ */
+static int shm_write(struct afb_shm *shm, const char *data, uint32_t length)
+{
+	struct ring *tx = shm->tx;
+	uint32_t head, used, count, offset, part, size = shm->mask + 1;
+
+	while (length) {
+		head = __atomic_load_n(&tx->head, __ATOMIC_ACQUIRE);
+		used = shm->txtail - head;
+		if (used > size) {
+			/* the peer is corrupting the ring */
+			errno = EPROTO;
+			return -1;
+		}
+		if (used == size) {
+			if (shm_wait_room(shm, head) < 0)
+				return -1;
+			continue;
+		}
+
+		count = size - used;
+		if (count > length)
+			count = length;
+		offset = shm->txtail & shm->mask;
+		part = size - offset;
+		if (part >= count)
+			memcpy(&shm->txdata[offset], data, count);
+		else {
+			memcpy(&shm->txdata[offset], data, part);
+			memcpy(shm->txdata, &data[part], count - part);
+		}
+		shm->txtail += count;
+		__atomic_store_n(&tx->tail, shm->txtail, __ATOMIC_SEQ_CST);
+		data += count;
+		length -= count;
+	}
+	return 0;
+}
+
+/*
+ * Sends the message described by the 'count' 'iov'
+ * Returns 0 on success or -1 in case of error.
+ */
+static int shm_send(struct afb_shm *shm, const struct iovec *iov, int count)
+{
+	size_t size;
+	uint32_t length;
+	int i;
+
+	if (shm->hungup) {
+		errno = EPIPE;
+		return -1;
+	}
+	if (__atomic_load_n(&shm->map, __ATOMIC_ACQUIRE) == NULL) {
+		/* the hello of the client is not yet received */
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	size = 0;
+	for (i = 0 ; i < count ; i++)
+		size += iov[i].iov_len;
+	if (size > SHM_MESSAGE_MAX) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	length = (uint32_t)size;
+	if (shm_write(shm, (const char*)&length, (uint32_t)sizeof length) < 0)
+		return -1;
+	for (i = 0 ; i < count ; i++)
+		if (shm_write(shm, iov[i].iov_base, (uint32_t)iov[i].iov_len) < 0)
+			return -1;
+
+	if (shm->corked)
+		shm->notify = 1;
+	else
+		shm_notify(shm);
+	return 0;
+}
+
+/*
+ * Reads the ring rx and dispatches the received messages.
+ * The messages written before the peer closed are delivered.
+ * Returns 1 if the ring is empty or 0 if hung up.
+ */
+static int shm_receive(struct afb_shm *shm)
+{
+	struct ring *rx = shm->rx;
+	uint32_t closed, tail, avail, count, offset, part, size = shm->mask + 1;
+	char *dest, *msg;
+
+	for (;;) {
+		/* closed is read first because it is set after the last tail */
+		closed = __atomic_load_n(&rx->closed, __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&rx->tail, __ATOMIC_SEQ_CST);
+		avail = tail - shm->rxhead;
+		if (avail == 0) {
+			if (closed) {
+				shm_disconnect(shm, 1);
+				return 0;
+			}
+			return 1;
+		}
+		if (avail > size) {
+			shm_disconnect(shm, 1);
+			return 0;
+		}
+
+		/* get the length or the data */
+		if (shm->lenpos < sizeof shm->lenbuf) {
+			dest = &shm->lenbuf[shm->lenpos];
+			count = (uint32_t)sizeof shm->lenbuf - shm->lenpos;
+		} else {
+			dest = &shm->msg[shm->msgpos];
+			count = shm->msglen - shm->msgpos;
+		}
+		if (count > avail)
+			count = avail;
+		offset = shm->rxhead & shm->mask;
+		part = size - offset;
+		if (part >= count)
+			memcpy(dest, &shm->rxdata[offset], count);
+		else {
+			memcpy(dest, &shm->rxdata[offset], part);
+			memcpy(&dest[part], shm->rxdata, count - part);
+		}
+
+		/* release the room */
+		shm->rxhead += count;
+		__atomic_store_n(&rx->head, shm->rxhead, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&rx->blocked, __ATOMIC_SEQ_CST))
+			futex_wake(&rx->head);
+
+		/* process the received bytes */
+		if (shm->lenpos < sizeof shm->lenbuf) {
+			shm->lenpos += count;
+			if (shm->lenpos < sizeof shm->lenbuf)
+				continue;
+			memcpy(&shm->msglen, shm->lenbuf, sizeof shm->msglen);
+			if (shm->msglen > SHM_MESSAGE_MAX) {
+				shm_disconnect(shm, 1);
+				return 0;
+			}
+			shm->msg = malloc(shm->msglen + 1);
+			if (shm->msg == NULL) {
+				shm_disconnect(shm, 1);
+				return 0;
+			}
+			shm->msgpos = 0;
+		} else
+			shm->msgpos += count;
+
+		if (shm->msgpos == shm->msglen) {
+			/* the message is complete */
+			msg = shm->msg;
+			msg[shm->msglen] = 0;
+			shm->msg = NULL;
+			shm->lenpos = 0;
+			shm->itf->on_binary(shm->closure, msg, shm->msglen);
+			if (shm->hungup)
+				return 0;
+		}
+	}
+}
+
+/*
+ * callback on wake up of the reader
+ */
+static void shm_on_event(void *closure, uint32_t revents, struct fdev *fdev)
+{
+	struct afb_shm *shm = closure;
+	uint64_t count;
+	ssize_t rc;
+
+	rc = read(fdev_fd(fdev), &count, sizeof count);
+	(void)rc;
+
+	for (;;) {
+		__atomic_store_n(&shm->rx->sleeping, 0, __ATOMIC_RELAXED);
+		if (!shm_receive(shm))
+			return;
+		/* sleep only if the writer can see it */
+		__atomic_store_n(&shm->rx->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&shm->rx->tail, __ATOMIC_SEQ_CST) == shm->rxhead)
+			return;
+	}
+}
+
+/*
+ * callback on events of the socket: only hangups are expected
+ */
+static void shm_on_socket(void *closure, uint32_t revents, struct fdev *fdev)
+{
+	struct afb_shm *shm = closure;
+	char buffer[64];
+	ssize_t rc;
+
+	if ((revents & EPOLLIN) != 0) {
+		do {
+			rc = read(fdev_fd(fdev), buffer, sizeof buffer);
+		} while (rc < 0 && errno == EINTR);
+		if (rc == 0 || (rc < 0 && errno != EAGAIN))
+			revents |= EPOLLHUP;
+	}
+	/* deliver the messages written before the hangup */
+	if ((revents & EPOLLHUP) != 0 && shm_receive(shm))
+		afb_shm_hangup(shm);
+}
+
+/*
+ * Creates an afb_shm for the socket of 'fdev' without memory.
+ * The socket is watched for hangups.
+ * In case of error, 'fdev' is released.
+ */
+static struct afb_shm *shm_create(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure)
+{
+	struct afb_shm *shm;
+
+	shm = calloc(1, sizeof *shm);
+	if (shm == NULL) {
+		fdev_unref(fdev);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	shm->itf = itf;
+	shm->closure = closure;
+	shm->fdev = fdev;
+	shm->sockfd = fdev_fd(fdev);
+	shm->txefd = -1;
+	fdev_set_events(fdev, EPOLLIN);
+	fdev_set_callback(fdev, shm_on_socket, shm);
+	return shm;
+}
+
+/*
+ * Sets up 'shm' for using the memory 'map' of rings of 'size',
+ * reading the ring 'rxindex' awaken by 'rxefd' and writing the other
+ * ring that has its reader awaken by 'txefd'.
+ * In case of error, the memory and the file descriptors are released.
+ * Returns 0 on success or -1 on error.
+ */
+static int shm_setup(struct afb_shm *shm, void *map, uint32_t size, int rxindex, int rxefd, int txefd)
+{
+	shm->efdev = fdev_sibling(shm->fdev, rxefd);
+	if (shm->efdev == NULL) {
+		close(rxefd);
+		close(txefd);
+		munmap(map, map_size(size));
+		return -1;
+	}
+
+	shm->txefd = txefd;
+	shm->mapsize = map_size(size);
+	shm->mask = size - 1;
+	shm->rx = ring_at(map, size, rxindex, &shm->rxdata);
+	shm->tx = ring_at(map, size, !rxindex, &shm->txdata);
+	shm->rxhead = __atomic_load_n(&shm->rx->head, __ATOMIC_RELAXED);
+	shm->txtail = __atomic_load_n(&shm->tx->tail, __ATOMIC_RELAXED);
+	__atomic_store_n(&shm->map, map, __ATOMIC_RELEASE);
+
+	fdev_set_events(shm->efdev, EPOLLIN);
+	fdev_set_callback(shm->efdev, shm_on_event, shm);
+	fdev_set_callback(shm->fdev, shm_on_socket, shm);
+	return 0;
+}
+
+/*
+ * Creates the client side of a shared memory channel on the
+ * connected socket of 'fdev': the shared memory and the eventfds
+ * are created and sent to the server.
+ * Returns the created afb_shm or NULL on error.
+ */
+struct afb_shm *afb_shm_create_client(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure)
+{
+	int memfd, efds[2], fds[3];
+	void *map;
+	struct ring *ring;
+	char *data;
+	struct afb_shm *shm;
+	struct hello hello;
+	struct iovec iov;
+	struct msghdr msg;
+	union {
+		struct cmsghdr cmsg;
+		char buffer[CMSG_SPACE(sizeof fds)];
+	} control;
+	ssize_t rc;
+
+	/* create the shared memory, sealed for the server */
+	memfd = memfd_create("afb-shm", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+	if (memfd < 0)
+		goto error;
+	if (ftruncate(memfd, (off_t)map_size(SHM_RING_SIZE)) < 0
+	 || fcntl(memfd, F_ADD_SEALS, SHM_SEALS) < 0)
+		goto error2;
+	map = mmap(NULL, map_size(SHM_RING_SIZE), PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (map == MAP_FAILED)
+		goto error2;
+	ring = ring_at(map, SHM_RING_SIZE, 0, &data);
+	ring->sleeping = 1;
+	ring = ring_at(map, SHM_RING_SIZE, 1, &data);
+	ring->sleeping = 1;
+
+	/* create the eventfds: efds[0] for the ring 0 read by the server */
+	efds[0] = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	if (efds[0] < 0)
+		goto error3;
+	efds[1] = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	if (efds[1] < 0)
+		goto error4;
+
+	/* send the hello */
+	memset(&hello, 0, sizeof hello);
+	memcpy(hello.magic, SHM_MAGIC, sizeof hello.magic);
+	hello.size = SHM_RING_SIZE;
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof hello;
+	fds[0] = memfd;
+	fds[1] = efds[0];
+	fds[2] = efds[1];
+	memset(&msg, 0, sizeof msg);
+	memset(&control, 0, sizeof control);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof control.buffer;
+	control.cmsg.cmsg_level = SOL_SOCKET;
+	control.cmsg.cmsg_type = SCM_RIGHTS;
+	control.cmsg.cmsg_len = CMSG_LEN(sizeof fds);
+	memcpy(CMSG_DATA(&control.cmsg), fds, sizeof fds);
+	do {
+		rc = sendmsg(fdev_fd(fdev), &msg, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+	if (rc != (ssize_t)sizeof hello)
+		goto error5;
+
+	close(memfd);
+	shm = shm_create(fdev, itf, closure);
+	if (shm == NULL) {
+		close(efds[0]);
+		close(efds[1]);
+		munmap(map, map_size(SHM_RING_SIZE));
+		return NULL;
+	}
+	if (shm_setup(shm, map, SHM_RING_SIZE, 1, efds[1], efds[0]) < 0) {
+		afb_shm_destroy(shm);
+		return NULL;
+	}
+	return shm;
+
+error5:
+	close(efds[1]);
+error4:
+	close(efds[0]);
+error3:
+	munmap(map, map_size(SHM_RING_SIZE));
+error2:
+	close(memfd);
+error:
+	fdev_unref(fdev);
+	return NULL;
+}
+
+/*
+ * callback on events of the socket of the server until the hello
+ * of the client is received: the shared memory and the eventfds
+ * are received and checked.
+ */
+static void shm_on_hello(void *closure, uint32_t revents, struct fdev *fdev)
+{
+	struct afb_shm *shm = closure;
+	int i, fd, nfds, extra, seals, fds[3];
+	size_t count;
+	void *map;
+	struct hello hello;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct stat st;
+	union {
+		struct cmsghdr cmsg;
+		char buffer[CMSG_SPACE(sizeof fds)];
+	} control;
+	ssize_t rc;
+
+	/* receive the hello */
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof hello;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof control.buffer;
+	do {
+		rc = recvmsg(fdev_fd(fdev), &msg, MSG_CMSG_CLOEXEC);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0) {
+		if (errno != EAGAIN || (revents & EPOLLHUP) != 0)
+			goto error;
+		return;
+	}
+
+	/* get the file descriptors, closing the ones in excess */
+	nfds = extra = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg) ; cmsg ; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+		 && cmsg->cmsg_len >= CMSG_LEN(0)) {
+			count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof fd;
+			for (i = 0 ; i < (int)count ; i++) {
+				memcpy(&fd, CMSG_DATA(cmsg) + (size_t)i * sizeof fd, sizeof fd);
+				if (nfds < 3)
+					fds[nfds++] = fd;
+				else {
+					close(fd);
+					extra = 1;
+				}
+			}
+		}
+	}
+
+	/* check the hello, the memory must be sealed for its size */
+	if (rc != (ssize_t)sizeof hello
+	 || (msg.msg_flags & MSG_CTRUNC)
+	 || nfds != 3
+	 || extra
+	 || memcmp(hello.magic, SHM_MAGIC, sizeof hello.magic)
+	 || hello.size < SHM_RING_SIZE_MIN
+	 || hello.size > SHM_RING_SIZE_MAX
+	 || (hello.size & (hello.size - 1))
+	 || (seals = fcntl(fds[0], F_GET_SEALS)) < 0
+	 || (seals & SHM_SEALS) != SHM_SEALS
+	 || fstat(fds[0], &st) < 0
+	 || (size_t)st.st_size != map_size(hello.size))
+		goto error2;
+
+	/* map the shared memory */
+	map = mmap(NULL, map_size(hello.size), PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (map == MAP_FAILED)
+		goto error2;
+
+	close(fds[0]);
+	if (shm_setup(shm, map, hello.size, 0, fds[1], fds[2]) < 0)
+		goto error;
+	return;
+
+error2:
+	for (i = 0 ; i < nfds ; i++)
+		close(fds[i]);
+error:
+	afb_shm_hangup(shm);
+}
+
+/*
+ * Creates the server side of a shared memory channel on the
+ * accepted socket of 'fdev': the shared memory and the eventfds
+ * are received from the client by the event loop. Until then,
+ * sending fails with ENOTCONN.
+ * Returns the created afb_shm or NULL on error.
+ */
+struct afb_shm *afb_shm_create_server(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure)
+{
+	struct afb_shm *shm;
+
+	shm = shm_create(fdev, itf, closure);
+	if (shm != NULL)
+		fdev_set_callback(fdev, shm_on_hello, shm);
+	return shm;
+}
+
+/*
+ * Destroys the channel 'shm'
+ * It first hangup (but without calling on_hangup for safety reasons)
+ * if needed.
+ */
+void afb_shm_destroy(struct afb_shm *shm)
+{
+	shm_disconnect(shm, 0);
+	if (shm->map != NULL) {
+		close(shm->txefd);
+		munmap(shm->map, shm->mapsize);
+	}
+	free(shm);
+}
+
+/*
+ * Hangup the channel 'shm'
+ */
+void afb_shm_hangup(struct afb_shm *shm)
+{
+	shm_disconnect(shm, 1);
+}
+
+/*
+ * Is the channel 'shm' still connected ?
+ */
+int afb_shm_is_connected(struct afb_shm *shm)
+{
+	return !shm->hungup;
+}
+
+/*
+ * Sends a binary 'data' of 'length' to the endpoint of 'shm'.
+ * Returns 0 on success or -1 in case of error.
+ */
+int afb_shm_binary(struct afb_shm *shm, const void *data, size_t length)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void*)data;
+	iov.iov_len = length;
+	return shm_send(shm, &iov, 1);
+}
+
+/*
+ * Sends a binary data described in the 'count' 'iovec' to the endpoint of 'shm'.
+ * Returns 0 on success or -1 in case of error.
+ */
+int afb_shm_binary_v(struct afb_shm *shm, const struct iovec *iovec, int count)
+{
+	return shm_send(shm, iovec, count);
+}
+
+/*
+ * Corks the channel 'shm': until it is uncorked, the reader
+ * is not awaken for the messages sent.
+ * Corks are counted: the reader is awaken on the last uncork.
+ */
+void afb_shm_cork(struct afb_shm *shm)
+{
+	shm->corked++;
+}
+
+/*
+ * Uncorks the channel 'shm' and wakes up the reader
+ * if it is the last uncork.
+ * Returns 0 on success or -1 in case of error.
+ */
+int afb_shm_uncork(struct afb_shm *shm)
+{
+	if (shm->corked != 0 && --shm->corked == 0 && shm->notify && !shm->hungup)
+		shm_notify(shm);
+	return 0;
+}
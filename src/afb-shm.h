@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Channel of binary messages between processes of the same host.
+ *
+ * The messages are exchanged through two rings, one per direction,
+ * of a shared memory. The memory and the eventfds used for waking up
+ * the readers are transmitted by the client through the connected
+ * unix socket given at creation. The memory must be sealed against
+ * resizing. The server receives them from its event loop and fails
+ * to send with ENOTCONN until then. The socket is then only used for
+ * detecting hangups.
+ *
+ * The interface is the same as the one of afb_ws for binary messages.
+ * Writers must be serialized by the caller.
+ */
+
+struct afb_shm;
+struct afb_ws_itf;
+struct fdev;
+struct iovec;
+
+extern struct afb_shm *afb_shm_create_client(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure);
+extern struct afb_shm *afb_shm_create_server(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure);
+extern void afb_shm_destroy(struct afb_shm *shm);
+extern void afb_shm_hangup(struct afb_shm *shm);
+extern int afb_shm_is_connected(struct afb_shm *shm);
+extern int afb_shm_binary(struct afb_shm *shm, const void *data, size_t length);
+extern int afb_shm_binary_v(struct afb_shm *shm, const struct iovec *iovec, int count);
+extern void afb_shm_cork(struct afb_shm *shm);
+extern int afb_shm_uncork(struct afb_shm *shm);
@@ -37,6 +37,11 @@
 
 #define BACKLOG  5
 
+/**
+ * The default backlog of listening sockets
+ */
+static int default_backlog = BACKLOG;
+
 /******************************************************************************/
 
 /**
@@ -69,6 +74,9 @@ struct entry
 
 	/** should not call listen for servers */
 	unsigned nolisten: 1;
+
+	/** the messages are exchanged through shared memory */
+	unsigned shm: 1;
 };
 
 /**
@@ -88,6 +96,11 @@ static struct entry entries[] = {
 	{
 		.prefix = "unix:",
 		.type = Type_Unix
+	},
+	{
+		.prefix = "shm:",
+		.type = Type_Unix,
+		.shm = 1
 	}
 };
 
@@ -95,7 +108,24 @@ static struct entry entries[] = {
  * It is possible to set explicit api name instead of using the
  * default one.
  */
-static const char as_api[] = "?as-api=";
+static const char as_api[] = "as-api";
+
+/**
+ * It is also possible to set a list of api names, comma separated,
+ * for sockets serving many apis.
+ */
+static const char as_apis[] = "apis";
+
+/**
+ * The backlog of listening sockets can be set.
+ */
+static const char backlog_param[] = "backlog";
+
+/**
+ * Listening sockets can be shared with other processes
+ * using SO_REUSEPORT.
+ */
+static const char reuseport_param[] = "reuseport";
 
 /******************************************************************************/
 
@@ -155,12 +185,13 @@ static int open_unix(const char *spec, int server)
  *
  * @param spec the specification of the host:port/...
  * @param server 0 for client, server otherwise
+ * @param reuseport for servers, not 0 for sharing the port with SO_REUSEPORT
  *
  * @return the file descriptor number of the socket or -1 in case of error
  */
-static int open_tcp(const char *spec, int server)
+static int open_tcp(const char *spec, int server, int reuseport)
 {
-	int rc, fd;
+	int rc, fd, one;
 	const char *service, *host, *tail;
 	struct addrinfo hint, *rai, *iai;
 
@@ -190,6 +221,10 @@ static int open_tcp(const char *spec, int server)
 		fd = socket(iai->ai_family, iai->ai_socktype, iai->ai_protocol);
 		if (fd >= 0) {
 			if (server) {
+				if (reuseport) {
+					one = 1;
+					setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one);
+				}
 				rc = bind(fd, iai->ai_addr, iai->ai_addrlen);
 			} else {
 				rc = connect(fd, iai->ai_addr, iai->ai_addrlen);
@@ -225,6 +260,35 @@ static int open_systemd(const char *spec)
 
 /******************************************************************************/
 
+/**
+ * Search a parameter in the query of the uri. The query starts
+ * with a question mark and its parameters are separated by ampersands.
+ *
+ * @param uri the searched uri
+ * @param name the name of the parameter
+ * @param length where to store the length of the value (can be NULL)
+ *
+ * @return the value of the parameter, an empty value if the parameter
+ * has no value, or NULL if the parameter is not found
+ */
+static const char *get_query_param(const char *uri, const char *name, size_t *length)
+{
+	const char *iter, *value;
+	size_t len;
+
+	len = strlen(name);
+	for (iter = strchr(uri, '?') ; iter ; iter = strchr(iter, '&')) {
+		iter++;
+		if (!strncmp(iter, name, len) && strchr("=&", iter[len])) {
+			value = &iter[len + (iter[len] == '=')];
+			if (length)
+				*length = strcspn(value, "&");
+			return value;
+		}
+	}
+	return NULL;
+}
+
 /**
  * Get the entry of the uri by searching to its prefix
  *
@@ -262,18 +326,30 @@ static struct entry *get_entry(const char *uri, int *offset)
  */
 static int open_uri(const char *uri, int server)
 {
-	int fd, rc, offset;
+	int fd, rc, offset, backlog, reuseport;
 	struct entry *e;
-	const char *api;
+	const char *query, *value;
 
 	/* search for the entry */
 	e = get_entry(uri, &offset);
 
-	/* get the names */
+	/* get the options */
 	uri += offset;
-	api = strstr(uri, as_api);
-	if (api)
-		uri = strndupa(uri, api - uri);
+	backlog = default_backlog;
+	value = get_query_param(uri, backlog_param, NULL);
+	if (value) {
+		backlog = atoi(value);
+		if (backlog <= 0) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	reuseport = get_query_param(uri, reuseport_param, NULL) != NULL;
+
+	/* remove the query */
+	query = strchr(uri, '?');
+	if (query)
+		uri = strndupa(uri, query - uri);
 
 	/* open the socket */
 	switch (e->type) {
@@ -281,7 +357,7 @@ static int open_uri(const char *uri, int server)
 		fd = open_unix(uri, server);
 		break;
 	case Type_Inet:
-		fd = open_tcp(uri, server);
+		fd = open_tcp(uri, server, reuseport);
 		break;
 	case Type_Systemd:
 		if (server)
@@ -308,7 +384,7 @@ static int open_uri(const char *uri, int server)
 			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &rc, sizeof rc);
 		}
 		if (!e->nolisten)
-			listen(fd, BACKLOG);
+			listen(fd, backlog);
 	}
 	return fd;
 }
@@ -359,29 +435,64 @@ struct fdev *afb_socket_open_fdev(const char *uri, int server)
  * Get the api name of the uri
  *
  * @param uri the specification of the socket
+ * @param length where to store the length of the name
  *
  * @return the api name or NULL if none can be deduced
  */
-const char *afb_socket_api(const char *uri)
+const char *afb_socket_api(const char *uri, size_t *length)
 {
 	int offset;
-	const char *api;
+	const char *api, *end;
 	struct entry *entry;
 
-	entry = get_entry(uri, &offset);
-	uri += offset;
-	uri += (entry->type == Type_Unix && *uri == '@');
-	api = strstr(uri, as_api);
-	if (api)
-		api += sizeof as_api - 1;
-	else {
-		api = strrchr(uri, '/');
-		if (api)
-			api++;
-		else
-			api = uri;
-		if (strchr(api, ':'))
+	api = get_query_param(uri, as_api, length);
+	if (api == NULL && get_query_param(uri, as_apis, NULL) == NULL) {
+		/* the last item of the path */
+		entry = get_entry(uri, &offset);
+		uri += offset;
+		uri += (entry->type == Type_Unix && *uri == '@');
+		end = strchrnul(uri, '?');
+		for (api = end ; api != uri && api[-1] != '/' ; api--);
+		*length = (size_t)(end - api);
+		if (memchr(api, ':', *length))
 			api = NULL;
 	}
 	return api;
 }
+
+/**
+ * Get the list of api names of the uri
+ *
+ * @param uri the specification of the socket
+ * @param length where to store the length of the list
+ *
+ * @return the comma separated list of api names or NULL if none is given
+ */
+const char *afb_socket_apis(const char *uri, size_t *length)
+{
+	return get_query_param(uri, as_apis, length);
+}
+
+/**
+ * Is the uri for exchanging messages through shared memory?
+ *
+ * @param uri the specification of the socket
+ *
+ * @return 1 if the messages are exchanged through shared memory or 0 otherwise
+ */
+int afb_socket_is_shm(const char *uri)
+{
+	int offset;
+
+	return get_entry(uri, &offset)->shm;
+}
+
+/**
+ * Set the default backlog of the listening sockets
+ *
+ * @param backlog the default backlog
+ */
+void afb_socket_set_backlog(int backlog)
+{
+	default_backlog = backlog;
+}
@@ -17,10 +17,18 @@
 
 #pragma once
 
+#include <stddef.h>
+
 struct fdev;
 
 extern int afb_socket_open(const char *uri, int server);
 
 extern struct fdev *afb_socket_open_fdev(const char *uri, int server);
 
-extern const char *afb_socket_api(const char *uri);
+extern const char *afb_socket_api(const char *uri, size_t *length);
+
+extern const char *afb_socket_apis(const char *uri, size_t *length);
+
+extern int afb_socket_is_shm(const char *uri);
+
+extern void afb_socket_set_backlog(int backlog);
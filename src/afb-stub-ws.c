@@ -23,6 +23,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 #include <endian.h>
 #include <netdb.h>
 #include <sys/types.h>
@@ -43,12 +44,26 @@
 #include "afb-context.h"
 #include "afb-evt.h"
 #include "afb-xreq.h"
+#include "idmap.h"
+#include "slab.h"
 #include "verbose.h"
 #include "fdev.h"
 #include "jobs.h"
 
+/* bounds in ms of the delay before retrying to reopen a client */
+#define RETRY_DELAY_MIN		100
+#define RETRY_DELAY_MAX		30000
+
 struct afb_stub_ws;
 
+/**
+ * structure for the apis of a stub
+ */
+struct stub_api
+{
+	struct afb_stub_ws *stubws;	/**< the stub */
+	const char *name;		/**< the api name */
+};
 
 /**
  * structure for a ws request: requests on server side
@@ -75,7 +90,7 @@ struct client_event
  */
 struct client_describe
 {
-	struct afb_stub_ws *stubws;	/**< the stub */
+	struct stub_api *api;		/**< the described api */
 	struct jobloop *jobloop;	/**< the jobloop to leave */
 	struct json_object *result;	/**< result */
 };
@@ -87,6 +102,7 @@ struct server_describe
 {
 	struct afb_stub_ws *stubws;
 	struct afb_proto_ws_describe *describe;
+	const char *apiname;
 };
 
 /**
@@ -98,6 +114,17 @@ struct server_session
 	struct afb_session *session;
 };
 
+/**
+ * structure for recording the contexts defined by clients
+ */
+struct server_context
+{
+	struct afb_session *session;	/**< the session */
+	struct afb_cred *cred;		/**< the credentials of calls */
+	uint8_t created;		/**< session created but not yet signaled */
+	char sessionid[];		/**< the session identifier */
+};
+
 /******************* stub description for client or servers ******************/
 
 struct afb_stub_ws
@@ -111,6 +138,9 @@ struct afb_stub_ws
 	/* on hangup callback */
 	void (*on_hangup)(struct afb_stub_ws *);
 
+	/* protection of contexts (server) or of reopening (client) */
+	pthread_mutex_t mutex;
+
 	union {
 		/* server side */
 		struct {
@@ -122,6 +152,9 @@ struct afb_stub_ws
 
 			/* credentials of the client */
 			struct afb_cred *cred;
+
+			/* contexts defined by the client, by handle */
+			struct idmap contexts;
 		};
 
 		/* client side */
@@ -131,9 +164,12 @@ struct afb_stub_ws
 
 			/* robustify */
 			struct {
-				struct fdev *(*reopen)(void*);
+				int (*reopen)(void*, void (*)(void*, struct fdev*), void*);
 				void *closure;
 				void (*release)(void*);
+				uint64_t retry;	/* time of the next reopen in ms */
+				unsigned delay;	/* delay before retrying in ms */
+				uint8_t reopening; /* a reopen is pending */
 			} robust;
 		};
 	};
@@ -144,8 +180,17 @@ struct afb_stub_ws
 	/* type of the stub: 0=server, 1=client */
 	uint8_t is_client;
 
-	/* the api name */
-	char apiname[1];
+	/* are the apis explicitly named in calls? */
+	uint8_t named_apis;
+
+	/* are the messages exchanged through shared memory? */
+	uint8_t shm;
+
+	/* count of apis */
+	uint16_t apicount;
+
+	/* the apis, the first is the default one, their names follow */
+	struct stub_api apis[1];
 };
 
 static struct afb_proto_ws *afb_stub_ws_create_proto(struct afb_stub_ws *stubws, struct fdev *fdev, uint8_t server);
@@ -162,7 +207,7 @@ static void server_req_destroy_cb(struct afb_xreq *xreq)
 	json_object_put(wreq->xreq.json);
 	afb_proto_ws_call_unref(wreq->call);
 	afb_stub_ws_unref(wreq->stubws);
-	free(wreq);
+	slab_free(wreq, sizeof *wreq);
 }
 
 static void server_req_reply_cb(struct afb_xreq *xreq, struct json_object *obj, const char *error, const char *info)
@@ -176,6 +221,16 @@ static void server_req_reply_cb(struct afb_xreq *xreq, struct json_object *obj,
 	json_object_put(obj);
 }
 
+static void server_req_reply_buffer_cb(struct afb_xreq *xreq, const char *buffer, size_t size, const char *error, const char *info)
+{
+	int rc;
+	struct server_req *wreq = CONTAINER_OF_XREQ(struct server_req, xreq);
+
+	rc = afb_proto_ws_call_reply_buffer(wreq->call, buffer, size, error, info);
+	if (rc < 0)
+		ERROR("error while sending reply");
+}
+
 static int server_req_subscribe_cb(struct afb_xreq *xreq, struct afb_event_x2 *event)
 {
 	int rc;
@@ -205,6 +260,7 @@ static int server_req_unsubscribe_cb(struct afb_xreq *xreq, struct afb_event_x2
 
 static const struct afb_xreq_query_itf server_req_xreq_itf = {
 	.reply = server_req_reply_cb,
+	.reply_buffer = server_req_reply_buffer_cb,
 	.unref = server_req_destroy_cb,
 	.subscribe = server_req_subscribe_cb,
 	.unsubscribe = server_req_unsubscribe_cb
@@ -238,40 +294,104 @@ static struct client_event *client_event_search(struct afb_stub_ws *stubws, uint
 	return ev;
 }
 
+/* current time in ms of the monotonic clock */
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Completion of the reopening of the client with the connected 'fdev'
+ * or NULL on failure. After a failure, no reopen is tried until a
+ * delay doubling at each failure is elapsed.
+ */
+static void client_on_reopen(void *closure, struct fdev *fdev)
+{
+	struct afb_stub_ws *stubws = closure;
+	struct afb_proto_ws *proto;
+	unsigned delay;
+
+	pthread_mutex_lock(&stubws->mutex);
+	proto = NULL;
+	if (fdev != NULL) {
+		proto = afb_stub_ws_create_proto(stubws, fdev, 0);
+		if (proto == NULL)
+			fdev_unref(fdev);
+	}
+	if (proto != NULL)
+		stubws->robust.delay = 0;
+	else {
+		delay = stubws->robust.delay << 1;
+		delay = delay < RETRY_DELAY_MIN ? RETRY_DELAY_MIN : delay > RETRY_DELAY_MAX ? RETRY_DELAY_MAX : delay;
+		stubws->robust.delay = delay;
+		stubws->robust.retry = now_ms() + delay;
+	}
+	stubws->robust.reopening = 0;
+	pthread_mutex_unlock(&stubws->mutex);
+	afb_stub_ws_unref(stubws);
+}
+
+/*
+ * Get the protocol. When it is lost, its reopening is started in
+ * background and the calls fail until it completes.
+ */
 static struct afb_proto_ws *client_get_proto(struct afb_stub_ws *stubws)
 {
-	struct fdev *fdev;
 	struct afb_proto_ws *proto;
+	int start;
 
 	proto = stubws->proto;
-	if (proto == NULL && stubws->robust.reopen) {
-		fdev = stubws->robust.reopen(stubws->robust.closure);
-		if (fdev != NULL)
-			proto = afb_stub_ws_create_proto(stubws, fdev, 0);
+	if (proto != NULL || !stubws->robust.reopen)
+		return proto;
+
+	/* the apis of the stub can be called concurrently */
+	pthread_mutex_lock(&stubws->mutex);
+	proto = stubws->proto;
+	start = proto == NULL && stubws->robust.reopen
+		&& !stubws->robust.reopening && now_ms() >= stubws->robust.retry;
+	if (start) {
+		stubws->robust.reopening = 1;
+		afb_stub_ws_addref(stubws);
 	}
+	pthread_mutex_unlock(&stubws->mutex);
+
+	/* the connection is made without holding the mutex */
+	if (start && stubws->robust.reopen(stubws->robust.closure, client_on_reopen, stubws) < 0)
+		client_on_reopen(stubws, NULL);
 	return proto;
 }
 
+/* name of the api to transmit: none when the stub was created for one api */
+static const char *client_api_name(struct stub_api *api)
+{
+	return api->stubws->named_apis ? api->name : NULL;
+}
+
 /* on call, propagate it to the ws service */
 static void client_api_call_cb(void * closure, struct afb_xreq *xreq)
 {
 	int rc;
-	struct afb_stub_ws *stubws = closure;
+	struct stub_api *api = closure;
 	struct afb_proto_ws *proto;
 
-	proto = client_get_proto(stubws);
+	proto = client_get_proto(api->stubws);
 	if (proto == NULL) {
 		afb_xreq_reply(xreq, NULL, "disconnected", "server hung up");
 		return;
 	}
 
-	rc = afb_proto_ws_client_call(
+	rc = afb_proto_ws_client_api_call(
 			proto,
+			client_api_name(api),
 			xreq->request.called_verb,
 			afb_xreq_json(xreq),
 			afb_session_uuid(xreq->context.session),
 			xreq,
-			xreq_on_behalf_cred_export(xreq));
+			xreq_on_behalf_cred_export(xreq),
+			afb_xreq_budget(xreq));
 	if (rc >= 0)
 		afb_xreq_unhooked_addref(xreq);
 	else
@@ -291,12 +411,12 @@ static void client_send_describe_cb(int signum, void *closure, struct jobloop *j
 	struct client_describe *desc = closure;
 	struct afb_proto_ws *proto;
 
-	proto = client_get_proto(desc->stubws);
+	proto = client_get_proto(desc->api->stubws);
 	if (signum || proto == NULL)
 		jobs_leave(jobloop);
 	else {
 		desc->jobloop = jobloop;
-		afb_proto_ws_client_describe(proto, client_on_description_cb, desc);
+		afb_proto_ws_client_api_describe(proto, client_api_name(desc->api), client_on_description_cb, desc);
 	}
 }
 
@@ -306,7 +426,7 @@ static struct json_object *client_api_describe_cb(void * closure)
 	struct client_describe desc;
 
 	/* synchronous job: send the request and wait its result */
-	desc.stubws = closure;
+	desc.api = closure;
 	desc.result = NULL;
 	jobs_enter(NULL, 0, client_send_describe_cb, &desc);
 	return desc.result;
@@ -504,45 +624,203 @@ static void server_release_all_sessions(struct afb_stub_ws *stubws)
 
 /*****************************************************/
 
-static void server_on_call_cb(void *closure, struct afb_proto_ws_call *call, const char *verb, struct json_object *args, const char *sessionid, const char *user_creds)
+/* search the served api of 'name', NULL for the default one */
+static const char *server_api_name(struct afb_stub_ws *stubws, const char *name)
 {
-	struct afb_stub_ws *stubws = closure;
-	struct server_req *wreq;
+	uint16_t i;
 
-	afb_stub_ws_addref(stubws);
+	if (!name)
+		return stubws->apis[0].name;
+
+	for (i = 0 ; i < stubws->apicount ; i++)
+		if (!strcmp(name, stubws->apis[i].name))
+			return stubws->apis[i].name;
+
+	return NULL;
+}
+
+/* creates the request for the 'call' to the 'api' */
+static struct server_req *server_req_create(struct afb_stub_ws *stubws, struct afb_proto_ws_call *call, const char *api, const char *verb, struct json_object *args)
+{
+	struct server_req *wreq;
+	const char *apiname;
+	uint32_t budget;
+
+	/* check the api */
+	apiname = server_api_name(stubws, api);
+	if (apiname == NULL) {
+		json_object_put(args);
+		afb_proto_ws_call_reply(call, NULL, "unknown-api", api);
+		afb_proto_ws_call_unref(call);
+		return NULL;
+	}
 
 	/* create the request */
-	wreq = malloc(sizeof *wreq);
-	if (wreq == NULL)
-		goto out_of_memory;
+	wreq = slab_alloc(sizeof *wreq);
+	if (wreq == NULL) {
+		json_object_put(args);
+		afb_proto_ws_call_reply(call, NULL, "internal-error", NULL);
+		afb_proto_ws_call_unref(call);
+		return NULL;
+	}
 
 	afb_xreq_init(&wreq->xreq, &server_req_xreq_itf);
 	wreq->stubws = stubws;
 	wreq->call = call;
+	wreq->xreq.request.called_api = apiname;
+	wreq->xreq.request.called_verb = verb;
+	wreq->xreq.json = args;
+	budget = afb_proto_ws_call_budget(call);
+	if (budget)
+		afb_xreq_set_budget(&wreq->xreq, budget);
+	return wreq;
+}
+
+/* releases the request not processed */
+static void server_req_cancel(struct server_req *wreq)
+{
+	json_object_put(wreq->xreq.json);
+	afb_proto_ws_call_reply(wreq->call, NULL, "internal-error", NULL);
+	afb_proto_ws_call_unref(wreq->call);
+	slab_free(wreq, sizeof *wreq);
+}
+
+static void server_on_call_cb(void *closure, struct afb_proto_ws_call *call, const char *api, const char *verb, struct json_object *args, const char *sessionid, const char *user_creds)
+{
+	struct afb_stub_ws *stubws = closure;
+	struct server_req *wreq;
+
+	/* create the request */
+	wreq = server_req_create(stubws, call, api, verb, args);
+	if (wreq == NULL)
+		return;
 
 	/* init the context */
-	if (afb_context_connect(&wreq->xreq.context, sessionid, NULL) < 0)
-		goto unconnected;
+	if (afb_context_connect(&wreq->xreq.context, sessionid, NULL) < 0) {
+		server_req_cancel(wreq);
+		return;
+	}
 	wreq->xreq.context.validated = 1;
 	server_record_session(stubws, wreq->xreq.context.session);
 	if (wreq->xreq.context.created)
 		afb_session_set_autoclose(wreq->xreq.context.session, 1);
 
 	/* makes the call */
+	afb_stub_ws_addref(stubws);
 	wreq->xreq.cred = afb_cred_mixed_on_behalf_import(stubws->cred, sessionid, user_creds);
-	wreq->xreq.request.called_api = stubws->apiname;
-	wreq->xreq.request.called_verb = verb;
-	wreq->xreq.json = args;
 	afb_xreq_process(&wreq->xreq, stubws->apiset);
-	return;
+}
 
-unconnected:
-	free(wreq);
-out_of_memory:
-	json_object_put(args);
-	afb_stub_ws_unref(stubws);
-	afb_proto_ws_call_reply(call, NULL, "internal-error", NULL);
-	afb_proto_ws_call_unref(call);
+/* get the session of the 'context', renewing it if closed */
+static int server_context_session(struct server_context *context)
+{
+	int created;
+	struct afb_session *session;
+
+	if (context->session == NULL || afb_session_is_closed(context->session)) {
+		session = afb_session_get(context->sessionid, AFB_SESSION_TIMEOUT_DEFAULT, &created);
+		if (session == NULL)
+			return -1;
+		if (created) {
+			afb_session_set_autoclose(session, 1);
+			context->created = 1;
+		}
+		afb_session_unref(context->session);
+		context->session = session;
+	}
+	return 0;
+}
+
+/* releases the 'context' */
+static void server_context_destroy(struct server_context *context)
+{
+	afb_session_unref(context->session);
+	afb_cred_unref(context->cred);
+	free(context);
+}
+
+static void server_context_destroy_cb(void *closure, uint32_t handle, void *value)
+{
+	server_context_destroy(value);
+}
+
+static void server_release_all_contexts(struct afb_stub_ws *stubws)
+{
+	struct idmap contexts;
+
+	pthread_mutex_lock(&stubws->mutex);
+	idmap_move(&contexts, &stubws->contexts);
+	pthread_mutex_unlock(&stubws->mutex);
+
+	idmap_for_all(&contexts, server_context_destroy_cb, NULL);
+	idmap_release(&contexts);
+}
+
+/* records the context of 'handle', the credentials are checked once here */
+static void server_on_context_set_cb(void *closure, uint32_t handle, const char *sessionid, const char *user_creds)
+{
+	struct afb_stub_ws *stubws = closure;
+	struct server_context *context, *previous;
+	int rc;
+
+	context = malloc(sizeof *context + 1 + strlen(sessionid));
+	if (context == NULL) {
+		ERROR("can't record context %u: out of memory", (unsigned)handle);
+		return;
+	}
+	strcpy(context->sessionid, sessionid);
+	context->session = NULL;
+	context->created = 0;
+	if (server_context_session(context) < 0) {
+		ERROR("can't record context %u: %m", (unsigned)handle);
+		free(context);
+		return;
+	}
+	context->cred = afb_cred_mixed_on_behalf_import(stubws->cred, sessionid, user_creds);
+
+	pthread_mutex_lock(&stubws->mutex);
+	previous = idmap_remove(&stubws->contexts, handle);
+	rc = idmap_set(&stubws->contexts, handle, context);
+	pthread_mutex_unlock(&stubws->mutex);
+
+	if (previous)
+		server_context_destroy(previous);
+	if (rc < 0) {
+		ERROR("can't record context %u: %m", (unsigned)handle);
+		server_context_destroy(context);
+	}
+}
+
+static void server_on_context_call_cb(void *closure, struct afb_proto_ws_call *call, const char *api, const char *verb, struct json_object *args, uint32_t handle)
+{
+	struct afb_stub_ws *stubws = closure;
+	struct server_req *wreq;
+	struct server_context *context;
+
+	/* create the request */
+	wreq = server_req_create(stubws, call, api, verb, args);
+	if (wreq == NULL)
+		return;
+
+	/* init the context */
+	pthread_mutex_lock(&stubws->mutex);
+	context = idmap_get(&stubws->contexts, handle);
+	if (context == NULL || server_context_session(context) < 0) {
+		pthread_mutex_unlock(&stubws->mutex);
+		ERROR("no session for context %u", (unsigned)handle);
+		server_req_cancel(wreq);
+		return;
+	}
+	afb_context_init(&wreq->xreq.context, context->session, NULL);
+	wreq->xreq.context.validated = 1;
+	wreq->xreq.context.created = context->created;
+	context->created = 0;
+	wreq->xreq.cred = afb_cred_addref(context->cred);
+	pthread_mutex_unlock(&stubws->mutex);
+
+	/* makes the call */
+	afb_stub_ws_addref(stubws);
+	afb_xreq_process(&wreq->xreq, stubws->apiset);
 }
 
 static void server_describe_cb(int signum, void *closure)
@@ -551,7 +829,7 @@ static void server_describe_cb(int signum, void *closure)
 	struct server_describe *desc = closure;
 
 	/* get the description if possible */
-	obj = !signum ? afb_apiset_describe(desc->stubws->apiset, desc->stubws->apiname) : NULL;
+	obj = !signum && desc->apiname ? afb_apiset_describe(desc->stubws->apiset, desc->apiname) : NULL;
 
 	/* send it */
 	afb_proto_ws_describe_put(desc->describe, obj);
@@ -565,7 +843,7 @@ static void server_describe_job(int signum, void *closure)
 	free(closure);
 }
 
-static void server_on_describe_cb(void *closure, struct afb_proto_ws_describe *describe)
+static void server_on_describe_cb(void *closure, struct afb_proto_ws_describe *describe, const char *api)
 {
 	struct server_describe *desc, sdesc;
 	struct afb_stub_ws *stubws = closure;
@@ -576,6 +854,7 @@ static void server_on_describe_cb(void *closure, struct afb_proto_ws_describe *d
 		desc = &sdesc;
 	desc->stubws = stubws;
 	desc->describe = describe;
+	desc->apiname = server_api_name(stubws, api);
 	afb_stub_ws_addref(stubws);
 
 	/* process */
@@ -603,8 +882,10 @@ static struct afb_api_itf client_api_itf = {
 
 static const struct afb_proto_ws_server_itf server_itf =
 {
-	.on_call = server_on_call_cb,
-	.on_describe = server_on_describe_cb
+	.on_api_call = server_on_call_cb,
+	.on_api_describe = server_on_describe_cb,
+	.on_context_set = server_on_context_set_cb,
+	.on_context_call = server_on_context_call_cb
 };
 
 /* the interface for events pushing */
@@ -627,6 +908,7 @@ static void disconnect(struct afb_stub_ws *stubws)
 		afb_evt_listener_unref(__atomic_exchange_n(&stubws->listener, NULL, __ATOMIC_RELAXED));
 		afb_cred_unref(__atomic_exchange_n(&stubws->cred, NULL, __ATOMIC_RELAXED));
 		server_release_all_sessions(stubws);
+		server_release_all_contexts(stubws);
 	}
 }
 
@@ -656,9 +938,14 @@ static struct afb_proto_ws *afb_stub_ws_create_proto(struct afb_stub_ws *stubws,
 {
 	struct afb_proto_ws *proto;
 
-	stubws->proto = proto = is_client
-		  ? afb_proto_ws_create_client(fdev, &client_itf, stubws)
-		  : afb_proto_ws_create_server(fdev, &server_itf, stubws);
+	if (stubws->shm)
+		stubws->proto = proto = is_client
+			  ? afb_proto_ws_create_client_shm(fdev, &client_itf, stubws)
+			  : afb_proto_ws_create_server_shm(fdev, &server_itf, stubws);
+	else
+		stubws->proto = proto = is_client
+			  ? afb_proto_ws_create_client(fdev, &client_itf, stubws)
+			  : afb_proto_ws_create_server(fdev, &server_itf, stubws);
 	if (proto) {
 		afb_proto_ws_on_hangup(proto, on_hangup);
 		afb_proto_ws_set_queuing(proto, enqueue_processing);
@@ -667,21 +954,49 @@ static struct afb_proto_ws *afb_stub_ws_create_proto(struct afb_stub_ws *stubws,
 	return proto;
 }
 
-static struct afb_stub_ws *afb_stub_ws_create(struct fdev *fdev, const char *apiname, struct afb_apiset *apiset, uint8_t is_client)
+/*
+ * Creates a stub for the api names given by 'apinames'.
+ * When 'separator' isn't zero, 'apinames' is a list of names separated
+ * by 'separator' and the first name is the default api.
+ * When 'shm' isn't zero, the messages are exchanged through shared memory.
+ */
+static struct afb_stub_ws *afb_stub_ws_create(struct fdev *fdev, const char *apinames, char separator, struct afb_apiset *apiset, uint8_t is_client, uint8_t shm)
 {
 	struct afb_stub_ws *stubws;
+	const char *iter;
+	char *names;
+	uint16_t i, count;
 
-	stubws = calloc(1, sizeof *stubws + strlen(apiname));
+	/* count the apis */
+	count = 1;
+	if (separator)
+		for (iter = apinames ; *iter ; iter++)
+			count = (uint16_t)(count + (*iter == separator));
+
+	stubws = calloc(1, sizeof *stubws + (count - 1) * sizeof *stubws->apis + strlen(apinames) + 1);
 	if (stubws == NULL)
 		errno = ENOMEM;
 	else {
+		pthread_mutex_init(&stubws->mutex, NULL);
+		stubws->shm = shm;
 		if (afb_stub_ws_create_proto(stubws, fdev, is_client)) {
 			stubws->refcount = 1;
 			stubws->is_client = is_client;
-			strcpy(stubws->apiname, apiname);
+			stubws->named_apis = !!separator;
+			stubws->apicount = count;
+			names = strcpy((char*)&stubws->apis[count], apinames);
+			for (i = 0 ; i < count ; i++) {
+				stubws->apis[i].stubws = stubws;
+				stubws->apis[i].name = names;
+				if (separator) {
+					names = strchrnul(names, separator);
+					*names++ = 0;
+				}
+			}
 			stubws->apiset = afb_apiset_addref(apiset);
 			return stubws;
 		}
+		pthread_mutex_destroy(&stubws->mutex);
 		free(stubws);
 	}
 	fdev_unref(fdev);
@@ -690,14 +1005,24 @@ static struct afb_stub_ws *afb_stub_ws_create(struct fdev *fdev, const char *api
 
 struct afb_stub_ws *afb_stub_ws_create_client(struct fdev *fdev, const char *apiname, struct afb_apiset *apiset)
 {
-	return afb_stub_ws_create(fdev, apiname, apiset, 1);
+	return afb_stub_ws_create(fdev, apiname, 0, apiset, 1, 0);
 }
 
-struct afb_stub_ws *afb_stub_ws_create_server(struct fdev *fdev, const char *apiname, struct afb_apiset *apiset)
+struct afb_stub_ws *afb_stub_ws_create_client_apis(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset)
+{
+	return afb_stub_ws_create(fdev, apinames, ',', apiset, 1, 0);
+}
+
+struct afb_stub_ws *afb_stub_ws_create_client_shm(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset)
+{
+	return afb_stub_ws_create(fdev, apinames, ',', apiset, 1, 1);
+}
+
+static struct afb_stub_ws *afb_stub_ws_create_server_list(struct fdev *fdev, const char *apinames, char separator, struct afb_apiset *apiset, uint8_t shm)
 {
 	struct afb_stub_ws *stubws;
 
-	stubws = afb_stub_ws_create(fdev, apiname, apiset, 0);
+	stubws = afb_stub_ws_create(fdev, apinames, separator, apiset, 0, shm);
 	if (stubws) {
 		stubws->cred = afb_cred_create_for_socket(fdev_fd(fdev));
 		stubws->listener = afb_evt_listener_create(&server_event_itf, stubws);
@@ -708,6 +1033,21 @@ struct afb_stub_ws *afb_stub_ws_create_server(struct fdev *fdev, const char *api
 	return NULL;
 }
 
+struct afb_stub_ws *afb_stub_ws_create_server(struct fdev *fdev, const char *apiname, struct afb_apiset *apiset)
+{
+	return afb_stub_ws_create_server_list(fdev, apiname, 0, apiset, 0);
+}
+
+struct afb_stub_ws *afb_stub_ws_create_server_apis(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset)
+{
+	return afb_stub_ws_create_server_list(fdev, apinames, ',', apiset, 0);
+}
+
+struct afb_stub_ws *afb_stub_ws_create_server_shm(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset)
+{
+	return afb_stub_ws_create_server_list(fdev, apinames, ',', apiset, 1);
+}
+
 void afb_stub_ws_unref(struct afb_stub_ws *stubws)
 {
 	if (stubws && !__atomic_sub_fetch(&stubws->refcount, 1, __ATOMIC_RELAXED)) {
@@ -719,6 +1059,7 @@ void afb_stub_ws_unref(struct afb_stub_ws *stubws)
 		}
 
 		disconnect(stubws);
+		pthread_mutex_destroy(&stubws->mutex);
 		afb_apiset_unref(stubws->apiset);
 		free(stubws);
 	}
@@ -736,26 +1077,50 @@ void afb_stub_ws_set_on_hangup(struct afb_stub_ws *stubws, void (*on_hangup)(str
 
 const char *afb_stub_ws_name(struct afb_stub_ws *stubws)
 {
-	return stubws->apiname;
+	return stubws->apis[0].name;
 }
 
-struct afb_api_item afb_stub_ws_client_api(struct afb_stub_ws *stubws)
+static struct afb_api_item client_api_item(struct stub_api *stubapi)
 {
 	struct afb_api_item api;
 
-	assert(stubws->is_client); /* check client */
-	api.closure = stubws;
+	api.closure = stubapi;
 	api.itf = &client_api_itf;
-	api.group = stubws; /* serialize for reconnections */
+	api.group = stubapi; /* serialize the calls of the api */
+	api.priority = JOBS_PRIORITY_NORMAL;
 	return api;
 }
 
+struct afb_api_item afb_stub_ws_client_api(struct afb_stub_ws *stubws)
+{
+	assert(stubws->is_client); /* check client */
+	return client_api_item(&stubws->apis[0]);
+}
+
 int afb_stub_ws_client_add(struct afb_stub_ws *stubws, struct afb_apiset *apiset)
 {
-	return afb_apiset_add(apiset, stubws->apiname, afb_stub_ws_client_api(stubws));
+	int rc;
+	uint16_t i;
+
+	assert(stubws->is_client); /* check client */
+	for (i = 0 ; i < stubws->apicount ; i++) {
+		rc = afb_apiset_add(apiset, stubws->apis[i].name, client_api_item(&stubws->apis[i]));
+		if (rc < 0) {
+			while (i)
+				afb_apiset_del(apiset, stubws->apis[--i].name);
+			return rc;
+		}
+	}
+	return 0;
 }
 
-void afb_stub_ws_client_robustify(struct afb_stub_ws *stubws, struct fdev *(*reopen)(void*), void *closure, void (*release)(void*))
+/*
+ * Makes the client 'stubws' reopen its connection when lost: 'reopen' is
+ * called with 'closure' to start the connection without blocking and
+ * calls later its callback with its argument and the connected fdev or
+ * NULL on failure. It returns 0 when started or -1 on error.
+ */
+void afb_stub_ws_client_robustify(struct afb_stub_ws *stubws, int (*reopen)(void*, void (*)(void*, struct fdev*), void*), void *closure, void (*release)(void*))
 {
 	assert(stubws->is_client); /* check client */
 
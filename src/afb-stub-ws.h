@@ -27,6 +27,14 @@ extern struct afb_stub_ws *afb_stub_ws_create_client(struct fdev *fdev, const ch
 
 extern struct afb_stub_ws *afb_stub_ws_create_server(struct fdev *fdev, const char *apiname, struct afb_apiset *apiset);
 
+extern struct afb_stub_ws *afb_stub_ws_create_client_apis(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset);
+
+extern struct afb_stub_ws *afb_stub_ws_create_server_apis(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset);
+
+extern struct afb_stub_ws *afb_stub_ws_create_client_shm(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset);
+
+extern struct afb_stub_ws *afb_stub_ws_create_server_shm(struct fdev *fdev, const char *apinames, struct afb_apiset *apiset);
+
 extern void afb_stub_ws_unref(struct afb_stub_ws *stubws);
 
 extern void afb_stub_ws_addref(struct afb_stub_ws *stubws);
@@ -39,5 +47,5 @@ extern struct afb_api_item afb_stub_ws_client_api(struct afb_stub_ws *stubws);
 
 extern int afb_stub_ws_client_add(struct afb_stub_ws *stubws, struct afb_apiset *apiset);
 
-extern void afb_stub_ws_client_robustify(struct afb_stub_ws *stubws, struct fdev *(*reopen)(void*), void *closure, void (*release)(void*));
+extern void afb_stub_ws_client_robustify(struct afb_stub_ws *stubws, int (*reopen)(void*, void (*)(void*, struct fdev*), void*), void *closure, void (*release)(void*));
 
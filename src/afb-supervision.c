@@ -256,7 +256,7 @@ int afb_supervision_init(struct afb_apiset *apiset, struct json_object *config)
 
 	/* init the apiset */
 	rc = afb_apiset_add(supervision_apiset, supervision_apiname,
-			(struct afb_api_item){ .itf = &supervision_api_itf, .closure = NULL});
+			(struct afb_api_item){ .itf = &supervision_api_itf, .closure = NULL, .priority = JOBS_PRIORITY_CRITICAL});
 	if (rc < 0) {
 		ERROR("Can't create supervision's apiset: %m");
 		afb_apiset_unref(supervision_apiset);
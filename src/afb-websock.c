@@ -29,6 +29,7 @@
 #include "afb-context.h"
 #include "afb-hreq.h"
 #include "afb-websock.h"
+#include "afb-ws.h"
 #include "afb-ws-json1.h"
 #include "afb-fdev.h"
 #include "fdev.h"
@@ -40,6 +41,7 @@ static const char sec_websocket_key_s[] = "Sec-WebSocket-Key";
 static const char sec_websocket_version_s[] = "Sec-WebSocket-Version";
 static const char sec_websocket_accept_s[] = "Sec-WebSocket-Accept";
 static const char sec_websocket_protocol_s[] = "Sec-WebSocket-Protocol";
+static const char sec_websocket_extensions_s[] = "Sec-WebSocket-Extensions";
 static const char websocket_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
 static void enc64(unsigned char *in, char *out)
@@ -96,7 +98,8 @@ static int headerhas(const char *header, const char *needle)
 struct protodef
 {
 	const char *name;
-	void *(*create)(struct fdev *fdev, struct afb_apiset *apiset, struct afb_context *context, void (*cleanup)(void*), void *cleanup_closure);
+	void *(*create)(struct fdev *fdev, struct afb_apiset *apiset, struct afb_context *context, const struct afb_ws_deflate *deflate, void (*cleanup)(void*), void *cleanup_closure);
+	int deflate; /* is compression supported? */
 };
 
 static const struct protodef *search_proto(const struct protodef *protodefs, const char *protocols)
@@ -125,6 +128,8 @@ struct memo_websocket {
 	const struct protodef *proto;
 	struct afb_hreq *hreq;
 	struct afb_apiset *apiset;
+	int deflating;
+	struct afb_ws_deflate deflate;
 };
 
 static void close_websocket(void *closure)
@@ -152,7 +157,8 @@ static void upgrade_to_websocket(
 		close_websocket(urh);
 	} else {
 		fdev_set_autoclose(fdev, 0);
-		ws = memo->proto->create(fdev, memo->apiset, &memo->hreq->xreq.context, close_websocket, urh);
+		ws = memo->proto->create(fdev, memo->apiset, &memo->hreq->xreq.context,
+				memo->deflating ? &memo->deflate : NULL, close_websocket, urh);
 		if (ws == NULL) {
 			/* TODO */
 			close_websocket(urh);
@@ -168,8 +174,8 @@ static int check_websocket_upgrade(struct MHD_Connection *con, const struct prot
 {
 	struct memo_websocket *memo;
 	struct MHD_Response *response;
-	const char *connection, *upgrade, *key, *version, *protocols;
-	char acceptval[29];
+	const char *connection, *upgrade, *key, *version, *protocols, *extensions;
+	char acceptval[29], extensionsval[160];
 	int vernum;
 	const struct protodef *proto;
 
@@ -222,11 +228,18 @@ static int check_websocket_upgrade(struct MHD_Connection *con, const struct prot
 	memo->hreq = hreq;
 	memo->apiset = apiset;
 
+	/* is the compression of messages requested? */
+	extensions = MHD_lookup_connection_value(con, MHD_HEADER_KIND, sec_websocket_extensions_s);
+	memo->deflating = proto->deflate && extensions != NULL
+		&& afb_ws_deflate_accept(extensions, &memo->deflate, extensionsval, sizeof extensionsval);
+
 	/* send the accept connection */
 	response = MHD_create_response_for_upgrade(upgrade_to_websocket, memo);
 	make_accept_value(key, acceptval);
 	MHD_add_response_header(response, sec_websocket_accept_s, acceptval);
 	MHD_add_response_header(response, sec_websocket_protocol_s, proto->name);
+	if (memo->deflating)
+		MHD_add_response_header(response, sec_websocket_extensions_s, extensionsval);
 	MHD_add_response_header(response, MHD_HTTP_HEADER_UPGRADE, websocket_s);
 	MHD_queue_response(con, MHD_HTTP_SWITCHING_PROTOCOLS, response);
 	MHD_destroy_response(response);
@@ -235,8 +248,8 @@ static int check_websocket_upgrade(struct MHD_Connection *con, const struct prot
 }
 
 static const struct protodef protodefs[] = {
-	{ "x-afb-ws-json1",	(void*)afb_ws_json1_create },
-	{ NULL, NULL }
+	{ "x-afb-ws-json1",	(void*)afb_ws_json1_create,	1 },
+	{ NULL, NULL, 0 }
 };
 
 int afb_websock_check_upgrade(struct afb_hreq *hreq, struct afb_apiset *apiset)
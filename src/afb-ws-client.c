@@ -18,17 +18,28 @@
 #define _GNU_SOURCE
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
 #include <netdb.h>
 #include <fcntl.h>
 
+#include <systemd/sd-event.h>
+
+#include "afb-ws.h"
 #include "afb-wsj1.h"
+#include "afb-proto-ws.h"
+#include "afb-ws-client.h"
+#include "fdev.h"
 #include "fdev-systemd.h"
 
 /**************** WebSocket handshake ****************************/
@@ -102,7 +113,7 @@ static char *strjoin(int count, const char **strings, const char *separ)
 }
 
 /* creates the http message for the request */
-static int make_request(char **request, const char *path, const char *host, const char *key, const char *protocols)
+static int make_request(char **request, const char *path, const char *host, const char *key, const char *protocols, const char *extensions)
 {
 	int rc = asprintf(request,
 			"GET %s HTTP/1.1\r\n"
@@ -112,12 +123,14 @@ static int make_request(char **request, const char *path, const char *host, cons
 			"Sec-WebSocket-Version: 13\r\n"
 			"Sec-WebSocket-Key: %s\r\n"
 			"Sec-WebSocket-Protocol: %s\r\n"
+			"Sec-WebSocket-Extensions: %s\r\n"
 			"Content-Length: 0\r\n"
 			"\r\n"
 			, path
 			, host
 			, key
 			, protocols
+			, extensions
 		);
 	if (rc < 0) {
 		errno = ENOMEM;
@@ -127,52 +140,340 @@ static int make_request(char **request, const char *path, const char *host, cons
 	return rc;
 }
 
-/* create the request and send it to fd, returns the expected accept string */
-static const char *send_request(int fd, const char **protocols, const char *path, const char *host)
+/* tiny parse a "standard" websock uri ws://host:port/path... */
+static int parse_uri(const char *uri, char **host, char **service, const char **path)
 {
-	const char *key, *ack;
-	char *protolist, *request;
-	int length, rc;
+	const char *h, *p;
+	size_t hlen, plen;
+
+	/* the scheme */
+	if (strncmp(uri, "ws://", 5) == 0)
+		uri += 5;
+
+	/* the host */
+	h = uri;
+	hlen = strcspn(h, ":/");
+	if (hlen == 0)
+		goto invalid;
+	uri += hlen;
+
+	/* the port (optional) */
+	if (*uri == ':') {
+		p = ++uri;
+		plen = strcspn(p, "/");
+		if (plen == 0)
+			goto invalid;
+		uri += plen;
+	} else {
+		p = NULL;
+		plen = 0;
+	}
+
+	/* the path */
+	if (*uri != '/')
+		goto invalid;
+
+	/* make the result */
+	*host = strndup(h, hlen);
+	if (*host != NULL) {
+		*service = plen ? strndup(p, plen) : strdup("http");
+		if (*service != NULL) {
+			*path = uri;
+			return 0;
+		}
+		free(*host);
+	}
+	errno = ENOMEM;
+	goto error;
+invalid:
+	errno = EINVAL;
+error:
+	return -1;
+}
+
+
+
+
+/**************** Connection state machine ****************************/
+
+/* maximum time in seconds for connecting and negotiating */
+#define CONNECT_TIMEOUT	10
+
+/* the states of a connection in progress */
+enum state
+{
+	Connecting,	/* waiting completion of the connect */
+	Sending,	/* sending the upgrade request */
+	Receiving,	/* receiving the header of the response */
+	Skipping,	/* skipping the content of the response */
+	Done		/* connected and negotiated */
+};
+
+/* a connection in progress */
+struct connect
+{
+	/* state of the connection */
+	enum state state;
+
+	/* the socket or -1 */
+	int fd;
+
+	/* the fdev of the socket, asynchronous mode only */
+	struct fdev *fdev;
+
+	/* the event loop */
+	struct sd_event *eloop;
+
+	/* timeout of the asynchronous mode */
+	sd_event_source *timer;
+
+	/* resolved addresses, next address to try */
+	struct addrinfo *addrs, *next;
+
+	/* address of unix sockets */
+	struct addrinfo unix_ai;
+	struct sockaddr_un unix_addr;
+
+	/* the proposed protocols or NULL when no handshake is needed */
+	const char **protocols;
+
+	/* host and path of the upgrade request */
+	char xhost[32];
+	char *path;
+
+	/* the upgrade request and its sent length */
+	char *request;
+	size_t reqlen, reqoff;
+
+	/* expected accept value */
+	const char *ack;
+
+	/* compression of messages accepted by the server */
+	int deflating;
+	struct afb_ws_deflate deflate;
+
+	/* received length of the header and remaining length of the content */
+	size_t hlen, clen;
+
+	/* completion of the asynchronous mode */
+	void (*complete)(struct connect *c, struct fdev *fdev);
+
+	/* interface and closure of the created object */
+	void *itf;
+	void *closure;
+
+	/* callback of the asynchronous mode */
+	union {
+		void (*wsj1)(void *closure, struct afb_wsj1 *wsj1);
+		void (*api)(void *closure, struct afb_proto_ws *pws);
+		void (*fdev)(void *closure, struct fdev *fdev);
+	} onconnect;
+
+	/* the messages of the api are exchanged through shared memory */
+	int shm;
+
+	/* buffer of the header of the response */
+	char header[4096];
+};
+
+/* current time in ms of the monotonic clock */
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* creates a connection for 'protocols' in the event loop 'eloop' */
+static struct connect *connect_create(struct sd_event *eloop, const char **protocols)
+{
+	struct connect *c;
+
+	c = calloc(1, sizeof *c);
+	if (c == NULL)
+		errno = ENOMEM;
+	else {
+		c->fd = -1;
+		c->eloop = eloop;
+		c->protocols = protocols;
+	}
+	return c;
+}
+
+/* closes the current socket of the connection */
+static void connect_drop_socket(struct connect *c)
+{
+	if (c->fdev) {
+		fdev_unref(c->fdev);
+		c->fdev = NULL;
+	} else if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+}
+
+/* releases the connection */
+static void connect_destroy(struct connect *c)
+{
+	int err = errno;
+
+	connect_drop_socket(c);
+	if (c->addrs != NULL && c->addrs != &c->unix_ai)
+		freeaddrinfo(c->addrs);
+	sd_event_source_unref(c->timer);
+	free(c->path);
+	free(c->request);
+	free(c);
+	errno = err;
+}
+
+/* sets the addresses to the ones of 'host' and 'service' */
+static int connect_resolve(struct connect *c, const char *host, const char *service)
+{
+	int rc;
+	struct addrinfo hint;
+
+	memset(&hint, 0, sizeof hint);
+	hint.ai_family = AF_INET;
+	hint.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo(host, service, &hint, &c->addrs);
+	if (rc != 0) {
+		c->addrs = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+	c->next = c->addrs;
+	return 0;
+}
+
+/* sets the address to the unix socket of 'path' */
+static int connect_unix(struct connect *c, const char *path)
+{
+	if (strlen(path) >= sizeof c->unix_addr.sun_path) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	c->unix_addr.sun_family = AF_UNIX;
+	strcpy(c->unix_addr.sun_path, path);
+	if (c->unix_addr.sun_path[0] == '@')
+		c->unix_addr.sun_path[0] = 0; /* implement abstract sockets */
+	c->unix_ai.ai_family = AF_UNIX;
+	c->unix_ai.ai_socktype = SOCK_STREAM;
+	c->unix_ai.ai_addr = (struct sockaddr*)&c->unix_addr;
+	c->unix_ai.ai_addrlen = (socklen_t)(sizeof c->unix_addr);
+	c->addrs = c->next = &c->unix_ai;
+	return 0;
+}
+
+/* events expected for progressing */
+static uint32_t connect_events(struct connect *c)
+{
+	return c->state == Receiving || c->state == Skipping ? EPOLLIN : EPOLLOUT;
+}
+
+/* the socket is connected, prepares the handshake if needed */
+static int connected(struct connect *c)
+{
+	const char *key;
+	char *protolist;
+	int length;
+
+	if (c->protocols == NULL) {
+		c->state = Done;
+		return 1;
+	}
 
 	/* make the list of accepted protocols */
-	protolist = strjoin(-1, protocols, ", ");
+	protolist = strjoin(-1, c->protocols, ", ");
 	if (protolist == NULL)
-		return NULL;
+		return -1;
 
 	/* create the request */
-	getkeypair(&key, &ack);
-	length = make_request(&request, path, host, key, protolist);
+	getkeypair(&key, &c->ack);
+	length = make_request(&c->request, c->path, c->xhost, key, protolist, afb_ws_deflate_offer);
 	free(protolist);
 	if (length < 0)
-		return NULL;
+		return -1;
 
-	/* send the request */
-	do { rc = (int)write(fd, request, length); } while(rc < 0 && errno == EINTR);
-	free(request);
-	return rc < 0 ? NULL : ack;
+	c->reqlen = (size_t)length;
+	c->reqoff = 0;
+	c->deflating = 0;
+	c->state = Sending;
+	return 1;
 }
 
-/* read a line not efficiently but without buffering */
-static int receive_line(int fd, char *line, int size)
+/*
+ * Connects to the next address.
+ * Returns 1 if connected, 0 if in progress or -1 if no more address.
+ */
+static int connect_next(struct connect *c)
 {
-	int rc, length = 0, cr = 0;
-	for(;;) {
-		if (length >= size) {
-			errno = EFBIG;
-			return -1;
+	struct addrinfo *ai;
+	struct sockaddr_in *a;
+	unsigned char *ipv4, *port;
+	int rc;
+
+	connect_drop_socket(c);
+	while ((ai = c->next) != NULL) {
+		c->next = ai->ai_next;
+		c->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (c->fd >= 0) {
+			if (ai->ai_family == AF_INET) {
+				a = (struct sockaddr_in*)(ai->ai_addr);
+				ipv4 = (unsigned char*)&(a->sin_addr.s_addr);
+				port = (unsigned char*)&(a->sin_port);
+				sprintf(c->xhost, "%d.%d.%d.%d:%d",
+					(int)ipv4[0], (int)ipv4[1], (int)ipv4[2], (int)ipv4[3],
+					(((int)port[0]) << 8)|(int)port[1]);
+			}
+			c->state = Connecting;
+			rc = connect(c->fd, ai->ai_addr, ai->ai_addrlen);
+			if (rc == 0)
+				return connected(c);
+			if (errno == EINPROGRESS)
+				return 0;
+			connect_drop_socket(c);
 		}
-		do { rc = (int)read(fd, line + length, 1); } while (rc < 0 && errno == EINTR);
-		if (rc < 0)
-			return -1;
-		if (line[length] == '\r')
-			cr = 1;
-		else if (cr != 0 && line[length] == '\n') {
-			line[--length] = 0;
-			return length;
-		} else
-			cr = 0;
-		length++;
 	}
+	return -1;
+}
+
+/* checks the end of the connect, trying the next address on failure */
+static int connect_check(struct connect *c, uint32_t revents)
+{
+	int rc, err;
+	socklen_t length;
+
+	if (!(revents & (EPOLLOUT|EPOLLERR|EPOLLHUP)))
+		return 0;
+
+	length = (socklen_t)sizeof err;
+	rc = getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &length);
+	if (rc == 0 && err == 0)
+		return connected(c);
+	if (rc == 0)
+		errno = err;
+	return connect_next(c);
+}
+
+/* sends the upgrade request */
+static int send_request(struct connect *c)
+{
+	ssize_t rc;
+
+	while (c->reqoff < c->reqlen) {
+		rc = write(c->fd, &c->request[c->reqoff], c->reqlen - c->reqoff);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN ? 0 : -1;
+		}
+		c->reqoff += (size_t)rc;
+	}
+	free(c->request);
+	c->request = NULL;
+	c->state = Receiving;
+	return 1;
 }
 
 /* check a header */
@@ -181,17 +482,28 @@ static inline int isheader(const char *head, size_t klen, const char *key)
 	return strncasecmp(head, key, klen) == 0 && key[klen] == 0;
 }
 
-/* receives and scan the response */
-static int receive_response(int fd, const char **protocols, const char *ack)
+/* get the next line of the header, returns NULL at end */
+static char *next_line(char **iter)
+{
+	char *line = *iter, *end = strstr(line, "\r\n");
+
+	*end = 0;
+	*iter = end + 2;
+	return *line ? line : NULL;
+}
+
+/* scans the received header of the response */
+static int scan_response(struct connect *c)
 {
-	char line[4096], *it;
-	int rc, haserr, result = -1;
-	size_t len, clen;
+	char *iter, *line, *it;
+	int haserr, result = -1;
+	size_t len;
 
 	/* check the header line to be something like: "HTTP/1.1 101 Switching Protocols" */
-	rc = receive_line(fd, line, (int)sizeof(line));
-	if (rc < 0)
-		goto error;
+	iter = c->header;
+	line = next_line(&iter);
+	if (line == NULL)
+		goto abort;
 	len = strcspn(line, " ");
 	if (len != 8 || 0 != strncmp(line, "HTTP/1.1", 8))
 		goto abort;
@@ -204,174 +516,370 @@ static int receive_response(int fd, const char **protocols, const char *ack)
 	if (len != 3 || 0 != strncmp(it, "101", 3))
 		goto abort;
 
-	/* reads the rest of the response until empty line */
-	clen = 0;
+	/* scans the rest of the response until empty line */
+	c->clen = 0;
 	haserr = 0;
-	for(;;) {
-		rc = receive_line(fd, line, (int)sizeof(line));
-		if (rc < 0)
-			goto error;
-		if (rc == 0)
-			break;
+	while ((line = next_line(&iter)) != NULL) {
 		len = strcspn(line, ": ");
 		if (len != 0 && line[len] == ':') {
 			/* checks the headers values */
 			it = line + len + 1;
 			it += strspn(it, " ,");
+			if (isheader(line, len, "Sec-WebSocket-Extensions")) {
+				if (c->deflating || afb_ws_deflate_agree(it, &c->deflate) < 0)
+					haserr = 1;
+				c->deflating = 1;
+				continue;
+			}
 			it[strcspn(it, " ,")] = 0;
 			if (isheader(line, len, "Sec-WebSocket-Accept")) {
-				if (strcmp(it, ack) != 0)
+				if (strcmp(it, c->ack) != 0)
 					haserr = 1;
 			} else if (isheader(line, len, "Sec-WebSocket-Protocol")) {
 				result = 0;
-				while(protocols[result] != NULL && strcmp(it, protocols[result]) != 0)
+				while(c->protocols[result] != NULL && strcmp(it, c->protocols[result]) != 0)
 					result++;
+				if (c->protocols[result] == NULL)
+					result = -1;
 			} else if (isheader(line, len, "Upgrade")) {
 				if (strcmp(it, "websocket") != 0)
 					haserr = 1;
 			} else if (isheader(line, len, "Content-Length")) {
-				clen = atol(it);
+				c->clen = (size_t)atol(it);
 			}
 		}
 	}
-
-	/* skips the remaining of the message */
-	while (clen >= sizeof line) {
-		while (read(fd, line, sizeof line) < 0 && errno == EINTR);
-		clen -= sizeof line;
-	}
-	if (clen > 0) {
-		while (read(fd, line, len) < 0 && errno == EINTR);
+	if (haserr == 0 && result >= 0) {
+		c->state = c->clen ? Skipping : Done;
+		return 1;
 	}
-	if (haserr != 0 || result < 0)
-		goto abort;
-	return result;
 abort:
 	errno = ECONNABORTED;
-error:
 	return -1;
 }
 
-static int negociate(int fd, const char **protocols, const char *path, const char *host)
+/*
+ * Receives the header of the response. The received data are first
+ * peeked so that only the bytes of the header are consumed, the
+ * bytes following it being left to the websocket.
+ */
+static int receive_response(struct connect *c)
 {
-	const char *ack = send_request(fd, protocols, path, host);
-	return ack == NULL ? -1 : receive_response(fd, protocols, ack);
+	ssize_t rc;
+	size_t length, start;
+	char *end;
+
+	for (;;) {
+		/* peek the available data */
+		length = sizeof c->header - 1 - c->hlen;
+		if (length == 0) {
+			errno = EFBIG;
+			return -1;
+		}
+		rc = recv(c->fd, &c->header[c->hlen], length, MSG_PEEK);
+		if (rc <= 0) {
+			if (rc == 0)
+				errno = ECONNABORTED;
+			else if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN)
+				return 0;
+			return -1;
+		}
+
+		/* search the empty line ending the header */
+		start = c->hlen < 3 ? 0 : c->hlen - 3;
+		end = memmem(&c->header[start], c->hlen + (size_t)rc - start, "\r\n\r\n", 4);
+		length = end ? (size_t)(end + 4 - &c->header[c->hlen]) : (size_t)rc;
+
+		/* consume the bytes of the header */
+		do { rc = recv(c->fd, &c->header[c->hlen], length, 0); } while (rc < 0 && errno == EINTR);
+		if (rc != (ssize_t)length) {
+			if (rc >= 0)
+				errno = EIO;
+			return -1;
+		}
+		c->hlen += length;
+		if (end) {
+			c->header[c->hlen] = 0;
+			return scan_response(c);
+		}
+	}
 }
 
-/* tiny parse a "standard" websock uri ws://host:port/path... */
-static int parse_uri(const char *uri, char **host, char **service, const char **path)
+/* skips the content of the response */
+static int skip_content(struct connect *c)
 {
-	const char *h, *p;
-	size_t hlen, plen;
+	ssize_t rc;
 
-	/* the scheme */
-	if (strncmp(uri, "ws://", 5) == 0)
-		uri += 5;
+	while (c->clen) {
+		rc = read(c->fd, c->header, c->clen < sizeof c->header ? c->clen : sizeof c->header);
+		if (rc <= 0) {
+			if (rc == 0)
+				errno = ECONNABORTED;
+			else if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN)
+				return 0;
+			return -1;
+		}
+		c->clen -= (size_t)rc;
+	}
+	c->state = Done;
+	return 1;
+}
 
-	/* the host */
-	h = uri;
-	hlen = strcspn(h, ":/");
-	if (hlen == 0)
-		goto invalid;
-	uri += hlen;
+/*
+ * Makes the connection progress after the events 'revents' of the socket.
+ * Returns 1 when connected, 0 when waiting events or -1 on error.
+ */
+static int connect_step(struct connect *c, uint32_t revents)
+{
+	int rc;
 
-	/* the port (optional) */
-	if (*uri == ':') {
-		p = ++uri;
-		plen = strcspn(p, "/");
-		if (plen == 0)
-			goto invalid;
-		uri += plen;
-	} else {
-		p = NULL;
-		plen = 0;
+	do {
+		switch (c->state) {
+		case Connecting:
+			rc = connect_check(c, revents);
+			break;
+		case Sending:
+			rc = send_request(c);
+			break;
+		case Receiving:
+			rc = receive_response(c);
+			break;
+		case Skipping:
+			rc = skip_content(c);
+			break;
+		default:
+			return 1;
+		}
+		revents = 0;
+	} while (rc > 0);
+	return rc;
+}
+
+/*
+ * Runs the connection until its end, blocking the caller.
+ * Returns the fdev of the connected socket or NULL on error.
+ * The connection 'c' must then be destroyed by the caller.
+ */
+static struct fdev *connect_run(struct connect *c)
+{
+	struct pollfd pfd;
+	struct fdev *fdev;
+	uint64_t deadline, now;
+	int rc;
+
+	deadline = now_ms() + CONNECT_TIMEOUT * 1000;
+	rc = connect_next(c);
+	if (rc >= 0)
+		rc = connect_step(c, 0);
+	while (rc == 0) {
+		now = now_ms();
+		if (now >= deadline) {
+			errno = ETIMEDOUT;
+			rc = -1;
+		} else {
+			pfd.fd = c->fd;
+			pfd.events = (short)connect_events(c);
+			rc = poll(&pfd, 1, (int)(deadline - now));
+			if (rc >= 0)
+				rc = connect_step(c, rc ? (uint32_t)pfd.revents : 0);
+			else if (errno == EINTR)
+				rc = 0;
+		}
 	}
 
-	/* the path */
-	if (*uri != '/')
-		goto invalid;
+	fdev = NULL;
+	if (rc > 0) {
+		fdev = fdev_systemd_create(c->eloop, c->fd);
+		if (fdev)
+			c->fd = -1;
+	}
+	return fdev;
+}
 
-	/* make the result */
-	*host = strndup(h, hlen);
-	if (*host != NULL) {
-		*service = plen ? strndup(p, plen) : strdup("http");
-		if (*service != NULL) {
-			*path = uri;
-			return 0;
+/* terminates the asynchronous connection with the status 'rc' */
+static void connect_async_end(struct connect *c, int rc)
+{
+	struct fdev *fdev;
+
+	fdev = NULL;
+	if (rc > 0) {
+		fdev = c->fdev ?: fdev_systemd_create(c->eloop, c->fd);
+		if (fdev) {
+			fdev_set_callback(fdev, NULL, NULL);
+			c->fdev = NULL;
+			c->fd = -1;
 		}
-		free(*host);
 	}
-	errno = ENOMEM;
-	goto error;
-invalid:
-	errno = EINVAL;
-error:
-	return -1;
+	c->complete(c, fdev);
+	connect_destroy(c);
+}
+
+static void connect_async_progress(struct connect *c, uint32_t revents);
+
+/* callback of events of the socket */
+static void connect_async_on_event(void *closure, uint32_t revents, struct fdev *fdev)
+{
+	connect_async_progress(closure, revents);
+}
+
+/* callback of the timeout */
+static int connect_async_on_timeout(sd_event_source *s, uint64_t usec, void *closure)
+{
+	errno = ETIMEDOUT;
+	connect_async_end(closure, -1);
+	return 0;
 }
 
+/* waits the events needed for progressing */
+static int connect_async_wait(struct connect *c)
+{
+	if (c->fdev == NULL) {
+		c->fdev = fdev_systemd_create(c->eloop, c->fd);
+		if (c->fdev == NULL)
+			return -1;
+		fdev_set_callback(c->fdev, connect_async_on_event, c);
+	}
+	fdev_set_events(c->fdev, connect_events(c));
+	return 0;
+}
 
+/* makes the connection progress, completing it at end */
+static void connect_async_progress(struct connect *c, uint32_t revents)
+{
+	int rc;
 
+	rc = connect_step(c, revents);
+	if (rc == 0)
+		rc = connect_async_wait(c);
+	if (rc != 0)
+		connect_async_end(c, rc);
+}
+
+/*
+ * Starts the connection in the event loop without blocking.
+ * The completion is always called from the event loop.
+ * Returns 0 on success or -1 on error, the connection being released.
+ */
+static int connect_async(struct connect *c)
+{
+	uint64_t usec;
+	int rc;
+
+	rc = sd_event_now(c->eloop, CLOCK_MONOTONIC, &usec);
+	if (rc >= 0)
+		rc = sd_event_add_time(c->eloop, &c->timer, CLOCK_MONOTONIC,
+				usec + CONNECT_TIMEOUT * 1000000, 0,
+				connect_async_on_timeout, c);
+	if (rc < 0)
+		errno = -rc;
+	else {
+		rc = connect_next(c);
+		if (rc >= 0)
+			rc = connect_async_wait(c);
+		if (rc >= 0)
+			return 0;
+	}
+	connect_destroy(c);
+	return -1;
+}
+
+/**************** WebSocket json1 ****************************/
 
 static const char *proto_json1[2] = { "x-afb-ws-json1",	NULL };
 
-struct afb_wsj1 *afb_ws_client_connect_wsj1(struct sd_event *eloop, const char *uri, struct afb_wsj1_itf *itf, void *closure)
+/* prepares the connection to the websocket of 'uri' */
+static struct connect *connect_wsj1(struct sd_event *eloop, const char *uri)
 {
-	int rc, fd;
-	char *host, *service, xhost[32];
+	int rc;
+	char *host, *service;
 	const char *path;
-	struct addrinfo hint, *rai, *iai;
-	struct afb_wsj1 *result;
-	struct fdev *fdev;
+	struct connect *c;
 
 	/* scan the uri */
 	rc = parse_uri(uri, &host, &service, &path);
 	if (rc < 0)
 		return NULL;
 
-	/* get addr */
-	memset(&hint, 0, sizeof hint);
-	hint.ai_family = AF_INET;
-	hint.ai_socktype = SOCK_STREAM;
-	rc = getaddrinfo(host, service, &hint, &rai);
+	c = connect_create(eloop, proto_json1);
+	if (c != NULL) {
+		c->path = strdup(path);
+		if (c->path == NULL) {
+			errno = ENOMEM;
+			rc = -1;
+		} else
+			rc = connect_resolve(c, host, service);
+		if (rc < 0) {
+			connect_destroy(c);
+			c = NULL;
+		}
+	}
 	free(host);
 	free(service);
-	if (rc != 0) {
-		errno = EINVAL;
+	return c;
+}
+
+/* creates the wsj1 of the connection 'c' for 'fdev' */
+static struct afb_wsj1 *make_wsj1(struct connect *c, struct fdev *fdev, struct afb_wsj1_itf *itf, void *closure)
+{
+	return afb_wsj1_create_deflate(fdev, itf, closure, c->deflating ? &c->deflate : NULL);
+}
+
+/* completion of the asynchronous connection of wsj1 */
+static void complete_wsj1(struct connect *c, struct fdev *fdev)
+{
+	struct afb_wsj1 *wsj1;
+
+	wsj1 = fdev ? make_wsj1(c, fdev, c->itf, c->closure) : NULL;
+	c->onconnect.wsj1(c->closure, wsj1);
+}
+
+/*
+ * Makes the WebSocket handshake at the 'uri' and if successful
+ * instantiate a wsj1 websocket for this connection using 'itf' and 'closure'.
+ * (see afb_wsj1_create).
+ * The systemd event loop 'eloop' is used to handle the websocket.
+ * Returns NULL in case of failure with errno set appropriately.
+ */
+struct afb_wsj1 *afb_ws_client_connect_wsj1(struct sd_event *eloop, const char *uri, struct afb_wsj1_itf *itf, void *closure)
+{
+	struct connect *c;
+	struct fdev *fdev;
+	struct afb_wsj1 *wsj1;
+
+	c = connect_wsj1(eloop, uri);
+	if (c == NULL)
 		return NULL;
-	}
 
-	/* get the socket */
-	result = NULL;
-	iai = rai;
-	while (iai != NULL) {
-		struct sockaddr_in *a = (struct sockaddr_in*)(iai->ai_addr);
-		unsigned char *ipv4 = (unsigned char*)&(a->sin_addr.s_addr);
-		unsigned char *port = (unsigned char*)&(a->sin_port);
-		sprintf(xhost, "%d.%d.%d.%d:%d",
-			(int)ipv4[0], (int)ipv4[1], (int)ipv4[2], (int)ipv4[3],
-			(((int)port[0]) << 8)|(int)port[1]);
-		fd = socket(iai->ai_family, iai->ai_socktype, iai->ai_protocol);
-		if (fd >= 0) {
-			rc = connect(fd, iai->ai_addr, iai->ai_addrlen);
-			if (rc == 0) {
-				rc = negociate(fd, proto_json1, path, xhost);
-				if (rc == 0) {
-					fdev = fdev_systemd_create(eloop, fd);
-					if (fdev) {
-						result = afb_wsj1_create(fdev, itf, closure);
-						if (result != NULL) {
-							fcntl(fd, F_SETFL, O_NONBLOCK);
-							break;
-						}
-					}
-				}
-			}
-			close(fd);
-		}
-		iai = iai->ai_next;
-	}
-	freeaddrinfo(rai);
-	return result;
+	fdev = connect_run(c);
+	wsj1 = fdev ? make_wsj1(c, fdev, itf, closure) : NULL;
+	connect_destroy(c);
+	return wsj1;
+}
+
+/*
+ * Same as 'afb_ws_client_connect_wsj1' but without blocking: the
+ * connection and the handshake are made in the event loop 'eloop'
+ * that calls 'onconnect' at end with 'closure' and the created wsj1
+ * or NULL on failure with errno set appropriately.
+ * Returns 0 if the connection started or -1 on error.
+ */
+int afb_ws_client_connect_wsj1_async(struct sd_event *eloop, const char *uri, struct afb_wsj1_itf *itf, void *closure, void (*onconnect)(void *closure, struct afb_wsj1 *wsj1))
+{
+	struct connect *c;
+
+	c = connect_wsj1(eloop, uri);
+	if (c == NULL)
+		return -1;
+
+	c->complete = complete_wsj1;
+	c->itf = itf;
+	c->closure = closure;
+	c->onconnect.wsj1 = onconnect;
+	return connect_async(c);
 }
 
 #if 0
@@ -404,100 +912,75 @@ static char *makequery(const char *path, const char *uuid, const char *token)
 
 /*****************************************************************************************************************************/
 
-#include <sys/un.h>
-#include "afb-proto-ws.h"
+/*****************************************************************************************************************************/
 
-static int get_socket_unix(const char *uri)
+/*
+ * prepares the connection to the api of 'uri', that is "unix:path",
+ * "shm:path" or "[tcp:]host:port/api", optionally followed by a query
+ */
+static struct connect *connect_api(struct sd_event *eloop, const char *uri)
 {
-	int fd, rc;
-	struct sockaddr_un addr;
-	size_t length;
+	int rc;
+	const char *service, *host, *api, *query;
+	struct connect *c;
 
-	length = strlen(uri);
-	if (length >= 108) {
-		errno = ENAMETOOLONG;
-		return -1;
-	}
+	c = connect_create(eloop, NULL);
+	if (c == NULL)
+		return NULL;
 
-	fd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (fd < 0)
-		return fd;
+	/* remove the query */
+	query = strchr(uri, '?');
+	if (query)
+		uri = strndupa(uri, query - uri);
 
-	memset(&addr, 0, sizeof addr);
-	addr.sun_family = AF_UNIX;
-	strcpy(addr.sun_path, uri);
-	if (addr.sun_path[0] == '@')
-		addr.sun_path[0] = 0; /* implement abstract sockets */
-	rc = connect(fd, (struct sockaddr *) &addr, (socklen_t)(sizeof addr));
+	/* check for unix socket */
+	if (0 == strncmp(uri, "unix:", 5))
+		rc = connect_unix(c, uri + 5);
+	else if (0 == strncmp(uri, "shm:", 4)) {
+		c->shm = 1;
+		rc = connect_unix(c, uri + 4);
+	} else {
+		/* scan the uri of inet socket */
+		if (0 == strncmp(uri, "tcp:", 4))
+			uri += 4;
+		api = strrchr(uri, '/');
+		service = strrchr(uri, ':');
+		if (api == NULL || service == NULL || api < service) {
+			errno = EINVAL;
+			rc = -1;
+		} else {
+			host = strndupa(uri, service++ - uri);
+			service = strndupa(service, api - service);
+			rc = connect_resolve(c, host, service);
+		}
+	}
 	if (rc < 0) {
-		close(fd);
-		return rc;
+		connect_destroy(c);
+		c = NULL;
 	}
-	return fd;
+	return c;
 }
 
-static int get_socket_inet(const char *uri)
+/* creates the client afb_proto_ws of the connection 'c' for 'fdev' */
+static struct afb_proto_ws *make_api(struct connect *c, struct fdev *fdev, struct afb_proto_ws_client_itf *itf, void *closure)
 {
-	int rc, fd;
-	const char *service, *host, *api;
-	struct addrinfo hint, *rai, *iai;
-
-	/* scan the uri */
-	api = strrchr(uri, '/');
-	service = strrchr(uri, ':');
-	if (api == NULL || service == NULL || api < service) {
-		errno = EINVAL;
-		return -1;
-	}
-	host = strndupa(uri, service++ - uri);
-	service = strndupa(service, api - service);
+	return c->shm ? afb_proto_ws_create_client_shm(fdev, itf, closure)
+		      : afb_proto_ws_create_client(fdev, itf, closure);
+}
 
-	/* get addr */
-	memset(&hint, 0, sizeof hint);
-	hint.ai_family = AF_INET;
-	hint.ai_socktype = SOCK_STREAM;
-	rc = getaddrinfo(host, service, &hint, &rai);
-	if (rc != 0) {
-		errno = EINVAL;
-		return -1;
-	}
+/* completion of the asynchronous connection of api */
+static void complete_api(struct connect *c, struct fdev *fdev)
+{
+	struct afb_proto_ws *pws;
 
-	/* get the socket */
-	iai = rai;
-	while (iai != NULL) {
-		fd = socket(iai->ai_family, iai->ai_socktype, iai->ai_protocol);
-		if (fd >= 0) {
-			rc = connect(fd, iai->ai_addr, iai->ai_addrlen);
-			if (rc == 0) {
-				freeaddrinfo(rai);
-				return fd;
-			}
-			close(fd);
-		}
-		iai = iai->ai_next;
-	}
-	freeaddrinfo(rai);
-	return -1;
+	pws = fdev ? make_api(c, fdev, c->itf, c->closure) : NULL;
+	c->onconnect.api(c->closure, pws);
 }
 
-static int get_socket(const char *uri)
+/* completion of the asynchronous connection of the socket of an api */
+static void complete_fdev(struct connect *c, struct fdev *fdev)
 {
-	int fd;
-
-	/* check for unix socket */
-	if (0 == strncmp(uri, "unix:", 5))
-		/* unix socket */
-		fd = get_socket_unix(uri + 5);
-	else
-		/* inet socket */
-		fd = get_socket_inet(uri);
-
-	/* configure the socket */
-	if (fd >= 0) {
-		fcntl(fd, F_SETFD, FD_CLOEXEC);
-		fcntl(fd, F_SETFL, O_NONBLOCK);
-	}
-	return fd;
+	c->onconnect.fdev(c->closure, fdev);
 }
 
 /*
@@ -509,20 +992,59 @@ static int get_socket(const char *uri)
  */
 struct afb_proto_ws *afb_ws_client_connect_api(struct sd_event *eloop, const char *uri, struct afb_proto_ws_client_itf *itf, void *closure)
 {
-	int fd;
-	struct afb_proto_ws *pws;
+	struct connect *c;
 	struct fdev *fdev;
+	struct afb_proto_ws *pws;
 
-	fd = get_socket(uri);
-	if (fd >= 0) {
-		fdev = fdev_systemd_create(eloop, fd);
-		if (fdev) {
-			pws = afb_proto_ws_create_client(fdev, itf, closure);
-			if (pws)
-				return pws;
-		}
-		close(fd);
-	}
-	return NULL;
+	c = connect_api(eloop, uri);
+	if (c == NULL)
+		return NULL;
+
+	fdev = connect_run(c);
+	pws = fdev ? make_api(c, fdev, itf, closure) : NULL;
+	connect_destroy(c);
+	return pws;
 }
 
+/*
+ * Same as 'afb_ws_client_connect_api' but without blocking: the
+ * connection is made in the event loop 'eloop' that calls 'onconnect'
+ * at end with 'closure' and the created afb_proto_ws or NULL on failure
+ * with errno set appropriately.
+ * Returns 0 if the connection started or -1 on error.
+ */
+int afb_ws_client_connect_api_async(struct sd_event *eloop, const char *uri, struct afb_proto_ws_client_itf *itf, void *closure, void (*onconnect)(void *closure, struct afb_proto_ws *pws))
+{
+	struct connect *c;
+
+	c = connect_api(eloop, uri);
+	if (c == NULL)
+		return -1;
+
+	c->complete = complete_api;
+	c->itf = itf;
+	c->closure = closure;
+	c->onconnect.api = onconnect;
+	return connect_async(c);
+}
+
+/*
+ * Connects the socket of the API of 'uri' without blocking: the
+ * connection is made in the event loop 'eloop' that calls 'onconnect'
+ * at end with 'closure' and the fdev of the connected socket or NULL
+ * on failure with errno set appropriately. The protocol isn't started.
+ * Returns 0 if the connection started or -1 on error.
+ */
+int afb_ws_client_connect_fdev_async(struct sd_event *eloop, const char *uri, void *closure, void (*onconnect)(void *closure, struct fdev *fdev))
+{
+	struct connect *c;
+
+	c = connect_api(eloop, uri);
+	if (c == NULL)
+		return -1;
+
+	c->complete = complete_fdev;
+	c->closure = closure;
+	c->onconnect.fdev = onconnect;
+	return connect_async(c);
+}
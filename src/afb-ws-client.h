@@ -22,6 +22,7 @@ struct afb_wsj1_itf;
 struct afb_proto_ws;
 struct afb_proto_ws_client_itf;
 struct sd_event;
+struct fdev;
 
 /*
  * Makes the WebSocket handshake at the 'uri' and if successful
@@ -32,6 +33,15 @@ struct sd_event;
  */
 extern struct afb_wsj1 *afb_ws_client_connect_wsj1(struct sd_event *eloop, const char *uri, struct afb_wsj1_itf *itf, void *closure);
 
+/*
+ * Same as 'afb_ws_client_connect_wsj1' but without blocking: the
+ * connection and the handshake are made in the event loop 'eloop'
+ * that calls 'onconnect' at end with 'closure' and the created wsj1
+ * or NULL on failure with errno set appropriately.
+ * Returns 0 if the connection started or -1 on error.
+ */
+extern int afb_ws_client_connect_wsj1_async(struct sd_event *eloop, const char *uri, struct afb_wsj1_itf *itf, void *closure, void (*onconnect)(void *closure, struct afb_wsj1 *wsj1));
+
 /*
  * Establish a websocket-like client connection to the API of 'uri' and if successful
  * instantiate a client afb_proto_ws websocket for this API using 'itf' and 'closure'.
@@ -41,3 +51,20 @@ extern struct afb_wsj1 *afb_ws_client_connect_wsj1(struct sd_event *eloop, const
  */
 extern struct afb_proto_ws *afb_ws_client_connect_api(struct sd_event *eloop, const char *uri, struct afb_proto_ws_client_itf *itf, void *closure);
 
+/*
+ * Same as 'afb_ws_client_connect_api' but without blocking: the
+ * connection is made in the event loop 'eloop' that calls 'onconnect'
+ * at end with 'closure' and the created afb_proto_ws or NULL on failure
+ * with errno set appropriately.
+ * Returns 0 if the connection started or -1 on error.
+ */
+extern int afb_ws_client_connect_api_async(struct sd_event *eloop, const char *uri, struct afb_proto_ws_client_itf *itf, void *closure, void (*onconnect)(void *closure, struct afb_proto_ws *pws));
+
+/*
+ * Connects the socket of the API of 'uri' without blocking: the
+ * connection is made in the event loop 'eloop' that calls 'onconnect'
+ * at end with 'closure' and the fdev of the connected socket or NULL
+ * on failure with errno set appropriately. The protocol isn't started.
+ * Returns 0 if the connection started or -1 on error.
+ */
+extern int afb_ws_client_connect_fdev_async(struct sd_event *eloop, const char *uri, void *closure, void (*onconnect)(void *closure, struct fdev *fdev));
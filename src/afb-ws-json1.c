@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include <json-c/json.h>
 
@@ -37,6 +38,7 @@
 #include "afb-evt.h"
 #include "verbose.h"
 #include "fdev.h"
+#include "slab.h"
 
 /* predeclaration of structures */
 struct afb_ws_json1;
@@ -50,6 +52,9 @@ static void aws_on_event(struct afb_ws_json1 *ws, const char *event, int eventid
 /* predeclaration of wsreq callbacks */
 static void wsreq_destroy(struct afb_xreq *xreq);
 static void wsreq_reply(struct afb_xreq *xreq, struct json_object *object, const char *error, const char *info);
+static void wsreq_reply_buffer(struct afb_xreq *xreq, const char *buffer, size_t size, const char *error, const char *info);
+static struct json_object *wsreq_json(struct afb_xreq *xreq);
+static const char *wsreq_raw(struct afb_xreq *xreq, size_t *size);
 
 /* declaration of websocket structure */
 struct afb_ws_json1
@@ -82,7 +87,10 @@ static struct afb_wsj1_itf wsj1_itf = {
 
 /* interface for xreq */
 const struct afb_xreq_query_itf afb_ws_json1_xreq_itf = {
+	.json = wsreq_json,
+	.raw = wsreq_raw,
 	.reply = wsreq_reply,
+	.reply_buffer = wsreq_reply_buffer,
 	.unref = wsreq_destroy
 };
 
@@ -100,7 +108,7 @@ static const struct afb_evt_itf evt_itf = {
 ****************************************************************
 ***************************************************************/
 
-struct afb_ws_json1 *afb_ws_json1_create(struct fdev *fdev, struct afb_apiset *apiset, struct afb_context *context, void (*cleanup)(void*), void *cleanup_closure)
+struct afb_ws_json1 *afb_ws_json1_create(struct fdev *fdev, struct afb_apiset *apiset, struct afb_context *context, const struct afb_ws_deflate *deflate, void (*cleanup)(void*), void *cleanup_closure)
 {
 	struct afb_ws_json1 *result;
 
@@ -119,20 +127,22 @@ struct afb_ws_json1 *afb_ws_json1_create(struct fdev *fdev, struct afb_apiset *a
 	if (result->session == NULL)
 		goto error2;
 
-	result->wsj1 = afb_wsj1_create(fdev, &wsj1_itf, result);
-	if (result->wsj1 == NULL)
-		goto error3;
-
 	result->listener = afb_evt_listener_create(&evt_itf, result);
 	if (result->listener == NULL)
-		goto error4;
+		goto error3;
 
 	result->cred = afb_cred_create_for_socket(fdev_fd(fdev));
 	result->apiset = afb_apiset_addref(apiset);
+
+	/* on error, afb_wsj1_create_deflate releases fdev */
+	result->wsj1 = afb_wsj1_create_deflate(fdev, &wsj1_itf, result, deflate);
+	if (result->wsj1 == NULL) {
+		result->cleanup = NULL;
+		afb_ws_json1_unref(result);
+		return NULL;
+	}
 	return result;
 
-error4:
-	afb_wsj1_unref(result->wsj1);
 error3:
 	afb_session_unref(result->session);
 error2:
@@ -174,7 +184,7 @@ static void aws_on_call(struct afb_ws_json1 *ws, const char *api, const char *ve
 	DEBUG("received websocket request for %s/%s: %s", api, verb, afb_wsj1_msg_object_s(msg));
 
 	/* allocate */
-	wsreq = calloc(1, sizeof *wsreq);
+	wsreq = slab_calloc(sizeof *wsreq);
 	if (wsreq == NULL) {
 		afb_wsj1_close(ws->wsj1, 1008, NULL);
 		return;
@@ -196,7 +206,6 @@ static void aws_on_call(struct afb_ws_json1 *ws, const char *api, const char *ve
 	wsreq->xreq.cred = afb_cred_addref(ws->cred);
 	wsreq->xreq.request.called_api = api;
 	wsreq->xreq.request.called_verb = verb;
-	wsreq->xreq.json = afb_wsj1_msg_object_j(wsreq->msgj1);
 	wsreq->aws = afb_ws_json1_addref(ws);
 	wsreq->xreq.listener = wsreq->aws->listener;
 
@@ -225,7 +234,24 @@ static void wsreq_destroy(struct afb_xreq *xreq)
 	afb_wsj1_msg_unref(wsreq->msgj1);
 	afb_cred_unref(wsreq->xreq.cred);
 	afb_ws_json1_unref(wsreq->aws);
-	free(wsreq);
+	slab_free(wsreq, sizeof *wsreq);
+}
+
+/* parsing of arguments is delayed until needed, out of the event loop */
+static struct json_object *wsreq_json(struct afb_xreq *xreq)
+{
+	struct afb_wsreq *wsreq = CONTAINER_OF_XREQ(struct afb_wsreq, xreq);
+
+	return afb_wsj1_msg_object_j(wsreq->msgj1);
+}
+
+static const char *wsreq_raw(struct afb_xreq *xreq, size_t *size)
+{
+	struct afb_wsreq *wsreq = CONTAINER_OF_XREQ(struct afb_wsreq, xreq);
+
+	if (size != NULL)
+		*size = afb_wsj1_msg_object_s_length(wsreq->msgj1);
+	return afb_wsj1_msg_object_s(wsreq->msgj1);
 }
 
 static void wsreq_reply(struct afb_xreq *xreq, struct json_object *object, const char *error, const char *info)
@@ -243,3 +269,29 @@ static void wsreq_reply(struct afb_xreq *xreq, struct json_object *object, const
 		ERROR("Can't send reply: %m");
 }
 
+static void wsreq_reply_buffer(struct afb_xreq *xreq, const char *buffer, size_t size, const char *error, const char *info)
+{
+	struct afb_wsreq *wsreq = CONTAINER_OF_XREQ(struct afb_wsreq, xreq);
+	int rc;
+	char *head;
+	struct iovec iov[3];
+
+	/* splice the buffer in the reply */
+	head = afb_msg_json_reply_head(error, info, &xreq->context, NULL, 1, &iov[0].iov_len);
+	if (head == NULL) {
+		errno = ENOMEM;
+		rc = -1;
+	} else {
+		iov[0].iov_base = head;
+		iov[1].iov_base = (void*)buffer;
+		iov[1].iov_len = size;
+		iov[2].iov_base = "}";
+		iov[2].iov_len = 1;
+		rc = afb_wsj1_reply_v(wsreq->msgj1, iov, 3,
+				afb_context_sent_token(&wsreq->xreq.context), error != NULL);
+		free(head);
+	}
+	if (rc)
+		ERROR("Can't send reply: %m");
+}
+
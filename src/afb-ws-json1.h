@@ -21,8 +21,9 @@ struct afb_ws_json1;
 struct afb_context;
 struct afb_apiset;
 struct fdev;
+struct afb_ws_deflate;
 
-extern struct afb_ws_json1 *afb_ws_json1_create(struct fdev *fdev, struct afb_apiset *apiset, struct afb_context *context, void (*cleanup)(void*), void *closure);
+extern struct afb_ws_json1 *afb_ws_json1_create(struct fdev *fdev, struct afb_apiset *apiset, struct afb_context *context, const struct afb_ws_deflate *deflate, void (*cleanup)(void*), void *closure);
 extern struct afb_ws_json1 *afb_ws_json1_addref(struct afb_ws_json1 *ws);
 extern void afb_ws_json1_unref(struct afb_ws_json1 *ws);
 
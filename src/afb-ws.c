@@ -24,15 +24,43 @@
 #include <sys/uio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include <zlib.h>
 
 #include "websock.h"
+#include "websock-simd.h"
 #include "afb-ws.h"
 #include "fdev.h"
 
+/*
+ * size above which the data of a corked websocket are written
+ */
+#define CORK_SIZE_MAX	65536
+
+/*
+ * maximum count of frames dispatched for one event of the socket
+ */
+#define DISPATCH_MAX	32
+
+/*
+ * settings of the compression of messages: the messages smaller than
+ * DEFLATE_SIZE_MIN are not compressed, the window of compression is at
+ * most of 2^DEFLATE_WINDOW_BITS bytes and the compressor uses at most
+ * 2^(DEFLATE_WINDOW_BITS+2) + 2^(DEFLATE_MEM_LEVEL+9) bytes.
+ */
+#define DEFLATE_SIZE_MIN	256
+#define DEFLATE_WINDOW_BITS	13
+#define DEFLATE_MEM_LEVEL	7
+#define DEFLATE_LEVEL		6
+
 /*
  * declaration of the websock interface for afb-ws
  */
+static ssize_t aws_on_writev(struct afb_ws *ws, const struct iovec *iov, int iovcnt);
 static ssize_t aws_writev(struct afb_ws *ws, const struct iovec *iov, int iovcnt);
 static ssize_t aws_readv(struct afb_ws *ws, const struct iovec *iov, int iovcnt);
 static void aws_on_close(struct afb_ws *ws, uint16_t code, size_t size);
@@ -41,9 +69,10 @@ static void aws_on_binary(struct afb_ws *ws, int last, size_t size);
 static void aws_on_continue(struct afb_ws *ws, int last, size_t size);
 static void aws_on_readable(struct afb_ws *ws);
 static void aws_on_error(struct afb_ws *ws, uint16_t code, const void *data, size_t size);
+static int aws_on_extension(struct afb_ws *ws, int last, int rsv1, int rsv2, int rsv3, int opcode, size_t size);
 
 static struct websock_itf aws_itf = {
-	.writev = (void*)aws_writev,
+	.writev = (void*)aws_on_writev,
 	.readv = (void*)aws_readv,
 
 	.on_ping = NULL,
@@ -52,7 +81,7 @@ static struct websock_itf aws_itf = {
 	.on_text = (void*)aws_on_text,
 	.on_binary = (void*)aws_on_binary,
 	.on_continue = (void*)aws_on_continue,
-	.on_extension = NULL,
+	.on_extension = (void*)aws_on_extension,
 
 	.on_error = (void*)aws_on_error
 };
@@ -88,6 +117,18 @@ struct afb_ws
 	struct websock *ws;	/* the websock handler */
 	struct fdev *fdev;	/* the fdev for the socket */
 	struct buf buffer;	/* the last read fragment */
+	struct buf output;	/* the data written while corked */
+	size_t outcap;		/* allocated size of output */
+	unsigned corked;	/* count of corks */
+	int dispatching;	/* are received frames being dispatched? */
+	int destroyed;		/* was destroyed while dispatching? */
+	int inflating;		/* is the message being read compressed? */
+	struct afb_ws_deflate deflate; /* settings of the compression */
+	z_stream *zout;		/* the compressor or NULL */
+	z_stream *zin;		/* the decompressor or NULL */
+	struct buf zbuf;	/* the last compressed message */
+	size_t zcap;		/* allocated size of zbuf */
+	pthread_mutex_t mutex;	/* serializes the sendings and their compression (recursive) */
 };
 
 /*
@@ -117,22 +158,76 @@ static inline void aws_clear_buffer(struct afb_ws *ws)
  */
 static void aws_disconnect(struct afb_ws *ws, int call_on_hangup)
 {
-	struct websock *wsi = ws->ws;
+	struct websock *wsi;
+
+	pthread_mutex_lock(&ws->mutex);
+	wsi = ws->ws;
 	if (wsi != NULL) {
 		ws->ws = NULL;
 		fdev_unref(ws->fdev);
 		websock_destroy(wsi);
 		free(ws->buffer.buffer);
+		free(ws->output.buffer);
+		ws->output.buffer = NULL;
+		ws->output.size = 0;
+		ws->outcap = 0;
 		ws->state = waiting;
+		ws->inflating = 0;
+		if (ws->zout) {
+			deflateEnd(ws->zout);
+			free(ws->zout);
+			ws->zout = NULL;
+		}
+		if (ws->zin) {
+			inflateEnd(ws->zin);
+			free(ws->zin);
+			ws->zin = NULL;
+		}
+		free(ws->zbuf.buffer);
+		ws->zbuf.buffer = NULL;
+		ws->zbuf.size = 0;
+		ws->zcap = 0;
+		pthread_mutex_unlock(&ws->mutex);
 		if (call_on_hangup && ws->itf->on_hangup)
 			ws->itf->on_hangup(ws->closure);
-	}
+	} else
+		pthread_mutex_unlock(&ws->mutex);
+}
+
+/* is there received data not yet dispatched? */
+static int aws_has_input(struct afb_ws *ws)
+{
+	int count;
+
+	return ws->ws != NULL && ioctl(ws->fd, FIONREAD, &count) == 0 && count > 0;
 }
 
-static void fdevcb(void *ws, uint32_t revents, struct fdev *fdev)
+/*
+ * Callback of the events of the socket. The frames already received
+ * are dispatched in a row with 'ws' corked: the messages sent during
+ * the dispatch, by the callbacks or by other threads, are written
+ * together at its end.
+ */
+static void fdevcb(void *closure, uint32_t revents, struct fdev *fdev)
 {
-	if ((revents & EPOLLIN) != 0)
-		aws_on_readable(ws);
+	struct afb_ws *ws = closure;
+	int count;
+
+	if ((revents & EPOLLIN) != 0) {
+		ws->dispatching = 1;
+		afb_ws_cork(ws);
+		count = 0;
+		do {
+			aws_on_readable(ws);
+		} while (!ws->destroyed && ++count < DISPATCH_MAX && aws_has_input(ws));
+		ws->dispatching = 0;
+		if (ws->destroyed) {
+			pthread_mutex_destroy(&ws->mutex);
+			free(ws);
+			return;
+		}
+		afb_ws_uncork(ws);
+	}
 	if ((revents & EPOLLHUP) != 0)
 		afb_ws_hangup(ws);
 }
@@ -143,15 +238,26 @@ static void fdevcb(void *ws, uint32_t revents, struct fdev *fdev)
  * and its 'closure'.
  * When the creation is a success, the systemd event loop 'eloop' is
  * used for handling event for 'fd'.
+ * When 'deflate' isn't NULL, the messages are compressed as negotiated
+ * in 'deflate' during the handshake.
  *
  * Returns the handle for the afb_ws created or NULL on error.
  */
-struct afb_ws *afb_ws_create(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure)
+struct afb_ws *afb_ws_create(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure, const struct afb_ws_deflate *deflate)
 {
 	struct afb_ws *result;
+	pthread_mutexattr_t attr;
 
 	assert(fdev);
 
+	/* check the compression */
+	if (deflate != NULL
+	 && ((deflate->out_window_bits != 0 && (deflate->out_window_bits < 9 || deflate->out_window_bits > 15))
+	  || (deflate->in_window_bits != 0 && (deflate->in_window_bits < 8 || deflate->in_window_bits > 15)))) {
+		errno = EINVAL;
+		goto error;
+	}
+
 	/* allocation */
 	result = malloc(sizeof * result);
 	if (result == NULL)
@@ -165,6 +271,26 @@ struct afb_ws *afb_ws_create(struct fdev *fdev, const struct afb_ws_itf *itf, vo
 	result->closure = closure;
 	result->buffer.buffer = NULL;
 	result->buffer.size = 0;
+	result->output.buffer = NULL;
+	result->output.size = 0;
+	result->outcap = 0;
+	result->corked = 0;
+	result->dispatching = 0;
+	result->destroyed = 0;
+	result->inflating = 0;
+	if (deflate != NULL)
+		result->deflate = *deflate;
+	else
+		memset(&result->deflate, 0, sizeof result->deflate);
+	result->zout = NULL;
+	result->zin = NULL;
+	result->zbuf.buffer = NULL;
+	result->zbuf.size = 0;
+	result->zcap = 0;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&result->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
 
 	/* creates the websocket */
 	result->ws = websock_create_v13(&aws_itf, result);
@@ -177,6 +303,7 @@ struct afb_ws *afb_ws_create(struct fdev *fdev, const struct afb_ws_itf *itf, vo
 	return result;
 
 error2:
+	pthread_mutex_destroy(&result->mutex);
 	free(result);
 error:
 	fdev_unref(fdev);
@@ -187,11 +314,18 @@ error:
  * Destroys the websocket 'ws'
  * It first hangup (but without calling on_hangup for safety reasons)
  * if needed.
+ * When called by a callback of the dispatch, the memory is released
+ * at the end of the dispatch.
  */
 void afb_ws_destroy(struct afb_ws *ws)
 {
 	aws_disconnect(ws, 0);
-	free(ws);
+	if (ws->dispatching)
+		ws->destroyed = 1;
+	else {
+		pthread_mutex_destroy(&ws->mutex);
+		free(ws);
+	}
 }
 
 /*
@@ -210,6 +344,42 @@ int afb_ws_is_connected(struct afb_ws *ws)
 	return ws->ws != NULL;
 }
 
+/*
+ * Corks the websocket 'ws': until it is uncorked, the data sent
+ * are accumulated and written together when their size reaches
+ * CORK_SIZE_MAX or when 'ws' is uncorked.
+ * Corks are counted: the data are written on the last uncork.
+ */
+void afb_ws_cork(struct afb_ws *ws)
+{
+	__atomic_add_fetch(&ws->corked, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Uncorks the websocket 'ws' and writes the accumulated data
+ * if it is the last uncork.
+ * Returns 0 on success or -1 in case of error.
+ */
+int afb_ws_uncork(struct afb_ws *ws)
+{
+	struct iovec iov;
+	ssize_t rc;
+
+	pthread_mutex_lock(&ws->mutex);
+	if (ws->corked == 0
+	 || __atomic_sub_fetch(&ws->corked, 1, __ATOMIC_RELAXED) != 0
+	 || ws->output.size == 0)
+		rc = 0;
+	else {
+		iov.iov_base = ws->output.buffer;
+		iov.iov_len = ws->output.size;
+		ws->output.size = 0;
+		rc = aws_writev(ws, &iov, 1);
+	}
+	pthread_mutex_unlock(&ws->mutex);
+	return rc < 0 ? -1 : 0;
+}
+
 /*
  * Sends a 'close' command to the endpoint of 'ws' with the 'code' and the
  * 'reason' (that can be NULL and that else should not be greater than 123
@@ -218,12 +388,17 @@ int afb_ws_is_connected(struct afb_ws *ws)
  */
 int afb_ws_close(struct afb_ws *ws, uint16_t code, const char *reason)
 {
+	int rc;
+
+	pthread_mutex_lock(&ws->mutex);
 	if (ws->ws == NULL) {
 		/* disconnected */
 		errno = EPIPE;
-		return -1;
-	}
-	return websock_close(ws->ws, code, reason, reason == NULL ? 0 : strlen(reason));
+		rc = -1;
+	} else
+		rc = websock_close(ws->ws, code, reason, reason == NULL ? 0 : strlen(reason));
+	pthread_mutex_unlock(&ws->mutex);
+	return rc;
 }
 
 /*
@@ -244,17 +419,142 @@ int afb_ws_error(struct afb_ws *ws, uint16_t code, const char *reason)
 }
 
 /*
- * Sends a 'text' of 'length' to the endpoint of 'ws'.
+ * Compresses in the buffer zbuf of 'ws' the message described
+ * by the 'count' 'iovec'.
  * Returns 0 on success or -1 in case of error.
  */
-int afb_ws_text(struct afb_ws *ws, const char *text, size_t length)
+static int aws_deflate(struct afb_ws *ws, const struct iovec *iovec, int count)
+{
+	z_stream *z;
+	char *buffer;
+	size_t cap;
+	int i, flush, rc;
+
+	/* creates the compressor at first use */
+	z = ws->zout;
+	if (z == NULL) {
+		z = calloc(1, sizeof *z);
+		if (z == NULL)
+			goto nomem;
+		if (deflateInit2(z, DEFLATE_LEVEL, Z_DEFLATED, -ws->deflate.out_window_bits,
+					DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+			free(z);
+			goto nomem;
+		}
+		ws->zout = z;
+	}
+
+	/* compresses the data and flushes */
+	ws->zbuf.size = 0;
+	for (i = 0 ; i <= count ; i++) {
+		if (i < count) {
+			z->next_in = iovec[i].iov_base;
+			z->avail_in = (uInt)iovec[i].iov_len;
+			flush = Z_NO_FLUSH;
+		} else {
+			z->next_in = NULL;
+			z->avail_in = 0;
+			flush = Z_SYNC_FLUSH;
+		}
+		do {
+			if (ws->zbuf.size == ws->zcap) {
+				cap = ws->zcap ? ws->zcap << 1 : 4096;
+				buffer = realloc(ws->zbuf.buffer, cap);
+				if (buffer == NULL)
+					goto error;
+				ws->zbuf.buffer = buffer;
+				ws->zcap = cap;
+			}
+			z->next_out = (Bytef*)&ws->zbuf.buffer[ws->zbuf.size];
+			z->avail_out = (uInt)(ws->zcap - ws->zbuf.size);
+			rc = deflate(z, flush);
+			ws->zbuf.size = ws->zcap - z->avail_out;
+			if (rc == Z_STREAM_ERROR)
+				goto error;
+		} while (z->avail_in != 0 || z->avail_out == 0);
+	}
+
+	/* the flush ends with 00 00 FF FF that is not transmitted */
+	ws->zbuf.size -= 4;
+	if (ws->deflate.out_no_takeover)
+		deflateReset(z);
+	return 0;
+
+error:
+	/* resetting is always safe for the decompressor of the peer */
+	deflateReset(z);
+nomem:
+	errno = ENOMEM;
+	return -1;
+}
+
+/*
+ * Sends the message described by the 'count' 'iovec' to the
+ * endpoint of 'ws' as a text if 'text' isn't zero or else as binary.
+ * The message is compressed if it was negotiated and if the message
+ * is big enough.
+ * Returns 0 on success or -1 in case of error.
+ */
+static int aws_send_v_locked(struct afb_ws *ws, int text, const struct iovec *iovec, int count)
 {
+	size_t size;
+	int i, rc;
+
 	if (ws->ws == NULL) {
 		/* disconnected */
 		errno = EPIPE;
 		return -1;
 	}
-	return websock_text(ws->ws, 1, text, length);
+
+	if (ws->deflate.out_window_bits != 0) {
+		size = 0;
+		for (i = 0 ; i < count ; i++)
+			size += iovec[i].iov_len;
+		if (size >= DEFLATE_SIZE_MIN) {
+			rc = aws_deflate(ws, iovec, count);
+			if (rc == 0)
+				rc = (text ? websock_text_compressed : websock_binary_compressed)
+					(ws->ws, 1, ws->zbuf.buffer, ws->zbuf.size);
+			/* don't keep big buffers */
+			if (ws->zcap > CORK_SIZE_MAX) {
+				free(ws->zbuf.buffer);
+				ws->zbuf.buffer = NULL;
+				ws->zcap = 0;
+			}
+			return rc;
+		}
+	}
+	return (text ? websock_text_v : websock_binary_v)(ws->ws, 1, iovec, count);
+}
+
+/*
+ * Sends the message as 'aws_send_v_locked' but serialized with the
+ * other sendings of 'ws': the messages must be written in the order
+ * of their compression because the peer decompresses them with
+ * the same context.
+ * Returns 0 on success or -1 in case of error.
+ */
+static int aws_send_v(struct afb_ws *ws, int text, const struct iovec *iovec, int count)
+{
+	int rc;
+
+	pthread_mutex_lock(&ws->mutex);
+	rc = aws_send_v_locked(ws, text, iovec, count);
+	pthread_mutex_unlock(&ws->mutex);
+	return rc;
+}
+
+/*
+ * Sends a 'text' of 'length' to the endpoint of 'ws'.
+ * Returns 0 on success or -1 in case of error.
+ */
+int afb_ws_text(struct afb_ws *ws, const char *text, size_t length)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void*)text;
+	iov.iov_len = length;
+	return aws_send_v(ws, 1, &iov, 1);
 }
 
 /*
@@ -288,7 +588,7 @@ int afb_ws_texts(struct afb_ws *ws, ...)
 		s = va_arg(args, const char *);
 	}
 	va_end(args);
-	return websock_text_v(ws->ws, 1, ios, count);
+	return aws_send_v(ws, 1, ios, count);
 }
 
 /*
@@ -297,12 +597,7 @@ int afb_ws_texts(struct afb_ws *ws, ...)
  */
 int afb_ws_text_v(struct afb_ws *ws, const struct iovec *iovec, int count)
 {
-	if (ws->ws == NULL) {
-		/* disconnected */
-		errno = EPIPE;
-		return -1;
-	}
-	return websock_text_v(ws->ws, 1, iovec, count);
+	return aws_send_v(ws, 1, iovec, count);
 }
 
 /*
@@ -311,12 +606,11 @@ int afb_ws_text_v(struct afb_ws *ws, const struct iovec *iovec, int count)
  */
 int afb_ws_binary(struct afb_ws *ws, const void *data, size_t length)
 {
-	if (ws->ws == NULL) {
-		/* disconnected */
-		errno = EPIPE;
-		return -1;
-	}
-	return websock_binary(ws->ws, 1, data, length);
+	struct iovec iov;
+
+	iov.iov_base = (void*)data;
+	iov.iov_len = length;
+	return aws_send_v(ws, 0, &iov, 1);
 }
 
 /*
@@ -325,16 +619,41 @@ int afb_ws_binary(struct afb_ws *ws, const void *data, size_t length)
  */
 int afb_ws_binary_v(struct afb_ws *ws, const struct iovec *iovec, int count)
 {
-	if (ws->ws == NULL) {
-		/* disconnected */
-		errno = EPIPE;
-		return -1;
+	return aws_send_v(ws, 0, iovec, count);
+}
+
+/*
+ * Appends to the corked output of 'ws' the data of 'size'
+ * described by 'iov' of 'iovcnt'.
+ * Returns 1 if appended or 0 if the data must be written now.
+ */
+static int aws_cork_append(struct afb_ws *ws, const struct iovec *iov, int iovcnt, size_t size)
+{
+	int i;
+	size_t length;
+	char *buffer;
+
+	length = ws->output.size + size;
+	if (length > CORK_SIZE_MAX)
+		return 0;
+
+	if (length > ws->outcap) {
+		buffer = realloc(ws->output.buffer, CORK_SIZE_MAX);
+		if (buffer == NULL)
+			return 0;
+		ws->output.buffer = buffer;
+		ws->outcap = CORK_SIZE_MAX;
+	}
+
+	for (i = 0 ; i < iovcnt ; i++) {
+		memcpy(&ws->output.buffer[ws->output.size], iov[i].iov_base, iov[i].iov_len);
+		ws->output.size += iov[i].iov_len;
 	}
-	return websock_binary_v(ws->ws, 1, iovec, count);
+	return 1;
 }
 
 /*
- * callback for writing data
+ * writes data, accumulating it when corked
  */
 static ssize_t aws_writev(struct afb_ws *ws, const struct iovec *iov, int iovcnt)
 {
@@ -356,6 +675,22 @@ static ssize_t aws_writev(struct afb_ws *ws, const struct iovec *iov, int iovcnt
 	if (dsz == 0)
 		return 0;
 
+	/* accumulate or write along with the accumulated data */
+	if (ws->corked) {
+		if (aws_cork_append(ws, iov, iovcnt, (size_t)dsz))
+			return dsz;
+		if (ws->output.size != 0) {
+			iov2 = alloca((size_t)(iovcnt + 1) * sizeof *iov2);
+			iov2[0].iov_base = ws->output.buffer;
+			iov2[0].iov_len = ws->output.size;
+			for (i = 0 ; i < iovcnt ; i++)
+				iov2[i + 1] = iov[i];
+			ws->output.size = 0;
+			rc = aws_writev(ws, iov2, iovcnt + 1);
+			return rc < 0 ? rc : dsz;
+		}
+	}
+
 	/* write the data */
 	iov2 = (struct iovec*)iov;
 	sz = dsz;
@@ -393,6 +728,27 @@ static ssize_t aws_writev(struct afb_ws *ws, const struct iovec *iov, int iovcnt
 	}
 }
 
+/*
+ * callback for writing data: the frames written by websock outside
+ * of the sendings of afb-ws (pongs, closes and errors) are serialized
+ * with them
+ */
+static ssize_t aws_on_writev(struct afb_ws *ws, const struct iovec *iov, int iovcnt)
+{
+	ssize_t rc;
+
+	pthread_mutex_lock(&ws->mutex);
+	if (ws->ws != NULL)
+		rc = aws_writev(ws, iov, iovcnt);
+	else {
+		/* disconnected */
+		errno = EPIPE;
+		rc = -1;
+	}
+	pthread_mutex_unlock(&ws->mutex);
+	return rc;
+}
+
 /*
  * callback for reading data
  */
@@ -481,11 +837,94 @@ static void aws_on_close(struct afb_ws *ws, uint16_t code, size_t size)
 static void aws_drop_error(struct afb_ws *ws, uint16_t code)
 {
 	ws->state = waiting;
+	ws->inflating = 0;
 	aws_clear_buffer(ws);
 	websock_drop(ws->ws);
 	websock_error(ws->ws, code, NULL, 0);
 }
 
+/*
+ * Decompresses the message of the current buffer of 'ws'.
+ * Returns 0 on success or the code of the error.
+ */
+static uint16_t aws_inflate(struct afb_ws *ws)
+{
+	static const char tail[4] = { 0, 0, '\xff', '\xff' };
+	z_stream *z;
+	struct buf out;
+	size_t cap, max;
+	char *buffer;
+	int rc, tailed;
+
+	/* creates the decompressor at first use */
+	z = ws->zin;
+	if (z == NULL) {
+		z = calloc(1, sizeof *z);
+		if (z == NULL)
+			return WEBSOCKET_CODE_INTERNAL_ERROR;
+		if (inflateInit2(z, -ws->deflate.in_window_bits) != Z_OK) {
+			free(z);
+			return WEBSOCKET_CODE_INTERNAL_ERROR;
+		}
+		ws->zin = z;
+	}
+
+	/* decompresses the data followed by the tail 00 00 FF FF */
+	max = websock_get_max_length(ws->ws);
+	out.buffer = NULL;
+	out.size = cap = 0;
+	z->next_in = (Bytef*)ws->buffer.buffer;
+	z->avail_in = (uInt)ws->buffer.size;
+	tailed = 0;
+	for (;;) {
+		if (z->avail_in == 0 && !tailed) {
+			z->next_in = (Bytef*)tail;
+			z->avail_in = (uInt)sizeof tail;
+			tailed = 1;
+		}
+		if (out.size == cap) {
+			if (cap >= max) {
+				rc = WEBSOCKET_CODE_MESSAGE_TOO_LARGE;
+				goto error;
+			}
+			cap = cap ? cap << 1 : (ws->buffer.size << 2) + 256;
+			if (cap > max)
+				cap = max;
+			buffer = realloc(out.buffer, cap + 1);
+			if (buffer == NULL) {
+				rc = WEBSOCKET_CODE_INTERNAL_ERROR;
+				goto error;
+			}
+			out.buffer = buffer;
+		}
+		z->next_out = (Bytef*)&out.buffer[out.size];
+		z->avail_out = (uInt)(cap - out.size);
+		rc = inflate(z, Z_SYNC_FLUSH);
+		out.size = cap - z->avail_out;
+		if (rc == Z_STREAM_END) {
+			/* a final block ends the stream */
+			inflateReset(z);
+			break;
+		}
+		if (rc != Z_OK && (rc != Z_BUF_ERROR || z->avail_out == 0)) {
+			rc = WEBSOCKET_CODE_PROTOCOL_ERROR;
+			goto error;
+		}
+		if (tailed && z->avail_in == 0 && z->avail_out != 0)
+			break;
+	}
+	if (ws->deflate.in_no_takeover)
+		inflateReset(z);
+
+	free(ws->buffer.buffer);
+	ws->buffer = out;
+	return 0;
+
+error:
+	free(out.buffer);
+	return (uint16_t)rc;
+}
+
 /*
  * Reads either text or binary data of 'size' from 'ws' eventually 'last'.
  */
@@ -493,11 +932,24 @@ static void aws_continue(struct afb_ws *ws, int last, size_t size)
 {
 	struct buf b;
 	int istxt;
+	uint16_t code;
 
 	if (!aws_read(ws, size))
 		aws_drop_error(ws, WEBSOCKET_CODE_ABNORMAL);
 	else if (last) {
 		istxt = ws->state == reading_text;
+		if (ws->inflating) {
+			ws->inflating = 0;
+			code = aws_inflate(ws);
+			if (code) {
+				aws_drop_error(ws, code);
+				return;
+			}
+		}
+		if (istxt && !websock_simd_utf8_valid(ws->buffer.buffer, ws->buffer.size)) {
+			aws_drop_error(ws, WEBSOCKET_CODE_INVALID_UTF8);
+			return;
+		}
 		ws->state = waiting;
 		b = aws_pick_buffer(ws);
 		(istxt ? ws->itf->on_text : ws->itf->on_binary)(ws->closure, b.buffer, b.size);
@@ -545,6 +997,30 @@ static void aws_on_continue(struct afb_ws *ws, int last, size_t size)
 		aws_continue(ws, last, size);
 }
 
+/*
+ * Callback when a frame of 'ws' has some of the bits 'rsv1', 'rsv2', 'rsv3'.
+ * Only the first frame of compressed messages has the bit 'rsv1' set.
+ * Returns 1 if the frame is handled or 0 otherwise.
+ */
+static int aws_on_extension(struct afb_ws *ws, int last, int rsv1, int rsv2, int rsv3, int opcode, size_t size)
+{
+	if (!rsv1 || rsv2 || rsv3 || ws->deflate.in_window_bits == 0 || ws->state != waiting)
+		return 0;
+
+	switch (opcode) {
+	case WEBSOCKET_OPCODE_TEXT:
+		ws->inflating = 1;
+		aws_on_text(ws, last, size);
+		return 1;
+	case WEBSOCKET_OPCODE_BINARY:
+		ws->inflating = 1;
+		aws_on_binary(ws, last, size);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 /*
  * Callback when 'close' command is sent to 'ws' with 'code' and 'size'.
  */
@@ -557,3 +1033,203 @@ static void aws_on_error(struct afb_ws *ws, uint16_t code, const void *data, siz
 }
 
 
+
+/******************************************************************************
+ * negotiation of the compression (permessage-deflate, RFC 7692)
+ ******************************************************************************/
+
+/*
+ * The offer made by clients: it accepts limitation of its window
+ */
+const char afb_ws_deflate_offer[] = "permessage-deflate; client_max_window_bits";
+
+/*
+ * Parameters of an extension offer or response
+ */
+struct deflate_params
+{
+	int server_no_context_takeover;
+	int client_no_context_takeover;
+	int server_max_window_bits;	/* -1 when absent */
+	int client_max_window_bits;	/* -1 when absent, 0 when without value */
+};
+
+static const char *skip_spaces(const char *s)
+{
+	return s + strspn(s, " \t");
+}
+
+static size_t token_length(const char *s)
+{
+	return strcspn(s, " \t,;=\"");
+}
+
+static int is_token(const char *s, size_t len, const char *token)
+{
+	return len == strlen(token) && !strncasecmp(s, token, len);
+}
+
+/*
+ * Parses the extension at '*iter' and updates '*iter' to the next one.
+ * Returns -1 at end, 1 if the extension is a valid permessage-deflate
+ * whose parameters are stored in 'params' or 0 otherwise.
+ */
+static int deflate_parse(const char **iter, struct deflate_params *params)
+{
+	const char *s, *name;
+	size_t len, nlen;
+	int valid, value, quoted;
+
+	s = skip_spaces(*iter);
+	if (!*s)
+		return -1;
+
+	params->server_no_context_takeover = 0;
+	params->client_no_context_takeover = 0;
+	params->server_max_window_bits = -1;
+	params->client_max_window_bits = -1;
+
+	len = token_length(s);
+	valid = is_token(s, len, "permessage-deflate");
+	s = skip_spaces(s + len);
+	while (*s == ';') {
+		/* scans the parameter */
+		name = skip_spaces(s + 1);
+		nlen = token_length(name);
+		s = skip_spaces(name + nlen);
+		value = -1;
+		if (*s == '=') {
+			s = skip_spaces(s + 1);
+			quoted = *s == '"';
+			s += quoted;
+			len = token_length(s);
+			if (len == 1 && *s == '8')
+				value = 8;
+			else if (len == 1 && *s == '9')
+				value = 9;
+			else if (len == 2 && s[0] == '1' && s[1] >= '0' && s[1] <= '5')
+				value = 10 + s[1] - '0';
+			else
+				valid = 0;
+			s += len;
+			if (quoted) {
+				if (*s == '"')
+					s++;
+				else
+					valid = 0;
+			}
+			s = skip_spaces(s);
+		}
+
+		/* records the parameter */
+		if (is_token(name, nlen, "server_no_context_takeover")
+		 && value < 0 && !params->server_no_context_takeover)
+			params->server_no_context_takeover = 1;
+		else if (is_token(name, nlen, "client_no_context_takeover")
+		 && value < 0 && !params->client_no_context_takeover)
+			params->client_no_context_takeover = 1;
+		else if (is_token(name, nlen, "server_max_window_bits")
+		 && value > 0 && params->server_max_window_bits < 0)
+			params->server_max_window_bits = value;
+		else if (is_token(name, nlen, "client_max_window_bits")
+		 && params->client_max_window_bits < 0)
+			params->client_max_window_bits = value < 0 ? 0 : value;
+		else
+			valid = 0;
+	}
+
+	/* goes to the next extension */
+	if (*s && *s != ',') {
+		valid = 0;
+		s += strcspn(s, ",");
+	}
+	*iter = *s ? s + 1 : s;
+	return valid;
+}
+
+/*
+ * Returns the window to use when the peer allows 'bits' (-1 or 0 when unset)
+ */
+static int deflate_window(int bits)
+{
+	return bits <= 0 || bits > DEFLATE_WINDOW_BITS ? DEFLATE_WINDOW_BITS : bits;
+}
+
+/*
+ * Returns the window to use for compressing when the peer allows 'bits'
+ */
+static int deflate_out_window(int bits)
+{
+	/* zlib doesn't compress raw streams with a window of 8 bits */
+	bits = deflate_window(bits);
+	return bits < 9 ? 0 : bits;
+}
+
+/*
+ * For servers, searches in the extension 'offers' of a client the first
+ * acceptable offer of permessage-deflate. When found, stores the settings
+ * in 'deflate' and the text of the header of the response in 'response'
+ * of 'size'.
+ * Returns 1 if an offer is accepted or 0 otherwise.
+ */
+int afb_ws_deflate_accept(const char *offers, struct afb_ws_deflate *deflate, char *response, size_t size)
+{
+	struct deflate_params params;
+	char sbits[32], cbits[32];
+	int rc;
+
+	while ((rc = deflate_parse(&offers, &params)) >= 0) {
+		if (rc == 0)
+			continue;
+
+		deflate->out_window_bits = deflate_out_window(params.server_max_window_bits);
+		deflate->out_no_takeover = params.server_no_context_takeover;
+		deflate->in_window_bits = params.client_max_window_bits < 0 ? 15
+				: deflate_window(params.client_max_window_bits);
+		deflate->in_no_takeover = params.client_no_context_takeover;
+
+		/* the server can limit its window even if not requested */
+		if (params.server_max_window_bits >= 0 && deflate->out_window_bits == 0)
+			snprintf(sbits, sizeof sbits, "; server_max_window_bits=%d", params.server_max_window_bits);
+		else if (deflate->out_window_bits < 15)
+			snprintf(sbits, sizeof sbits, "; server_max_window_bits=%d", deflate->out_window_bits);
+		else
+			sbits[0] = 0;
+
+		/* the server can limit the window of the client only if offered */
+		if (params.client_max_window_bits >= 0)
+			snprintf(cbits, sizeof cbits, "; client_max_window_bits=%d", deflate->in_window_bits);
+		else
+			cbits[0] = 0;
+
+		rc = snprintf(response, size, "permessage-deflate%s%s%s%s",
+				params.server_no_context_takeover ? "; server_no_context_takeover" : "",
+				params.client_no_context_takeover ? "; client_no_context_takeover" : "",
+				sbits, cbits);
+		return rc > 0 && (size_t)rc < size;
+	}
+	return 0;
+}
+
+/*
+ * For clients, checks the extension 'response' of the server to the offer
+ * 'afb_ws_deflate_offer' and stores the settings in 'deflate'.
+ * Returns 0 on success or -1 if the response is invalid.
+ */
+int afb_ws_deflate_agree(const char *response, struct afb_ws_deflate *deflate)
+{
+	struct deflate_params params;
+
+	if (deflate_parse(&response, &params) <= 0
+	 || params.client_max_window_bits == 0
+	 || *skip_spaces(response)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	deflate->out_window_bits = deflate_out_window(params.client_max_window_bits);
+	deflate->out_no_takeover = params.client_no_context_takeover;
+	deflate->in_window_bits = params.server_max_window_bits < 0 ? 15 : params.server_max_window_bits;
+	deflate->in_no_takeover = params.server_no_context_takeover;
+	return 0;
+}
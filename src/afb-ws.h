@@ -21,6 +21,19 @@ struct afb_ws;
 struct fdev;
 struct iovec;
 
+/*
+ * Settings of the compression of the messages (extension
+ * permessage-deflate of RFC 7692) as seen by the local end.
+ * The window sizes are given as their base 2 logarithm.
+ */
+struct afb_ws_deflate
+{
+	int out_window_bits;	/* window of compression (9..15) or 0 for not compressing */
+	int out_no_takeover;	/* is the compression reset after each message? */
+	int in_window_bits;	/* window of decompression (8..15) or 0 for refusing compressed messages */
+	int in_no_takeover;	/* is the decompression reset after each message? */
+};
+
 struct afb_ws_itf
 {
 	void (*on_close) (void *, uint16_t code, char *, size_t size); /* optional, if not set hangup is called */
@@ -30,7 +43,7 @@ struct afb_ws_itf
 	void (*on_hangup) (void *); /* optional, it is safe too call afb_ws_destroy within the callback */
 };
 
-extern struct afb_ws *afb_ws_create(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure);
+extern struct afb_ws *afb_ws_create(struct fdev *fdev, const struct afb_ws_itf *itf, void *closure, const struct afb_ws_deflate *deflate);
 extern void afb_ws_destroy(struct afb_ws *ws);
 extern void afb_ws_hangup(struct afb_ws *ws);
 extern int afb_ws_is_connected(struct afb_ws *ws);
@@ -41,4 +54,9 @@ extern int afb_ws_texts(struct afb_ws *ws, ...);
 extern int afb_ws_binary(struct afb_ws *ws, const void *data, size_t length);
 extern int afb_ws_text_v(struct afb_ws *ws, const struct iovec *iovec, int count);
 extern int afb_ws_binary_v(struct afb_ws *ws, const struct iovec *iovec, int count);
+extern void afb_ws_cork(struct afb_ws *ws);
+extern int afb_ws_uncork(struct afb_ws *ws);
 
+extern const char afb_ws_deflate_offer[];
+extern int afb_ws_deflate_accept(const char *offers, struct afb_ws_deflate *deflate, char *response, size_t size);
+extern int afb_ws_deflate_agree(const char *response, struct afb_ws_deflate *deflate);
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include <json-c/json.h>
 #if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
@@ -33,6 +34,7 @@
 #include "afb-ws.h"
 #include "afb-wsj1.h"
 #include "fdev.h"
+#include "idmap.h"
 
 #define CALL 2
 #define RETOK 3
@@ -53,9 +55,9 @@ static struct afb_ws_itf wsj1_itf = {
 
 struct wsj1_call
 {
-	struct wsj1_call *next;
 	void (*callback)(void *, struct afb_wsj1_msg *);
 	void *closure;
+	uint32_t callid;
 	char id[16];
 };
 
@@ -79,17 +81,15 @@ struct afb_wsj1_msg
 struct afb_wsj1
 {
 	int refcount;
-	int genid;
 	struct afb_wsj1_itf *itf;
 	void *closure;
-	struct json_tokener *tokener;
 	struct afb_ws *ws;
 	struct afb_wsj1_msg *messages;
-	struct wsj1_call *calls;
+	struct idmap calls;
 	pthread_mutex_t mutex;
 };
 
-struct afb_wsj1 *afb_wsj1_create(struct fdev *fdev, struct afb_wsj1_itf *itf, void *closure)
+struct afb_wsj1 *afb_wsj1_create_deflate(struct fdev *fdev, struct afb_wsj1_itf *itf, void *closure, const struct afb_ws_deflate *deflate)
 {
 	struct afb_wsj1 *result;
 
@@ -98,31 +98,30 @@ struct afb_wsj1 *afb_wsj1_create(struct fdev *fdev, struct afb_wsj1_itf *itf, vo
 	assert(itf->on_call);
 
 	result = calloc(1, sizeof * result);
-	if (result == NULL)
-		goto error;
+	if (result == NULL) {
+		fdev_unref(fdev);
+		return NULL;
+	}
 
 	result->refcount = 1;
 	result->itf = itf;
 	result->closure = closure;
 	pthread_mutex_init(&result->mutex, NULL);
 
-	result->tokener = json_tokener_new();
-	if (result->tokener == NULL)
-		goto error2;
-
-	result->ws = afb_ws_create(fdev, &wsj1_itf, result);
-	if (result->ws == NULL)
-		goto error3;
+	/* on error, afb_ws_create releases fdev */
+	result->ws = afb_ws_create(fdev, &wsj1_itf, result, deflate);
+	if (result->ws == NULL) {
+		pthread_mutex_destroy(&result->mutex);
+		free(result);
+		return NULL;
+	}
 
 	return result;
+}
 
-error3:
-	json_tokener_free(result->tokener);
-error2:
-	free(result);
-error:
-	fdev_unref(fdev);
-	return NULL;
+struct afb_wsj1 *afb_wsj1_create(struct fdev *fdev, struct afb_wsj1_itf *itf, void *closure)
+{
+	return afb_wsj1_create_deflate(fdev, itf, closure, NULL);
 }
 
 void afb_wsj1_addref(struct afb_wsj1 *wsj1)
@@ -135,14 +134,15 @@ void afb_wsj1_unref(struct afb_wsj1 *wsj1)
 {
 	if (wsj1 && !__atomic_sub_fetch(&wsj1->refcount, 1, __ATOMIC_RELAXED)) {
 		afb_ws_destroy(wsj1->ws);
-		json_tokener_free(wsj1->tokener);
+		idmap_release(&wsj1->calls);
 		free(wsj1);
 	}
 }
 
-static void wsj1_on_hangup(struct afb_wsj1 *wsj1)
+static void wsj1_on_hangup_call(void *closure, uint32_t callid, void *value)
 {
-	struct wsj1_call *call, *ncall;
+	struct afb_wsj1 *wsj1 = closure;
+	struct wsj1_call *call = value;
 	struct afb_wsj1_msg *msg;
 	char *text;
 	int len;
@@ -153,49 +153,64 @@ static void wsj1_on_hangup(struct afb_wsj1 *wsj1)
 			"\"status\":\"disconnected\","
 			"\"info\":\"server hung up\"}}";
 
-	ncall = __atomic_exchange_n(&wsj1->calls, NULL, __ATOMIC_RELAXED);
-	while (ncall) {
-		call = ncall;
-		ncall = call->next;
-		len = asprintf(&text, "[%d,\"%s\",%s]", RETERR, call->id, error_object_str);
-		if (len > 0) {
-			msg = wsj1_msg_make(wsj1, text, (size_t)len);
-			if (msg != NULL) {
-				call->callback(call->closure, msg);
-				afb_wsj1_msg_unref(msg);
-			}
+	len = asprintf(&text, "[%d,\"%s\",%s]", RETERR, call->id, error_object_str);
+	if (len > 0) {
+		msg = wsj1_msg_make(wsj1, text, (size_t)len);
+		if (msg != NULL) {
+			call->callback(call->closure, msg);
+			afb_wsj1_msg_unref(msg);
 		}
-		free(call);
 	}
+	free(call);
+}
+
+static void wsj1_on_hangup(struct afb_wsj1 *wsj1)
+{
+	struct idmap calls;
+
+	pthread_mutex_lock(&wsj1->mutex);
+	idmap_move(&calls, &wsj1->calls);
+	pthread_mutex_unlock(&wsj1->mutex);
+
+	idmap_for_all(&calls, wsj1_on_hangup_call, wsj1);
+	idmap_release(&calls);
 
 	if (wsj1->itf->on_hangup != NULL)
 		wsj1->itf->on_hangup(wsj1->closure, wsj1);
 }
 
 
-static struct wsj1_call *wsj1_locked_call_search(struct afb_wsj1 *wsj1, const char *id, int remove)
+/*
+ * Gets in 'callid' the numeric value of the call identifier 'id'.
+ * Only the identifiers emitted by 'wsj1_call_create' are accepted.
+ * Returns 1 on success or 0 otherwise.
+ */
+static int wsj1_call_id(const char *id, uint32_t *callid)
 {
-	struct wsj1_call *r, **p;
-
-	p = &wsj1->calls;
-	while((r = *p) != NULL) {
-		if (strcmp(r->id, id) == 0) {
-			if (remove)
-				*p = r->next;
-			break;
-		}
-		p = &r->next;
-	}
+	uint32_t x = 0, d;
 
-	return r;
+	if (*id < '1' || *id > '9')
+		return 0;
+	do {
+		d = (uint32_t)(*id++ - '0');
+		if (x > UINT32_MAX / 10 || (x == UINT32_MAX / 10 && d > UINT32_MAX % 10))
+			return 0;
+		x = x * 10 + d;
+	} while (*id >= '0' && *id <= '9');
+	*callid = x;
+	return !*id;
 }
 
 static struct wsj1_call *wsj1_call_search(struct afb_wsj1 *wsj1, const char *id, int remove)
 {
 	struct wsj1_call *r;
+	uint32_t callid;
+
+	if (!wsj1_call_id(id, &callid))
+		return NULL;
 
 	pthread_mutex_lock(&wsj1->mutex);
-	r = wsj1_locked_call_search(wsj1, id, remove);
+	r = (remove ? idmap_remove : idmap_get)(&wsj1->calls, callid);
 	pthread_mutex_unlock(&wsj1->mutex);
 
 	return r;
@@ -203,21 +218,22 @@ static struct wsj1_call *wsj1_call_search(struct afb_wsj1 *wsj1, const char *id,
 
 static struct wsj1_call *wsj1_call_create(struct afb_wsj1 *wsj1, void (*on_reply)(void*,struct afb_wsj1_msg*), void *closure)
 {
+	int rc;
 	struct wsj1_call *call = malloc(sizeof *call);
 	if (call == NULL)
 		errno = ENOMEM;
 	else {
-		pthread_mutex_lock(&wsj1->mutex);
-		do {
-			if (wsj1->genid == 0)
-				wsj1->genid = 999999;
-			sprintf(call->id, "%d", wsj1->genid--);
-		} while (wsj1_locked_call_search(wsj1, call->id, 0) != NULL);
 		call->callback = on_reply;
 		call->closure = closure;
-		call->next = wsj1->calls;
-		wsj1->calls = call;
+		pthread_mutex_lock(&wsj1->mutex);
+		rc = idmap_add(&wsj1->calls, call, &call->callid);
+		if (rc >= 0)
+			sprintf(call->id, "%u", (unsigned)call->callid);
 		pthread_mutex_unlock(&wsj1->mutex);
+		if (rc < 0) {
+			free(call);
+			call = NULL;
+		}
 	}
 	return call;
 }
@@ -442,21 +458,68 @@ const char *afb_wsj1_msg_object_s(struct afb_wsj1_msg *msg)
 	return msg->object_s;
 }
 
+size_t afb_wsj1_msg_object_s_length(struct afb_wsj1_msg *msg)
+{
+	return msg->object_s_length;
+}
+
+/*
+ * Parsing of objects is made lazily by the threads that need it,
+ * each one using its own tokener, avoiding to parse on the thread
+ * of the event loop and to serialize parsings on a shared tokener.
+ */
+static pthread_key_t tokener_key;
+static pthread_once_t tokener_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct json_tokener *tokener;
+
+static void tokener_key_create()
+{
+	pthread_key_create(&tokener_key, (void(*)(void*))json_tokener_free);
+}
+
+/* get the tokener of the current thread */
+static struct json_tokener *tokener_get()
+{
+	if (tokener == NULL) {
+		tokener = json_tokener_new();
+		if (tokener != NULL) {
+			/* the key releases the tokener at thread's exit */
+			pthread_once(&tokener_once, tokener_key_create);
+			pthread_setspecific(tokener_key, tokener);
+		}
+	}
+	else
+		json_tokener_reset(tokener);
+	return tokener;
+}
+
 struct json_object *afb_wsj1_msg_object_j(struct afb_wsj1_msg *msg)
 {
-	enum json_tokener_error jerr;
-	struct json_object *object = msg->object_j;
+	struct json_tokener *tok;
+	struct json_object *object, *expected;
+
+	object = __atomic_load_n(&msg->object_j, __ATOMIC_ACQUIRE);
 	if (object == NULL) {
-		pthread_mutex_lock(&msg->wsj1->mutex);
-		json_tokener_reset(msg->wsj1->tokener);
-		object = json_tokener_parse_ex(msg->wsj1->tokener, msg->object_s, 1 + (int)msg->object_s_length);
-		jerr = json_tokener_get_error(msg->wsj1->tokener);
-		pthread_mutex_unlock(&msg->wsj1->mutex);
-		if (jerr != json_tokener_success) {
-			/* lazy error detection of json request. Is it to improve? */
+		tok = tokener_get();
+		if (tok == NULL)
+			object = NULL;
+		else {
+			object = json_tokener_parse_ex(tok, msg->object_s, 1 + (int)msg->object_s_length);
+			if (json_tokener_get_error(tok) != json_tokener_success) {
+				/* lazy error detection of json request. Is it to improve? */
+				json_object_put(object);
+				object = NULL;
+			}
+		}
+		if (object == NULL)
 			object = json_object_new_string_len(msg->object_s, (int)msg->object_s_length);
+
+		/* keep the first parsed object if concurrently parsed */
+		expected = NULL;
+		if (!__atomic_compare_exchange_n(&msg->object_j, &expected, object, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			json_object_put(object);
+			object = expected;
 		}
-		msg->object_j = object;
 	}
 	return object;
 }
@@ -569,7 +632,9 @@ int afb_wsj1_call_s(struct afb_wsj1 *wsj1, const char *api, const char *verb, co
 	/* makes the call */
 	rc = wsj1_send_issot(wsj1, CALL, call->id, tag, object, NULL);
 	if (rc < 0) {
-		wsj1_call_search(wsj1, call->id, 1);
+		pthread_mutex_lock(&wsj1->mutex);
+		idmap_remove(&wsj1->calls, call->callid);
+		pthread_mutex_unlock(&wsj1->mutex);
 		free(call);
 	}
 	return rc;
@@ -588,3 +653,41 @@ int afb_wsj1_reply_s(struct afb_wsj1_msg *msg, const char *object, const char *t
 	return wsj1_send_isot(msg->wsj1, iserror ? RETERR : RETOK, msg->id, object, token);
 }
 
+int afb_wsj1_reply_v(struct afb_wsj1_msg *msg, const struct iovec *iovec, int count, const char *token, int iserror)
+{
+	struct iovec ios[32];
+	char code[2] = { (char)('0' + (iserror ? RETERR : RETOK)), 0 };
+	const char *texts[5];
+	int i, n, t;
+
+	if (count > 32 - 8) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the head */
+	texts[0] = "[";
+	texts[1] = code;
+	texts[2] = ",\"";
+	texts[3] = msg->id;
+	texts[4] = "\",";
+	for (n = 0 ; n < 5 ; n++) {
+		ios[n].iov_base = (void*)texts[n];
+		ios[n].iov_len = strlen(texts[n]);
+	}
+
+	/* the object */
+	for (i = 0 ; i < count ; i++)
+		ios[n++] = iovec[i];
+
+	/* the tail */
+	texts[0] = token != NULL ? ",\"" : "]";
+	texts[1] = token;
+	texts[2] = "\"]";
+	for (t = 0 ; t < (token != NULL ? 3 : 1) ; t++, n++) {
+		ios[n].iov_base = (void*)texts[t];
+		ios[n].iov_len = strlen(texts[t]);
+	}
+	return afb_ws_text_v(msg->wsj1->ws, ios, n);
+}
+
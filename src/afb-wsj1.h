@@ -22,6 +22,8 @@ struct afb_wsj1_msg;
 
 struct json_object;
 struct fdev;
+struct iovec;
+struct afb_ws_deflate;
 
 /*
  * Interface for callback functions.
@@ -54,6 +56,12 @@ struct afb_wsj1_itf {
  */
 extern struct afb_wsj1 *afb_wsj1_create(struct fdev *fdev, struct afb_wsj1_itf *itf, void *closure);
 
+/*
+ * Same as 'afb_wsj1_create' but the messages are compressed as
+ * negotiated in 'deflate' during the handshake, if not NULL.
+ */
+extern struct afb_wsj1 *afb_wsj1_create_deflate(struct fdev *fdev, struct afb_wsj1_itf *itf, void *closure, const struct afb_ws_deflate *deflate);
+
 /*
  * Increases by one the count of reference to 'wsj1'
  */
@@ -126,6 +134,15 @@ extern int afb_wsj1_reply_s(struct afb_wsj1_msg *msg, const char *object, const
  */
 extern int afb_wsj1_reply_j(struct afb_wsj1_msg *msg, struct json_object *object, const char *token, int iserror);
 
+/*
+ * Sends for message 'msg' the reply with the object whose text is made
+ * of the 'count' buffers of 'iovec' and, if not NULL, the token.
+ * When 'iserror' is zero a OK reply is send, otherwise an ERROR reply is sent.
+ * The text should be a valid JSON string.
+ * Return 0 in case of success. Otherwise, returns -1 and set errno.
+ */
+extern int afb_wsj1_reply_v(struct afb_wsj1_msg *msg, const struct iovec *iovec, int count, const char *token, int iserror);
+
 /*
  * Sends for message 'msg' the OK reply with the 'object' and, if not NULL, the token.
  * If not NULL, 'object' should be a valid JSON string.
@@ -245,6 +262,11 @@ extern struct afb_wsj1 *afb_wsj1_msg_wsj1(struct afb_wsj1_msg *msg);
  */
 extern const char *afb_wsj1_msg_object_s(struct afb_wsj1_msg *msg);
 
+/*
+ * Returns the length of the string representation of the object received with 'msg'
+ */
+extern size_t afb_wsj1_msg_object_s_length(struct afb_wsj1_msg *msg);
+
 /*
  * Returns the object received with 'msg'
  */
@@ -22,6 +22,8 @@
 #include <string.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <time.h>
 
 #include <json-c/json.h>
 #if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
@@ -36,19 +38,78 @@
 #include "afb-api.h"
 #include "afb-apiset.h"
 #include "afb-auth.h"
+#include "afb-cache.h"
 #include "afb-calls.h"
 #include "afb-context.h"
 #include "afb-evt.h"
 #include "afb-cred.h"
 #include "afb-hook.h"
 #include "afb-msg-json.h"
+#include "afb-session.h"
 #include "afb-xreq.h"
 
 #include "jobs.h"
+#include "slab.h"
 #include "verbose.h"
 
 /******************************************************************************/
 
+#define CHUNK_ALIGN	16		/* alignment of the allocations */
+#define CHUNK_SIZE	512		/* default size of the chunks */
+
+/* chunk of memory allocated for a request */
+struct xreq_chunk
+{
+	struct xreq_chunk *next;	/**< next chunk of the request */
+	size_t size;			/**< size of the chunk */
+	size_t used;			/**< used bytes of data */
+	char data[] __attribute__((aligned(CHUNK_ALIGN)));
+};
+
+/* allocates 'size' bytes for the request 'xreq' */
+static void *xreq_alloc(struct afb_xreq *xreq, size_t size)
+{
+	struct xreq_chunk *chunk;
+	size_t csize;
+	void *result;
+
+	size = (size + CHUNK_ALIGN - 1) & ~(size_t)(CHUNK_ALIGN - 1);
+	chunk = xreq->chunks;
+	if (chunk == NULL || chunk->used + size > chunk->size - sizeof *chunk) {
+		/* big allocations get their own chunk */
+		csize = sizeof *chunk + size;
+		if (csize < CHUNK_SIZE)
+			csize = CHUNK_SIZE;
+		chunk = slab_alloc(csize);
+		if (chunk == NULL)
+			return NULL;
+		chunk->size = csize;
+		chunk->used = 0;
+		if (xreq->chunks == NULL || csize == CHUNK_SIZE) {
+			chunk->next = xreq->chunks;
+			xreq->chunks = chunk;
+		} else {
+			/* the big chunk is full: keep the current one first */
+			chunk->next = xreq->chunks->next;
+			xreq->chunks->next = chunk;
+		}
+	}
+	result = &chunk->data[chunk->used];
+	chunk->used += size;
+	return result;
+}
+
+/* releases the memory allocated for the request 'xreq' */
+static void xreq_release_chunks(struct afb_xreq *xreq)
+{
+	struct xreq_chunk *chunk;
+
+	while ((chunk = xreq->chunks)) {
+		xreq->chunks = chunk->next;
+		slab_free(chunk, chunk->size);
+	}
+}
+
 static void xreq_finalize(struct afb_xreq *xreq)
 {
 	if (!xreq->replied)
@@ -57,6 +118,8 @@ static void xreq_finalize(struct afb_xreq *xreq)
 		afb_hook_xreq_end(xreq);
 	if (xreq->caller)
 		afb_xreq_unhooked_unref(xreq->caller);
+	afb_cache_unref(xreq->cache);
+	xreq_release_chunks(xreq);
 	xreq->queryitf->unref(xreq);
 }
 
@@ -108,19 +171,69 @@ static struct afb_arg xreq_get_cb(struct afb_req_x2 *closure, const char *name)
 	return arg;
 }
 
+/* records the successful reply of 'xreq' in its cache */
+static void xreq_cache_put(struct afb_xreq *xreq, const char *buffer, size_t size, const char *info)
+{
+	const char *session;
+
+	session = xreq->cachesession ? afb_session_uuid(xreq->context.session) : NULL;
+	if (afb_cache_put(xreq->cache, xreq->request.called_verb, session, afb_xreq_unhooked_json(xreq),
+						buffer, size, info, xreq->cachettl, xreq->cachegen) < 0)
+		ERROR("can't cache the reply of %s/%s: %m", xreq->request.called_api, xreq->request.called_verb);
+}
+
 static void xreq_reply_cb(struct afb_req_x2 *closure, struct json_object *obj, const char *error, const char *info)
 {
 	struct afb_xreq *xreq = xreq_from_req_x2(closure);
+	const char *text;
 
 	if (xreq->replied) {
 		ERROR("reply called more than one time!!");
 		json_object_put(obj);
 	} else {
 		xreq->replied = 1;
+		if (xreq->cache && !error) {
+			text = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN|JSON_C_TO_STRING_NOSLASHESCAPE);
+			xreq_cache_put(xreq, text, strlen(text), info);
+		}
 		xreq->queryitf->reply(xreq, obj, error, info);
 	}
 }
 
+/* get the object of the JSON text of 'size' bytes of 'buffer' */
+static struct json_object *xreq_buffer_object(const char *buffer, size_t size)
+{
+	struct json_object *obj;
+	enum json_tokener_error jerr;
+	char *text;
+
+	text = strndup(buffer, size);
+	if (text == NULL)
+		return NULL;
+	obj = json_tokener_parse_verbose(text, &jerr);
+	if (jerr != json_tokener_success)
+		obj = json_object_new_string(text);
+	free(text);
+	return obj;
+}
+
+static void xreq_reply_buffer_cb(struct afb_req_x2 *closure, const char *buffer, size_t size, const char *error, const char *info)
+{
+	struct afb_xreq *xreq = xreq_from_req_x2(closure);
+
+	if (buffer == NULL || xreq->queryitf->reply_buffer == NULL)
+		/* the implementation needs the object */
+		xreq_reply_cb(closure, buffer ? xreq_buffer_object(buffer, size) : NULL, error, info);
+	else if (xreq->replied)
+		ERROR("reply called more than one time!!");
+	else {
+		xreq->replied = 1;
+		if (xreq->cache && !error)
+			xreq_cache_put(xreq, buffer, size, info);
+		xreq->queryitf->reply_buffer(xreq, buffer, size, error, info);
+	}
+}
+
 static void xreq_vreply_cb(struct afb_req_x2 *closure, struct json_object *obj, const char *error, const char *fmt, va_list args)
 {
 	char *info;
@@ -261,7 +374,9 @@ static void xreq_vverbose_cb(struct afb_req_x2 *closure, int level, const char *
 	char *p;
 	struct afb_xreq *xreq = xreq_from_req_x2(closure);
 
-	if (!fmt || vasprintf(&p, fmt, args) < 0)
+	if (fmt && !strchr(fmt, '%'))
+		verbose(level, file, line, func, "[REQ/API %s] %s", xreq->request.called_api, fmt);
+	else if (!fmt || vasprintf(&p, fmt, args) < 0)
 		vverbose(level, file, line, func, fmt, args);
 	else {
 		verbose(level, file, line, func, "[REQ/API %s] %s", xreq->request.called_api, p);
@@ -345,6 +460,18 @@ static int xreq_subcallsync_cb(
 	return afb_calls_subcall_sync(xreq, api, verb, args, flags, object, error, info);
 }
 
+static void *xreq_alloc_cb(struct afb_req_x2 *req, size_t size)
+{
+	struct afb_xreq *xreq = xreq_from_req_x2(req);
+	return xreq_alloc(xreq, size);
+}
+
+static int xreq_remaining_time_cb(struct afb_req_x2 *req)
+{
+	struct afb_xreq *xreq = xreq_from_req_x2(req);
+	return afb_xreq_remaining_time(xreq);
+}
+
 /******************************************************************************/
 
 static struct json_object *xreq_hooked_json_cb(struct afb_req_x2 *closure)
@@ -368,6 +495,12 @@ static void xreq_hooked_reply_cb(struct afb_req_x2 *closure, struct json_object
 	xreq_reply_cb(closure, obj, error, info);
 }
 
+static void xreq_hooked_reply_buffer_cb(struct afb_req_x2 *closure, const char *buffer, size_t size, const char *error, const char *info)
+{
+	/* hooks need the object */
+	xreq_hooked_reply_cb(closure, buffer ? xreq_buffer_object(buffer, size) : NULL, error, info);
+}
+
 static void xreq_hooked_vreply_cb(struct afb_req_x2 *closure, struct json_object *obj, const char *error, const char *fmt, va_list args)
 {
 	char *info;
@@ -601,6 +734,9 @@ const struct afb_req_x2_itf xreq_itf = {
 	.get_client_info = xreq_get_client_info_cb,
 	.subcall = xreq_subcall_cb,
 	.subcallsync = xreq_subcallsync_cb,
+	.alloc = xreq_alloc_cb,
+	.reply_buffer = xreq_reply_buffer_cb,
+	.remaining_time = xreq_remaining_time_cb,
 };
 
 const struct afb_req_x2_itf xreq_hooked_itf = {
@@ -635,6 +771,9 @@ const struct afb_req_x2_itf xreq_hooked_itf = {
 	.get_client_info = xreq_hooked_get_client_info_cb,
 	.subcall = xreq_hooked_subcall_cb,
 	.subcallsync = xreq_hooked_subcallsync_cb,
+	.alloc = xreq_alloc_cb,
+	.reply_buffer = xreq_hooked_reply_buffer_cb,
+	.remaining_time = xreq_remaining_time_cb,
 };
 
 /******************************************************************************/
@@ -668,8 +807,15 @@ void afb_xreq_reply_f(struct afb_xreq *xreq, struct json_object *obj, const char
 
 const char *afb_xreq_raw(struct afb_xreq *xreq, size_t *size)
 {
-	struct json_object *obj = xreq_json_cb(xreq_to_req_x2(xreq));
-	const char *result = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_NOSLASHESCAPE);
+	struct json_object *obj;
+	const char *result;
+
+	/* avoids parsing when the text is available */
+	if (!xreq->json && xreq->queryitf->raw)
+		return xreq->queryitf->raw(xreq, size);
+
+	obj = xreq_json_cb(xreq_to_req_x2(xreq));
+	result = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_NOSLASHESCAPE);
 	if (size != NULL)
 		*size = strlen(result);
 	return result;
@@ -858,6 +1004,10 @@ static void process_async(int signum, void *arg)
 	if (signum != 0) {
 		/* emit the error (assumes that hooking is initialised) */
 		afb_xreq_reply_f(xreq, NULL, "aborted", "signal %s(%d) caught", strsignal(signum), signum);
+	} else if (afb_xreq_remaining_time(xreq) == 0) {
+		/* the deadline expired while the job was pending */
+		init_hooking(xreq);
+		afb_xreq_reply_f(xreq, NULL, "timeout", "deadline of the request reached");
 	} else {
 		/* init hooking */
 		init_hooking(xreq);
@@ -869,6 +1019,18 @@ static void process_async(int signum, void *arg)
 	afb_xreq_unhooked_unref(xreq);
 }
 
+/**
+ * Replies to 'xreq' with a reply of the 'verb' kept in cache, made of the
+ * JSON text 'buffer' of 'size' bytes and of 'info'. It is done in place
+ * of the job 'process_async' so the authorisation of the verb is checked.
+ */
+void afb_xreq_reply_cached_v3(struct afb_xreq *xreq, const struct afb_verb_v3 *verb, const char *buffer, size_t size, const char *info)
+{
+	init_hooking(xreq);
+	if (xreq_session_check_apply_v2(xreq, verb->session, verb->auth) >= 0)
+		afb_req_x2_reply_buffer(xreq_to_req_x2(xreq), buffer, size, NULL, info);
+}
+
 /**
  * Early request failure of the request 'xreq' with, as usual, 'status' and 'info'
  * The early failure occurs only in function 'afb_xreq_process' where normally,
@@ -896,6 +1058,7 @@ void afb_xreq_process(struct afb_xreq *xreq, struct afb_apiset *apiset)
 {
 	const struct afb_api_item *api;
 	struct afb_xreq *caller;
+	int timeout, remaining;
 
 	/* lookup at the api */
 	xreq->apiset = apiset;
@@ -923,9 +1086,24 @@ void afb_xreq_process(struct afb_xreq *xreq, struct afb_apiset *apiset)
 		}
 	}
 
+	/* the deadline of the request is in the limit of the timeout of the apiset */
+	timeout = afb_apiset_timeout_get(apiset);
+	if (timeout > 0)
+		afb_xreq_set_budget(xreq, (uint32_t)timeout * 1000);
+	remaining = afb_xreq_remaining_time(xreq);
+	if (remaining == 0) {
+		early_failure(xreq, "timeout", "deadline of the request reached");
+		goto end;
+	}
+	timeout = remaining < 0 ? 0 : 1 + (remaining - 1) / 1000;
+
+	/* reply from the cache of the api when possible */
+	if (api->itf->call_cached && api->itf->call_cached(api->closure, xreq))
+		goto end;
+
 	/* queue the request job */
 	afb_xreq_unhooked_addref(xreq);
-	if (jobs_queue(api->group, afb_apiset_timeout_get(apiset), process_async, xreq) < 0) {
+	if (jobs_queue_priority(api->group, timeout, api->priority, process_async, xreq) < 0) {
 		/* TODO: allows or not to proccess it directly as when no threading? (see above) */
 		ERROR("can't process job with threads: %m");
 		early_failure(xreq, "cancelled", "not able to create a job for the task");
@@ -940,3 +1118,59 @@ const char *xreq_on_behalf_cred_export(struct afb_xreq *xreq)
 	return xreq->caller ? afb_cred_export(xreq->cred) : NULL;
 }
 
+/******************************************************************************/
+
+/* get the current time in milliseconds of the monotonic clock */
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * Set the deadline of 'xreq' in 'budget' milliseconds
+ * unless its current deadline is earlier.
+ * @param xreq the request
+ * @param budget the time in milliseconds given to the request
+ */
+void afb_xreq_set_budget(struct afb_xreq *xreq, uint32_t budget)
+{
+	uint64_t deadline = now_ms() + budget;
+
+	if (!xreq->deadline || deadline < xreq->deadline)
+		xreq->deadline = deadline;
+}
+
+/**
+ * Get the time remaining before the deadline of 'xreq'
+ * @param xreq the request
+ * @return the time in milliseconds, 0 if the deadline is reached
+ * or -1 if the request has no deadline
+ */
+int afb_xreq_remaining_time(struct afb_xreq *xreq)
+{
+	uint64_t now;
+
+	if (!xreq->deadline)
+		return -1;
+	now = now_ms();
+	if (now >= xreq->deadline)
+		return 0;
+	return xreq->deadline - now > INT_MAX ? INT_MAX : (int)(xreq->deadline - now);
+}
+
+/**
+ * Get the budget of 'xreq' to transmit to remote services
+ * @param xreq the request
+ * @return the time in milliseconds remaining, at least 1,
+ * or 0 if the request has no deadline
+ */
+uint32_t afb_xreq_budget(struct afb_xreq *xreq)
+{
+	int remaining = afb_xreq_remaining_time(xreq);
+
+	return remaining < 0 ? 0 : remaining == 0 ? 1 : (uint32_t)remaining;
+}
+
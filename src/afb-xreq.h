@@ -18,6 +18,7 @@
 #pragma once
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <afb/afb-req-x1-itf.h>
 #include <afb/afb-req-x2-itf.h>
 #include "afb-context.h"
@@ -27,6 +28,7 @@ struct afb_evt_listener;
 struct afb_xreq;
 struct afb_cred;
 struct afb_apiset;
+struct afb_cache;
 struct afb_event_x2;
 struct afb_verb_desc_v1;
 struct afb_verb_v2;
@@ -36,8 +38,10 @@ struct afb_stored_req;
 
 struct afb_xreq_query_itf {
 	struct json_object *(*json)(struct afb_xreq *xreq);
+	const char *(*raw)(struct afb_xreq *xreq, size_t *size);
 	struct afb_arg (*get)(struct afb_xreq *xreq, const char *name);
 	void (*reply)(struct afb_xreq *xreq, struct json_object *obj, const char *error, const char *info);
+	void (*reply_buffer)(struct afb_xreq *xreq, const char *buffer, size_t size, const char *error, const char *info);
 	void (*unref)(struct afb_xreq *xreq);
 	int (*subscribe)(struct afb_xreq *xreq, struct afb_event_x2 *event);
 	int (*unsubscribe)(struct afb_xreq *xreq, struct afb_event_x2 *event);
@@ -60,6 +64,12 @@ struct afb_xreq
 	struct afb_evt_listener *listener; /**< event listener for the request */
 	struct afb_cred *cred;		/**< client credential if revelant */
 	struct afb_xreq *caller;	/**< caller request if any */
+	struct xreq_chunk *chunks;	/**< memory allocated for the request */
+	uint64_t deadline;		/**< deadline in ms of the monotonic clock or 0 */
+	struct afb_cache *cache;	/**< cache recording the reply or NULL */
+	uint32_t cachettl;		/**< time to live in ms of the recorded reply */
+	int cachesession;		/**< is the recorded reply specific to the session? */
+	uint32_t cachegen;		/**< generation of the cache at miss */
 };
 
 /**
@@ -155,9 +165,15 @@ extern void afb_xreq_process(struct afb_xreq *xreq, struct afb_apiset *apiset);
 extern void afb_xreq_call_verb_v1(struct afb_xreq *xreq, const struct afb_verb_desc_v1 *verb);
 extern void afb_xreq_call_verb_v2(struct afb_xreq *xreq, const struct afb_verb_v2 *verb);
 extern void afb_xreq_call_verb_v3(struct afb_xreq *xreq, const struct afb_verb_v3 *verb);
+extern void afb_xreq_reply_cached_v3(struct afb_xreq *xreq, const struct afb_verb_v3 *verb, const char *buffer, size_t size, const char *info);
 
 extern const char *xreq_on_behalf_cred_export(struct afb_xreq *xreq);
 
+/* deadline of xreq */
+extern void afb_xreq_set_budget(struct afb_xreq *xreq, uint32_t budget);
+extern int afb_xreq_remaining_time(struct afb_xreq *xreq);
+extern uint32_t afb_xreq_budget(struct afb_xreq *xreq);
+
 /******************************************************************************/
 
 static inline struct afb_req_x1 xreq_to_req_x1(struct afb_xreq *xreq)
@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+
+#include <json-c/json.h>
+
+#include "cbor-json.h"
+
+/*
+ * Encoding and decoding of json-c trees using the Concise Binary Object
+ * Representation (CBOR, RFC 7049).
+ *
+ * The encoder only produces definite lengths and keeps the distinction
+ * between integers and doubles of json-c. The decoder accepts the items
+ * that the encoder produces plus the usual variants (byte strings, single
+ * precision floats, tags, undefined).
+ */
+
+/* major types of CBOR */
+#define MAJOR_UINT	0
+#define MAJOR_NEGINT	1
+#define MAJOR_BYTES	2
+#define MAJOR_TEXT	3
+#define MAJOR_ARRAY	4
+#define MAJOR_MAP	5
+#define MAJOR_TAG	6
+#define MAJOR_SIMPLE	7
+
+/* simple values of CBOR */
+#define SIMPLE_FALSE	20
+#define SIMPLE_TRUE	21
+#define SIMPLE_NULL	22
+#define SIMPLE_UNDEF	23
+#define SIMPLE_FLOAT32	26
+#define SIMPLE_FLOAT64	27
+
+/* maximum depth of nesting accepted when decoding */
+#define MAX_DEPTH	64
+
+/* minimal allocation granularity of buffers */
+#define BUFFER_GRANULARITY	256
+
+/******************* encoding **********************************/
+
+/* ensure that 'size' more bytes can be added to 'buffer' */
+static int ensure(struct cbor_json_buffer *buffer, size_t size)
+{
+	size_t capacity;
+	char *base;
+
+	capacity = buffer->length + size;
+	if (capacity > buffer->capacity) {
+		capacity = (capacity + capacity / 2 + BUFFER_GRANULARITY - 1) & ~(size_t)(BUFFER_GRANULARITY - 1);
+		base = realloc(buffer->base, capacity);
+		if (!base) {
+			errno = ENOMEM;
+			return 0;
+		}
+		buffer->base = base;
+		buffer->capacity = capacity;
+	}
+	return 1;
+}
+
+/* put the 'length' bytes of 'data' */
+static int put_bytes(struct cbor_json_buffer *buffer, const void *data, size_t length)
+{
+	if (!ensure(buffer, length))
+		return 0;
+	memcpy(&buffer->base[buffer->length], data, length);
+	buffer->length += length;
+	return 1;
+}
+
+/* put the head of an item of 'major' type with its 'value' */
+static int put_head(struct cbor_json_buffer *buffer, int major, uint64_t value)
+{
+	unsigned char *p;
+	int n;
+
+	if (!ensure(buffer, 9))
+		return 0;
+
+	p = (unsigned char*)&buffer->base[buffer->length];
+	major <<= 5;
+	if (value < 24) {
+		*p = (unsigned char)(major | (int)value);
+		buffer->length++;
+		return 1;
+	}
+	if (value <= UINT8_MAX) {
+		*p = (unsigned char)(major | 24);
+		n = 1;
+	} else if (value <= UINT16_MAX) {
+		*p = (unsigned char)(major | 25);
+		n = 2;
+	} else if (value <= UINT32_MAX) {
+		*p = (unsigned char)(major | 26);
+		n = 4;
+	} else {
+		*p = (unsigned char)(major | 27);
+		n = 8;
+	}
+	buffer->length += (size_t)n + 1;
+	while (n) {
+		p[n--] = (unsigned char)value;
+		value >>= 8;
+	}
+	return 1;
+}
+
+/* put the simple value 'simple' */
+static int put_simple(struct cbor_json_buffer *buffer, int simple)
+{
+	unsigned char c = (unsigned char)((MAJOR_SIMPLE << 5) | simple);
+	return put_bytes(buffer, &c, 1);
+}
+
+/* put the text 'text' of 'length' */
+static int put_text(struct cbor_json_buffer *buffer, const char *text, size_t length)
+{
+	return put_head(buffer, MAJOR_TEXT, length) && put_bytes(buffer, text, length);
+}
+
+/* put the double 'value' */
+static int put_double(struct cbor_json_buffer *buffer, double value)
+{
+	unsigned char c;
+	uint64_t u;
+
+	c = (unsigned char)((MAJOR_SIMPLE << 5) | SIMPLE_FLOAT64);
+	memcpy(&u, &value, sizeof u);
+	u = htobe64(u);
+	return put_bytes(buffer, &c, 1) && put_bytes(buffer, &u, sizeof u);
+}
+
+/* put the integer 'value' */
+static int put_int(struct cbor_json_buffer *buffer, int64_t value)
+{
+	return value >= 0
+		? put_head(buffer, MAJOR_UINT, (uint64_t)value)
+		: put_head(buffer, MAJOR_NEGINT, (uint64_t)(-1 - value));
+}
+
+/* put the json 'object' */
+static int put_object(struct cbor_json_buffer *buffer, struct json_object *object)
+{
+	struct json_object_iterator it, end;
+	const char *key;
+	size_t i, n;
+
+	switch (json_object_get_type(object)) {
+	case json_type_null:
+		return put_simple(buffer, SIMPLE_NULL);
+	case json_type_boolean:
+		return put_simple(buffer, json_object_get_boolean(object) ? SIMPLE_TRUE : SIMPLE_FALSE);
+	case json_type_int:
+		return put_int(buffer, json_object_get_int64(object));
+	case json_type_double:
+		return put_double(buffer, json_object_get_double(object));
+	case json_type_string:
+		return put_text(buffer, json_object_get_string(object), (size_t)json_object_get_string_len(object));
+	case json_type_array:
+		n = json_object_array_length(object);
+		if (!put_head(buffer, MAJOR_ARRAY, n))
+			return 0;
+		for (i = 0 ; i < n ; i++)
+			if (!put_object(buffer, json_object_array_get_idx(object, i)))
+				return 0;
+		return 1;
+	case json_type_object:
+		if (!put_head(buffer, MAJOR_MAP, (uint64_t)json_object_object_length(object)))
+			return 0;
+		it = json_object_iter_begin(object);
+		end = json_object_iter_end(object);
+		while (!json_object_iter_equal(&it, &end)) {
+			key = json_object_iter_peek_name(&it);
+			if (!put_text(buffer, key, strlen(key))
+			 || !put_object(buffer, json_object_iter_peek_value(&it)))
+				return 0;
+			json_object_iter_next(&it);
+		}
+		return 1;
+	default:
+		errno = EINVAL;
+		return 0;
+	}
+}
+
+/**
+ * Encodes the json 'object' in CBOR and store the result in 'buffer'.
+ * The previous content of 'buffer' is lost but its memory is reused.
+ *
+ * @param buffer the buffer receiving the encoded data
+ * @param object the object to encode (can be NULL)
+ *
+ * @return 0 in case of success or -1 with errno set in case of error
+ */
+int cbor_json_encode(struct cbor_json_buffer *buffer, struct json_object *object)
+{
+	buffer->length = 0;
+	return put_object(buffer, object) ? 0 : -1;
+}
+
+/**
+ * Releases the memory used by the 'buffer' and reset it.
+ *
+ * @param buffer the buffer to release
+ */
+void cbor_json_buffer_release(struct cbor_json_buffer *buffer)
+{
+	free(buffer->base);
+	buffer->base = NULL;
+	buffer->length = 0;
+	buffer->capacity = 0;
+}
+
+/******************* decoding **********************************/
+
+/* state of the decoding */
+struct decoder
+{
+	const unsigned char *head;
+	const unsigned char *end;
+};
+
+/* get the head of the next item: its 'major' type, its 'info' and its 'value' */
+static int get_head(struct decoder *dec, int *major, int *info, uint64_t *value)
+{
+	uint64_t v;
+	int i, n;
+
+	if (dec->head >= dec->end)
+		return 0;
+
+	i = *dec->head++;
+	*major = i >> 5;
+	*info = i &= 31;
+	if (i < 24) {
+		*value = (uint64_t)i;
+		return 1;
+	}
+	if (i > 27)
+		return 0; /* indefinite lengths are not supported */
+
+	n = 1 << (i - 24);
+	if (dec->end - dec->head < n)
+		return 0;
+	v = 0;
+	while (n--)
+		v = (v << 8) | *dec->head++;
+	*value = v;
+	return 1;
+}
+
+/* get the 'length' bytes of a string */
+static const char *get_string(struct decoder *dec, uint64_t length)
+{
+	const char *result;
+
+	if ((uint64_t)(dec->end - dec->head) < length)
+		return NULL;
+	result = (const char*)dec->head;
+	dec->head += length;
+	return result;
+}
+
+/* decode one item in 'object' */
+static int get_object(struct decoder *dec, struct json_object **object, int depth)
+{
+	int major, info;
+	uint64_t value, count, i;
+	const char *string;
+	char *key, skey[64];
+	struct json_object *array, *item;
+	uint32_t f32;
+	float f;
+	double d;
+
+	if (!get_head(dec, &major, &info, &value))
+		return 0;
+
+	switch (major) {
+	case MAJOR_UINT:
+		*object = value <= INT64_MAX
+			? json_object_new_int64((int64_t)value)
+			: json_object_new_double((double)value);
+		break;
+	case MAJOR_NEGINT:
+		*object = value <= INT64_MAX
+			? json_object_new_int64(-1 - (int64_t)value)
+			: json_object_new_double(-1.0 - (double)value);
+		break;
+	case MAJOR_BYTES:
+	case MAJOR_TEXT:
+		if (value > INT32_MAX)
+			return 0;
+		string = get_string(dec, value);
+		if (!string)
+			return 0;
+		*object = json_object_new_string_len(string, (int)value);
+		break;
+	case MAJOR_ARRAY:
+		if (depth >= MAX_DEPTH)
+			return 0;
+		*object = array = json_object_new_array();
+		if (!array)
+			break;
+		for (i = 0 ; i < value ; i++) {
+			if (!get_object(dec, &item, depth + 1)) {
+				json_object_put(array);
+				return 0;
+			}
+			json_object_array_add(array, item);
+		}
+		return 1;
+	case MAJOR_MAP:
+		if (depth >= MAX_DEPTH)
+			return 0;
+		*object = array = json_object_new_object();
+		if (!array)
+			break;
+		for (count = value, i = 0 ; i < count ; i++) {
+			/* read the key */
+			if (!get_head(dec, &major, &info, &value)
+			 || major != MAJOR_TEXT
+			 || value > INT32_MAX
+			 || !(string = get_string(dec, value))) {
+				json_object_put(array);
+				return 0;
+			}
+			key = value < sizeof skey ? skey : malloc((size_t)value + 1);
+			if (!key) {
+				json_object_put(array);
+				errno = ENOMEM;
+				return 0;
+			}
+			memcpy(key, string, (size_t)value);
+			key[value] = 0;
+
+			/* read the value */
+			if (!get_object(dec, &item, depth + 1)) {
+				if (key != skey)
+					free(key);
+				json_object_put(array);
+				return 0;
+			}
+			json_object_object_add(array, key, item);
+			if (key != skey)
+				free(key);
+		}
+		return 1;
+	case MAJOR_TAG:
+		/* tags are ignored but count in depth */
+		if (depth >= MAX_DEPTH)
+			return 0;
+		return get_object(dec, object, depth + 1);
+	default:
+		switch (info) {
+		case SIMPLE_FALSE:
+		case SIMPLE_TRUE:
+			*object = json_object_new_boolean(info == SIMPLE_TRUE);
+			break;
+		case SIMPLE_NULL:
+		case SIMPLE_UNDEF:
+			*object = NULL;
+			return 1;
+		case SIMPLE_FLOAT32:
+			f32 = (uint32_t)value;
+			memcpy(&f, &f32, sizeof f);
+			*object = json_object_new_double((double)f);
+			break;
+		case SIMPLE_FLOAT64:
+			memcpy(&d, &value, sizeof d);
+			*object = json_object_new_double(d);
+			break;
+		default:
+			return 0;
+		}
+		break;
+	}
+	if (*object == NULL) {
+		errno = ENOMEM;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Decodes the CBOR 'data' of 'size' to its json representation.
+ * The data must contain exactly one item.
+ *
+ * @param data the data to decode
+ * @param size the size of the data
+ * @param object where to store the decoded object
+ *
+ * @return 0 in case of success or -1 with errno set in case of error
+ */
+int cbor_json_decode(const void *data, size_t size, struct json_object **object)
+{
+	struct decoder dec;
+	struct json_object *obj;
+
+	dec.head = data;
+	dec.end = dec.head + size;
+	errno = EBADMSG;
+	if (!get_object(&dec, &obj, 0))
+		return -1;
+	if (dec.head != dec.end) {
+		json_object_put(obj);
+		errno = EBADMSG;
+		return -1;
+	}
+	*object = obj;
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+struct json_object;
+
+/*
+ * Buffer receiving the CBOR encoding of json objects.
+ * It can be reused for successive encodings: its memory is
+ * only grown. Initialise it with zeroes.
+ */
+struct cbor_json_buffer
+{
+	char *base;		/* the data */
+	size_t length;		/* length of the data */
+	size_t capacity;	/* allocated size */
+};
+
+extern int cbor_json_encode(struct cbor_json_buffer *buffer, struct json_object *object);
+extern int cbor_json_decode(const void *data, size_t size, struct json_object **object);
+extern void cbor_json_buffer_release(struct cbor_json_buffer *buffer);
@@ -80,6 +80,14 @@ static void update(void *closure, const struct fdev *fdev)
 	enable_or_update(closure, fdev, EPOLL_CTL_MOD, ENOENT);
 }
 
+/*
+ * sibling callback for fdev
+ */
+static struct fdev *sibling(void *closure, int fd)
+{
+	return fdev_epoll_add(closure, fd);
+}
+
 /*
  * unref is not handled here
  */
@@ -88,7 +96,8 @@ static struct fdev_itf itf =
 	.unref = 0,
 	.disable = disable,
 	.enable = enable,
-	.update = update
+	.update = update,
+	.sibling = sibling
 };
 
 /*
@@ -49,12 +49,19 @@ static void enable(void *closure, const struct fdev *fdev)
 	sd_event_source_set_enabled(source, SD_EVENT_ON);
 }
 
+static struct fdev *sibling(void *closure, int fd)
+{
+	sd_event_source *source = closure;
+	return fdev_systemd_create(sd_event_source_get_event(source), fd);
+}
+
 static struct fdev_itf itf =
 {
 	.unref = unref,
 	.disable = disable,
 	.enable = enable,
-	.update = enable
+	.update = enable,
+	.sibling = sibling
 };
 
 struct fdev *fdev_systemd_create(struct sd_event *eloop, int fd)
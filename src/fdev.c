@@ -60,6 +60,18 @@ void fdev_dispatch(struct fdev *fdev, uint32_t events)
 		fdev->callback(fdev->closure_callback, events, fdev);
 }
 
+/*
+ * Creates an fdev for 'fd' handled by the event loop of 'fdev'
+ */
+struct fdev *fdev_sibling(const struct fdev *fdev, int fd)
+{
+	if (!fdev->itf || !fdev->itf->sibling) {
+		errno = ENOTSUP;
+		return 0;
+	}
+	return fdev->itf->sibling(fdev->closure_itf, fd);
+}
+
 struct fdev *fdev_addref(struct fdev *fdev)
 {
 	if (fdev)
@@ -28,6 +28,7 @@ struct fdev_itf
 	void (*disable)(void *closure, const struct fdev *fdev);
 	void (*enable)(void *closure, const struct fdev *fdev);
 	void (*update)(void *closure, const struct fdev *fdev);
+	struct fdev *(*sibling)(void *closure, int fd); /* optional */
 };
 
 extern struct fdev *fdev_create(int fd);
@@ -35,6 +36,7 @@ extern void fdev_set_itf(struct fdev *fdev, struct fdev_itf *itf, void *closure_
 extern void fdev_dispatch(struct fdev *fdev, uint32_t events);
 #endif
 
+extern struct fdev *fdev_sibling(const struct fdev *fdev, int fd);
 extern struct fdev *fdev_addref(struct fdev *fdev);
 extern void fdev_unref(struct fdev *fdev);
 
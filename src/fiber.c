@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fiber.h"
+
+#define FIBER_STACK_SIZE	(256 * 1024)
+#define FIBER_POOL_MAX		128
+
+/** Description of a fiber */
+struct fiber
+{
+	struct fiber *next;		/**< link in the pool */
+	void (*entry)(void *closure);	/**< the function to run */
+	void *closure;			/**< its closure */
+	ucontext_t *caller;		/**< context of the thread running the fiber */
+	ucontext_t context;		/**< context of the fiber */
+	void *stack;			/**< the stack (guard page included) */
+	size_t size;			/**< size of the stack */
+	int ended;			/**< is the entry returned? */
+};
+
+/* pool of ended fibers */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fiber *pool;
+static int pooled;
+
+/* the fiber running on the thread and the context of the thread */
+static _Thread_local struct fiber *current;
+static _Thread_local ucontext_t thread_context;
+
+/**
+ * Main routine of fibers: runs the entries for ever,
+ * returning to the caller after each one.
+ * The routine doesn't take the fiber as parameter because
+ * makecontext only passes integers.
+ */
+static void fiber_main()
+{
+	struct fiber *fiber;
+
+	for (;;) {
+		fiber = fiber_current();
+		fiber->entry(fiber->closure);
+		fiber->ended = 1;
+		swapcontext(&fiber->context, fiber->caller);
+	}
+}
+
+/**
+ * Prepares the context of the 'fiber' for running 'fiber_main'
+ * @return 0 on success or -1 on error
+ */
+static int fiber_prepare(struct fiber *fiber)
+{
+	if (getcontext(&fiber->context) < 0)
+		return -1;
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = fiber->size;
+	fiber->context.uc_link = NULL;
+	makecontext(&fiber->context, fiber_main, 0);
+	return 0;
+}
+
+/**
+ * Allocates a new fiber with its stack
+ * @return the fiber or NULL on error
+ */
+static struct fiber *fiber_alloc()
+{
+	struct fiber *fiber;
+	long pgsz;
+
+	fiber = malloc(sizeof *fiber);
+	if (fiber == NULL)
+		goto error;
+
+	/* the stack and its guard page for catching overflows */
+	pgsz = sysconf(_SC_PAGESIZE);
+	fiber->size = FIBER_STACK_SIZE + (size_t)pgsz;
+	fiber->stack = mmap(NULL, fiber->size, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK|MAP_NORESERVE, -1, 0);
+	if (fiber->stack == MAP_FAILED)
+		goto error2;
+	if (mprotect(fiber->stack, (size_t)pgsz, PROT_NONE) < 0)
+		goto error3;
+
+	if (fiber_prepare(fiber) < 0)
+		goto error3;
+	return fiber;
+
+error3:
+	munmap(fiber->stack, fiber->size);
+error2:
+	free(fiber);
+error:
+	errno = ENOMEM;
+	return NULL;
+}
+
+/**
+ * Creates a fiber that will run 'entry' with 'closure'
+ * when switched to it.
+ * @param entry the function to run
+ * @param closure the closure of the function
+ * @return the created fiber or NULL on error
+ */
+struct fiber *fiber_create(void (*entry)(void *closure), void *closure)
+{
+	struct fiber *fiber;
+
+	/* try to reuse a pooled fiber */
+	pthread_mutex_lock(&mutex);
+	fiber = pool;
+	if (fiber != NULL) {
+		pool = fiber->next;
+		pooled--;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (fiber == NULL) {
+		fiber = fiber_alloc();
+		if (fiber == NULL)
+			return NULL;
+	}
+	fiber->entry = entry;
+	fiber->closure = closure;
+	fiber->ended = 0;
+	return fiber;
+}
+
+/**
+ * Releases the 'fiber' that must be ended or never switched to.
+ * @param fiber the fiber to release
+ */
+void fiber_destroy(struct fiber *fiber)
+{
+	pthread_mutex_lock(&mutex);
+	if (pooled < FIBER_POOL_MAX) {
+		fiber->next = pool;
+		pool = fiber;
+		pooled++;
+		fiber = NULL;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (fiber != NULL) {
+		munmap(fiber->stack, fiber->size);
+		free(fiber);
+	}
+}
+
+/**
+ * Runs 'fiber' on the current thread until it yields or ends.
+ * Must not be called from a fiber.
+ * @param fiber the fiber to run
+ * @return 1 if the fiber ended or 0 if it yielded
+ */
+int fiber_switch(struct fiber *fiber)
+{
+	fiber->caller = &thread_context;
+	current = fiber;
+	swapcontext(&thread_context, &fiber->context);
+	current = NULL;
+	return fiber->ended;
+}
+
+/**
+ * Suspends the current fiber and returns to the thread that runs it.
+ * The fiber will continue when a thread switches to it.
+ */
+void fiber_yield()
+{
+	struct fiber *fiber = fiber_current();
+
+	swapcontext(&fiber->context, fiber->caller);
+}
+
+/**
+ * Get the fiber running on the current thread.
+ * Not inlined because the thread may change across switches.
+ * @return the current fiber or NULL if not running a fiber
+ */
+__attribute__((noinline))
+struct fiber *fiber_current()
+{
+	return current;
+}
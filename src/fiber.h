@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Fibers are flows of execution having their own stack. A fiber
+ * runs when a thread switches to it and until it yields or ends.
+ * A fiber that yielded must be switched to again by the thread that
+ * ran it: its code may keep the addresses of thread local variables,
+ * errno included, across the switches.
+ *
+ * The stacks of ended fibers are kept in a pool for reuse.
+ */
+struct fiber;
+
+extern struct fiber *fiber_create(void (*entry)(void *closure), void *closure);
+extern void fiber_destroy(struct fiber *fiber);
+
+extern int fiber_switch(struct fiber *fiber);
+extern void fiber_yield();
+extern struct fiber *fiber_current();
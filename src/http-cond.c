@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "http-cond.h"
+
+#if !defined(OFF_MAX)
+#define OFF_MAX ((off_t)(((uint64_t)1 << (8 * sizeof(off_t) - 1)) - 1))
+#endif
+
+/*
+ * Reads the decimal offset at 'p' and stores it in 'value'.
+ * Returns the pointer after the digits or NULL if there isn't
+ * digits or if the value overflows.
+ */
+static const char *parse_offset(const char *p, off_t *value)
+{
+	off_t v = 0;
+
+	if (*p < '0' || *p > '9')
+		return NULL;
+	do {
+		if (v > (OFF_MAX - 9) / 10)
+			return NULL;
+		v = 10 * v + (off_t)(*p++ - '0');
+	} while (*p >= '0' && *p <= '9');
+	*value = v;
+	return p;
+}
+
+/*
+ * Parses the header 'range' for a file of 'size' bytes and stores the
+ * boundaries of the requested range in 'first' and 'last'.
+ * Returns 1 for a satisfiable single range, -1 for an unsatisfiable
+ * range or 0 when the header must be ignored: invalid syntax, unit
+ * other than bytes or multiple ranges.
+ */
+int http_cond_parse_range(const char *range, off_t size, off_t *first, off_t *last)
+{
+	const char *p;
+	off_t f, l;
+
+	if (strncasecmp(range, "bytes=", 6))
+		return 0;
+	p = range + 6;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == '-') {
+		/* suffix range: the 'l' last bytes */
+		p = parse_offset(p + 1, &l);
+		if (p == NULL)
+			return 0;
+		f = l < size ? size - l : 0;
+		l = size - 1;
+		if (f > l) {
+			while (*p == ' ' || *p == '\t')
+				p++;
+			return *p ? 0 : -1;
+		}
+	} else {
+		p = parse_offset(p, &f);
+		if (p == NULL || *p++ != '-')
+			return 0;
+		if (*p >= '0' && *p <= '9') {
+			p = parse_offset(p, &l);
+			if (p == NULL || l < f)
+				return 0;
+		} else
+			l = OFF_MAX;
+	}
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p)
+		return 0; /* multiple ranges are not served */
+	if (f >= size)
+		return -1;
+	*first = f;
+	*last = l < size ? l : size - 1;
+	return 1;
+}
+
+/*
+ * Formats 'date' in 'buffer' of 'size' as an HTTP date.
+ */
+void http_cond_date(char *buffer, size_t size, time_t date)
+{
+	struct tm tm;
+
+	strftime(buffer, size, "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&date, &tm));
+}
+
+/*
+ * Returns 1 if the HTTP date 'value' is valid and not older
+ * than 'date' or 0 otherwise.
+ */
+int http_cond_not_modified_since(const char *value, time_t date)
+{
+	struct tm tm;
+	const char *end;
+
+	memset(&tm, 0, sizeof tm);
+	end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return end != NULL && *end == 0 && date <= timegm(&tm);
+}
+
+/*
+ * Computes the range of a file of 'size' bytes requested by the
+ * headers 'range' and 'ifrange', both possibly NULL, for the
+ * file of tag 'etag' modified at the HTTP date 'lastmod'.
+ * The range is ignored when 'ifrange' matches neither 'etag'
+ * nor 'lastmod'. Returns the same values as http_cond_parse_range
+ * and 0 when there is no range.
+ */
+int http_cond_range(const char *range, const char *ifrange, const char *etag, const char *lastmod, off_t size, off_t *first, off_t *last)
+{
+	if (!range || (ifrange && strcmp(ifrange, etag) && strcmp(ifrange, lastmod)))
+		return 0;
+	return http_cond_parse_range(range, size, first, last);
+}
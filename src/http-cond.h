@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <time.h>
+
+extern void http_cond_date(char *buffer, size_t size, time_t date);
+extern int http_cond_not_modified_since(const char *value, time_t date);
+extern int http_cond_parse_range(const char *range, off_t size, off_t *first, off_t *last);
+extern int http_cond_range(const char *range, const char *ifrange, const char *etag, const char *lastmod, off_t size, off_t *first, off_t *last);
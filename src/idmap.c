@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "idmap.h"
+
+#define MIN_BITS	4
+#define MAX_BITS	30
+
+/*
+ * A slot of the table. It is free when its value is NULL.
+ */
+struct idmap_entry
+{
+	uint32_t id;
+	void *value;
+};
+
+/* the fibonacci hash of 'id' for a table of 2^'bits' slots */
+static inline uint32_t home(uint32_t id, uint8_t bits)
+{
+	return (id * UINT32_C(2654435769)) >> (32 - bits);
+}
+
+/*
+ * Search the slot of 'id' in 'map' that must have slots.
+ * Returns the index of the slot holding 'id' or if not found
+ * the index of the free slot where 'id' would go.
+ */
+static uint32_t search(struct idmap *map, uint32_t id)
+{
+	struct idmap_entry *entries = map->entries;
+	uint32_t mask = (UINT32_C(1) << map->bits) - 1;
+	uint32_t i = home(id, map->bits);
+
+	while (entries[i].value != NULL && entries[i].id != id)
+		i = (i + 1) & mask;
+	return i;
+}
+
+/*
+ * Resizes the slots of 'map' to 2^'bits'
+ * Returns 0 on success or -1 with errno=ENOMEM
+ */
+static int resize(struct idmap *map, uint8_t bits)
+{
+	struct idmap_entry *entries, *previous;
+	uint32_t i, n;
+
+	entries = calloc((size_t)1 << bits, sizeof *entries);
+	if (entries == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	previous = map->entries;
+	n = previous ? UINT32_C(1) << map->bits : 0;
+	map->entries = entries;
+	map->bits = bits;
+	for (i = 0 ; i < n ; i++)
+		if (previous[i].value != NULL)
+			entries[search(map, previous[i].id)] = previous[i];
+	free(previous);
+	return 0;
+}
+
+/*
+ * Ensures that 'map' can receive one more value while
+ * keeping its load under 3/4.
+ * Returns 0 on success or -1 with errno=ENOMEM
+ */
+static int reserve(struct idmap *map)
+{
+	uint8_t bits = map->bits;
+
+	if (map->entries == NULL)
+		return resize(map, MIN_BITS);
+	if (((map->count + 1) << 2) <= (UINT32_C(3) << bits))
+		return 0;
+	if (bits >= MAX_BITS) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return resize(map, (uint8_t)(bits + 1));
+}
+
+/* records in the free slot 'i' of 'map' the 'value' of 'id' */
+static void put(struct idmap *map, uint32_t i, uint32_t id, void *value)
+{
+	map->entries[i].id = id;
+	map->entries[i].value = value;
+	map->count++;
+}
+
+/*
+ * Initialise the 'map' as empty
+ */
+void idmap_init(struct idmap *map)
+{
+	memset(map, 0, sizeof *map);
+}
+
+/*
+ * Releases the memory used by 'map' and empties it.
+ * The recorded values are not released.
+ */
+void idmap_release(struct idmap *map)
+{
+	free(map->entries);
+	map->entries = NULL;
+	map->count = 0;
+	map->bits = 0;
+}
+
+/*
+ * Moves the content of the map 'from' to the map 'to' that
+ * is overwritten. After the move, 'from' is empty but continues
+ * to allocate identifiers after the ones it gave.
+ * This is intended for getting all pending values while
+ * holding a lock and for processing them after unlocking.
+ */
+void idmap_move(struct idmap *to, struct idmap *from)
+{
+	*to = *from;
+	from->entries = NULL;
+	from->count = 0;
+	from->bits = 0;
+}
+
+/*
+ * Records the 'value' in 'map' with a new identifier
+ * stored in 'id'. The identifiers are allocated increasingly
+ * (modulo 2^32), skipping the value 0 and the identifiers
+ * still in use.
+ * Returns 0 on success or -1 with errno=EINVAL if 'value'
+ * is NULL or with errno=ENOMEM.
+ */
+int idmap_add(struct idmap *map, void *value, uint32_t *id)
+{
+	uint32_t i, x;
+
+	if (value == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (reserve(map) < 0)
+		return -1;
+
+	x = map->lastid;
+	do {
+		if (!++x)
+			x = 1;
+		i = search(map, x);
+	} while (map->entries[i].value != NULL);
+	map->lastid = x;
+	put(map, i, x, value);
+	*id = x;
+	return 0;
+}
+
+/*
+ * Records the 'value' in 'map' for the given 'id'.
+ * Returns 0 on success or -1 with errno=EINVAL if 'value'
+ * is NULL or 'id' is 0, with errno=EEXIST if 'id' is already
+ * recorded or with errno=ENOMEM.
+ */
+int idmap_set(struct idmap *map, uint32_t id, void *value)
+{
+	uint32_t i;
+
+	if (value == NULL || id == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (reserve(map) < 0)
+		return -1;
+
+	i = search(map, id);
+	if (map->entries[i].value != NULL) {
+		errno = EEXIST;
+		return -1;
+	}
+	put(map, i, id, value);
+	return 0;
+}
+
+/*
+ * Returns the value recorded in 'map' for 'id' or NULL
+ */
+void *idmap_get(struct idmap *map, uint32_t id)
+{
+	return map->entries == NULL ? NULL : map->entries[search(map, id)].value;
+}
+
+/*
+ * Removes from 'map' the value recorded for 'id'.
+ * Returns the removed value or NULL if 'id' wasn't found.
+ */
+void *idmap_remove(struct idmap *map, uint32_t id)
+{
+	struct idmap_entry *entries = map->entries;
+	uint32_t i, j, k, mask;
+	void *value;
+
+	if (entries == NULL)
+		return NULL;
+
+	i = search(map, id);
+	value = entries[i].value;
+	if (value != NULL) {
+		/* shift back the entries following the removed one */
+		mask = (UINT32_C(1) << map->bits) - 1;
+		j = i;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (entries[j].value == NULL)
+				break;
+			k = home(entries[j].id, map->bits);
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+				continue;
+			entries[i] = entries[j];
+			i = j;
+		}
+		entries[i].value = NULL;
+		map->count--;
+	}
+	return value;
+}
+
+/*
+ * Calls the 'callback' with 'closure' for all the values
+ * recorded in 'map'. The 'callback' must not modify 'map'.
+ */
+void idmap_for_all(struct idmap *map, void (*callback)(void *closure, uint32_t id, void *value), void *closure)
+{
+	uint32_t i, n;
+
+	n = map->entries ? UINT32_C(1) << map->bits : 0;
+	for (i = 0 ; i < n ; i++)
+		if (map->entries[i].value != NULL)
+			callback(closure, map->entries[i].id, map->entries[i].value);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Table of pointers indexed by 32 bits integer identifiers.
+ * It is used for retrieving pending calls when their replies come.
+ *
+ * The table is an open addressing hash table with linear probing
+ * and without tombstones. The identifier 0 is never valid and
+ * the recorded values can't be NULL.
+ *
+ * The table doesn't lock: it is the responsability of its user.
+ * Initialise it with zeroes or with 'idmap_init'.
+ */
+struct idmap_entry;
+struct idmap
+{
+	struct idmap_entry *entries;	/* the slots */
+	uint32_t count;			/* count of recorded values */
+	uint32_t lastid;		/* last allocated identifier */
+	uint8_t bits;			/* log2 of the count of slots */
+};
+
+extern void idmap_init(struct idmap *map);
+extern void idmap_release(struct idmap *map);
+extern void idmap_move(struct idmap *to, struct idmap *from);
+
+extern int idmap_add(struct idmap *map, void *value, uint32_t *id);
+extern int idmap_set(struct idmap *map, uint32_t id, void *value);
+extern void *idmap_get(struct idmap *map, uint32_t id);
+extern void *idmap_remove(struct idmap *map, uint32_t id);
+
+extern void idmap_for_all(struct idmap *map, void (*callback)(void *closure, uint32_t id, void *value), void *closure);
@@ -23,6 +23,12 @@
 #   define HAS_WATCHDOG 1
 #endif
 
+#if defined(WITH_JOBS_FIBERS)
+#   define HAS_FIBERS 1
+#else
+#   define HAS_FIBERS 0
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -44,6 +50,9 @@
 #include "jobs.h"
 #include "sig-monitor.h"
 #include "verbose.h"
+#if HAS_FIBERS
+#include "fiber.h"
+#endif
 
 #if defined(REMOVE_SYSTEMD_EVENT)
 #include "fdev-epoll.h"
@@ -63,8 +72,14 @@ struct job
 	job_cb_t callback;   /**< processing callback */
 	void *arg;           /**< argument */
 	int timeout;         /**< timeout in second for processing the request */
+	uint64_t queued;     /**< time of queuing in microseconds */
 	unsigned blocked: 1; /**< is an other request blocking this one ? */
 	unsigned dropped: 1; /**< is removed ? */
+	unsigned priority: 2; /**< priority of the job */
+	void *local;         /**< value local to the job */
+#if HAS_FIBERS
+	struct sig_monitor_state state; /**< monitoring of the job's fiber */
+#endif
 };
 
 /** Description of handled event loops */
@@ -104,6 +119,12 @@ struct sync
 				/**< the entering synchronous routine */
 	};
 	void *arg;		/**< the argument of the callback */
+#if HAS_FIBERS
+	struct sync *next;	/**< next suspended or resumable */
+	struct fiber *fiber;	/**< the suspended fiber */
+	struct job *job;	/**< the job of the suspended fiber */
+	pthread_t tid;		/**< the thread of the suspended fiber */
+#endif
 };
 
 
@@ -114,14 +135,37 @@ static pthread_cond_t  cond = PTHREAD_COND_INITIALIZER;
 /* count allowed, started and running threads */
 static int allowed = 0; /** allowed count of threads */
 static int started = 0; /** started count of threads */
+static int starting = 0; /** count of threads created but not yet started */
 static int running = 0; /** running count of threads */
-static int remains = 0; /** allowed count of waiting jobs */
+
+/*
+ * Admission of jobs: a job of a given priority is admitted only if the
+ * count of waiting jobs, of any priority, is lower than the limit of its
+ * priority. The limit of bulk jobs being the lowest and the limit of
+ * critical jobs the highest, bulk jobs are rejected first on overload
+ * while critical jobs are still admitted.
+ */
+static int waiting = 0; /** count of waiting jobs */
+static int limits[JOBS_PRIORITY_COUNT]; /** limits of waiting jobs per priority */
+
+/* rank of the priorities in the queue, critical first */
+static const int ranks[JOBS_PRIORITY_COUNT] = {
+	[JOBS_PRIORITY_CRITICAL] = 0,
+	[JOBS_PRIORITY_NORMAL] = 1,
+	[JOBS_PRIORITY_BULK] = 2
+};
+
+/* statistics per priority */
+static struct jobs_stats stats[JOBS_PRIORITY_COUNT];
 
 /* list of threads */
 static struct thread *threads;
 static _Thread_local struct thread *current_thread;
 static _Thread_local struct evloop *current_evloop;
 
+/* value local to the thread when it doesn't process a job */
+static _Thread_local void *thread_local_value;
+
 /* queue of pending jobs */
 static struct job *first_job;
 static struct job *free_jobs;
@@ -129,11 +173,28 @@ static struct job *free_jobs;
 /* event loop */
 static struct evloop evloop[1];
 
+#if HAS_FIBERS
+/* synchronous calls suspended and the ones to resume */
+static struct sync *suspended_syncs;
+static struct sync *first_resumable, *last_resumable;
+#endif
+
 #if defined(REMOVE_SYSTEMD_EVENT)
 static struct fdev_epoll *fdevepoll;
 static int waitevt;
 #endif
 
+/**
+ * Get the current time in microseconds
+ */
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
 /**
  * Create a new job with the given parameters
  * @param group    the group of the job
@@ -171,36 +232,51 @@ static struct job *job_create(
 	job->arg = arg;
 	job->blocked = 0;
 	job->dropped = 0;
+	job->priority = JOBS_PRIORITY_NORMAL;
+	job->local = NULL;
+#if HAS_FIBERS
+	memset(&job->state, 0, sizeof job->state);
+#endif
 end:
 	return job;
 }
 
 /**
- * Adds 'job' at the end of the list of jobs, marking it
- * as blocked if an other job with the same group is pending.
+ * Adds 'job' in the list of jobs after the jobs of same or higher
+ * priority, marking it as blocked if an other job with the same
+ * group is pending.
  * @param job the job to add
  */
 static void job_add(struct job *job)
 {
 	const void *group;
 	struct job *ijob, **pjob;
+	int rank;
 
 	/* prepare to add */
 	group = job->group;
-	job->next = NULL;
+	rank = ranks[job->priority];
 
-	/* search end and blockers */
+	/* search place and blockers */
 	pjob = &first_job;
 	ijob = first_job;
 	while (ijob) {
 		if (group && ijob->group == group)
 			job->blocked = 1;
-		pjob = &ijob->next;
+		if (ranks[ijob->priority] <= rank)
+			pjob = &ijob->next;
 		ijob = ijob->next;
 	}
 
 	/* queue the jobs */
+	job->next = *pjob;
 	*pjob = job;
+
+	/* account it */
+	job->queued = now_us();
+	waiting++;
+	stats[job->priority].waiting++;
+	stats[job->priority].queued++;
 }
 
 /**
@@ -238,7 +314,7 @@ static inline void job_release(struct job *job)
 	/* then unblock jobs of the same group */
 	group = job->group;
 	if (group) {
-		ijob = job->next;
+		ijob = first_job;
 		while (ijob && ijob->group != group)
 			ijob = ijob->next;
 		if (ijob)
@@ -331,6 +407,89 @@ static void evloop_run(int signum, void *arg)
 }
 
 
+#if HAS_FIBERS
+/**
+ * Entry of fibers running jobs. Fibers are switched to
+ * and from with the mutex locked.
+ * @param closure the job to run
+ */
+static void job_fiber_main(void *closure)
+{
+	struct job *job = closure;
+
+	pthread_mutex_unlock(&mutex);
+	sig_monitor(job->timeout, job->callback, job->arg);
+	pthread_mutex_lock(&mutex);
+}
+
+/**
+ * Runs or continues the 'job' in its 'fiber' until it
+ * ends or it suspends. The mutex must be locked.
+ * @param job the job to run
+ * @param fiber the fiber of the job
+ */
+static void job_fiber_run(struct job *job, struct fiber *fiber)
+{
+	int ended;
+
+	sig_monitor_exchange(&job->state);
+	ended = fiber_switch(fiber);
+	sig_monitor_exchange(&job->state);
+	if (ended) {
+		fiber_destroy(fiber);
+		job_release(job);
+	}
+}
+#endif
+
+/**
+ * Runs the 'job' for the thread 'me'.
+ * The mutex must be locked and is locked on return.
+ * @param me the description of the thread running the job
+ * @param job the job to run
+ */
+static void job_run(volatile struct thread *me, struct job *job)
+{
+	struct jobs_stats *st;
+	uint64_t wait;
+#if HAS_FIBERS
+	struct fiber *fiber;
+#endif
+
+	/* account the end of the wait */
+	st = &stats[job->priority];
+	wait = now_us() - job->queued;
+	waiting--;
+	st->waiting--;
+	st->started++;
+	st->wait_total_us += wait;
+	if (wait > st->wait_max_us)
+		st->wait_max_us = wait;
+
+	/* prepare running the job */
+	job->blocked = 1; /* mark job as blocked */
+	me->job = job; /* record the job (for terminate and jobs_get_local) */
+
+#if HAS_FIBERS
+	/* run the job in a fiber, it is released when it ends */
+	fiber = fiber_create(job_fiber_main, job);
+	if (fiber) {
+		job_fiber_run(job, fiber);
+		me->job = NULL;
+		return;
+	}
+#endif
+
+	/* run the job */
+	pthread_mutex_unlock(&mutex);
+	sig_monitor(job->timeout, job->callback, job->arg);
+	pthread_mutex_lock(&mutex);
+
+	/* release the run job */
+	me->job = NULL;
+	job_release(job);
+}
+
 #if defined(REMOVE_SYSTEMD_EVENT)
 /**
  * Monitored normal loop for waiting events.
@@ -353,18 +512,21 @@ static void monitored_wait_and_dispatch(int signum, void *arg)
  * The loop must be called with the mutex locked
  * and it returns with the mutex locked.
  * @param me the description of the thread to use
- * TODO: how are timeout handled when reentering?
  */
 static void thread_run(volatile struct thread *me)
 {
 	struct thread **prv;
 	struct job *job;
+#if HAS_FIBERS
+	struct sync *sync, *prvsync;
+#endif
 #if !defined(REMOVE_SYSTEMD_EVENT)
 	struct evloop *el;
 #endif
 
 	/* initialize description of itself and link it in the list */
 	me->tid = pthread_self();
+	me->job = NULL;
 	me->stop = 0;
 	me->waits = 0;
 	me->upper = current_thread;
@@ -384,21 +546,33 @@ static void thread_run(volatile struct thread *me)
 			current_evloop = NULL;
 		}
 
+#if HAS_FIBERS
+		/* continue synchronous calls of the thread first */
+		prvsync = NULL;
+		sync = first_resumable;
+		while (sync && !pthread_equal(sync->tid, me->tid)) {
+			prvsync = sync;
+			sync = sync->next;
+		}
+		if (sync) {
+			if (prvsync)
+				prvsync->next = sync->next;
+			else
+				first_resumable = sync->next;
+			if (last_resumable == sync)
+				last_resumable = prvsync;
+			job = sync->job;
+			me->job = job;
+			job_fiber_run(job, sync->fiber);
+			me->job = NULL;
+			continue;
+		}
+#endif
+
 		/* get a job */
 		job = job_get();
 		if (job) {
-			/* prepare running the job */
-			remains++; /* increases count of job that can wait */
-			job->blocked = 1; /* mark job as blocked */
-			me->job = job; /* record the job (only for terminate) */
-
-			/* run the job */
-			pthread_mutex_unlock(&mutex);
-			sig_monitor(job->timeout, job->callback, job->arg);
-			pthread_mutex_lock(&mutex);
-
-			/* release the run job */
-			job_release(job);
+			job_run(me, job);
 #if !defined(REMOVE_SYSTEMD_EVENT)
 		} else {
 			/* no job, check events */
@@ -417,8 +591,10 @@ static void thread_run(volatile struct thread *me)
 					ERROR("Entering job deep sleep! Check your bindings.");
 				me->waits = 1;
 				pthread_cond_wait(&cond, &mutex);
-				me->waits = 0;
-				running++;
+				if (me->waits) {
+					me->waits = 0;
+					running++;
+				}
 			}
 #else
 		} else if (waitevt) {
@@ -428,8 +604,10 @@ static void thread_run(volatile struct thread *me)
 				ERROR("Entering job deep sleep! Check your bindings.");
 			me->waits = 1;
 			pthread_cond_wait(&cond, &mutex);
-			me->waits = 0;
-			running++;
+			if (me->waits) {
+				me->waits = 0;
+				running++;
+			}
 		} else {
 			/* wait for events */
 			waitevt = 1;
@@ -469,6 +647,7 @@ static void *thread_main(void *data)
 	struct thread me;
 
 	pthread_mutex_lock(&mutex);
+	starting--;
 	running++;
 	thread_run(&me);
 	running--;
@@ -490,19 +669,32 @@ static int start_one_thread()
 		/* errno = rc; */
 		WARNING("not able to start thread: %m");
 		rc = -1;
-	}
+	} else
+		starting++;
 	return rc;
 }
 
+/**
+ * Tells whether a new thread should be started: it is the case
+ * when all threads are busy, none is starting and more are allowed.
+ * Must be called with the mutex locked.
+ * @return 1 if a thread should be started or 0 otherwise
+ */
+static inline int should_start_thread()
+{
+	return running == started && !starting && started < allowed;
+}
+
 /**
  * Queues a new asynchronous job represented by 'callback' and 'arg'
- * for the 'group' and the 'timeout'.
- * Jobs are queued FIFO and are possibly executed in parallel
- * concurrently except for job of the same group that are
- * executed sequentially in FIFO order.
+ * for the 'group', the 'timeout' and the 'priority'.
+ * Jobs are queued FIFO after the jobs of same or higher priority and
+ * are possibly executed in parallel concurrently except for job of the
+ * same group that are executed sequentially in queue order.
  * @param group    The group of the job or NULL when no group.
  * @param timeout  The maximum execution time in seconds of the job
  *                 or 0 for unlimited time.
+ * @param priority The priority of the job (JOBS_PRIORITY_...)
  * @param callback The function to execute for achieving the job.
  *                 Its first parameter is either 0 on normal flow
  *                 or the signal number that broke the normal flow.
@@ -511,9 +703,10 @@ static int start_one_thread()
  * @param arg      The second argument for 'callback'
  * @return 0 in case of success or -1 in case of error
  */
-int jobs_queue(
+int jobs_queue_priority(
 		const void *group,
 		int timeout,
+		int priority,
 		void (*callback)(int, void*),
 		void *arg)
 {
@@ -521,8 +714,19 @@ int jobs_queue(
 	struct job *job;
 	int rc;
 
+	if (priority < 0 || priority >= JOBS_PRIORITY_COUNT)
+		priority = JOBS_PRIORITY_NORMAL;
+
 	pthread_mutex_lock(&mutex);
 
+	/* check availability */
+	if (waiting >= limits[priority]) {
+		stats[priority].rejected++;
+		errno = EBUSY;
+		info = "too many jobs";
+		goto error;
+	}
+
 	/* allocates the job */
 	job = job_create(group, timeout, callback, arg);
 	if (!job) {
@@ -530,16 +734,10 @@ int jobs_queue(
 		info = "out of memory";
 		goto error;
 	}
-
-	/* check availability */
-	if (remains == 0) {
-		errno = EBUSY;
-		info = "too many jobs";
-		goto error2;
-	}
+	job->priority = priority;
 
 	/* start a thread if needed */
-	if (running == started && started < allowed) {
+	if (should_start_thread()) {
 		/* all threads are busy and a new can be started */
 		rc = start_one_thread();
 		if (rc < 0 && started == 0) {
@@ -549,7 +747,6 @@ int jobs_queue(
 	}
 
 	/* queues the job */
-	remains--;
 	job_add(job);
 
 	/* signal an existing job */
@@ -566,6 +763,38 @@ error:
 	return -1;
 }
 
+/**
+ * Queues a new asynchronous job of normal priority.
+ * @see jobs_queue_priority
+ */
+int jobs_queue(
+		const void *group,
+		int timeout,
+		void (*callback)(int, void*),
+		void *arg)
+{
+	return jobs_queue_priority(group, timeout, JOBS_PRIORITY_NORMAL, callback, arg);
+}
+
+/**
+ * Get the statistics of the jobs of 'priority'.
+ * @param priority the priority (JOBS_PRIORITY_...)
+ * @param result where to store the statistics
+ * @return 0 in case of success or -1 if priority is invalid
+ */
+int jobs_get_stats(int priority, struct jobs_stats *result)
+{
+	if (priority < 0 || priority >= JOBS_PRIORITY_COUNT) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&mutex);
+	*result = stats[priority];
+	result->limit = limits[priority];
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
 /**
  * Internal helper function for 'jobs_enter'.
  * @see jobs_enter, jobs_leave
@@ -601,6 +830,7 @@ static int do_sync(
 )
 {
 	struct job *job;
+	struct sig_monitor_state state;
 
 	pthread_mutex_lock(&mutex);
 
@@ -613,11 +843,32 @@ static int do_sync(
 		return -1;
 	}
 
+	/* the job continues the flow of the caller */
+	job->local = jobs_get_local();
+
 	/* queues the job */
 	job_add(job);
 
-	/* run until stopped */
+#if HAS_FIBERS
+	if (fiber_current()) {
+		/* suspend the fiber until jobs_leave, the thread continues other jobs */
+		sync->fiber = fiber_current();
+		sync->job = current_thread->job;
+		sync->tid = current_thread->tid;
+		sync->next = suspended_syncs;
+		suspended_syncs = sync;
+		fiber_yield();
+		/* here the fiber continues on the same thread */
+		pthread_mutex_unlock(&mutex);
+		return 0;
+	}
+#endif
+
+	/* run until stopped, the waiting isn't accounted to the current job */
+	memset(&state, 0, sizeof state);
+	sig_monitor_exchange(&state);
 	thread_run(&sync->thread);
+	sig_monitor_exchange(&state);
 	pthread_mutex_unlock(&mutex);
 	return 0;
 }
@@ -651,6 +902,49 @@ int jobs_enter(
 	return do_sync(group, timeout, enter_cb, &sync);
 }
 
+/**
+ * Wakes up the thread 't' if it waits for jobs. It is counted as
+ * running at once, so that no thread sees all the threads sleeping
+ * before it wakes up.
+ * Must be called with the mutex locked.
+ * @param t the thread to wake up
+ * @return 1 if the thread was waiting or 0 otherwise
+ */
+static int thread_wakeup(struct thread *t)
+{
+	if (!t->waits)
+		return 0;
+	t->waits = 0;
+	running++;
+	pthread_cond_broadcast(&cond);
+	return 1;
+}
+
+#if HAS_FIBERS
+/**
+ * Wakes up the thread 'tid' if it waits for jobs or for events.
+ * Must be called with the mutex locked.
+ * @param tid the thread to wake up
+ */
+static void thread_wakeup_tid(pthread_t tid)
+{
+	struct thread *t;
+#if !defined(REMOVE_SYSTEMD_EVENT)
+	uint64_t x;
+#endif
+
+	for (t = threads ; t ; t = t->next)
+		if (pthread_equal(t->tid, tid) && thread_wakeup(t))
+			return;
+#if !defined(REMOVE_SYSTEMD_EVENT)
+	if (__atomic_load_n(&evloop[0].state, __ATOMIC_RELAXED) & EVLOOP_STATE_WAIT) {
+		x = 1;
+		write(evloop[0].efd, &x, sizeof x);
+	}
+#endif
+}
+#endif
+
 /**
  * Unlocks the execution flow designed by 'jobloop'.
  * @param jobloop indication of the flow to unlock
@@ -659,22 +953,74 @@ int jobs_enter(
 int jobs_leave(struct jobloop *jobloop)
 {
 	struct thread *t;
+#if HAS_FIBERS
+	struct sync *sync, **prv;
+#endif
 
 	pthread_mutex_lock(&mutex);
 	t = threads;
 	while (t && t != (struct thread*)jobloop)
 		t = t->next;
+#if HAS_FIBERS
+	if (!t) {
+		/* is it a suspended fiber? */
+		prv = &suspended_syncs;
+		while ((sync = *prv) && &sync->thread != (struct thread*)jobloop)
+			prv = &sync->next;
+		if (sync) {
+			/* yes, make it resumable */
+			*prv = sync->next;
+			sync->next = NULL;
+			if (last_resumable)
+				last_resumable->next = sync;
+			else
+				first_resumable = sync;
+			last_resumable = sync;
+			thread_wakeup_tid(sync->tid);
+			pthread_mutex_unlock(&mutex);
+			return 0;
+		}
+	}
+#endif
 	if (!t) {
 		errno = EINVAL;
 	} else {
 		t->stop = 1;
-		if (t->waits)
-			pthread_cond_broadcast(&cond);
+		thread_wakeup(t);
 	}
 	pthread_mutex_unlock(&mutex);
 	return -!t;
 }
 
+/**
+ * Gets the value local to the current flow of execution: the job
+ * processed by the current thread or, when it processes no job,
+ * the thread itself. The jobs of synchronous calls start with the
+ * value of their caller.
+ * @return the value set by 'jobs_set_local' or NULL
+ */
+void *jobs_get_local()
+{
+	struct thread *t = current_thread;
+
+	return t && t->job ? t->job->local : thread_local_value;
+}
+
+/**
+ * Sets the value local to the current flow of execution.
+ * @param value the value to set
+ * @see jobs_get_local
+ */
+void jobs_set_local(void *value)
+{
+	struct thread *t = current_thread;
+
+	if (t && t->job)
+		t->job->local = value;
+	else
+		thread_local_value = value;
+}
+
 /**
  * Calls synchronously the job represented by 'callback' and 'arg1'
  * for the 'group' and the 'timeout' and waits for its completion.
@@ -872,7 +1218,11 @@ int jobs_start(int allowed_count, int start_count, int waiter_count, void (*star
 	allowed = allowed_count;
 	started = 0;
 	running = 0;
-	remains = waiter_count;
+	waiting = 0;
+	memset(stats, 0, sizeof stats);
+	limits[JOBS_PRIORITY_BULK] = waiter_count / 2 ?: 1;
+	limits[JOBS_PRIORITY_NORMAL] = waiter_count;
+	limits[JOBS_PRIORITY_CRITICAL] = waiter_count + (waiter_count / 4 ?: 1);
 
 #if HAS_WATCHDOG
 	/* set the watchdog */
@@ -898,10 +1248,11 @@ int jobs_start(int allowed_count, int start_count, int waiter_count, void (*star
 		goto error;
 	}
 	job_add(job);
-	remains--;
 
 	/* run until end */
+	running++;
 	thread_run(&me);
+	running--;
 	rc = 0;
 error:
 	pthread_mutex_unlock(&mutex);
@@ -959,7 +1310,7 @@ void jobs_terminate()
 	pthread_mutex_lock(&mutex);
 
 	/* cancel pending jobs of other threads */
-	remains = 0;
+	memset(limits, 0, sizeof limits);
 	head = first_job;
 	first_job = NULL;
 	tail = NULL;
@@ -988,6 +1339,11 @@ void jobs_terminate()
 			pthread_mutex_lock(&mutex);
 		}
 	}
+
+	/* no job is waiting anymore */
+	waiting = 0;
+	for (count = 0 ; count < JOBS_PRIORITY_COUNT ; count++)
+		stats[count].waiting = 0;
 	pthread_mutex_unlock(&mutex);
 }
 
@@ -17,14 +17,43 @@
 
 #pragma once
 
+#include <stdint.h>
+
 struct jobloop;
 
+/* priorities of jobs, the values match the ones of bindings */
+#define JOBS_PRIORITY_NORMAL	0	/* default priority */
+#define JOBS_PRIORITY_CRITICAL	1	/* processed first, rejected last */
+#define JOBS_PRIORITY_BULK	2	/* processed last, rejected first */
+#define JOBS_PRIORITY_COUNT	3
+
+/* statistics of the jobs of a priority */
+struct jobs_stats
+{
+	unsigned long queued;	/**< count of queued jobs */
+	unsigned long rejected;	/**< count of jobs rejected on overload */
+	unsigned long started;	/**< count of started jobs */
+	int waiting;		/**< count of jobs currently waiting */
+	int limit;		/**< count of waiting jobs above which jobs are rejected */
+	uint64_t wait_total_us;	/**< cumulated waiting time of started jobs */
+	uint64_t wait_max_us;	/**< maximal waiting time of started jobs */
+};
+
 extern int jobs_queue(
 		const void *group,
 		int timeout,
 		void (*callback)(int signum, void* arg),
 		void *arg);
 
+extern int jobs_queue_priority(
+		const void *group,
+		int timeout,
+		int priority,
+		void (*callback)(int signum, void* arg),
+		void *arg);
+
+extern int jobs_get_stats(int priority, struct jobs_stats *result);
+
 extern int jobs_enter(
 		const void *group,
 		int timeout,
@@ -39,6 +68,9 @@ extern int jobs_call(
 		void (*callback)(int, void*),
 		void *arg);
 
+extern void *jobs_get_local();
+extern void jobs_set_local(void *value);
+
 extern void jobs_terminate();
 
 extern int jobs_start(
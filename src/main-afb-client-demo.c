@@ -37,6 +37,7 @@
 #include "afb-wsj1.h"
 #include "afb-ws-client.h"
 #include "afb-proto-ws.h"
+#include "afb-client-bench.h"
 
 enum {
 	Exit_Success      = 0,
@@ -104,6 +105,12 @@ static sd_event *loop;
 static sd_event_source *evsrc;
 static char *sessionid = "afb-client-demo";
 static int exitcode = 0;
+static int benchmark;
+static struct afb_client_bench bench = {
+	.connections = 1,
+	.inflight = 1,
+	.duration = 10
+};
 
 /* print usage of the program */
 static void usage(int status, char *arg0)
@@ -112,6 +119,8 @@ static void usage(int status, char *arg0)
 	name = name ? name + 1 : arg0;
 	fprintf(status ? stderr : stdout, "usage: %s [-H [-r]] [-b] [-e] uri [api verb [data]]\n", name);
 	fprintf(status ? stderr : stdout, "       %s -d [-H [-r]] [-b] [-e] uri [verb [data]]\n", name);
+	fprintf(status ? stderr : stdout, "       %s -B [-H] [bench-options] uri api verb [data]\n", name);
+	fprintf(status ? stderr : stdout, "       %s -B -d [-H] [bench-options] uri verb [data]\n", name);
 	fprintf(status ? stderr : stdout, "\n"
 		"allowed options\n"
 		"  --break, -b         Break connection just after event/call has been emitted.\n"
@@ -122,6 +131,14 @@ static void usage(int status, char *arg0)
 		"  --raw, -r           Raw output (default)\n"
 		"  --sync, -s          Synchronous: wait for answers\n"
 		"  --keep-running, -k  Keep running until disconnect, even if input closed\n"
+		"  --bench, -B         Benchmark the calls, print a JSON report\n"
+		"bench-options\n"
+		"  --connections=N     Count of connections [default 1]\n"
+		"  --inflight=N        Count of calls in flight per connection [default 1]\n"
+		"  --rate=R            Total rate of calls per second [default: max]\n"
+		"  --duration=S        Duration in seconds [default 10]\n"
+		"  --direct-uri=URI    Also make connections to the direct api of URI\n"
+		"  --subscribe='V [D]' Call the verb V with data D once per connection\n"
 		"Example:\n"
 		" %s --human 'localhost:1234/api?token=HELLO&uuid=magic' hello ping\n"
 		"\n", name
@@ -130,9 +147,48 @@ static void usage(int status, char *arg0)
 	exit(status);
 }
 
+/* get the value of the option 'arg' if it is 'name=value' */
+static const char *optval(const char *arg, const char *name)
+{
+	size_t len = strlen(name);
+	return strncmp(arg, name, len) || arg[len] != '=' ? NULL : &arg[len + 1];
+}
+
+/* runs the benchmark */
+static int run_bench(int ac, char **av)
+{
+	char *subscribe;
+
+	if (direct) {
+		if (ac != 3 && ac != 4)
+			return Exit_Bad_Arg;
+		bench.direct_uri = av[1];
+		bench.verb = av[2];
+		bench.data = av[3];
+	} else {
+		if (ac != 4 && ac != 5)
+			return Exit_Bad_Arg;
+		bench.uri = av[1];
+		bench.api = av[2];
+		bench.verb = av[3];
+		bench.data = av[4];
+	}
+	if (bench.subscribe) {
+		subscribe = strdupa(bench.subscribe);
+		bench.subscribe = strsep(&subscribe, " ");
+		bench.subscribe_data = subscribe;
+	}
+	if (bench.connections <= 0 || bench.inflight <= 0 || bench.rate < 0 || bench.duration <= 0)
+		return Exit_Bad_Arg;
+
+	bench.pretty = human;
+	return afb_client_bench_run(loop, &bench) < 0 ? Exit_Cant_Connect : Exit_Success;
+}
+
 /* entry function */
 int main(int ac, char **av, char **env)
 {
+	const char *val;
 	int rc;
 	char *a0;
 
@@ -165,6 +221,27 @@ int main(int ac, char **av, char **env)
 			else if (!strcmp(av[1], "--echo")) /* request to echo inputs */
 				echo = 1;
 
+			else if (!strcmp(av[1], "--bench")) /* request for benchmark */
+				benchmark = 1;
+
+			else if ((val = optval(av[1], "--connections")))
+				bench.connections = atoi(val);
+
+			else if ((val = optval(av[1], "--inflight")))
+				bench.inflight = atoi(val);
+
+			else if ((val = optval(av[1], "--rate")))
+				bench.rate = atof(val);
+
+			else if ((val = optval(av[1], "--duration")))
+				bench.duration = atof(val);
+
+			else if ((val = optval(av[1], "--direct-uri")))
+				bench.direct_uri = val;
+
+			else if ((val = optval(av[1], "--subscribe")))
+				bench.subscribe = val;
+
 			/* emit usage and exit */
 			else
 				usage(strcmp(av[1], "--help") ? Exit_Bad_Arg : Exit_Success, a0);
@@ -179,6 +256,7 @@ int main(int ac, char **av, char **env)
 				case 'k': keeprun = 1; break;
 				case 's': synchro = 1; break;
 				case 'e': echo = 1; break;
+				case 'B': benchmark = 1; break;
 				default: usage(av[1][rc] != 'h' ? Exit_Bad_Arg : Exit_Success, a0);
 				}
 		}
@@ -187,7 +265,7 @@ int main(int ac, char **av, char **env)
 	}
 
 	/* check the argument count */
-	if (ac != 2 && ac != 4 && ac != 5)
+	if (!benchmark && ac != 2 && ac != 4 && ac != 5)
 		usage(1, a0);
 
 	/* set raw by default */
@@ -201,6 +279,14 @@ int main(int ac, char **av, char **env)
 		return 1;
 	}
 
+	/* run the benchmark if requested */
+	if (benchmark) {
+		rc = run_bench(ac, av);
+		if (rc == Exit_Bad_Arg)
+			usage(rc, a0);
+		return rc;
+	}
+
 	/* connect the websocket wsj1 to the uri given by the first argument */
 	if (direct) {
 		pws = afb_ws_client_connect_api(loop, av[1], &pws_itf, NULL);
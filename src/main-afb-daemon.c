@@ -43,10 +43,12 @@
 #include "afb-apiset.h"
 #include "afb-autoset.h"
 #include "afb-api-so.h"
+#include "afb-api-so-cache.h"
 #if defined(WITH_DBUS_TRANSPARENCY)
 #   include "afb-api-dbus.h"
 #endif
 #include "afb-api-ws.h"
+#include "afb-socket.h"
 #include "afb-hsrv.h"
 #include "afb-hreq.h"
 #include "afb-xreq.h"
@@ -323,13 +325,14 @@ static struct afb_hsrv *start_http_server()
 	int rc;
 	const char *uploaddir, *rootdir;
 	struct afb_hsrv *hsrv;
-	int cache_timeout, http_port;
+	int cache_timeout, http_port, http_threads;
 
-	rc = wrap_json_unpack(main_config, "{ss ss si si}",
+	rc = wrap_json_unpack(main_config, "{ss ss si si si}",
 				"uploaddir", &uploaddir,
 				"rootdir", &rootdir,
 				"cache-eol", &cache_timeout,
-				"port", &http_port);
+				"port", &http_port,
+				"http-threads", &http_threads);
 	if (rc < 0) {
 		ERROR("Can't get HTTP server start config");
 		exit(1);
@@ -347,6 +350,7 @@ static struct afb_hsrv *start_http_server()
 	}
 
 	if (!afb_hsrv_set_cache_timeout(hsrv, cache_timeout)
+	    || !afb_hsrv_set_threads(hsrv, http_threads)
 	    || !init_http_server(hsrv)) {
 		ERROR("initialisation of httpd failed");
 		afb_hsrv_put(hsrv);
@@ -650,9 +654,9 @@ static void start(int signum, void *arg)
 {
 	const char *tracereq, *traceapi, *traceevt, *traceses, *tracesvc, *traceditf, *traceglob;
 	const char *workdir, *rootdir, *token, *rootapi;
-	struct json_object *settings;
+	struct json_object *settings, *obj;
 	struct afb_hsrv *hsrv;
-	int max_session_count, session_timeout, api_timeout;
+	int max_session_count, session_timeout, api_timeout, ws_backlog;
 	int no_httpd, http_port;
 	int rc;
 
@@ -670,7 +674,7 @@ static void start(int signum, void *arg)
 	no_httpd = http_port = 0;
 	rc = wrap_json_unpack(main_config, "{"
 			"ss ss s?s"
-			"si si si"
+			"si si si si"
 			"s?b s?i s?s"
 			"s?o"
 #if !defined(REMOVE_LEGACY_TRACE)
@@ -686,6 +690,7 @@ static void start(int signum, void *arg)
 			"apitimeout", &api_timeout,
 			"cntxtimeout", &session_timeout,
 			"session-max", &max_session_count,
+			"ws-backlog", &ws_backlog,
 
 			"no-httpd", &no_httpd,
 			"port", &http_port,
@@ -725,6 +730,7 @@ static void start(int signum, void *arg)
 
 	/* configure the daemon */
 	afb_export_set_config(settings);
+	afb_socket_set_backlog(ws_backlog);
 	if (afb_session_init(max_session_count, session_timeout, token)) {
 		ERROR("initialisation of session manager failed");
 		goto error;
@@ -766,9 +772,14 @@ static void start(int signum, void *arg)
 
 	/* load bindings and apis */
 	afb_debug("start-load");
+	if (json_object_object_get_ex(main_config, "binding-cache", &obj)
+	 && afb_api_so_cache_load(json_object_get_string(obj)) < 0)
+		WARNING("can't use the binding cache %s", json_object_get_string(obj));
 	apiset_start_list("binding", afb_api_so_add_binding, "the binding");
 	apiset_start_list("ldpaths", afb_api_so_add_pathset_fails, "the binding path set");
 	apiset_start_list("weak-ldpaths", afb_api_so_add_pathset_nofails, "the weak binding path set");
+	apiset_start_list("lazy-ldpaths", afb_api_so_add_pathset_lazy, "the lazy binding path set");
+	afb_api_so_cache_save();
 	apiset_start_list("auto-api", afb_autoset_add_any, "the automatic api path set");
 #if defined(WITH_DBUS_TRANSPARENCY)
 	apiset_start_list("dbus-client", afb_api_dbus_add_client, "the afb-dbus client");
@@ -782,7 +793,12 @@ static void start(int signum, void *arg)
 #if !defined(NO_CALL_PERSONALITY)
 	personality((unsigned long)-1L);
 #endif
-	if (afb_apiset_start_all_services(main_apiset) < 0)
+	if (!json_object_object_get_ex(main_config, "parallel-init", &obj)
+			|| json_object_get_boolean(obj))
+		rc = afb_apiset_start_all_services_parallel(main_apiset);
+	else
+		rc = afb_apiset_start_all_services(main_apiset);
+	if (rc < 0)
 		goto error;
 
 	/* export started apis */
@@ -856,6 +872,17 @@ int main(int argc, char *argv[])
 	daemonize();
 	INFO("running with pid %d", getpid());
 
+	/* set the logging */
+	if (json_object_object_get_ex(main_config, "log-ratelimit", &obj))
+		verbose_set_ratelimit((unsigned)json_object_get_int(obj));
+	/* asynchronous logs by default when supported */
+	if (!json_object_object_get_ex(main_config, "log-async", &obj))
+		obj = NULL;
+	if ((!obj || json_object_get_boolean(obj))
+	 && verbose_async_start() < 0
+	 && (obj || errno != ENOTSUP))
+		WARNING("can't write logs asynchronously: %m");
+
 	/* set the daemon environment */
 	setup_daemon();
 
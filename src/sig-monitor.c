@@ -23,22 +23,49 @@
 #include <string.h>
 #include <setjmp.h>
 #include <time.h>
+#include <stdint.h>
 #include <unistd.h>
-#include <sys/syscall.h>
+#include <pthread.h>
 #include <execinfo.h>
 
 #include "sig-monitor.h"
 #include "verbose.h"
 
 #define SIG_FOR_TIMER   SIGVTALRM
+#define TIMER_CLOCK     CLOCK_MONOTONIC_COARSE
+#define TICK_MS         100	/* maximal delay for detecting expirations */
+#define EXPIRED         1	/* deadline of slots whose thread is signaled */
 
 /* local handler */
 static _Thread_local sigjmp_buf *error_handler;
 static _Thread_local int in_safe_dumpstack;
 
-/* local timers */
-static _Thread_local int thread_timer_set;
-static _Thread_local timer_t thread_timerid;
+/*
+ * Deadline of the monitored job of a thread.
+ *
+ * Instead of arming a timer per job, threads just record the deadline
+ * of their current job in their slot. A single watchdog thread checks
+ * the slots of the threads and signals the threads whose deadline expired.
+ */
+struct slot
+{
+	struct slot *next;	/**< next slot of the watchdog list */
+	pthread_t tid;		/**< the thread */
+	uint64_t deadline;	/**< deadline in ms, 0 if none, EXPIRED if signaled */
+};
+
+/* local slot */
+static _Thread_local struct slot thread_slot;
+static _Thread_local int thread_slot_set;
+
+/* the watchdog */
+static pthread_mutex_t watchdog_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watchdog_cond;
+static pthread_once_t watchdog_once = PTHREAD_ONCE_INIT;
+static pthread_key_t watchdog_key;
+static struct slot *watchdog_slots;
+static int watchdog_sleeping;
+static int watchdog_started;
 
 /* internal signal lists */
 static int sigerr[] = { SIG_FOR_TIMER, SIGSEGV, SIGFPE, SIGILL, SIGBUS, 0 };
@@ -101,70 +128,185 @@ static void safe_dumpstack(int crop, int signum)
 }
 
 /*
- * Creates a timer for the current thread
+ * Get the current time in milliseconds
+ */
+static inline uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(TIMER_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Signals the threads whose deadline expired.
+ * Must be called with the mutex of the watchdog locked.
  *
- * Returns 0 in case of success
+ * Returns the nearest deadline still pending or 0 if none
  */
-static inline int timeout_create()
+static uint64_t expire()
 {
-	int rc;
-	struct sigevent sevp;
+	struct slot *slot;
+	uint64_t now, deadline, next;
+
+	now = now_ms();
+	next = 0;
+	for (slot = watchdog_slots ; slot ; slot = slot->next) {
+		deadline = __atomic_load_n(&slot->deadline, __ATOMIC_SEQ_CST);
+		if (deadline <= EXPIRED)
+			continue;
+		if (deadline > now) {
+			if (!next || deadline < next)
+				next = deadline;
+		} else if (__atomic_compare_exchange_n(&slot->deadline, &deadline, EXPIRED,
+					0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			/* the thread still runs the job, abort it */
+			pthread_kill(slot->tid, SIG_FOR_TIMER);
+		}
+	}
+	return next;
+}
 
-	if (thread_timer_set)
-		rc = 0;
-	else {
-		sevp.sigev_notify = SIGEV_THREAD_ID;
-		sevp.sigev_signo = SIG_FOR_TIMER;
-		sevp.sigev_value.sival_ptr = NULL;
-#if defined(sigev_notify_thread_id)
-		sevp.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
-#else
-		sevp._sigev_un._tid = (pid_t)syscall(SYS_gettid);
-#endif
-		rc = timer_create(CLOCK_THREAD_CPUTIME_ID, &sevp, &thread_timerid);
-		thread_timer_set = !rc;
+/*
+ * Main of the watchdog thread: checks deadlines every TICK_MS
+ * while some are pending and sleeps until awaken otherwise.
+ */
+static void *watchdog(void *arg)
+{
+	uint64_t next, tick;
+	struct timespec ts;
+
+	pthread_mutex_lock(&watchdog_mutex);
+	for (;;) {
+		__atomic_store_n(&watchdog_sleeping, 1, __ATOMIC_SEQ_CST);
+		next = expire();
+		if (!next)
+			pthread_cond_wait(&watchdog_cond, &watchdog_mutex);
+		else {
+			__atomic_store_n(&watchdog_sleeping, 0, __ATOMIC_SEQ_CST);
+			tick = now_ms() + TICK_MS;
+			if (next > tick)
+				next = tick;
+			ts.tv_sec = (time_t)(next / 1000);
+			ts.tv_nsec = (long)(next % 1000) * 1000000;
+			pthread_cond_timedwait(&watchdog_cond, &watchdog_mutex, &ts);
+		}
 	}
-	return 0;
+	return NULL;
 }
 
 /*
- * Arms the alarm in timeout seconds for the current thread
+ * Removes the slot of the current thread from the list of the watchdog
  */
-static inline int timeout_arm(int timeout)
+static inline void timeout_delete()
 {
-	int rc;
-	struct itimerspec its;
-
-	rc = timeout_create();
-	if (rc == 0) {
-		its.it_interval.tv_sec = 0;
-		its.it_interval.tv_nsec = 0;
-		its.it_value.tv_sec = timeout;
-		its.it_value.tv_nsec = 0;
-		rc = timer_settime(thread_timerid, 0, &its, NULL);
+	struct slot **prv;
+
+	if (thread_slot_set) {
+		pthread_mutex_lock(&watchdog_mutex);
+		prv = &watchdog_slots;
+		while (*prv != &thread_slot)
+			prv = &(*prv)->next;
+		*prv = thread_slot.next;
+		pthread_mutex_unlock(&watchdog_mutex);
+		pthread_setspecific(watchdog_key, NULL);
+		thread_slot_set = 0;
 	}
+}
 
-	return rc;
+static void slot_exit(void *arg)
+{
+	timeout_delete();
 }
 
 /*
- * Disarms the current alarm
+ * Creates the watchdog thread and its resources
  */
-static inline void timeout_disarm()
+static void watchdog_start()
 {
-	if (thread_timer_set)
-		timeout_arm(0);
+	int rc;
+	pthread_t tid;
+	pthread_condattr_t attr;
+	sigset_t all, saved;
+
+	pthread_key_create(&watchdog_key, slot_exit);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&watchdog_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/* the watchdog doesn't handle signals: it inherits a full mask */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	rc = pthread_create(&tid, NULL, watchdog, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (rc != 0)
+		ERROR("can't start the watchdog of timeouts: %s", strerror(rc));
+	else {
+		pthread_detach(tid);
+		watchdog_started = 1;
+	}
 }
 
 /*
- * Destroy any alarm resource for the current thread
+ * Records the slot of the current thread in the list of the watchdog
+ *
+ * Returns 0 in case of success
  */
-static inline void timeout_delete()
+static inline int timeout_create()
+{
+	if (!thread_slot_set) {
+		pthread_once(&watchdog_once, watchdog_start);
+		if (!watchdog_started)
+			return -1;
+		thread_slot.tid = pthread_self();
+		thread_slot.deadline = 0;
+		pthread_mutex_lock(&watchdog_mutex);
+		thread_slot.next = watchdog_slots;
+		watchdog_slots = &thread_slot;
+		pthread_mutex_unlock(&watchdog_mutex);
+		pthread_setspecific(watchdog_key, &thread_slot);
+		thread_slot_set = 1;
+	}
+	return 0;
+}
+
+/*
+ * Sets the deadline of the current thread to 'deadline' (0 for none)
+ * and returns the previous one.
+ */
+static inline uint64_t timeout_set(uint64_t deadline)
 {
-	if (thread_timer_set) {
-		timer_delete(thread_timerid);
-		thread_timer_set = 0;
+	uint64_t previous;
+
+	previous = __atomic_exchange_n(&thread_slot.deadline, deadline, __ATOMIC_SEQ_CST);
+	if (deadline && __atomic_load_n(&watchdog_sleeping, __ATOMIC_SEQ_CST)) {
+		/* awake the watchdog waiting for deadlines */
+		pthread_mutex_lock(&watchdog_mutex);
+		pthread_cond_signal(&watchdog_cond);
+		pthread_mutex_unlock(&watchdog_mutex);
 	}
+	return previous;
+}
+
+/*
+ * Arms the alarm in timeout seconds for the current thread
+ * and returns the previous deadline.
+ */
+static inline uint64_t timeout_arm(int timeout)
+{
+	if (timeout_create() < 0)
+		return 0;
+	return timeout_set(now_ms() + (uint64_t)timeout * 1000);
+}
+
+/*
+ * Is the deadline of the current thread expired?
+ */
+static inline int timeout_expired()
+{
+	return thread_slot_set
+		&& __atomic_load_n(&thread_slot.deadline, __ATOMIC_SEQ_CST) == EXPIRED;
 }
 
 /* install the handlers */
@@ -220,6 +362,10 @@ static void on_signal_terminate (int signum)
 /* Handles monitored signals that can be continued */
 static void on_signal_error(int signum)
 {
+	/* ignore signals of the watchdog coming after the end of the job */
+	if (signum == SIG_FOR_TIMER && !timeout_expired())
+		return;
+
 	if (in_safe_dumpstack)
 		longjmp(*error_handler, signum);
 
@@ -271,25 +417,27 @@ void sig_monitor_clean_timeouts()
 static void monitor(int timeout, void (*function)(int sig, void*), void *arg)
 {
 	volatile int signum, signum2;
+	volatile uint64_t older_deadline;
 	sigjmp_buf jmpbuf, *older;
 
 	older = error_handler;
+	older_deadline = 0;
 	signum = setjmp(jmpbuf);
 	if (signum == 0) {
 		error_handler = &jmpbuf;
-		if (timeout) {
-			timeout_create();
-			timeout_arm(timeout);
-		}
+		if (timeout)
+			older_deadline = timeout_arm(timeout);
 		function(0, arg);
 	} else {
 		signum2 = setjmp(jmpbuf);
 		if (signum2 == 0)
 			function(signum, arg);
 	}
-	if (timeout)
-		timeout_disarm();
+	if (timeout && thread_slot_set)
+		timeout_set(0);
 	error_handler = older;
+	if (older_deadline)
+		timeout_set(older_deadline);
 }
 
 void sig_monitor(int timeout, void (*function)(int sig, void*), void *arg)
@@ -299,3 +447,43 @@ void sig_monitor(int timeout, void (*function)(int sig, void*), void *arg)
 	else
 		function(0, arg);
 }
+
+/*
+ * Exchanges the monitoring state of the current thread with 'state'.
+ * This is used when the thread switches between flows of execution
+ * (fibers) or waits for the end of an other flow: the error handler
+ * and the remaining time of the pending timeout are saved in 'state'
+ * while the ones of 'state' are installed. The time elapsing while
+ * a flow is not installed is not accounted to its timeout.
+ * A zeroed state is the state of a flow not monitored.
+ */
+void sig_monitor_exchange(struct sig_monitor_state *state)
+{
+	sigjmp_buf *handler;
+	uint64_t deadline, now, remaining;
+
+	/* suspend the deadline of the current flow */
+	now = 0;
+	remaining = 0;
+	deadline = thread_slot_set ? timeout_set(0) : 0;
+	if (deadline) {
+		now = now_ms();
+		remaining = deadline > now ? deadline - now : 1;
+	}
+
+	handler = error_handler;
+	error_handler = state->handler;
+	state->handler = handler;
+
+	/* resume the deadline of the installed flow */
+	if (state->remaining_sec || state->remaining_nsec) {
+		if (!now)
+			now = now_ms();
+		deadline = now + (uint64_t)state->remaining_sec * 1000
+				+ (uint64_t)state->remaining_nsec / 1000000;
+		if (timeout_create() == 0)
+			timeout_set(deadline > now ? deadline : now + 1);
+	}
+	state->remaining_sec = (long)(remaining / 1000);
+	state->remaining_nsec = (long)(remaining % 1000) * 1000000;
+}
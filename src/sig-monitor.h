@@ -25,3 +25,13 @@ extern int sig_monitor_enable();
 
 extern void sig_monitor(int timeout, void (*function)(int sig, void*), void *arg);
 
+/* monitoring state of a flow of execution that can move between threads */
+struct sig_monitor_state
+{
+	void *handler;
+	long remaining_sec;
+	long remaining_nsec;
+};
+
+extern void sig_monitor_exchange(struct sig_monitor_state *state);
+
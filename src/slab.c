@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "slab.h"
+
+#define SLAB_SHIFT_MIN	5			/* smallest class: 32 bytes */
+#define SLAB_CLASSES	7			/* 32 .. 2048 bytes */
+#define SLAB_BYTES	32768			/* memory carved at once */
+#define BATCH		32			/* blocks moved between caches and depot */
+#define CACHE_MAX	(2 * BATCH)		/* blocks kept by a thread per class */
+
+/*
+ * A free block. The first block of a batch of the depot links
+ * the next batch and counts the blocks of its batch.
+ */
+struct block
+{
+	struct block *next;	/**< next block of the cache or of the batch */
+	struct block *batch;	/**< next batch in the depot */
+	unsigned count;		/**< count of blocks in the batch */
+};
+
+/* the blocks of a class cached by a thread */
+struct cache
+{
+	struct block *head;
+	unsigned count;
+};
+
+/* the depot of batches of free blocks per class */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct block *depot[SLAB_CLASSES];
+
+/* caches of the thread */
+static _Thread_local struct cache caches[SLAB_CLASSES];
+static _Thread_local int registered;
+
+/* key for flushing caches at thread exit */
+static pthread_key_t key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/* index of the class for 'size' that must not be greater than SLAB_SIZE_MAX */
+static inline unsigned class_of(size_t size)
+{
+	if (size <= ((size_t)1 << SLAB_SHIFT_MIN))
+		return 0;
+	return (unsigned)(32 - __builtin_clz((unsigned)(size - 1)) - SLAB_SHIFT_MIN);
+}
+
+/* size of the blocks of the class 'cls' */
+static inline size_t size_of(unsigned cls)
+{
+	return (size_t)1 << (cls + SLAB_SHIFT_MIN);
+}
+
+/* gives to the depot the 'count' blocks of 'head' for the class 'cls' */
+static void depot_put(unsigned cls, struct block *head, unsigned count)
+{
+	head->count = count;
+	pthread_mutex_lock(&mutex);
+	head->batch = depot[cls];
+	depot[cls] = head;
+	pthread_mutex_unlock(&mutex);
+}
+
+/* flushes the caches of the exiting thread to the depot */
+static void flush(void *arg)
+{
+	unsigned cls;
+
+	for (cls = 0 ; cls < SLAB_CLASSES ; cls++) {
+		if (caches[cls].head) {
+			depot_put(cls, caches[cls].head, caches[cls].count);
+			caches[cls].head = NULL;
+			caches[cls].count = 0;
+		}
+	}
+}
+
+static void make_key()
+{
+	pthread_key_create(&key, flush);
+}
+
+/* get the cache of the class 'cls' for the current thread */
+static inline struct cache *cache_of(unsigned cls)
+{
+	if (!registered) {
+		/* registers the flush of the caches at thread exit */
+		pthread_once(&once, make_key);
+		pthread_setspecific(key, caches);
+		registered = 1;
+	}
+	return &caches[cls];
+}
+
+/*
+ * Fills the empty 'cache' of class 'cls' from the depot
+ * or from new memory.
+ * Returns 0 on success or -1 when out of memory.
+ */
+static int refill(struct cache *cache, unsigned cls)
+{
+	struct block *head, *block;
+	char *mem;
+	size_t size;
+	unsigned i, n;
+
+	/* take a batch from the depot */
+	pthread_mutex_lock(&mutex);
+	head = depot[cls];
+	if (head)
+		depot[cls] = head->batch;
+	pthread_mutex_unlock(&mutex);
+	if (head) {
+		cache->head = head;
+		cache->count = head->count;
+		return 0;
+	}
+
+	/* carve new memory */
+	mem = malloc(SLAB_BYTES);
+	if (mem == NULL)
+		return -1;
+	size = size_of(cls);
+	n = (unsigned)(SLAB_BYTES / size);
+	head = NULL;
+	for (i = n ; i ; ) {
+		block = (struct block*)&mem[--i * size];
+		block->next = head;
+		head = block;
+	}
+	cache->head = head;
+	cache->count = n;
+	return 0;
+}
+
+/**
+ * Allocates a block of 'size' bytes
+ * @param size the size to allocate
+ * @return the allocated block or NULL when out of memory
+ */
+void *slab_alloc(size_t size)
+{
+	struct cache *cache;
+	struct block *block;
+	unsigned cls;
+
+	if (size > SLAB_SIZE_MAX)
+		return malloc(size);
+
+	cls = class_of(size);
+	cache = cache_of(cls);
+	if (cache->head == NULL && refill(cache, cls) < 0)
+		return NULL;
+
+	block = cache->head;
+	cache->head = block->next;
+	cache->count--;
+	return block;
+}
+
+/**
+ * Allocates a block of 'size' bytes filled with zeroes
+ * @param size the size to allocate
+ * @return the allocated block or NULL when out of memory
+ */
+void *slab_calloc(size_t size)
+{
+	void *result = slab_alloc(size);
+	if (result)
+		memset(result, 0, size);
+	return result;
+}
+
+/**
+ * Releases the block 'ptr' of 'size' bytes
+ * @param ptr the block to release (can be NULL)
+ * @param size the size given at allocation
+ */
+void slab_free(void *ptr, size_t size)
+{
+	struct cache *cache;
+	struct block *block, *head;
+	unsigned cls, i;
+
+	if (ptr == NULL)
+		return;
+	if (size > SLAB_SIZE_MAX) {
+		free(ptr);
+		return;
+	}
+
+	cls = class_of(size);
+	cache = cache_of(cls);
+	block = ptr;
+	block->next = cache->head;
+	cache->head = block;
+	if (++cache->count >= CACHE_MAX) {
+		/* gives a batch to the depot */
+		head = block;
+		for (i = 1 ; i < BATCH ; i++)
+			block = block->next;
+		cache->head = block->next;
+		cache->count -= BATCH;
+		block->next = NULL;
+		depot_put(cls, head, BATCH);
+	}
+}
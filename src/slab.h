@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Pool of small memory blocks for the short lived objects of requests.
+ *
+ * Blocks are served by size classes from caches local to threads,
+ * the caches exchanging batches of blocks with a shared depot. Blocks
+ * can be released by a thread other than the one that allocated them.
+ * The size given when releasing must be the size given when allocating.
+ * Sizes above SLAB_SIZE_MAX are delegated to malloc/free.
+ */
+#define SLAB_SIZE_MAX	2048
+
+extern void *slab_alloc(size_t size);
+extern void *slab_calloc(size_t size);
+extern void slab_free(void *ptr, size_t size);
@@ -0,0 +1,159 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <check.h>
+
+#include <json-c/json.h>
+
+#include "afb-api-so-cache.h"
+
+/*********************************************************************/
+
+static char manifest[40];
+
+/* creates an empty manifest file name */
+static void mkmanifest()
+{
+	int fd;
+
+	strcpy(manifest, "/tmp/test-api-so-cache-XXXXXX");
+	fd = mkstemp(manifest);
+	ck_assert_int_le(0, fd);
+	close(fd);
+	unlink(manifest);
+}
+
+static struct json_object *names(const char *a, const char *b)
+{
+	struct json_object *r = json_object_new_array();
+	json_object_array_add(r, json_object_new_string(a));
+	json_object_array_add(r, json_object_new_string(b));
+	return r;
+}
+
+START_TEST (check_records)
+{
+	struct stat st1, st2;
+	struct json_object *apis;
+
+	mkmanifest();
+	memset(&st1, 0, sizeof st1);
+	st1.st_ino = 12;
+	st1.st_size = 3456;
+	st1.st_mtim.tv_sec = 78;
+	st2 = st1;
+	st2.st_ino = 13;
+
+	/* nothing is recorded before a load */
+	ck_assert_int_eq(0, afb_api_so_cache_is_active());
+	afb_api_so_cache_put("/a/b.so", &st1, "v3", NULL);
+	ck_assert_int_eq(-1, afb_api_so_cache_get("/a/b.so", &st1, &apis));
+
+	/* an absent manifest is empty */
+	ck_assert_int_eq(0, afb_api_so_cache_load(manifest));
+	ck_assert_int_eq(1, afb_api_so_cache_is_active());
+	ck_assert_int_eq(-1, afb_api_so_cache_get("/a/b.so", &st1, &apis));
+	afb_api_so_cache_put("/a/b.so", &st1, "v3", names("hello", "world"));
+	afb_api_so_cache_put("/a/c.so", &st2, "none", NULL);
+	afb_api_so_cache_put("/a/d.so", &st2, "v2", names("x", "y"));
+	ck_assert_int_eq(0, afb_api_so_cache_save());
+
+	/* reload */
+	ck_assert_int_eq(0, afb_api_so_cache_load(manifest));
+	ck_assert_int_eq(1, afb_api_so_cache_get("/a/b.so", &st1, &apis));
+	ck_assert_int_eq(2, (int)json_object_array_length(apis));
+	ck_assert_str_eq("world", json_object_get_string(json_object_array_get_idx(apis, 1)));
+	ck_assert_int_eq(0, afb_api_so_cache_get("/a/c.so", &st2, &apis));
+	ck_assert_ptr_eq(NULL, apis);
+
+	/* the file changed */
+	st2.st_mtim.tv_nsec = 1;
+	ck_assert_int_eq(-1, afb_api_so_cache_get("/a/d.so", &st2, &apis));
+	ck_assert_int_eq(-1, afb_api_so_cache_get("/a/e.so", &st1, &apis));
+
+	/* only the used entries are kept */
+	ck_assert_int_eq(0, afb_api_so_cache_save());
+	ck_assert_int_eq(0, afb_api_so_cache_load(manifest));
+	ck_assert_int_eq(-1, afb_api_so_cache_get("/a/d.so", &st2, &apis));
+	ck_assert_int_eq(1, afb_api_so_cache_get("/a/b.so", &st1, &apis));
+
+	unlink(manifest);
+}
+END_TEST
+
+START_TEST (check_invalid)
+{
+	struct stat st;
+	struct json_object *apis;
+	FILE *f;
+
+	mkmanifest();
+	f = fopen(manifest, "w");
+	ck_assert_ptr_ne(NULL, f);
+	fputs("{\"version\":\"bad\"}", f);
+	fclose(f);
+
+	/* an invalid manifest is replaced */
+	memset(&st, 0, sizeof st);
+	ck_assert_int_eq(0, afb_api_so_cache_load(manifest));
+	ck_assert_int_eq(-1, afb_api_so_cache_get("/a/b.so", &st, &apis));
+	ck_assert_int_eq(0, afb_api_so_cache_save());
+	ck_assert_int_eq(0, afb_api_so_cache_load(manifest));
+	afb_api_so_cache_put("/a/b.so", &st, "none", NULL);
+	ck_assert_int_eq(0, afb_api_so_cache_save());
+	ck_assert_int_eq(0, afb_api_so_cache_load(manifest));
+	ck_assert_int_eq(0, afb_api_so_cache_get("/a/b.so", &st, &apis));
+
+	unlink(manifest);
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("api-so-cache");
+		addtcase("api-so-cache");
+			addtest(check_records);
+			addtest(check_invalid);
+	return !!srun();
+}
@@ -3,6 +3,8 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <check.h>
 #if !defined(ck_assert_ptr_null)
@@ -10,8 +12,11 @@
 # define ck_assert_ptr_nonnull(X)   ck_assert_ptr_ne(X, NULL)
 #endif
 
+#include <json-c/json.h>
+
 #include "afb-api.h"
 #include "afb-apiset.h"
+#include "jobs.h"
 
 const char *names[] = {
 	"Sadie",
@@ -133,6 +138,7 @@ START_TEST (check_creation)
 		sa.itf = &api_itf_null;
 		sa.closure = (void*)names[i];
 		sa.group = names[i];
+		sa.priority = JOBS_PRIORITY_NORMAL;
 		ck_assert_int_eq(0, afb_apiset_add(a, names[i], sa));
 		pa = afb_apiset_lookup(a, names[i], 1);
 		ck_assert_ptr_nonnull(pa);
@@ -265,6 +271,7 @@ static int onlack(void *closure, struct afb_apiset *a, const char *name)
 	sa.itf = &api_itf_null;
 	sa.closure = (void*)name;
 	sa.group = name;
+	sa.priority = JOBS_PRIORITY_NORMAL;
 
 	ck_assert_int_eq(0, afb_apiset_add(a, name, sa));
 	return 1;
@@ -287,6 +294,7 @@ START_TEST (check_onlack)
 		sa.itf = &api_itf_null;
 		sa.closure = (void*)names[i];
 		sa.group = names[i];
+		sa.priority = JOBS_PRIORITY_NORMAL;
 		ck_assert_int_eq(0, afb_apiset_add(a, names[i], sa));
 		pa = afb_apiset_lookup(a, names[i], 1);
 		ck_assert_ptr_nonnull(pa);
@@ -417,6 +425,7 @@ START_TEST (check_settings)
 		sa.itf = &set_api_itf;
 		sa.closure = &set_apis[i];
 		sa.group = NULL;
+		sa.priority = JOBS_PRIORITY_NORMAL;
 		ck_assert_int_eq(0, afb_apiset_add(a, set_apis[i].name, sa));
 	}
 	nn = i;
@@ -527,6 +536,7 @@ START_TEST (check_classes)
 		sa.itf = &clitf;
 		sa.closure = &clapi[i];
 		sa.group = NULL;
+		sa.priority = JOBS_PRIORITY_NORMAL;
 		ck_assert_int_eq(0, afb_apiset_add(a, clapi[i].name, sa));
 	}
 
@@ -549,6 +559,134 @@ END_TEST
 
 /*********************************************************************/
 
+struct clapi parapi[] = {
+	{ "Ada", "", "", "", 0, 0 },
+	{ "Bob", "Base", "", "", 0, 0 },
+	{ "Cid", "Base", "", "", 0, 0 },
+	{ "Dan", "", "", "Ada", 0, 0 },
+	{ "Eve", "", "Base", "", 0, 0 },
+	{ "Fay", "Top", "Base", "Dan", 0, 0 },
+	{ "Gus", "", "Top", "Eve", 0, 0 },
+	{ NULL, NULL, NULL, NULL, 0, 0 }
+};
+
+static pthread_mutex_t paramutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t paracond = PTHREAD_COND_INITIALIZER;
+static int pararunning, paramax, paradone, pararc;
+
+int paracb_start(void *closure)
+{
+	struct clapi *a = closure;
+	int i;
+
+	pthread_mutex_lock(&paramutex);
+	ck_assert_int_eq(0, a->init);
+	for (i = 0 ; parapi[i].name ; i++) {
+		if (a->requires[0] && !strcmp(a->requires, parapi[i].provides))
+			ck_assert_int_ne(0, parapi[i].init);
+		if (a->apireq[0] && !strcmp(a->apireq, parapi[i].name))
+			ck_assert_int_ne(0, parapi[i].init);
+	}
+	if (++pararunning > paramax)
+		paramax = pararunning;
+	pthread_mutex_unlock(&paramutex);
+
+	/* simulates an init waiting for I/O */
+	usleep(20000);
+
+	pthread_mutex_lock(&paramutex);
+	pararunning--;
+	a->init = ++clorder;
+	pthread_mutex_unlock(&paramutex);
+	return 0;
+}
+
+struct afb_api_itf paraitf = {
+	.call = NULL,
+	.service_start = paracb_start,
+	.update_hooks = NULL,
+	.get_logmask = NULL,
+	.set_logmask = NULL,
+	.describe = NULL,
+	.unref = NULL
+};
+
+static void parastart(int signum, void *closure)
+{
+	int rc = afb_apiset_start_all_services_parallel(closure);
+
+	pthread_mutex_lock(&paramutex);
+	pararc = rc;
+	paradone = 1;
+	pthread_cond_signal(&paracond);
+	pthread_mutex_unlock(&paramutex);
+}
+
+static void *pararun(void *closure)
+{
+	jobs_start(4, 0, 20, parastart, closure);
+	return NULL;
+}
+
+START_TEST (check_parallel)
+{
+	int i;
+	pthread_t tid;
+	struct afb_apiset *a;
+	struct afb_api_item sa;
+	struct json_object *report, *item;
+
+	/* create a apiset */
+	a = afb_apiset_create(NULL, 0);
+	ck_assert_ptr_nonnull(a);
+
+	/* add apis and constraints */
+	for (i = 0 ; parapi[i].name != NULL ; i++) {
+		sa.itf = &paraitf;
+		sa.closure = &parapi[i];
+		sa.group = NULL;
+		sa.priority = JOBS_PRIORITY_NORMAL;
+		ck_assert_int_eq(0, afb_apiset_add(a, parapi[i].name, sa));
+	}
+	for (i = 0 ; parapi[i].name != NULL ; i++) {
+		if (parapi[i].provides[0])
+			ck_assert_int_eq(0, afb_apiset_provide_class(a, parapi[i].name, parapi[i].provides));
+		if (parapi[i].requires[0])
+			ck_assert_int_eq(0, afb_apiset_require_class(a, parapi[i].name, parapi[i].requires));
+		if (parapi[i].apireq[0])
+			ck_assert_int_eq(0, afb_apiset_require(a, parapi[i].name, parapi[i].apireq));
+	}
+
+	/* start all in jobs */
+	clorder = 0;
+	ck_assert_int_eq(0, pthread_create(&tid, NULL, pararun, a));
+	pthread_detach(tid);
+	pthread_mutex_lock(&paramutex);
+	while (!paradone)
+		pthread_cond_wait(&paracond, &paramutex);
+	pthread_mutex_unlock(&paramutex);
+
+	/* all are started, some concurrently */
+	ck_assert_int_eq(0, pararc);
+	for (i = 0 ; parapi[i].name != NULL ; i++)
+		ck_assert_int_ne(0, parapi[i].init);
+	ck_assert_int_lt(1, paramax);
+
+	/* the report gives the duration of inits */
+	report = afb_apiset_get_start_report(a, 1);
+	for (i = 0 ; parapi[i].name != NULL ; i++) {
+		ck_assert(json_object_object_get_ex(report, parapi[i].name, &item));
+		ck_assert(json_object_object_get_ex(item, "init-us", &item));
+		ck_assert_int_le(20000, json_object_get_int(item));
+	}
+	json_object_put(report);
+
+	afb_apiset_unref(a);
+}
+END_TEST
+
+/*********************************************************************/
+
 START_TEST (check_subset)
 {
 	int rc;
@@ -619,5 +757,6 @@ int main(int ac, char **av)
 			addtest(check_settings);
 			addtest(check_classes);
 			addtest(check_subset);
+			addtest(check_parallel);
 	return !!srun();
 }
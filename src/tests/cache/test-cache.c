@@ -0,0 +1,212 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <json-c/json.h>
+
+#include "afb-cache.h"
+
+/*********************************************************************/
+
+/* puts the reply 'text' for the key */
+static void put(struct afb_cache *cache, const char *verb, const char *session, const char *args, const char *text, uint32_t ttl)
+{
+	struct json_object *obj = json_tokener_parse(args);
+	ck_assert_int_eq(0, afb_cache_put(cache, verb, session, obj, text, strlen(text), "info", ttl, afb_cache_generation(cache)));
+	json_object_put(obj);
+}
+
+/* checks that the cached reply of the key is 'text' or that there is none if 'text' is NULL */
+static void get(struct afb_cache *cache, const char *verb, const char *session, const char *args, const char *text)
+{
+	struct json_object *obj = json_tokener_parse(args);
+	struct afb_cache_entry *entry = afb_cache_get(cache, verb, session, obj);
+	const char *buffer;
+	size_t size;
+
+	json_object_put(obj);
+	if (text == NULL)
+		ck_assert_ptr_eq(NULL, entry);
+	else {
+		ck_assert_ptr_ne(NULL, entry);
+		buffer = afb_cache_entry_buffer(entry, &size);
+		ck_assert_int_eq((int)strlen(text), (int)size);
+		ck_assert(!memcmp(text, buffer, size));
+		ck_assert_str_eq("info", afb_cache_entry_info(entry));
+		afb_cache_entry_unref(entry);
+	}
+}
+
+START_TEST (check_keys)
+{
+	struct afb_cache *cache = afb_cache_create(100);
+	ck_assert_ptr_ne(NULL, cache);
+
+	put(cache, "verb", NULL, "{\"a\":1,\"b\":[true,null]}", "1", 10000);
+	put(cache, "verb", "S1", "{\"a\":1,\"b\":[true,null]}", "2", 10000);
+	put(cache, "other", NULL, "{\"a\":1,\"b\":[true,null]}", "3", 10000);
+	put(cache, "verb", NULL, "null", "4", 10000);
+
+	/* order of fields and case of verbs don't matter */
+	get(cache, "verb", NULL, "{\"b\":[true,null],\"a\":1}", "1");
+	get(cache, "VERB", NULL, "{\"a\":1,\"b\":[true,null]}", "1");
+	get(cache, "verb", "S1", "{\"a\":1,\"b\":[true,null]}", "2");
+	get(cache, "other", NULL, "{\"a\":1,\"b\":[true,null]}", "3");
+	get(cache, "verb", NULL, "null", "4");
+
+	/* other keys miss */
+	get(cache, "verb", "S2", "{\"a\":1,\"b\":[true,null]}", NULL);
+	get(cache, "verb", NULL, "{\"a\":1,\"b\":[null,true]}", NULL);
+	get(cache, "verb", NULL, "{\"a\":1.0,\"b\":[true,null]}", NULL);
+	get(cache, "verb", NULL, "{}", NULL);
+
+	/* replacement */
+	put(cache, "verb", NULL, "null", "5", 10000);
+	get(cache, "verb", NULL, "null", "5");
+
+	/* invalidation */
+	afb_cache_invalidate(cache, "Verb");
+	get(cache, "verb", NULL, "null", NULL);
+	get(cache, "verb", "S1", "{\"a\":1,\"b\":[true,null]}", NULL);
+	get(cache, "other", NULL, "{\"a\":1,\"b\":[true,null]}", "3");
+	afb_cache_invalidate(cache, NULL);
+	get(cache, "other", NULL, "{\"a\":1,\"b\":[true,null]}", NULL);
+
+	afb_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST (check_expire)
+{
+	struct afb_cache *cache = afb_cache_create(100);
+	struct afb_cache_entry *entry;
+
+	put(cache, "short", NULL, "null", "1", 50);
+	put(cache, "long", NULL, "null", "2", 10000);
+	get(cache, "short", NULL, "null", "1");
+
+	/* entries held stay valid after expiration and destruction */
+	entry = afb_cache_get(cache, "short", NULL, NULL);
+	ck_assert_ptr_ne(NULL, entry);
+	usleep(100000);
+	get(cache, "short", NULL, "null", NULL);
+	get(cache, "long", NULL, "null", "2");
+	afb_cache_destroy(cache);
+	ck_assert_str_eq("info", afb_cache_entry_info(entry));
+	afb_cache_entry_unref(entry);
+}
+END_TEST
+
+START_TEST (check_capacity)
+{
+	struct afb_cache *cache = afb_cache_create(10);
+	char args[20], text[20];
+	int i;
+
+	for (i = 0 ; i < 15 ; i++) {
+		snprintf(args, sizeof args, "%d", i);
+		snprintf(text, sizeof text, "\"%d\"", i);
+		put(cache, "verb", NULL, args, text, 10000);
+	}
+
+	/* the oldest replies are dropped */
+	for (i = 0 ; i < 15 ; i++) {
+		snprintf(args, sizeof args, "%d", i);
+		snprintf(text, sizeof text, "\"%d\"", i);
+		get(cache, "verb", NULL, args, i < 5 ? NULL : text);
+	}
+	afb_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST (check_generation)
+{
+	struct afb_cache *cache = afb_cache_create(10);
+	uint32_t generation;
+
+	/* a reply missed before an invalidation is not recorded */
+	generation = afb_cache_generation(cache);
+	afb_cache_invalidate(cache, "other");
+	ck_assert_int_eq(0, afb_cache_put(cache, "verb", NULL, NULL, "1", 1, "info", 10000, generation));
+	get(cache, "verb", NULL, "null", NULL);
+
+	/* a reply missed after is recorded */
+	generation = afb_cache_generation(cache);
+	ck_assert_int_eq(0, afb_cache_put(cache, "verb", NULL, NULL, "2", 1, "info", 10000, generation));
+	get(cache, "verb", NULL, "null", "2");
+	afb_cache_destroy(cache);
+}
+END_TEST
+
+START_TEST (check_references)
+{
+	struct afb_cache *cache = afb_cache_create(10);
+	uint32_t generation;
+
+	/* a request missing the reply keeps the cache after its destruction */
+	put(cache, "verb", NULL, "null", "1", 10000);
+	generation = afb_cache_generation(cache);
+	ck_assert_ptr_eq(cache, afb_cache_addref(cache));
+	afb_cache_destroy(cache);
+
+	/* its replies were dropped and the late reply is not recorded */
+	get(cache, "verb", NULL, "null", NULL);
+	ck_assert_int_eq(0, afb_cache_put(cache, "verb", NULL, NULL, "2", 1, "info", 10000, generation));
+	get(cache, "verb", NULL, "null", NULL);
+	afb_cache_unref(cache);
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("cache");
+		addtcase("cache");
+			addtest(check_keys);
+			addtest(check_expire);
+			addtest(check_capacity);
+			addtest(check_generation);
+			addtest(check_references);
+	return !!srun();
+}
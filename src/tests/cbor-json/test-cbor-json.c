@@ -0,0 +1,234 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+
+#include <json-c/json.h>
+
+#include "cbor-json.h"
+#include "wrap-json.h"
+
+/*********************************************************************/
+
+/* typical payloads: arguments, replies and events */
+static const char *payloads[] = {
+	"null",
+	"true",
+	"false",
+	"0",
+	"23",
+	"24",
+	"-1",
+	"-25",
+	"65535",
+	"4294967296",
+	"9223372036854775807",
+	"-9223372036854775808",
+	"3.25",
+	"-1.5e300",
+	"\"\"",
+	"\"hello world\"",
+	"\"caf\\u00e9 \\u00e0 la cr\\u00e8me\"",
+	"[]",
+	"{}",
+	"[1,[2,[3,[4,{\"a\":null}]]]]",
+	"{\"value\":12}",
+	"{\"uid\":\"4f2b56b2-7d58-4cbd-9e60-a1e1d2c8b3aa\",\"verbose\":true}",
+	"{\"name\":\"vehicle-speed\",\"value\":123.5,\"unit\":\"km/h\",\"timestamp\":1539878400123}",
+	"{\"jtype\":\"afb-reply\",\"request\":{\"status\":\"success\",\"info\":\"done\",\"uuid\":\"1234\"},"
+		"\"response\":{\"apis\":[\"hello\",\"monitor\",\"low-can\",\"signal-composer\"],"
+		"\"list\":[{\"id\":1,\"on\":true},{\"id\":2,\"on\":false},{\"id\":3,\"on\":true}]}}",
+	NULL
+};
+
+/* encode and decode the object and check it is the same */
+static void roundtrip(struct cbor_json_buffer *buffer, struct json_object *object)
+{
+	struct json_object *result;
+
+	ck_assert_int_eq(0, cbor_json_encode(buffer, object));
+	ck_assert_int_eq(0, cbor_json_decode(buffer->base, buffer->length, &result));
+	ck_assert(wrap_json_equal(object, result));
+	json_object_put(result);
+}
+
+/*********************************************************************/
+/* check that decoding of encoding is identity */
+START_TEST (check_roundtrip)
+{
+	int i;
+	struct json_object *object;
+	struct cbor_json_buffer buffer = { NULL, 0, 0 };
+
+	for (i = 0 ; payloads[i] ; i++) {
+		object = json_tokener_parse(payloads[i]);
+		roundtrip(&buffer, object);
+		json_object_put(object);
+	}
+	cbor_json_buffer_release(&buffer);
+}
+END_TEST
+
+/*********************************************************************/
+/* check some encodings against RFC 7049 */
+START_TEST (check_encoding)
+{
+	struct json_object *object;
+	struct cbor_json_buffer buffer = { NULL, 0, 0 };
+
+	object = json_tokener_parse("[1,-1000,\"a\",{\"b\":null},true]");
+	ck_assert_int_eq(0, cbor_json_encode(&buffer, object));
+	ck_assert_int_eq(12, (int)buffer.length);
+	ck_assert(!memcmp(buffer.base, "\x85\x01\x39\x03\xe7\x61\x61\xa1\x61\x62\xf6\xf5", 12));
+	json_object_put(object);
+	cbor_json_buffer_release(&buffer);
+}
+END_TEST
+
+/*********************************************************************/
+/* check that bad data are rejected */
+START_TEST (check_bad_data)
+{
+	size_t length;
+	struct json_object *object;
+	struct cbor_json_buffer buffer = { NULL, 0, 0 };
+
+	/* truncations */
+	object = json_tokener_parse(payloads[sizeof payloads / sizeof *payloads - 2]);
+	ck_assert_int_eq(0, cbor_json_encode(&buffer, object));
+	json_object_put(object);
+	for (length = 0 ; length < buffer.length ; length++) {
+		ck_assert_int_eq(-1, cbor_json_decode(buffer.base, length, &object));
+		ck_assert_int_eq(EBADMSG, errno);
+	}
+	cbor_json_buffer_release(&buffer);
+
+	/* trailing data */
+	ck_assert_int_eq(-1, cbor_json_decode("\x01\x02", 2, &object));
+
+	/* indefinite length */
+	ck_assert_int_eq(-1, cbor_json_decode("\x9f\x01\xff", 3, &object));
+
+	/* key that is not a string */
+	ck_assert_int_eq(-1, cbor_json_decode("\xa1\x01\x02", 3, &object));
+
+	/* too deep */
+	ck_assert_int_eq(-1, cbor_json_decode(
+		"\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81"
+		"\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81"
+		"\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81"
+		"\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81"
+		"\x81\xf6", 66, &object));
+
+	/* tags are skipped */
+	ck_assert_int_eq(0, cbor_json_decode("\xc0\xc1\x01", 3, &object));
+	ck_assert_int_eq(1, json_object_get_int(object));
+	json_object_put(object);
+
+	/* long chain of tags */
+	buffer.base = malloc(100001);
+	ck_assert_ptr_ne(NULL, buffer.base);
+	memset(buffer.base, 0xc0, 100000);
+	buffer.base[100000] = 1;
+	ck_assert_int_eq(-1, cbor_json_decode(buffer.base, 100001, &object));
+	free(buffer.base);
+}
+END_TEST
+
+/*********************************************************************/
+/* compare the round trip costs of JSON text and CBOR */
+
+#define BENCH_COUNT 20000
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+START_TEST (check_benchmark)
+{
+	int i, n;
+	double t0, t1, t2;
+	size_t ltxt;
+	const char *text;
+	struct json_object *object, *result;
+	struct cbor_json_buffer buffer = { NULL, 0, 0 };
+
+	printf("%-12s %8s %8s %12s %12s\n", "payload", "json", "cbor", "json ns/rt", "cbor ns/rt");
+	for (i = 0 ; payloads[i] ; i++) {
+		object = json_tokener_parse(payloads[i]);
+
+		t0 = now();
+		for (n = 0 ; n < BENCH_COUNT ; n++) {
+			text = json_object_to_json_string_ext(object, JSON_C_TO_STRING_PLAIN);
+			ltxt = strlen(text);
+			result = json_tokener_parse(text);
+			json_object_put(result);
+		}
+		t1 = now();
+		for (n = 0 ; n < BENCH_COUNT ; n++) {
+			cbor_json_encode(&buffer, object);
+			cbor_json_decode(buffer.base, buffer.length, &result);
+			json_object_put(result);
+		}
+		t2 = now();
+
+		printf("#%-11d %8u %8u %12.0f %12.0f\n", i, (unsigned)ltxt, (unsigned)buffer.length,
+				(t1 - t0) * 1e9 / BENCH_COUNT, (t2 - t1) * 1e9 / BENCH_COUNT);
+		json_object_put(object);
+	}
+	cbor_json_buffer_release(&buffer);
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("cbor-json");
+		addtcase("cbor-json");
+			addtest(check_roundtrip);
+			addtest(check_encoding);
+			addtest(check_bad_data);
+			addtest(check_benchmark);
+	return !!srun();
+}
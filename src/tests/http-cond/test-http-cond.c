@@ -0,0 +1,155 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <check.h>
+
+#include "http-cond.h"
+
+/*********************************************************************/
+
+/* checks that 'range' for a file of 'size' gives 'result' and the range 'first'-'last' */
+static void range(const char *range, off_t size, int result, off_t first, off_t last)
+{
+	off_t f = -1, l = -1;
+
+	ck_assert_int_eq(result, http_cond_parse_range(range, size, &f, &l));
+	if (result > 0) {
+		ck_assert_int_eq((long long)first, (long long)f);
+		ck_assert_int_eq((long long)last, (long long)l);
+	}
+}
+
+START_TEST (check_range)
+{
+	/* single ranges */
+	range("bytes=0-", 10, 1, 0, 9);
+	range("bytes=0-0", 10, 1, 0, 0);
+	range("bytes=2-5", 10, 1, 2, 5);
+	range("bytes=2-50", 10, 1, 2, 9);
+	range("BYTES= 3-4 ", 10, 1, 3, 4);
+	range("bytes=-3", 10, 1, 7, 9);
+	range("bytes=-30", 10, 1, 0, 9);
+
+	/* unsatisfiable */
+	range("bytes=-0", 10, -1, 0, 0);
+	range("bytes=10-", 10, -1, 0, 0);
+	range("bytes=10-20", 10, -1, 0, 0);
+
+	/* ignored */
+	range("bytes=5-2", 10, 0, 0, 0);
+	range("bytes=0-1,3-4", 10, 0, 0, 0);
+	range("bytes=-0,-1", 10, 0, 0, 0);
+	range("bytes=", 10, 0, 0, 0);
+	range("bytes=-", 10, 0, 0, 0);
+	range("bytes=a-", 10, 0, 0, 0);
+	range("lines=0-1", 10, 0, 0, 0);
+	range("bytes=99999999999999999999-", 10, 0, 0, 0);
+	range("bytes=0-99999999999999999999", 10, 0, 0, 0);
+	range("bytes=-99999999999999999999", 10, 0, 0, 0);
+
+	/* zero-size file */
+	range("bytes=0-", 0, -1, 0, 0);
+	range("bytes=0-0", 0, -1, 0, 0);
+	range("bytes=-1", 0, -1, 0, 0);
+	range("bytes=-0", 0, -1, 0, 0);
+}
+END_TEST
+
+START_TEST (check_if_range)
+{
+	char lastmod[40];
+	off_t f, l;
+
+	http_cond_date(lastmod, sizeof lastmod, 1500000000);
+	ck_assert_str_eq("Fri, 14 Jul 2017 02:40:00 GMT", lastmod);
+
+	/* no range */
+	ck_assert_int_eq(0, http_cond_range(NULL, NULL, "ETAG", lastmod, 10, &f, &l));
+	ck_assert_int_eq(0, http_cond_range(NULL, "ETAG", "ETAG", lastmod, 10, &f, &l));
+
+	/* no condition */
+	f = l = -1;
+	ck_assert_int_eq(1, http_cond_range("bytes=1-2", NULL, "ETAG", lastmod, 10, &f, &l));
+	ck_assert_int_eq(1, (int)f);
+	ck_assert_int_eq(2, (int)l);
+
+	/* matching etag or date */
+	f = l = -1;
+	ck_assert_int_eq(1, http_cond_range("bytes=3-4", "ETAG", "ETAG", lastmod, 10, &f, &l));
+	ck_assert_int_eq(3, (int)f);
+	ck_assert_int_eq(4, (int)l);
+	f = l = -1;
+	ck_assert_int_eq(1, http_cond_range("bytes=5-", "Fri, 14 Jul 2017 02:40:00 GMT", "ETAG", lastmod, 10, &f, &l));
+	ck_assert_int_eq(5, (int)f);
+	ck_assert_int_eq(9, (int)l);
+	ck_assert_int_eq(-1, http_cond_range("bytes=-0", lastmod, "ETAG", lastmod, 10, &f, &l));
+
+	/* the file changed: the range is ignored */
+	ck_assert_int_eq(0, http_cond_range("bytes=1-2", "OTHER", "ETAG", lastmod, 10, &f, &l));
+	ck_assert_int_eq(0, http_cond_range("bytes=1-2", "Fri, 14 Jul 2017 02:40:01 GMT", "ETAG", lastmod, 10, &f, &l));
+	ck_assert_int_eq(0, http_cond_range("bytes=-0", "OTHER", "ETAG", lastmod, 10, &f, &l));
+}
+END_TEST
+
+START_TEST (check_not_modified_since)
+{
+	ck_assert_int_eq(1, http_cond_not_modified_since("Fri, 14 Jul 2017 02:40:00 GMT", 1500000000));
+	ck_assert_int_eq(1, http_cond_not_modified_since("Fri, 14 Jul 2017 02:40:01 GMT", 1500000000));
+	ck_assert_int_eq(0, http_cond_not_modified_since("Fri, 14 Jul 2017 02:39:59 GMT", 1500000000));
+
+	/* invalid dates */
+	ck_assert_int_eq(0, http_cond_not_modified_since("", 1500000000));
+	ck_assert_int_eq(0, http_cond_not_modified_since("Fri, 14 Jul 2017", 1500000000));
+	ck_assert_int_eq(0, http_cond_not_modified_since("Fri, 14 Jul 2017 02:40:00 GMT+1", 1500000000));
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("http-cond");
+		addtcase("http-cond");
+			addtest(check_range);
+			addtest(check_if_range);
+			addtest(check_not_modified_since);
+	return !!srun();
+}
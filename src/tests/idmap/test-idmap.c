@@ -0,0 +1,226 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+
+#include "idmap.h"
+
+#define COUNT		10000
+#define BENCH_PENDING	5000
+#define BENCH_COUNT	1000000
+
+static char values[COUNT];
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void count_cb(void *closure, uint32_t id, void *value)
+{
+	int *count = closure;
+	(*count)++;
+}
+
+/*********************************************************************/
+
+START_TEST (check_add)
+{
+	struct idmap map;
+	uint32_t i, id;
+	int count;
+
+	idmap_init(&map);
+	ck_assert_ptr_eq(NULL, idmap_get(&map, 1));
+	ck_assert_ptr_eq(NULL, idmap_remove(&map, 1));
+
+	/* identifiers are allocated increasingly */
+	for (i = 0 ; i < COUNT ; i++) {
+		ck_assert_int_eq(0, idmap_add(&map, &values[i], &id));
+		ck_assert_int_eq(i + 1, id);
+	}
+	ck_assert_int_eq(COUNT, map.count);
+	for (i = 0 ; i < COUNT ; i++)
+		ck_assert_ptr_eq(&values[i], idmap_get(&map, i + 1));
+	ck_assert_ptr_eq(NULL, idmap_get(&map, 0));
+	ck_assert_ptr_eq(NULL, idmap_get(&map, COUNT + 1));
+
+	count = 0;
+	idmap_for_all(&map, count_cb, &count);
+	ck_assert_int_eq(COUNT, count);
+
+	/* remove the odd ones */
+	for (i = 1 ; i <= COUNT ; i += 2)
+		ck_assert_ptr_eq(&values[i - 1], idmap_remove(&map, i));
+	for (i = 1 ; i <= COUNT ; i++)
+		ck_assert_ptr_eq(i & 1 ? NULL : &values[i - 1], idmap_get(&map, i));
+	ck_assert_int_eq(COUNT / 2, map.count);
+
+	/* not reused */
+	ck_assert_int_eq(0, idmap_add(&map, &values[0], &id));
+	ck_assert_int_eq(COUNT + 1, id);
+
+	ck_assert_int_eq(-1, idmap_add(&map, NULL, &id));
+	ck_assert_int_eq(EINVAL, errno);
+
+	idmap_release(&map);
+	ck_assert_ptr_eq(NULL, idmap_get(&map, 2));
+}
+END_TEST
+
+START_TEST (check_set)
+{
+	struct idmap map, moved;
+	uint32_t i, id;
+	int count;
+
+	idmap_init(&map);
+
+	/* strided identifiers */
+	for (i = 0 ; i < COUNT ; i++)
+		ck_assert_int_eq(0, idmap_set(&map, (i + 1) << 12, &values[i]));
+	ck_assert_int_eq(-1, idmap_set(&map, 1 << 12, &values[0]));
+	ck_assert_int_eq(EEXIST, errno);
+	ck_assert_int_eq(-1, idmap_set(&map, 0, &values[0]));
+	ck_assert_int_eq(EINVAL, errno);
+	for (i = 0 ; i < COUNT ; i++)
+		ck_assert_ptr_eq(&values[i], idmap_get(&map, (i + 1) << 12));
+
+	/* removal in reverse order keeps the others reachable */
+	for (i = COUNT ; i > COUNT / 2 ; i--) {
+		ck_assert_ptr_eq(&values[i - 1], idmap_remove(&map, i << 12));
+		ck_assert_ptr_eq(NULL, idmap_remove(&map, i << 12));
+	}
+	for (i = 1 ; i <= COUNT / 2 ; i++)
+		ck_assert_ptr_eq(&values[i - 1], idmap_get(&map, i << 12));
+
+	/* identifiers wrap skipping 0 and the used ones */
+	map.lastid = UINT32_MAX - 1;
+	ck_assert_int_eq(0, idmap_add(&map, &values[0], &id));
+	ck_assert_int_eq(UINT32_MAX, id);
+	ck_assert_int_eq(0, idmap_set(&map, 1, &values[0]));
+	ck_assert_int_eq(0, idmap_add(&map, &values[1], &id));
+	ck_assert_int_eq(2, id);
+	idmap_remove(&map, UINT32_MAX);
+	idmap_remove(&map, 1);
+	idmap_remove(&map, 2);
+
+	/* moving */
+	idmap_move(&moved, &map);
+	ck_assert_int_eq(0, map.count);
+	ck_assert_ptr_eq(NULL, idmap_get(&map, 1 << 12));
+	count = 0;
+	idmap_for_all(&moved, count_cb, &count);
+	ck_assert_int_eq(COUNT / 2, count);
+	ck_assert_int_eq(COUNT / 2, moved.count);
+	ck_assert_int_eq(0, idmap_add(&map, &values[2], &id));
+	ck_assert_int_eq(3, id);
+
+	idmap_release(&moved);
+	idmap_release(&map);
+}
+END_TEST
+
+/*
+ * compare with a linked list as it was used before
+ * for the pending calls
+ */
+struct item { struct item *next; uint32_t id; };
+
+START_TEST (check_benchmark)
+{
+	struct idmap map;
+	struct item *items, *head, **prv, *it;
+	uint32_t i, id, lastid;
+	double t0, t1, t2;
+
+	items = calloc(BENCH_PENDING, sizeof *items);
+	ck_assert_ptr_ne(NULL, items);
+
+	/* keep BENCH_PENDING calls pending, replying to the oldest */
+	idmap_init(&map);
+	for (i = 0 ; i < BENCH_PENDING ; i++)
+		idmap_add(&map, &items[i], &id);
+	t0 = now();
+	for (i = 0 ; i < BENCH_COUNT ; i++) {
+		it = idmap_remove(&map, i + 1);
+		idmap_add(&map, it, &id);
+	}
+	t1 = now();
+	idmap_release(&map);
+
+	head = NULL;
+	lastid = 0;
+	for (i = 0 ; i < BENCH_PENDING ; i++) {
+		items[i].id = ++lastid;
+		items[i].next = head;
+		head = &items[i];
+	}
+	for (i = 0 ; i < BENCH_COUNT / 100 ; i++) {
+		prv = &head;
+		while ((*prv)->id != i + 1)
+			prv = &(*prv)->next;
+		it = *prv;
+		*prv = it->next;
+		it->id = ++lastid;
+		it->next = head;
+		head = it;
+	}
+	t2 = now();
+	free(items);
+
+	printf("with %d pending calls: idmap %.0f ns/reply, list %.0f ns/reply\n",
+		BENCH_PENDING, (t1 - t0) * 1e9 / BENCH_COUNT, (t2 - t1) * 1e9 / (BENCH_COUNT / 100));
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("idmap");
+		addtcase("idmap");
+			addtest(check_add);
+			addtest(check_set);
+			addtest(check_benchmark);
+	return !!srun();
+}
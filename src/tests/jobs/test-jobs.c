@@ -0,0 +1,263 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+
+#include "jobs.h"
+
+#define THREADS		4
+#define CHAINS		16
+#define DEPTH		32
+#define WAIT_MAX	60
+#define CALLEE_WAIT	200	/* microseconds */
+
+#if defined(WITH_JOBS_FIBERS)
+#define BACKEND	"fibers"
+#else
+#define BACKEND	"threads"
+#endif
+
+/*********************************************************************/
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int done;
+static double started, total, longest;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Each level of a chain calls synchronously the next level,
+ * the call being achieved by an other job, as for subcalls.
+ */
+struct call
+{
+	int depth;
+	struct jobloop *jobloop;
+};
+
+static void level(int depth);
+
+static void callee(int signum, void *closure)
+{
+	struct call *call = closure;
+
+	if (!signum) {
+		/* simulates a short wait, as for I/O */
+		usleep(CALLEE_WAIT);
+		level(call->depth - 1);
+	}
+	jobs_leave(call->jobloop);
+}
+
+static void caller(int signum, void *closure, struct jobloop *jobloop)
+{
+	struct call *call = closure;
+
+	call->jobloop = jobloop;
+	if (signum || jobs_queue(NULL, 0, callee, call) < 0)
+		jobs_leave(jobloop);
+}
+
+static void level(int depth)
+{
+	struct call call;
+
+	if (depth > 0) {
+		call.depth = depth;
+		ck_assert_int_eq(0, jobs_enter(NULL, 0, caller, &call));
+	}
+}
+
+static void chain(int signum, void *closure)
+{
+	double duration;
+
+	level(DEPTH);
+
+	pthread_mutex_lock(&mutex);
+	duration = now() - started;
+	total += duration;
+	if (duration > longest)
+		longest = duration;
+	done++;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+static void start(int signum, void *closure)
+{
+	int i;
+
+	for (i = 0 ; i < CHAINS ; i++)
+		ck_assert_int_eq(0, jobs_queue(NULL, 0, chain, NULL));
+}
+
+static void *run(void *closure)
+{
+	jobs_start(THREADS, 0, CHAINS * (DEPTH + 1) + 1, start, NULL);
+	return NULL;
+}
+
+/*
+ * run concurrently CHAINS chains of DEPTH synchronous calls
+ */
+START_TEST (check_chains)
+{
+	pthread_t tid;
+	struct timespec ts;
+	double t0, t1;
+
+	t0 = started = now();
+	ck_assert_int_eq(0, pthread_create(&tid, NULL, run, NULL));
+	pthread_detach(tid);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += WAIT_MAX;
+	pthread_mutex_lock(&mutex);
+	while (done < CHAINS && pthread_cond_timedwait(&cond, &mutex, &ts) == 0);
+	pthread_mutex_unlock(&mutex);
+	t1 = now();
+
+	printf("%s: %d chains of %d synchronous calls on %d threads: %d done in %.3fs, chain completion mean %.3fs max %.3fs\n",
+		BACKEND, CHAINS, DEPTH, THREADS, done, t1 - t0, done ? total / done : 0.0, longest);
+	ck_assert_int_eq(CHAINS, done);
+}
+END_TEST
+
+/*********************************************************************/
+
+#define PRIO_WAITERS	8
+
+#define PRIO_CRITICALS	(PRIO_WAITERS / 4)
+#define PRIO_JOBS	(PRIO_WAITERS + PRIO_CRITICALS)
+
+static int order[PRIO_JOBS];
+static int ordered;
+
+static void record(int signum, void *closure)
+{
+	pthread_mutex_lock(&mutex);
+	order[ordered++] = (int)(intptr_t)closure;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+static int queue(int priority)
+{
+	return jobs_queue_priority(NULL, 0, priority, record, (void*)(intptr_t)priority);
+}
+
+static void start_prio(int signum, void *closure)
+{
+	int i;
+
+	/* the only thread is busy so jobs wait: the lowest priorities are rejected first */
+	for (i = 0 ; i < PRIO_WAITERS / 2 ; i++)
+		ck_assert_int_eq(0, queue(JOBS_PRIORITY_BULK));
+	ck_assert_int_eq(-1, queue(JOBS_PRIORITY_BULK));
+	for (i = 0 ; i < PRIO_WAITERS / 2 ; i++)
+		ck_assert_int_eq(0, queue(JOBS_PRIORITY_NORMAL));
+	ck_assert_int_eq(-1, queue(JOBS_PRIORITY_NORMAL));
+	for (i = 0 ; i < PRIO_CRITICALS ; i++)
+		ck_assert_int_eq(0, queue(JOBS_PRIORITY_CRITICAL));
+	ck_assert_int_eq(-1, queue(JOBS_PRIORITY_CRITICAL));
+}
+
+static void *run_prio(void *closure)
+{
+	jobs_start(1, 0, PRIO_WAITERS, start_prio, NULL);
+	return NULL;
+}
+
+/*
+ * check the admission of jobs and their order of processing
+ */
+START_TEST (check_priorities)
+{
+	pthread_t tid;
+	struct timespec ts;
+	struct jobs_stats st;
+	int i;
+
+	ck_assert_int_eq(0, pthread_create(&tid, NULL, run_prio, NULL));
+	pthread_detach(tid);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += WAIT_MAX;
+	pthread_mutex_lock(&mutex);
+	while (ordered < PRIO_JOBS && pthread_cond_timedwait(&cond, &mutex, &ts) == 0);
+	pthread_mutex_unlock(&mutex);
+
+	ck_assert_int_eq(PRIO_JOBS, ordered);
+	for (i = 0 ; i < PRIO_CRITICALS ; i++)
+		ck_assert_int_eq(JOBS_PRIORITY_CRITICAL, order[i]);
+	for ( ; i < PRIO_CRITICALS + PRIO_WAITERS / 2 ; i++)
+		ck_assert_int_eq(JOBS_PRIORITY_NORMAL, order[i]);
+	for ( ; i < PRIO_JOBS ; i++)
+		ck_assert_int_eq(JOBS_PRIORITY_BULK, order[i]);
+
+	for (i = 0 ; i < JOBS_PRIORITY_COUNT ; i++) {
+		ck_assert_int_eq(0, jobs_get_stats(i, &st));
+		ck_assert_int_eq(1, st.rejected);
+		ck_assert_int_eq(0, st.waiting);
+	}
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("jobs-" BACKEND);
+		addtcase("jobs");
+			tcase_set_timeout(tcase, WAIT_MAX + 10);
+			addtest(check_chains);
+			addtest(check_priorities);
+	return !!srun();
+}
@@ -0,0 +1,611 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <check.h>
+
+#include <json-c/json.h>
+#include <systemd/sd-event.h>
+
+#include "afb-proto-ws.h"
+#include "afb-api.h"
+#include "afb-apiset.h"
+#include "afb-context.h"
+#include "afb-fdev.h"
+#include "afb-session.h"
+#include "afb-stub-ws.h"
+#include "afb-xreq.h"
+#include "fdev.h"
+#include "fdev-systemd.h"
+#include "jobs.h"
+
+#define CALL_COUNT	20000
+#define THREAD_MAX	8
+#define ARGS	"{\"name\":\"speed\",\"value\":123.5,\"unit\":\"km/h\"}"
+
+/*********************************************************************/
+
+static struct afb_proto_ws *client;
+static int callcount;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* count of write system calls of the process */
+static unsigned long syscw()
+{
+	unsigned long result = 0;
+	char line[100];
+	FILE *f = fopen("/proc/self/io", "r");
+
+	if (f) {
+		while (fgets(line, sizeof line, f))
+			if (sscanf(line, "syscw: %lu", &result) == 1)
+				break;
+		fclose(f);
+	}
+	return result;
+}
+
+/* reads the socket 'fd' and counts the websocket frames until 'expected' */
+static void *reader(void *closure)
+{
+	int fd = (int)(intptr_t)closure;
+	static char buffer[65536];
+	ssize_t sz;
+	size_t pos, end, hlen;
+	uint64_t len;
+	long frames = 0;
+
+	pos = end = 0;
+	while (frames < callcount) {
+		sz = read(fd, &buffer[end], sizeof buffer - end);
+		if (sz <= 0)
+			break;
+		end += (size_t)sz;
+		for (;;) {
+			if (end - pos < 2)
+				break;
+			len = buffer[pos + 1] & 127;
+			hlen = len == 127 ? 10 : len == 126 ? 4 : 2;
+			if (end - pos < hlen)
+				break;
+			if (len == 126)
+				len = ((uint64_t)(uint8_t)buffer[pos + 2] << 8) | (uint8_t)buffer[pos + 3];
+			ck_assert(len != 127);
+			if (end - pos < hlen + len)
+				break;
+			pos += hlen + len;
+			frames++;
+		}
+		memmove(buffer, &buffer[pos], end - pos);
+		end -= pos;
+		pos = 0;
+	}
+	return (void*)(intptr_t)frames;
+}
+
+/* emits calls */
+static void *caller(void *closure)
+{
+	int i, n = (int)(intptr_t)closure;
+	struct json_object *args;
+
+	/* json-c objects are not thread safe: one per thread */
+	args = json_tokener_parse(ARGS);
+	for (i = 0 ; i < n ; i++)
+		ck_assert_int_eq(0, afb_proto_ws_client_call(client, "verb", args, "session", NULL, NULL));
+	json_object_put(args);
+	return NULL;
+}
+
+static void on_reply(void *closure, void *request, struct json_object *result, const char *error, const char *info)
+{
+	json_object_put(result);
+}
+
+static struct afb_proto_ws_client_itf client_itf =
+{
+	.on_reply = on_reply
+};
+
+/*
+ * send CALL_COUNT calls from 'nthreads' threads to a socketpair
+ * and compare the count of frames to the count of writes
+ */
+static void burst(int nthreads)
+{
+	int i, sv[2];
+	pthread_t tids[THREAD_MAX], tidr;
+	unsigned long w0, w1;
+	double t0, t1;
+	void *frames;
+	struct sd_event *eloop;
+
+	ck_assert_int_eq(0, sd_event_new(&eloop));
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+	/* the version offer is the first frame */
+	callcount = 1 + CALL_COUNT;
+	ck_assert_int_eq(0, pthread_create(&tidr, NULL, reader, (void*)(intptr_t)sv[0]));
+	client = afb_proto_ws_create_client(fdev_systemd_create(eloop, sv[1]), &client_itf, NULL);
+	ck_assert_ptr_ne(NULL, client);
+
+	w0 = syscw();
+	t0 = now();
+	for (i = 0 ; i < nthreads ; i++)
+		ck_assert_int_eq(0, pthread_create(&tids[i], NULL, caller, (void*)(intptr_t)(CALL_COUNT / nthreads)));
+	for (i = 0 ; i < nthreads ; i++)
+		pthread_join(tids[i], NULL);
+	pthread_join(tidr, &frames);
+	t1 = now();
+	w1 = syscw();
+
+	ck_assert_int_eq(callcount, (int)(intptr_t)frames);
+	printf("%d thread(s): %d frames in %.3fs (%.0f/s) with %lu writes (%.2f frames/write)\n",
+		nthreads, CALL_COUNT, t1 - t0, CALL_COUNT / (t1 - t0),
+		w1 - w0, w1 > w0 ? (double)CALL_COUNT / (double)(w1 - w0) : 0.0);
+
+	afb_proto_ws_unref(client);
+	close(sv[0]);
+	sd_event_unref(eloop);
+}
+
+START_TEST (check_burst)
+{
+	burst(1);
+	burst(2);
+	burst(THREAD_MAX);
+}
+END_TEST
+
+/*********************************************************************/
+
+#define RT_LATENCY_COUNT	5000
+#define RT_THROUGHPUT_COUNT	50000
+#define RT_WINDOW		64
+#define RT_WINDOW_BYTES		65536
+
+static struct sd_event *rt_eloop;
+static struct afb_proto_ws *rt_client;
+static struct json_object *rt_args;
+static int rt_sent, rt_replied, rt_total;
+
+static void rt_call()
+{
+	rt_sent++;
+	ck_assert_int_eq(0, afb_proto_ws_client_call(rt_client, "verb", rt_args, "session", NULL, NULL));
+}
+
+static void rt_on_reply(void *closure, void *request, struct json_object *result, const char *error, const char *info)
+{
+	json_object_put(result);
+	rt_replied++;
+	if (rt_sent < rt_total)
+		rt_call();
+}
+
+static void rt_on_call(void *closure, struct afb_proto_ws_call *call, const char *verb, struct json_object *args, const char *sessionid, const char *user_creds)
+{
+	afb_proto_ws_call_reply(call, args, NULL, NULL);
+	json_object_put(args);
+	afb_proto_ws_call_unref(call);
+}
+
+static struct afb_proto_ws_client_itf rt_client_itf =
+{
+	.on_reply = rt_on_reply
+};
+
+static struct afb_proto_ws_server_itf rt_server_itf =
+{
+	.on_call = rt_on_call
+};
+
+/* runs 'total' calls with at most 'window' calls pending, returns the duration */
+static double rt_run(int total, int window)
+{
+	double t0;
+
+	rt_sent = rt_replied = 0;
+	rt_total = total;
+	t0 = now();
+	while (rt_sent < window && rt_sent < total)
+		rt_call();
+	while (rt_replied < total)
+		ck_assert_int_le(0, sd_event_run(rt_eloop, 1000000));
+	return now() - t0;
+}
+
+/*
+ * measure the latency and the throughput of calls
+ * between a client and a server of the same process
+ */
+static void roundtrips(int shm, size_t size)
+{
+	int sv[2];
+	int window;
+	unsigned long w0, w1;
+	double lat, thr;
+	char *text;
+	struct afb_proto_ws *server;
+
+	ck_assert_int_eq(0, sd_event_new(&rt_eloop));
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	text = malloc(size + 1);
+	memset(text, 'x', size);
+	text[size] = 0;
+	rt_args = json_object_new_string(text);
+	free(text);
+
+	/* the client of shared memory sends its hello first */
+	rt_client = shm ? afb_proto_ws_create_client_shm(fdev_systemd_create(rt_eloop, sv[1]), &rt_client_itf, NULL)
+			: afb_proto_ws_create_client(fdev_systemd_create(rt_eloop, sv[1]), &rt_client_itf, NULL);
+	ck_assert_ptr_ne(NULL, rt_client);
+	server = shm ? afb_proto_ws_create_server_shm(fdev_systemd_create(rt_eloop, sv[0]), &rt_server_itf, NULL)
+		     : afb_proto_ws_create_server(fdev_systemd_create(rt_eloop, sv[0]), &rt_server_itf, NULL);
+	ck_assert_ptr_ne(NULL, server);
+
+	rt_run(100, 1);
+	lat = rt_run(RT_LATENCY_COUNT, 1);
+	/* the pending calls must fit in the buffers as the loop is shared */
+	window = RT_WINDOW_BYTES / (int)size;
+	if (window > RT_WINDOW)
+		window = RT_WINDOW;
+	w0 = syscw();
+	thr = rt_run(RT_THROUGHPUT_COUNT, window);
+	w1 = syscw();
+	printf("%s, %5d bytes: latency %.1fus, throughput %.0f calls/s (window %d) with %.2f writes/call\n",
+		shm ? "shm " : "unix", (int)size,
+		lat * 1e6 / RT_LATENCY_COUNT, RT_THROUGHPUT_COUNT / thr, window,
+		(double)(w1 - w0) / RT_THROUGHPUT_COUNT);
+
+	afb_proto_ws_unref(rt_client);
+	afb_proto_ws_unref(server);
+	json_object_put(rt_args);
+	sd_event_unref(rt_eloop);
+}
+
+START_TEST (check_roundtrips)
+{
+	roundtrips(0, 64);
+	roundtrips(1, 64);
+	roundtrips(0, 8192);
+	roundtrips(1, 8192);
+}
+END_TEST
+
+/*********************************************************************/
+
+#define CTX_SESSIONS	600
+#define CTX_CALLS	6000
+#define CTX_WINDOW	8
+#define CTX_HANDLES	256
+
+static struct afb_proto_ws *ctx_client;
+static char ctx_defined[CTX_HANDLES + 1][20];
+static int ctx_sent, ctx_replied, ctx_sets, ctx_hits, ctx_fulls;
+
+static void ctx_call()
+{
+	char session[20];
+	struct json_object *obj;
+
+	sprintf(session, "session-%d", (ctx_sent * 7) % CTX_SESSIONS);
+	obj = json_object_new_string(session);
+	ctx_sent++;
+	ck_assert_int_eq(0, afb_proto_ws_client_call(ctx_client, "verb", obj, session, NULL, NULL));
+	json_object_put(obj);
+}
+
+static void ctx_on_reply(void *closure, void *request, struct json_object *result, const char *error, const char *info)
+{
+	ck_assert_ptr_eq(NULL, error);
+	json_object_put(result);
+	ctx_replied++;
+	if (ctx_sent < CTX_CALLS)
+		ctx_call();
+}
+
+static void ctx_on_call(void *closure, struct afb_proto_ws_call *call, const char *verb, struct json_object *args, const char *sessionid, const char *user_creds)
+{
+	ck_assert_str_eq(sessionid, json_object_get_string(args));
+	ctx_fulls++;
+	afb_proto_ws_call_reply(call, args, NULL, NULL);
+	json_object_put(args);
+	afb_proto_ws_call_unref(call);
+}
+
+static void ctx_on_context_set(void *closure, uint32_t handle, const char *sessionid, const char *user_creds)
+{
+	ck_assert(handle >= 1 && handle <= CTX_HANDLES);
+	strcpy(ctx_defined[handle], sessionid);
+	ctx_sets++;
+}
+
+static void ctx_on_context_call(void *closure, struct afb_proto_ws_call *call, const char *api, const char *verb, struct json_object *args, uint32_t handle)
+{
+	ck_assert(handle >= 1 && handle <= CTX_HANDLES);
+	ck_assert_str_eq(ctx_defined[handle], json_object_get_string(args));
+	ctx_hits++;
+	afb_proto_ws_call_reply(call, args, NULL, NULL);
+	json_object_put(args);
+	afb_proto_ws_call_unref(call);
+}
+
+static struct afb_proto_ws_client_itf ctx_client_itf =
+{
+	.on_reply = ctx_on_reply
+};
+
+static struct afb_proto_ws_server_itf ctx_server_itf =
+{
+	.on_call = ctx_on_call,
+	.on_context_set = ctx_on_context_set,
+	.on_context_call = ctx_on_context_call
+};
+
+/* check that the handles of contexts are recycled when more sessions are used */
+START_TEST (check_contexts)
+{
+	int sv[2];
+	struct sd_event *eloop;
+	struct afb_proto_ws *server;
+
+	ck_assert_int_eq(0, sd_event_new(&eloop));
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	ctx_client = afb_proto_ws_create_client(fdev_systemd_create(eloop, sv[1]), &ctx_client_itf, NULL);
+	ck_assert_ptr_ne(NULL, ctx_client);
+	server = afb_proto_ws_create_server(fdev_systemd_create(eloop, sv[0]), &ctx_server_itf, NULL);
+	ck_assert_ptr_ne(NULL, server);
+
+	/* negotiates the version */
+	ctx_call();
+	while (ctx_replied < 1)
+		ck_assert_int_le(0, sd_event_run(eloop, 1000000));
+
+	while (ctx_sent < CTX_WINDOW)
+		ctx_call();
+	while (ctx_replied < CTX_CALLS)
+		ck_assert_int_le(0, sd_event_run(eloop, 1000000));
+
+	printf("contexts: %d definitions, %d calls by handle, %d calls in full\n", ctx_sets, ctx_hits, ctx_fulls);
+	ck_assert_int_gt(ctx_sets, CTX_HANDLES);
+	ck_assert_int_gt(ctx_hits, CTX_CALLS - CTX_SESSIONS - CTX_WINDOW);
+
+	afb_proto_ws_unref(ctx_client);
+	afb_proto_ws_unref(server);
+	sd_event_unref(eloop);
+}
+END_TEST
+
+/*********************************************************************/
+
+#define BUD_BUDGET	5000	/* milliseconds given to the calls */
+#define BUD_SHORT	100	/* milliseconds given to the call that expires */
+#define BUD_SLEEP	500	/* milliseconds spent by the verb "sleep" */
+#define BUD_WAIT_MAX	10	/* seconds */
+#define BUD_CALLS	4
+
+/*
+ * The requests are made in the apiset of the client stub. They
+ * cross the websocket to the server stub that processes them in
+ * its apiset with the api "hop".
+ */
+struct bud_req
+{
+	struct afb_xreq xreq;
+	int index;
+};
+
+static pthread_mutex_t bud_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bud_cond = PTHREAD_COND_INITIALIZER;
+static struct afb_apiset *bud_client_apiset;
+static struct afb_apiset *bud_server_apiset;
+static int bud_ready, bud_replied, bud_calls, bud_remaining;
+static char *bud_errors[BUD_CALLS];
+
+/* implementation of the verbs of the api "hop" */
+static void bud_api_call(void *closure, struct afb_xreq *xreq)
+{
+	if (!strcmp(xreq->request.called_verb, "sleep"))
+		usleep(BUD_SLEEP * 1000);
+	pthread_mutex_lock(&bud_mutex);
+	bud_remaining = afb_xreq_remaining_time(xreq);
+	bud_calls++;
+	pthread_mutex_unlock(&bud_mutex);
+	afb_xreq_reply(xreq, NULL, NULL, NULL);
+}
+
+static struct afb_api_itf bud_api_itf =
+{
+	.call = bud_api_call
+};
+
+static void bud_req_reply(struct afb_xreq *xreq, struct json_object *obj, const char *error, const char *info)
+{
+	struct bud_req *req = CONTAINER_OF_XREQ(struct bud_req, xreq);
+
+	json_object_put(obj);
+	pthread_mutex_lock(&bud_mutex);
+	bud_errors[req->index] = error ? strdup(error) : NULL;
+	bud_replied++;
+	pthread_cond_signal(&bud_cond);
+	pthread_mutex_unlock(&bud_mutex);
+}
+
+static void bud_req_unref(struct afb_xreq *xreq)
+{
+	struct bud_req *req = CONTAINER_OF_XREQ(struct bud_req, xreq);
+
+	json_object_put(req->xreq.json);
+	afb_context_disconnect(&req->xreq.context);
+	free(req);
+}
+
+static const struct afb_xreq_query_itf bud_req_itf =
+{
+	.reply = bud_req_reply,
+	.unref = bud_req_unref
+};
+
+/* calls the 'verb' of "hop" with the 'budget' in milliseconds or none if 0 */
+static void bud_call(int index, const char *verb, uint32_t budget)
+{
+	struct bud_req *req = calloc(1, sizeof *req);
+
+	ck_assert_ptr_ne(NULL, req);
+	afb_xreq_init(&req->xreq, &bud_req_itf);
+	req->index = index;
+	req->xreq.request.called_api = "hop";
+	req->xreq.request.called_verb = verb;
+	ck_assert_int_eq(0, afb_context_connect(&req->xreq.context, NULL, NULL));
+	if (budget)
+		afb_xreq_set_budget(&req->xreq, budget);
+	afb_xreq_process(&req->xreq, bud_client_apiset);
+}
+
+/* waits until 'count' replies are received */
+static void bud_wait(int count)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += BUD_WAIT_MAX;
+	pthread_mutex_lock(&bud_mutex);
+	while (bud_replied < count && pthread_cond_timedwait(&bud_cond, &bud_mutex, &ts) == 0);
+	pthread_mutex_unlock(&bud_mutex);
+	ck_assert_int_eq(count, bud_replied);
+}
+
+/* creates the stubs linked by a socket: it must be done by a job */
+static void bud_start(int signum, void *arg)
+{
+	int sv[2];
+	struct afb_stub_ws *stub;
+	struct afb_api_item api = { .closure = NULL, .itf = &bud_api_itf, .group = &bud_api_itf };
+
+	bud_client_apiset = afb_apiset_create("bud-client", 0);
+	bud_server_apiset = afb_apiset_create("bud-server", 0);
+	ck_assert_ptr_ne(NULL, bud_client_apiset);
+	ck_assert_ptr_ne(NULL, bud_server_apiset);
+	ck_assert_int_eq(0, afb_apiset_add(bud_server_apiset, "hop", api));
+
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	ck_assert_ptr_ne(NULL, afb_stub_ws_create_server(afb_fdev_create(sv[0]), "hop", bud_server_apiset));
+	stub = afb_stub_ws_create_client(afb_fdev_create(sv[1]), "hop", bud_client_apiset);
+	ck_assert_ptr_ne(NULL, stub);
+	ck_assert_int_eq(0, afb_stub_ws_client_add(stub, bud_client_apiset));
+
+	pthread_mutex_lock(&bud_mutex);
+	bud_ready = 1;
+	pthread_cond_signal(&bud_cond);
+	pthread_mutex_unlock(&bud_mutex);
+}
+
+static void *bud_run(void *closure)
+{
+	jobs_start(4, 0, 64, bud_start, NULL);
+	return NULL;
+}
+
+/*
+ * check that the budget of a request is given to the server through
+ * the stubs and that the server rejects the request expired while
+ * pending instead of processing it
+ */
+START_TEST (check_budgets)
+{
+	pthread_t tid;
+
+	ck_assert_int_eq(0, afb_session_init(10, 3600, NULL));
+	ck_assert_int_eq(0, pthread_create(&tid, NULL, bud_run, NULL));
+	pthread_detach(tid);
+	pthread_mutex_lock(&bud_mutex);
+	while (!bud_ready)
+		pthread_cond_wait(&bud_cond, &bud_mutex);
+	pthread_mutex_unlock(&bud_mutex);
+
+	/* without budget, no deadline (it also negotiates the version) */
+	bud_call(0, "check", 0);
+	bud_wait(1);
+	ck_assert_ptr_eq(NULL, bud_errors[0]);
+	ck_assert_int_eq(1, bud_calls);
+	ck_assert_int_eq(-1, bud_remaining);
+
+	/* the budget crosses the stubs */
+	bud_call(1, "check", BUD_BUDGET);
+	bud_wait(2);
+	ck_assert_ptr_eq(NULL, bud_errors[1]);
+	ck_assert_int_eq(2, bud_calls);
+	ck_assert_int_gt(bud_remaining, BUD_BUDGET - 1000);
+	ck_assert_int_le(bud_remaining, BUD_BUDGET);
+
+	/* the call pending behind "sleep" expires and is not processed */
+	bud_call(2, "sleep", BUD_BUDGET);
+	bud_call(3, "check", BUD_SHORT);
+	bud_wait(4);
+	ck_assert_ptr_eq(NULL, bud_errors[2]);
+	ck_assert_ptr_ne(NULL, bud_errors[3]);
+	ck_assert_str_eq("timeout", bud_errors[3]);
+	ck_assert_int_eq(3, bud_calls);
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("proto-ws");
+		addtcase("proto-ws");
+			addtest(check_burst);
+			addtest(check_roundtrips);
+			addtest(check_contexts);
+			addtest(check_budgets);
+	return !!srun();
+}
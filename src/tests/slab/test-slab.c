@@ -0,0 +1,222 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <check.h>
+
+#include "slab.h"
+
+#define COUNT		1000
+#define BENCH_COUNT	1000000
+#define BENCH_SIZE	200
+#define THREAD_COUNT	4
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*********************************************************************/
+
+/* size of the i-th block of the tests */
+static size_t size_of(int i)
+{
+	return (size_t)(1 + (i * 37) % (SLAB_SIZE_MAX + 100));
+}
+
+/* fills the blocks with a pattern, checks the pattern and releases the blocks */
+static void fill(char **blocks, int count)
+{
+	int i;
+
+	for (i = 0 ; i < count ; i++) {
+		blocks[i] = slab_alloc(size_of(i));
+		ck_assert_ptr_ne(NULL, blocks[i]);
+		memset(blocks[i], i & 255, size_of(i));
+	}
+}
+
+static void check(char **blocks, int count)
+{
+	int i;
+	size_t j;
+
+	for (i = 0 ; i < count ; i++) {
+		for (j = 0 ; j < size_of(i) ; j++)
+			ck_assert_int_eq(i & 255, (unsigned char)blocks[i][j]);
+		slab_free(blocks[i], size_of(i));
+	}
+}
+
+START_TEST (check_alloc)
+{
+	static char *blocks[COUNT];
+	char *block;
+	int i;
+
+	fill(blocks, COUNT);
+	check(blocks, COUNT);
+
+	/* freed blocks are reused */
+	fill(blocks, COUNT);
+	check(blocks, COUNT);
+
+	block = slab_calloc(100);
+	ck_assert_ptr_ne(NULL, block);
+	for (i = 0 ; i < 100 ; i++)
+		ck_assert_int_eq(0, block[i]);
+	slab_free(block, 100);
+
+	slab_free(NULL, 10);
+}
+END_TEST
+
+/*********************************************************************/
+
+static char *shared[THREAD_COUNT][COUNT];
+
+static void *allocator(void *closure)
+{
+	fill(shared[(intptr_t)closure], COUNT);
+	return NULL;
+}
+
+static void *releaser(void *closure)
+{
+	check(shared[(intptr_t)closure], COUNT);
+	return NULL;
+}
+
+/* blocks are allocated by some threads and released by others */
+START_TEST (check_threads)
+{
+	pthread_t tids[THREAD_COUNT];
+	intptr_t i;
+	int round;
+
+	for (round = 0 ; round < 3 ; round++) {
+		for (i = 0 ; i < THREAD_COUNT ; i++)
+			ck_assert_int_eq(0, pthread_create(&tids[i], NULL, allocator, (void*)i));
+		for (i = 0 ; i < THREAD_COUNT ; i++)
+			pthread_join(tids[i], NULL);
+		for (i = 0 ; i < THREAD_COUNT ; i++)
+			ck_assert_int_eq(0, pthread_create(&tids[i], NULL, releaser, (void*)((i + 1) % THREAD_COUNT)));
+		for (i = 0 ; i < THREAD_COUNT ; i++)
+			pthread_join(tids[i], NULL);
+	}
+}
+END_TEST
+
+/*********************************************************************/
+
+/* allocation and release of requests, some of them being pending */
+static void *bench_slab(void *closure)
+{
+	void *pending[16];
+	int i;
+
+	memset(pending, 0, sizeof pending);
+	for (i = 0 ; i < BENCH_COUNT ; i++) {
+		slab_free(pending[i & 15], BENCH_SIZE);
+		pending[i & 15] = slab_alloc(BENCH_SIZE);
+	}
+	for (i = 0 ; i < 16 ; i++)
+		slab_free(pending[i], BENCH_SIZE);
+	return NULL;
+}
+
+static void *bench_malloc(void *closure)
+{
+	void *pending[16];
+	int i;
+
+	memset(pending, 0, sizeof pending);
+	for (i = 0 ; i < BENCH_COUNT ; i++) {
+		free(pending[i & 15]);
+		pending[i & 15] = malloc(BENCH_SIZE);
+	}
+	for (i = 0 ; i < 16 ; i++)
+		free(pending[i]);
+	return NULL;
+}
+
+static double bench(void *(*fun)(void*))
+{
+	pthread_t tids[THREAD_COUNT];
+	double t0, t1;
+	int i;
+
+	t0 = now();
+	for (i = 0 ; i < THREAD_COUNT ; i++)
+		ck_assert_int_eq(0, pthread_create(&tids[i], NULL, fun, NULL));
+	for (i = 0 ; i < THREAD_COUNT ; i++)
+		pthread_join(tids[i], NULL);
+	t1 = now();
+	return t1 - t0;
+}
+
+START_TEST (check_bench)
+{
+	double ts, tm;
+
+	ts = bench(bench_slab);
+	tm = bench(bench_malloc);
+	printf("%d threads x %d allocations of %d bytes: slab %.3fs (%.0f/s), malloc %.3fs (%.0f/s)\n",
+		THREAD_COUNT, BENCH_COUNT, BENCH_SIZE,
+		ts, THREAD_COUNT * BENCH_COUNT / ts,
+		tm, THREAD_COUNT * BENCH_COUNT / tm);
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("slab");
+		addtcase("slab");
+			addtest(check_alloc);
+			addtest(check_threads);
+			addtest(check_bench);
+	return !!srun();
+}
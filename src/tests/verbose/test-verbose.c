@@ -0,0 +1,246 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <check.h>
+
+#include "verbose.h"
+
+#define NTHREADS	4
+#define NMESSAGES	2000
+
+/*********************************************************************/
+
+static int savedfd = -1;
+static char output[1 << 20];
+static size_t outlen;
+
+/* redirects the standard error to the file descriptor 'fd' */
+static void redirect(int fd)
+{
+	savedfd = dup(STDERR_FILENO);
+	ck_assert_int_le(0, savedfd);
+	ck_assert_int_eq(STDERR_FILENO, dup2(fd, STDERR_FILENO));
+	close(fd);
+}
+
+/* restores the standard error */
+static void restore()
+{
+	verbose_flush();
+	ck_assert_int_eq(STDERR_FILENO, dup2(savedfd, STDERR_FILENO));
+	close(savedfd);
+}
+
+/* reads all of 'fd' in 'output' */
+static void *reader(void *arg)
+{
+	int fd = (int)(intptr_t)arg;
+	ssize_t rc;
+
+	outlen = 0;
+	while ((rc = read(fd, &output[outlen], sizeof output - 1 - outlen)) > 0)
+		outlen += (size_t)rc;
+	output[outlen] = 0;
+	close(fd);
+	return NULL;
+}
+
+/* redirects the standard error to a temporary file */
+static void capture()
+{
+	char path[] = "/tmp/test-verbose-XXXXXX";
+	int fd = mkstemp(path);
+
+	ck_assert_int_le(0, fd);
+	unlink(path);
+	redirect(fd);
+}
+
+/* reads in 'output' the captured standard error */
+static void captured()
+{
+	int fd = dup(STDERR_FILENO);
+
+	restore();
+	lseek(fd, 0, SEEK_SET);
+	reader((void*)(intptr_t)fd);
+}
+
+/* counts the messages of the threads in the output, checking their order */
+static int count_messages(int *dropped)
+{
+	int t, i, n, count, next[NTHREADS];
+	unsigned d;
+	char *line;
+
+	memset(next, 0, sizeof next);
+	count = 0;
+	*dropped = 0;
+	for (line = output ; *line ; line = strchr(line, '\n') + 1) {
+		if (sscanf(line, "<4> WARNING: thread %d message %d", &t, &i) == 2) {
+			ck_assert_int_le(next[t], i);
+			next[t] = i + 1;
+			count++;
+		} else if (sscanf(line, "<4> WARNING: %u messages dropped%n", &d, &n) == 1 && n)
+			*dropped += (int)d;
+		else
+			ck_abort_msg("unexpected line %.*s", (int)(strchr(line, '\n') - line), line);
+	}
+	return count;
+}
+
+static void *logger(void *arg)
+{
+	int t = (int)(intptr_t)arg;
+	int i;
+
+	for (i = 0 ; i < NMESSAGES ; i++)
+		WARNING("thread %d message %d", t, i);
+	return NULL;
+}
+
+/*********************************************************************/
+
+START_TEST (check_async)
+{
+	pthread_t tids[NTHREADS];
+	int t, count, dropped;
+
+	capture();
+	ck_assert_int_eq(0, verbose_async_start());
+	for (t = 0 ; t < NTHREADS ; t++)
+		ck_assert_int_eq(0, pthread_create(&tids[t], NULL, logger, (void*)(intptr_t)t));
+	for (t = 0 ; t < NTHREADS ; t++)
+		pthread_join(tids[t], NULL);
+	verbose_flush();
+	captured();
+
+	/* all messages are in order, either written or counted as dropped */
+	count = count_messages(&dropped);
+	ck_assert_int_eq(NTHREADS * NMESSAGES, count + dropped);
+}
+END_TEST
+
+START_TEST (check_dropped)
+{
+	pthread_t tid;
+	int fds[2], count, dropped;
+
+	/* nobody reads the output while logging */
+	ck_assert_int_eq(0, pipe(fds));
+	redirect(fds[1]);
+	ck_assert_int_eq(0, verbose_async_start());
+	logger((void*)(intptr_t)0);
+
+	/* then read it */
+	ck_assert_int_eq(0, pthread_create(&tid, NULL, reader, (void*)(intptr_t)fds[0]));
+	verbose_flush();
+	restore();
+	pthread_join(tid, NULL);
+
+	count = count_messages(&dropped);
+	ck_assert_int_lt(0, dropped);
+	ck_assert_int_eq(NMESSAGES, count + dropped);
+}
+END_TEST
+
+static void limited(int i)
+{
+	WARNING("limited %d", i);
+}
+
+START_TEST (check_ratelimit)
+{
+	int i;
+	time_t t;
+
+	capture();
+	verbose_set_ratelimit(3);
+
+	/* starts at the beginning of a second */
+	t = time(NULL);
+	while (t == time(NULL))
+		usleep(1000);
+	for (i = 0 ; i < 10 ; i++)
+		limited(i);
+	sleep(1);
+	limited(i);
+	captured();
+
+	ck_assert_ptr_ne(NULL, strstr(output, "WARNING: limited 2 "));
+	ck_assert_ptr_eq(NULL, strstr(output, "WARNING: limited 3 "));
+	ck_assert_ptr_ne(NULL, strstr(output, "WARNING: 7 similar messages suppressed "));
+	ck_assert_ptr_ne(NULL, strstr(output, "WARNING: limited 10 "));
+}
+END_TEST
+
+START_TEST (check_format)
+{
+	capture();
+	WARNING("constant message");
+	WARNING("constant %% message");
+	WARNING("simple %s and %s%%", "one", "two");
+	WARNING("complex %d %5s|", 42, "x");
+	captured();
+
+	ck_assert_ptr_ne(NULL, strstr(output, "WARNING: constant message ["));
+	ck_assert_ptr_ne(NULL, strstr(output, "WARNING: constant % message ["));
+	ck_assert_ptr_ne(NULL, strstr(output, "WARNING: simple one and two% ["));
+	ck_assert_ptr_ne(NULL, strstr(output, "WARNING: complex 42     x| ["));
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("verbose");
+		addtcase("verbose");
+			addtest(check_async);
+			addtest(check_dropped);
+			addtest(check_ratelimit);
+			addtest(check_format);
+			tcase_set_timeout(tcase, 10);
+	return !!srun();
+}
@@ -0,0 +1,110 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+/*
+ * Measures the throughput of the masking and of the UTF-8 validation
+ * of websocket payloads for each implementation level.
+ *
+ *   bench-websock [SIZE [TOTAL]]
+ *
+ * SIZE is the size of the payloads (default 65536) and TOTAL the count
+ * of bytes processed per measure (default 1 GiB). The payloads start
+ * at an odd offset to account for unaligned buffers.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "websock-simd.h"
+
+static const char *names[] = { "generic", "sse2", "avx2" };
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *what, int level, size_t size, size_t total, double t)
+{
+	printf("%-6s %-8s size %8zu: %8.2f MiB/s\n", what, names[level], size,
+		(double)total / t / (1024.0 * 1024.0));
+}
+
+int main(int ac, char **av)
+{
+	size_t size, total, done;
+	uint8_t *buffer, *payload, *scratch;
+	uint32_t mask;
+	int best, level, valid;
+	double t;
+
+	size = ac > 1 ? (size_t)strtoull(av[1], NULL, 0) : 65536;
+	total = ac > 2 ? (size_t)strtoull(av[2], NULL, 0) : (size_t)1 << 30;
+	if (!size || total < size) {
+		fprintf(stderr, "usage: %s [SIZE [TOTAL]]\n", av[0]);
+		return 1;
+	}
+
+	buffer = malloc(size + 1);
+	scratch = malloc(size + 1);
+	if (!buffer || !scratch) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	payload = buffer + 1;
+
+	/* a JSON like payload with some multi-byte characters */
+	for (done = 0 ; done < size ; done++)
+		payload[done] = (uint8_t)"{\"verb\":\"ping\",\"data\":12345}"[done % 28];
+	for (done = 100 ; done + 2 < size ; done += 1000) {
+		payload[done] = 0xc3;
+		payload[done + 1] = 0xa9;
+	}
+
+	memcpy(scratch, buffer, size + 1);
+
+	best = websock_simd_set_level(WEBSOCK_SIMD_AVX2);
+	for (level = WEBSOCK_SIMD_GENERIC ; level <= best ; level++) {
+		websock_simd_set_level(level);
+
+		mask = 0x5a3c9e17;
+		t = now();
+		for (done = 0 ; done < total ; done += size)
+			mask = websock_simd_mask(scratch + 1, size, mask);
+		report("mask", level, size, done, now() - t);
+
+		valid = 1;
+		t = now();
+		for (done = 0 ; done < total ; done += size)
+			valid &= websock_simd_utf8_valid(payload, size);
+		report("utf8", level, size, done, now() - t);
+		if (!valid)
+			printf("unexpected invalid UTF-8\n");
+	}
+	free(buffer);
+	free(scratch);
+	return 0;
+}
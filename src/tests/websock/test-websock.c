@@ -0,0 +1,212 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "websock-simd.h"
+
+/*********************************************************************/
+
+#define SIZE 1024
+
+static uint8_t data[SIZE + 64];
+static uint8_t copy[SIZE + 64];
+static uint8_t ref[SIZE + 64];
+
+static const uint8_t mbytes[4] = { 0x12, 0x9a, 0x5c, 0xe7 };
+
+static void fill()
+{
+	int i;
+
+	for (i = 0 ; i < (int)sizeof data ; i++)
+		data[i] = (uint8_t)(i * 7 + 3);
+}
+
+START_TEST (check_mask)
+{
+	int lvl, best, off, size, cut;
+	uint32_t mask, next;
+
+	best = websock_simd_set_level(WEBSOCK_SIMD_AVX2);
+	fill();
+	memcpy(&mask, mbytes, 4);
+	for (lvl = WEBSOCK_SIMD_GENERIC ; lvl <= best ; lvl++) {
+		ck_assert_int_eq(lvl, websock_simd_set_level(lvl));
+		for (off = 0 ; off < 36 ; off++) {
+			for (size = 0 ; size + off <= SIZE ; size += size < 300 ? 1 : 61) {
+				/* reference */
+				memcpy(ref, data, sizeof ref);
+				for (cut = 0 ; cut < size ; cut++)
+					ref[off + cut] ^= mbytes[cut & 3];
+
+				/* in one call */
+				memcpy(copy, data, sizeof copy);
+				next = websock_simd_mask(&copy[off], (size_t)size, mask);
+				ck_assert(!memcmp(copy, ref, sizeof ref));
+				ck_assert_int_eq(mbytes[size & 3], ((uint8_t*)&next)[0]);
+
+				/* in two calls */
+				cut = size / 3;
+				memcpy(copy, data, sizeof copy);
+				next = websock_simd_mask(&copy[off], (size_t)cut, mask);
+				next = websock_simd_mask(&copy[off + cut], (size_t)(size - cut), next);
+				ck_assert(!memcmp(copy, ref, sizeof ref));
+			}
+		}
+	}
+	websock_simd_set_level(WEBSOCK_SIMD_AVX2);
+}
+END_TEST
+
+/*********************************************************************/
+
+static const char *valids[] = {
+	"",
+	"a",
+	"\x7f",
+	"\xc2\x80",
+	"\xdf\xbf",
+	"\xe0\xa0\x80",
+	"\xed\x9f\xbf",
+	"\xee\x80\x80",
+	"\xef\xbf\xbf",
+	"\xf0\x90\x80\x80",
+	"\xf4\x8f\xbf\xbf",
+	"h\xc3\xa9llo w\xc3\xb6rld \xe2\x82\xac \xf0\x9f\x98\x80",
+	NULL
+};
+
+static const char *invalids[] = {
+	"\x80",			/* lonely continuation */
+	"\xbf",
+	"\xc0\x80",		/* overlong */
+	"\xc1\xbf",
+	"\xe0\x9f\xbf",
+	"\xf0\x8f\xbf\xbf",
+	"\xed\xa0\x80",		/* surrogates */
+	"\xed\xbf\xbf",
+	"\xf4\x90\x80\x80",	/* too large */
+	"\xf5\x80\x80\x80",
+	"\xff",
+	"\xc2",			/* truncated */
+	"\xe0\xa0",
+	"\xf0\x90\x80",
+	"\xc2\x41",		/* missing continuation */
+	"\xe2\x82\x41",
+	"\xf0\x9f\x98\x41",
+	"\xc2\x80\x80",		/* too many continuations */
+	NULL
+};
+
+/* puts 's' at 'pos' of a buffer of ascii of 'size' */
+static size_t place(const char *s, size_t pos, size_t size)
+{
+	size_t len = strlen(s);
+
+	memset(data, 'x', sizeof data);
+	memcpy(&data[pos], s, len);
+	return size < pos + len ? pos + len : size;
+}
+
+static int valid_at_all_levels(const char *s, size_t pos, size_t size)
+{
+	int lvl, best, r, result;
+
+	size = place(s, pos, size);
+	best = websock_simd_set_level(WEBSOCK_SIMD_AVX2);
+	result = websock_simd_utf8_valid(data, size);
+	for (lvl = WEBSOCK_SIMD_GENERIC ; lvl < best ; lvl++) {
+		websock_simd_set_level(lvl);
+		r = websock_simd_utf8_valid(data, size);
+		ck_assert_int_eq(result, r);
+	}
+	websock_simd_set_level(WEBSOCK_SIMD_AVX2);
+	return result;
+}
+
+START_TEST (check_utf8)
+{
+	size_t pos, size;
+	int i;
+
+	for (pos = 0 ; pos < 100 ; pos++) {
+		for (size = 0 ; size < 100 ; size += 7) {
+			for (i = 0 ; valids[i] ; i++)
+				ck_assert_int_eq(1, valid_at_all_levels(valids[i], pos, size));
+			for (i = 0 ; invalids[i] ; i++)
+				ck_assert_int_eq(0, valid_at_all_levels(invalids[i], pos, size));
+		}
+	}
+}
+END_TEST
+
+START_TEST (check_utf8_random)
+{
+	int best, n, i, r;
+	size_t size;
+
+	srand(123);
+	best = websock_simd_set_level(WEBSOCK_SIMD_AVX2);
+	for (n = 0 ; n < 20000 ; n++) {
+		size = (size_t)(rand() % 200);
+		place(valids[11], (size_t)(rand() % 100), 0);
+		for (i = rand() % 3 ; i ; i--)
+			data[rand() % 200] = (uint8_t)rand();
+		websock_simd_set_level(WEBSOCK_SIMD_GENERIC);
+		r = websock_simd_utf8_valid(data, size);
+		websock_simd_set_level(best);
+		ck_assert_int_eq(r, websock_simd_utf8_valid(data, size));
+	}
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("websock");
+		addtcase("websock");
+			addtest(check_mask);
+			addtest(check_utf8);
+			addtest(check_utf8_random);
+	return !!srun();
+}
@@ -19,6 +19,7 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "wrap-json.h"
 #if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
@@ -104,11 +105,24 @@ void tmix(struct json_object *object)
 	}
 }
 
+/* checks the status 'rcp' of a compiled descriptor against the status 'rc' of the interpreted one */
+int differs(int rc, int rcp)
+{
+	/* the syntax errors of compiled descriptors are reported before the errors of the values */
+	if (rc && rcp && rc != rcp)
+		switch (wrap_json_get_error_code(rcp)) {
+		case 2: /* truncated */
+		case 5: /* invalid character */
+			return 0;
+		}
+	return rc != rcp;
+}
+
 void p(const char *desc, ...)
 {
-	int rc;
+	int rc, rcp;
 	va_list args;
-	struct json_object *result;
+	struct json_object *result, *resultp;
 
 	va_start(args, desc);
 	rc = wrap_json_vpack(&result, desc, args);
@@ -117,6 +131,19 @@ void p(const char *desc, ...)
 		printf("  SUCCESS %s\n\n", json_object_to_json_string_ext(result, JSON_C_TO_STRING_NOSLASHESCAPE));
 	else
 		printf("  ERROR[char %d err %d] %s\n\n", wrap_json_get_error_position(rc), wrap_json_get_error_code(rc), wrap_json_get_error_string(rc));
+
+	if (!desc || !strchr(desc, 'o')) {
+		/* compiled packing builds the same result, objects of 'o' can't be given twice */
+		va_start(args, desc);
+		rcp = wrap_json_vpack_program(&resultp, wrap_json_compile(desc), args);
+		va_end(args);
+		if (differs(rc, rcp))
+			printf("  ERROR COMPILED DIFFERS[char %d err %d] %s\n\n", wrap_json_get_error_position(rcp), wrap_json_get_error_code(rcp), wrap_json_get_error_string(rcp));
+		else if (!rc && !wrap_json_equal(result, resultp))
+			printf("  ERROR COMPILED DIFFERS %s\n\n", json_object_to_json_string_ext(resultp, JSON_C_TO_STRING_NOSLASHESCAPE));
+		json_object_put(resultp);
+	}
+
 	tclone(result);
 	json_object_put(result);
 }
@@ -181,12 +208,15 @@ const char *mkeys[5];
 
 void tchk(struct json_object *object, const char *desc, const char **keys, int length, int qrc)
 {
-	int rm, rc;
+	int rm, rc, rcp;
 
 	rm = wrap_json_match(object, desc, keys[0], keys[1], keys[2], keys[3], keys[4]);
 	rc = wrap_json_check(object, desc, keys[0], keys[1], keys[2], keys[3], keys[4]);
+	rcp = wrap_json_check_program(object, wrap_json_compile(desc), keys[0], keys[1], keys[2], keys[3], keys[4]);
 	if (rc != qrc)
 		printf("  ERROR DIFFERS[char %d err %d] %s\n", wrap_json_get_error_position(rc), wrap_json_get_error_code(rc), wrap_json_get_error_string(rc));
+	if (differs(qrc, rcp))
+		printf("  ERROR COMPILED DIFFERS[char %d err %d] %s\n", wrap_json_get_error_position(rcp), wrap_json_get_error_code(rcp), wrap_json_get_error_string(rcp));
 	if (rm != !rc)
 		printf("  ERROR OF MATCH\n");
 }
@@ -249,6 +279,14 @@ void u(const char *value, const char *desc, ...)
 		va_end(args);
 	}
 	printf("\n");
+	if (!desc || !strpbrk(desc, "OyY")) {
+		/* compiled unpacking stores the same values again */
+		va_start(args, desc);
+		n = wrap_json_vunpack_program(object, wrap_json_compile(desc), args);
+		va_end(args);
+		if (differs(rc, n))
+			printf("  ERROR COMPILED DIFFERS[char %d err %d] %s\n", wrap_json_get_error_position(n), wrap_json_get_error_code(n), wrap_json_get_error_string(n));
+	}
 	va_start(args, desc);
 	n = extrchk(desc, mkeys, (int)(sizeof mkeys / sizeof *mkeys), args);
 	va_end(args);
@@ -281,10 +319,58 @@ void c(const char *sx, const char *sy, int e, int c)
 		printf("  ERROR should be %s\n", e ? "equal" : "different");
 	if (!rc != !c)
 		printf("  ERROR should %scontain\n", c ? "" : "not ");
+	if (!re && wrap_json_hash(jx) != wrap_json_hash(jy))
+		printf("  ERROR should have the same hash\n");
 
 	printf("\n");
 }
 
+/* current time in seconds */
+double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* throughput of the interpreted and compiled descriptors of a typical verb */
+void bench(int count)
+{
+	static const char desc[] = "{ss si s?o}";
+	const struct wrap_json_program *program = wrap_json_compile(desc);
+	struct json_object *args, *extra, *result;
+	const char *name;
+	int i, value, rc;
+	double t0, t1, t2, t3, t4;
+
+	args = json_tokener_parse("{\"name\":\"temperature\",\"value\":21,\"extra\":{\"unit\":\"C\"}}");
+	rc = 0;
+	t0 = now();
+	for (i = 0 ; i < count ; i++)
+		rc |= wrap_json_unpack(args, desc, "name", &name, "value", &value, "extra", &extra);
+	t1 = now();
+	for (i = 0 ; i < count ; i++)
+		rc |= wrap_json_unpack_program(args, program, "name", &name, "value", &value, "extra", &extra);
+	t2 = now();
+	for (i = 0 ; i < count ; i++) {
+		rc |= wrap_json_pack(&result, desc, "name", name, "value", value, "extra", json_object_get(extra));
+		json_object_put(result);
+	}
+	t3 = now();
+	for (i = 0 ; i < count ; i++) {
+		rc |= wrap_json_pack_program(&result, program, "name", name, "value", value, "extra", json_object_get(extra));
+		json_object_put(result);
+	}
+	t4 = now();
+	if (rc || strcmp(name, "temperature") || value != 21)
+		printf("  ERROR bench %d\n", rc);
+	printf("bench(%s) x %d\n", desc, count);
+	printf("  unpack: %.0f/s interpreted, %.0f/s compiled\n", count / (t1 - t0), count / (t2 - t1));
+	printf("  pack:   %.0f/s interpreted, %.0f/s compiled\n", count / (t3 - t2), count / (t4 - t3));
+	json_object_put(args);
+}
+
 #define P(...) do{ printf("pack(%s)\n",#__VA_ARGS__); p(__VA_ARGS__); } while(0)
 #define U(...) do{ printf("unpack(%s)\n",#__VA_ARGS__); u(__VA_ARGS__); } while(0)
 
@@ -441,6 +527,7 @@ int main()
 	c("\"hi\"", "\"hi\"", 1, 1);
 	c("{}", "{}", 1, 1);
 	c("{\"a\":true,\"b\":false}", "{\"b\":false,\"a\":true}", 1, 1);
+	c("{\"a\":[1,{\"x\":0,\"y\":\"z\"}],\"b\":2}", "{\"b\":2,\"a\":[1,{\"y\":\"z\",\"x\":0}]}", 1, 1);
 	c("[]", "[]", 1, 1);
 	c("[1,true,null]", "[1,true,null]", 1, 1);
 
@@ -467,5 +554,7 @@ int main()
 	c("{\"a\":true,\"b\":false}", "{\"a\":true,\"c\":false}", 0, 0);
 	c("{\"a\":true,\"c\":false}", "{\"a\":true,\"b\":false}", 0, 0);
 
+	bench(200000);
+
 	return 0;
 }
@@ -0,0 +1,364 @@
+/*
+ Copyright (C) 2018 "IoT.bzh"
+
+ author: José Bollo <jose.bollo@iot.bzh>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <check.h>
+
+#include <zlib.h>
+#include <systemd/sd-event.h>
+
+#include "afb-ws.h"
+#include "fdev.h"
+#include "fdev-systemd.h"
+
+/*********************************************************************/
+
+static void accept_offer(const char *offer, const char *expected, int out, int outnt, int in, int innt)
+{
+	struct afb_ws_deflate d;
+	char response[160];
+
+	ck_assert_int_eq(1, afb_ws_deflate_accept(offer, &d, response, sizeof response));
+	ck_assert_str_eq(expected, response);
+	ck_assert_int_eq(out, d.out_window_bits);
+	ck_assert_int_eq(outnt, d.out_no_takeover);
+	ck_assert_int_eq(in, d.in_window_bits);
+	ck_assert_int_eq(innt, d.in_no_takeover);
+}
+
+START_TEST (check_negotiation)
+{
+	struct afb_ws_deflate d, s;
+	char response[160];
+
+	/* accepted offers */
+	accept_offer("permessage-deflate",
+		"permessage-deflate; server_max_window_bits=13", 13, 0, 15, 0);
+	accept_offer(afb_ws_deflate_offer,
+		"permessage-deflate; server_max_window_bits=13; client_max_window_bits=13", 13, 0, 13, 0);
+	accept_offer("permessage-deflate; client_max_window_bits=10; server_no_context_takeover",
+		"permessage-deflate; server_no_context_takeover; server_max_window_bits=13; client_max_window_bits=10",
+		13, 1, 10, 0);
+	accept_offer("permessage-deflate; server_max_window_bits=\"8\"; client_no_context_takeover",
+		"permessage-deflate; client_no_context_takeover; server_max_window_bits=8", 0, 0, 15, 1);
+	accept_offer("x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=16, permessage-deflate",
+		"permessage-deflate; server_max_window_bits=13", 13, 0, 15, 0);
+
+	/* refused offers */
+	ck_assert_int_eq(0, afb_ws_deflate_accept("", &d, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_accept("x-webkit-deflate-frame", &d, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_accept("permessage-deflate; foo", &d, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_accept("permessage-deflate; server_max_window_bits", &d, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_accept("permessage-deflate; server_no_context_takeover; server_no_context_takeover", &d, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_accept("permessage-deflate", &d, response, 10));
+
+	/* agreement of the client */
+	ck_assert_int_eq(1, afb_ws_deflate_accept(afb_ws_deflate_offer, &s, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_agree(response, &d));
+	ck_assert_int_eq(s.out_window_bits, d.in_window_bits);
+	ck_assert_int_eq(s.in_window_bits, d.out_window_bits);
+	ck_assert_int_eq(0, afb_ws_deflate_agree("permessage-deflate; client_max_window_bits=8; server_no_context_takeover", &d));
+	ck_assert_int_eq(0, d.out_window_bits);
+	ck_assert_int_eq(15, d.in_window_bits);
+	ck_assert_int_eq(1, d.in_no_takeover);
+	ck_assert_int_eq(-1, afb_ws_deflate_agree("permessage-deflate, permessage-deflate", &d));
+	ck_assert_int_eq(-1, afb_ws_deflate_agree("permessage-deflate; client_max_window_bits", &d));
+	ck_assert_int_eq(-1, afb_ws_deflate_agree("x-other", &d));
+}
+END_TEST
+
+/*********************************************************************/
+
+#define COUNT	50
+
+static struct sd_event *eloop;
+static int received;
+static char *expected[COUNT];
+
+static void on_text(void *closure, char *text, size_t size)
+{
+	ck_assert_int_lt(received, COUNT);
+	ck_assert_int_eq((int)strlen(expected[received]), (int)size);
+	ck_assert_str_eq(expected[received], text);
+	received++;
+	free(text);
+}
+
+static struct afb_ws_itf itf = {
+	.on_text = on_text
+};
+
+/* makes the message 'i' of a repetitive JSON stream */
+static char *message(int i)
+{
+	char *result;
+	int pos, n, j;
+
+	result = malloc(4096);
+	ck_assert_ptr_ne(NULL, result);
+	pos = sprintf(result, "{\"event\":\"hvac/temperature\",\"data\":{\"index\":%d,\"values\":[", i);
+	n = i % 7 == 0 ? 1 : 200;
+	for (j = 0 ; j < n ; j++)
+		pos += sprintf(&result[pos], "%d,", 20 + (i + j) % 10);
+	strcpy(&result[pos], "0]}}");
+	return result;
+}
+
+/* exchanges messages between a server and a client having negotiated 'offer' */
+static void exchange(const char *offer)
+{
+	int i, sv[2];
+	struct afb_ws *server, *client;
+	struct afb_ws_deflate sd, cd;
+	char response[160];
+
+	ck_assert_int_eq(1, afb_ws_deflate_accept(offer, &sd, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_agree(response, &cd));
+
+	ck_assert_int_eq(0, sd_event_new(&eloop));
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	server = afb_ws_create(fdev_systemd_create(eloop, sv[0]), &itf, NULL, &sd);
+	client = afb_ws_create(fdev_systemd_create(eloop, sv[1]), &itf, NULL, &cd);
+	ck_assert_ptr_ne(NULL, server);
+	ck_assert_ptr_ne(NULL, client);
+
+	received = 0;
+	for (i = 0 ; i < COUNT ; i++) {
+		expected[i] = message(i);
+		ck_assert_int_eq(0, afb_ws_text((i & 1) ? server : client, expected[i], strlen(expected[i])));
+		while (received <= i)
+			sd_event_run(eloop, 1000000);
+	}
+	ck_assert_int_eq(COUNT, received);
+
+	for (i = 0 ; i < COUNT ; i++)
+		free(expected[i]);
+	afb_ws_destroy(server);
+	afb_ws_destroy(client);
+	sd_event_unref(eloop);
+}
+
+START_TEST (check_exchange)
+{
+	exchange("permessage-deflate");
+	exchange(afb_ws_deflate_offer);
+	exchange("permessage-deflate; server_no_context_takeover; client_no_context_takeover");
+	exchange("permessage-deflate; server_max_window_bits=9; client_max_window_bits=8");
+}
+END_TEST
+
+/*********************************************************************/
+
+/* reads the frame of 'fd' and returns its first byte, its payload in 'data' */
+static int read_frame(int fd, char *data, size_t *size)
+{
+	unsigned char head[4];
+	size_t len;
+
+	ck_assert_int_eq(2, (int)read(fd, head, 2));
+	len = head[1] & 127;
+	ck_assert(len < 127);
+	if (len == 126) {
+		ck_assert_int_eq(2, (int)read(fd, &head[2], 2));
+		len = ((size_t)head[2] << 8) | head[3];
+	}
+	ck_assert_int_le((int)len, (int)*size);
+	ck_assert_int_eq((int)len, (int)read(fd, data, len));
+	*size = len;
+	return head[0];
+}
+
+START_TEST (check_wire)
+{
+	int sv[2], first;
+	struct afb_ws *ws;
+	struct afb_ws_deflate d, bad;
+	char *text, data[65536], out[65536];
+	size_t size;
+	z_stream z;
+
+	ck_assert_int_eq(0, sd_event_new(&eloop));
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	ck_assert_int_eq(0, afb_ws_deflate_agree("permessage-deflate", &d));
+
+	/* invalid settings are rejected */
+	bad = d;
+	bad.out_window_bits = 8;
+	errno = 0;
+	ck_assert_ptr_eq(NULL, afb_ws_create(fdev_systemd_create(eloop, dup(sv[0])), &itf, NULL, &bad));
+	ck_assert_int_eq(EINVAL, errno);
+
+	ws = afb_ws_create(fdev_systemd_create(eloop, sv[0]), &itf, NULL, &d);
+	ck_assert_ptr_ne(NULL, ws);
+
+	/* small messages aren't compressed */
+	ck_assert_int_eq(0, afb_ws_text(ws, "hello", 5));
+	size = sizeof data;
+	first = read_frame(sv[1], data, &size);
+	ck_assert_int_eq(0x81, first);
+	ck_assert_int_eq(5, (int)size);
+
+	/* big messages are compressed */
+	text = message(1);
+	ck_assert_int_eq(0, afb_ws_text(ws, text, strlen(text)));
+	size = sizeof data - 4;
+	first = read_frame(sv[1], data, &size);
+	ck_assert_int_eq(0xc1, first);
+	ck_assert_int_lt((int)size, (int)strlen(text) / 2);
+
+	/* that can be decompressed */
+	memcpy(&data[size], "\0\0\xff\xff", 4);
+	memset(&z, 0, sizeof z);
+	ck_assert_int_eq(Z_OK, inflateInit2(&z, -15));
+	z.next_in = (Bytef*)data;
+	z.avail_in = (uInt)size + 4;
+	z.next_out = (Bytef*)out;
+	z.avail_out = (uInt)sizeof out;
+	ck_assert_int_eq(Z_OK, inflate(&z, Z_SYNC_FLUSH));
+	ck_assert_int_eq((int)strlen(text), (int)(sizeof out - z.avail_out));
+	ck_assert(!memcmp(text, out, strlen(text)));
+	inflateEnd(&z);
+
+	free(text);
+	afb_ws_destroy(ws);
+	close(sv[1]);
+	sd_event_unref(eloop);
+}
+END_TEST
+
+/*********************************************************************/
+
+#define THREADS	4
+#define SENDS	100
+
+static struct afb_ws *concurrent;
+static int errors, hangups;
+
+/* checks that the received text is a message of the stream */
+static void on_text_any(void *closure, char *text, size_t size)
+{
+	char *exp;
+	int i;
+
+	ck_assert_int_eq(1, sscanf(text, "{\"event\":\"hvac/temperature\",\"data\":{\"index\":%d,", &i));
+	exp = message(i);
+	ck_assert_str_eq(exp, text);
+	free(exp);
+	received++;
+	free(text);
+}
+
+static void on_hangup_any(void *closure)
+{
+	hangups++;
+}
+
+static struct afb_ws_itf itf_any = {
+	.on_text = on_text_any,
+	.on_hangup = on_hangup_any
+};
+
+/* sends compressed messages concurrently with the other threads */
+static void *sender(void *closure)
+{
+	int i, base = (int)(intptr_t)closure * SENDS;
+	char *text;
+
+	for (i = 0 ; i < SENDS ; i++) {
+		text = message(base + i);
+		if (afb_ws_text(concurrent, text, strlen(text)) < 0)
+			__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+		free(text);
+	}
+	return NULL;
+}
+
+START_TEST (check_concurrency)
+{
+	int i, sv[2];
+	struct afb_ws *client;
+	struct afb_ws_deflate sd, cd;
+	pthread_t tids[THREADS];
+	char response[160];
+
+	ck_assert_int_eq(1, afb_ws_deflate_accept(afb_ws_deflate_offer, &sd, response, sizeof response));
+	ck_assert_int_eq(0, afb_ws_deflate_agree(response, &cd));
+
+	ck_assert_int_eq(0, sd_event_new(&eloop));
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	concurrent = afb_ws_create(fdev_systemd_create(eloop, sv[0]), &itf_any, NULL, &sd);
+	client = afb_ws_create(fdev_systemd_create(eloop, sv[1]), &itf_any, NULL, &cd);
+	ck_assert_ptr_ne(NULL, concurrent);
+	ck_assert_ptr_ne(NULL, client);
+
+	/* the compressed messages of the threads are all decompressed */
+	received = errors = hangups = 0;
+	for (i = 0 ; i < THREADS ; i++)
+		ck_assert_int_eq(0, pthread_create(&tids[i], NULL, sender, (void*)(intptr_t)i));
+	while (received < THREADS * SENDS && !hangups)
+		sd_event_run(eloop, 1000000);
+	for (i = 0 ; i < THREADS ; i++)
+		pthread_join(tids[i], NULL);
+	ck_assert_int_eq(0, errors);
+	ck_assert_int_eq(0, hangups);
+	ck_assert_int_eq(THREADS * SENDS, received);
+
+	afb_ws_destroy(concurrent);
+	afb_ws_destroy(client);
+	sd_event_unref(eloop);
+}
+END_TEST
+
+/*********************************************************************/
+
+static Suite *suite;
+static TCase *tcase;
+
+void mksuite(const char *name) { suite = suite_create(name); }
+void addtcase(const char *name) { tcase = tcase_create(name); suite_add_tcase(suite, tcase); }
+void addtest(TFun fun) { tcase_add_test(tcase, fun); }
+int srun()
+{
+	int nerr;
+	SRunner *srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	nerr = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+	return nerr;
+}
+
+int main(int ac, char **av)
+{
+	mksuite("ws-deflate");
+		addtcase("ws-deflate");
+			addtest(check_negotiation);
+			addtest(check_exchange);
+			addtest(check_wire);
+			addtest(check_concurrency);
+	return !!srun();
+}
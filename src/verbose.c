@@ -18,11 +18,15 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "verbose.h"
 
 #define MASKOF(x)		(1 << (x))
 
+#define RATELIMIT_SLOTS		256	/* count of rate limited call sites, a power of 2 */
+
 #if !defined(DEFAULT_LOGLEVEL)
 # define DEFAULT_LOGLEVEL	Log_Level_Warning
 #endif
@@ -62,6 +66,7 @@ void (*verbose_observer)(int loglevel, const char *file, int line, const char *f
 
 #if defined(VERBOSE_WITH_SYSLOG)
 
+#include <errno.h>
 #include <syslog.h>
 
 static void _vverbose_(int loglevel, const char *file, int line, const char *function, const char *fmt, va_list args)
@@ -81,10 +86,21 @@ void verbose_set_name(const char *name, int authority)
 	openlog(name, LOG_PERROR, authority ? LOG_AUTH : LOG_USER);
 }
 
+int verbose_async_start()
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+void verbose_flush()
+{
+}
+
 #elif defined(VERBOSE_WITH_SYSTEMD)
 
 #define SD_JOURNAL_SUPPRESS_LOCATION
 
+#include <errno.h>
 #include <systemd/sd-journal.h>
 
 static const char *appname;
@@ -109,14 +125,32 @@ void verbose_set_name(const char *name, int authority)
 	appauthority = authority;
 }
 
+int verbose_async_start()
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+void verbose_flush()
+{
+}
+
 #else
 
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <signal.h>
 #include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <sys/uio.h>
 #include <pthread.h>
 
+#define RING_SIZE	16384	/* size of the ring of messages of each thread, a power of 2 */
+#define BATCH_COUNT	64	/* maximum count of iovec written at once */
+
 static const char *appname;
 
 static int appauthority;
@@ -151,6 +185,271 @@ static const char chars[] = { '\n', '?', ':', ' ', '[', ',', ']' };
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * When asynchronous, each thread formats its messages in its own ring
+ * without locking and a background thread writes the rings in batches.
+ * The rings are single producer (the thread owning it) and single
+ * consumer (the writer, serialized by 'mutex'). The rings of the threads
+ * that exited are reused by the new threads.
+ */
+struct ring
+{
+	struct ring *next;	/**< next ring of the list */
+	int busy;		/**< is the ring used by a thread? */
+	unsigned head;		/**< write index, set by the owner */
+	unsigned tail;		/**< read index, set by the writer */
+	unsigned dropped;	/**< count of messages dropped because full */
+	char data[RING_SIZE];	/**< the messages */
+};
+
+/* the list of rings */
+static struct ring *rings;
+
+/* the ring of the current thread */
+static __thread struct ring *myring;
+
+/* key for releasing the rings when threads exit */
+static pthread_key_t ringkey;
+
+/* is the writer started? */
+static int async;
+
+/* wakeup flag of the writer */
+static uint32_t signaled;
+
+/* get the prefix of the level */
+static const char *prefix(int loglevel)
+{
+	const char *result = (colorize ? prefixes_colorized : prefixes)[CROP_LOGLEVEL(loglevel)];
+	return tty - 1 ? result + 4 : result;
+}
+
+/* writes the 'count' buffers of 'iov' completely */
+static void write_all(struct iovec *iov, int count)
+{
+	ssize_t rc;
+
+	while (count) {
+		rc = writev(STDERR_FILENO, iov, count);
+		if (rc < 0) {
+			if (errno != EINTR)
+				return;
+		} else {
+			while (count && (size_t)rc >= iov->iov_len) {
+				rc -= (ssize_t)iov->iov_len;
+				iov++;
+				count--;
+			}
+			if (count) {
+				iov->iov_base = (char*)iov->iov_base + rc;
+				iov->iov_len -= (size_t)rc;
+			}
+		}
+	}
+}
+
+/* writes the pending messages of the rings, returns the count of bytes written */
+static size_t drain()
+{
+	struct iovec iov[BATCH_COUNT + 1];
+	struct { struct ring *ring; unsigned head; } done[BATCH_COUNT];
+	struct ring *ring;
+	unsigned head, tail, len, off, dropped;
+	int n, d, i;
+	char lost[100];
+	size_t result;
+
+	result = 0;
+	dropped = 0;
+	pthread_mutex_lock(&mutex);
+	ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	while (ring) {
+		/* collect the pending messages of the rings in one batch */
+		n = d = 0;
+		for ( ; ring && n <= BATCH_COUNT - 2 ; ring = ring->next) {
+			dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+			tail = ring->tail;
+			head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			if (head == tail)
+				continue;
+			len = head - tail;
+			off = tail & (RING_SIZE - 1);
+			iov[n].iov_base = &ring->data[off];
+			if (off + len <= RING_SIZE)
+				iov[n++].iov_len = len;
+			else {
+				iov[n++].iov_len = RING_SIZE - off;
+				iov[n].iov_base = ring->data;
+				iov[n++].iov_len = len - (RING_SIZE - off);
+			}
+			done[d].ring = ring;
+			done[d++].head = head;
+			result += len;
+		}
+		if (dropped && !ring) {
+			iov[n].iov_base = lost;
+			iov[n++].iov_len = (size_t)snprintf(lost, sizeof lost, "%s: %u messages dropped\n",
+							prefix(Log_Level_Warning), dropped);
+		}
+
+		/* write it and release the space */
+		write_all(iov, n);
+		for (i = 0 ; i < d ; i++)
+			__atomic_store_n(&done[i].ring->tail, done[i].head, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+/* the background writer */
+static void *writer(void *arg)
+{
+	sigset_t sigs;
+
+	/* signals are for the other threads */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	for (;;) {
+		__atomic_exchange_n(&signaled, 0, __ATOMIC_SEQ_CST);
+		if (!drain())
+			syscall(SYS_futex, &signaled, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+	}
+	return NULL;
+}
+
+/* wakes the writer */
+static void wakeup()
+{
+	if (!__atomic_exchange_n(&signaled, 1, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &signaled, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* the writer doesn't exist in forked children */
+static void atfork_prepare()
+{
+	pthread_mutex_lock(&mutex);
+}
+
+static void atfork_parent()
+{
+	pthread_mutex_unlock(&mutex);
+}
+
+static void atfork_child()
+{
+	pthread_mutex_unlock(&mutex);
+	async = 0;
+}
+
+/* releases the ring of an exiting thread */
+static void release_ring(void *arg)
+{
+	struct ring *ring = arg;
+
+	__atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+}
+
+/* get the ring of the current thread */
+static struct ring *get_ring()
+{
+	struct ring *ring = myring;
+
+	if (!ring) {
+		/* reuse a released ring */
+		for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE) ; ring ; ring = ring->next)
+			if (!__atomic_load_n(&ring->busy, __ATOMIC_RELAXED)
+			 && !__atomic_exchange_n(&ring->busy, 1, __ATOMIC_ACQUIRE))
+				break;
+		/* or create a new ring */
+		if (!ring) {
+			ring = malloc(sizeof *ring);
+			if (!ring)
+				return NULL;
+			ring->busy = 1;
+			ring->head = ring->tail = 0;
+			ring->dropped = 0;
+			ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+			while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		}
+		pthread_setspecific(ringkey, ring);
+		myring = ring;
+	}
+	return ring;
+}
+
+/* put the message of the 'count' buffers of 'iov' in the ring of the thread, returns 0 on success */
+static int put_ring(struct iovec *iov, int count)
+{
+	struct ring *ring;
+	unsigned head, off;
+	size_t len, sz;
+	int i;
+
+	ring = get_ring();
+	if (!ring)
+		return -1;
+
+	for (len = 0, i = 0 ; i < count ; i++)
+		len += iov[i].iov_len;
+	head = ring->head;
+	if (len > RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	for (i = 0 ; i < count ; i++) {
+		off = head & (RING_SIZE - 1);
+		len = iov[i].iov_len;
+		sz = RING_SIZE - off;
+		if (len <= sz)
+			memcpy(&ring->data[off], iov[i].iov_base, len);
+		else {
+			memcpy(&ring->data[off], iov[i].iov_base, sz);
+			memcpy(ring->data, (char*)iov[i].iov_base + sz, len - sz);
+		}
+		head += (unsigned)len;
+	}
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* formats 'fmt' in 'buffer' if it only has %s or %%, returns the length or -1 if not possible */
+static int format_simple(char *buffer, size_t size, const char *fmt, va_list args)
+{
+	const char *f, *s;
+	size_t n, len;
+
+	for (f = fmt ; (f = strchr(f, '%')) ; f += 2)
+		if (f[1] != 's' && f[1] != '%')
+			return -1;
+
+	n = 0;
+	while (*fmt) {
+		f = strchr(fmt, '%');
+		if (!f) {
+			s = fmt;
+			len = strlen(fmt);
+			fmt += len;
+		} else if (f != fmt) {
+			s = fmt;
+			len = (size_t)(f - fmt);
+			fmt = f;
+		} else if (fmt[1] == '%') {
+			s = fmt;
+			len = 1;
+			fmt += 2;
+		} else {
+			s = va_arg(args, const char*) ?: "(null)";
+			len = strlen(s);
+			fmt += 2;
+		}
+		if (n < size)
+			memcpy(&buffer[n], s, len < size - n ? len : size - n);
+		n += len;
+	}
+	return n > INT_MAX ? INT_MAX : (int)n;
+}
+
 static void _vverbose_(int loglevel, const char *file, int line, const char *function, const char *fmt, va_list args)
 {
 	char buffer[4000];
@@ -166,10 +465,7 @@ static void _vverbose_(int loglevel, const char *file, int line, const char *fun
 		tty = 1 + isatty(STDERR_FILENO);
 
 	/* prefix */
-	if (colorize)
-		iov[0].iov_base = (void*)prefixes_colorized[CROP_LOGLEVEL(loglevel)] + (tty - 1 ? 4 : 0);
-	else
-		iov[0].iov_base = (void*)prefixes[CROP_LOGLEVEL(loglevel)] + (tty - 1 ? 4 : 0);
+	iov[0].iov_base = (void*)prefix(loglevel);
 	iov[0].iov_len = strlen(iov[0].iov_base);
 
 	/* " " */
@@ -178,15 +474,24 @@ static void _vverbose_(int loglevel, const char *file, int line, const char *fun
 
 	n = 2;
 	if (fmt) {
-		iov[n].iov_base = buffer;
-		errno = saverr;
-		rc = vsnprintf(buffer, sizeof buffer, fmt, args);
-		if (rc < 0)
-			rc = 0;
-		else if ((size_t)rc > sizeof buffer) {
-			/* if too long, ellipsis the end with ... */
-			rc = (int)sizeof buffer;
-			buffer[rc - 1] = buffer[rc - 2]  = buffer[rc - 3] = '.';
+		if (!strchr(fmt, '%')) {
+			/* constant message */
+			iov[n].iov_base = (void*)fmt;
+			rc = (int)strlen(fmt);
+		} else {
+			iov[n].iov_base = buffer;
+			rc = format_simple(buffer, sizeof buffer, fmt, args);
+			if (rc < 0) {
+				errno = saverr;
+				rc = vsnprintf(buffer, sizeof buffer, fmt, args);
+			}
+			if (rc < 0)
+				rc = 0;
+			else if ((size_t)rc > sizeof buffer) {
+				/* if too long, ellipsis the end with ... */
+				rc = (int)sizeof buffer;
+				buffer[rc - 1] = buffer[rc - 2]  = buffer[rc - 3] = '.';
+			}
 		}
 		iov[n++].iov_len = (size_t)rc;
 	}
@@ -247,9 +552,17 @@ static void _vverbose_(int loglevel, const char *file, int line, const char *fun
 	iov[n++].iov_len = 1;
 
 	/* emit the message */
-	pthread_mutex_lock(&mutex);
-	writev(STDERR_FILENO, iov, n);
-	pthread_mutex_unlock(&mutex);
+	if (async && !put_ring(iov, n)) {
+		/* errors are written before returning */
+		if (loglevel <= Log_Level_Error)
+			drain();
+		else
+			wakeup();
+	} else {
+		pthread_mutex_lock(&mutex);
+		writev(STDERR_FILENO, iov, n);
+		pthread_mutex_unlock(&mutex);
+	}
 
 	/* restore errno */
 	errno = saverr;
@@ -261,11 +574,133 @@ void verbose_set_name(const char *name, int authority)
 	appauthority = authority;
 }
 
+/**
+ * Writes the messages from a background thread. The messages are
+ * dropped, and the count of dropped messages reported, when a thread
+ * logs faster than the output accepts. Errors and messages of higher
+ * levels are written before returning.
+ *
+ * @return 0 on success or -1 with errno set
+ */
+int verbose_async_start()
+{
+	int rc;
+	pthread_t tid;
+
+	if (async)
+		return 0;
+
+	rc = pthread_key_create(&ringkey, release_ring);
+	if (!rc) {
+		rc = pthread_create(&tid, NULL, writer, NULL);
+		if (rc)
+			pthread_key_delete(ringkey);
+	}
+	if (rc) {
+		errno = rc;
+		return -1;
+	}
+	pthread_detach(tid);
+	pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+	atexit(verbose_flush);
+	async = 1;
+	return 0;
+}
+
+/**
+ * Writes the pending messages
+ */
+void verbose_flush()
+{
+	if (async)
+		drain();
+}
+
 #endif
 
+/*
+ * Rate limiting of the messages by call site, the call sites being
+ * identified by file and line or by format. It is approximate: call
+ * sites can share a slot and concurrent updates of a slot can race.
+ */
+struct ratelimit
+{
+	const void *key;	/**< file or format of the call site */
+	int line;		/**< line of the call site */
+	unsigned second;	/**< current period */
+	unsigned count;		/**< count of messages of the period */
+	unsigned suppressed;	/**< count of messages suppressed */
+};
+
+static struct ratelimit ratelimits[RATELIMIT_SLOTS];
+
+static unsigned ratelimit;
+
+/* checks the rate of the call site, returns 0 if the message is suppressed */
+static int ratelimit_check(const char *file, int line, const char *fmt, unsigned *suppressed)
+{
+	const void *key = file ?: fmt;
+	struct ratelimit *rl;
+	struct timespec ts;
+	unsigned now;
+	uintptr_t h;
+
+	h = (uintptr_t)key;
+	h = (h ^ (h >> 7)) + (uintptr_t)line * 31;
+	rl = &ratelimits[(h ^ (h >> 9)) & (RATELIMIT_SLOTS - 1)];
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	now = (unsigned)ts.tv_sec;
+	*suppressed = 0;
+	if (__atomic_load_n(&rl->key, __ATOMIC_RELAXED) != key || __atomic_load_n(&rl->line, __ATOMIC_RELAXED) != line) {
+		/* the slot changes of call site */
+		__atomic_store_n(&rl->key, key, __ATOMIC_RELAXED);
+		__atomic_store_n(&rl->line, line, __ATOMIC_RELAXED);
+		__atomic_store_n(&rl->second, now, __ATOMIC_RELAXED);
+		__atomic_store_n(&rl->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+	} else if (__atomic_exchange_n(&rl->second, now, __ATOMIC_RELAXED) != now) {
+		/* new period */
+		__atomic_store_n(&rl->count, 0, __ATOMIC_RELAXED);
+		*suppressed = __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+	}
+	if (__atomic_add_fetch(&rl->count, 1, __ATOMIC_RELAXED) <= ratelimit)
+		return 1;
+	__atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void _verbose_(int loglevel, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	_vverbose_(loglevel, file, line, function, fmt, ap);
+	va_end(ap);
+}
+
+/**
+ * Set the maximum count of messages per second of each call site,
+ * except for levels critical and above. Zero, the default, is unlimited.
+ *
+ * @param count the maximum count of messages per second
+ */
+void verbose_set_ratelimit(unsigned count)
+{
+	ratelimit = count;
+}
+
 void vverbose(int loglevel, const char *file, int line, const char *function, const char *fmt, va_list args)
 {
 	void (*observer)(int loglevel, const char *file, int line, const char *function, const char *fmt, va_list args) = verbose_observer;
+	unsigned suppressed;
+
+	if (ratelimit && loglevel > Log_Level_Critical) {
+		if (!ratelimit_check(file, line, fmt, &suppressed))
+			return;
+		if (suppressed)
+			_verbose_(loglevel, file, line, function, "%u similar messages suppressed", suppressed);
+	}
 
 	if (!observer)
 		_vverbose_(loglevel, file, line, function, fmt, args);
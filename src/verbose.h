@@ -112,6 +112,10 @@ extern void verbose_sub(int level);
 extern void verbose_colorize();
 extern int verbose_is_colorized();
 
+extern int verbose_async_start();
+extern void verbose_flush();
+extern void verbose_set_ratelimit(unsigned count);
+
 extern int verbose_level_of_name(const char *name);
 extern const char *verbose_name_of_level(int level);
 
@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+
+#include "websock-simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define WITH_X86 1
+# include <immintrin.h>
+#else
+# define WITH_X86 0
+#endif
+
+/* the level in use or -1 before detection */
+static int level = -1;
+
+/*************************************************************************
+ * generic implementation
+ ************************************************************************/
+
+/*
+ * Returns 'mask' rotated of 'count' bytes
+ */
+static uint32_t rotate(uint32_t mask, size_t count)
+{
+	uint8_t m[8];
+
+	memcpy(m, &mask, 4);
+	memcpy(m + 4, &mask, 4);
+	memcpy(&mask, m + (count & 3), 4);
+	return mask;
+}
+
+static uint32_t mask_generic(uint8_t *buffer, size_t size, uint32_t mask)
+{
+	uint64_t m64, w;
+	uint8_t m[4];
+	size_t i;
+
+	m64 = ((uint64_t)mask << 32) | (uint64_t)mask;
+	for (i = 0 ; i + 8 <= size ; i += 8) {
+		memcpy(&w, buffer + i, 8);
+		w ^= m64;
+		memcpy(buffer + i, &w, 8);
+	}
+	memcpy(m, &mask, 4);
+	for ( ; i < size ; i++)
+		buffer[i] ^= m[i & 3];
+	return rotate(mask, size);
+}
+
+static int utf8_valid_generic(const uint8_t *text, size_t size)
+{
+	uint64_t w;
+	uint8_t c, lo, hi;
+	size_t n, i;
+
+	while (size) {
+		/* skip ascii words */
+		if (size >= 8) {
+			memcpy(&w, text, 8);
+			if (!(w & UINT64_C(0x8080808080808080))) {
+				text += 8;
+				size -= 8;
+				continue;
+			}
+		}
+		c = *text;
+		if (c < 0x80) {
+			text++;
+			size--;
+			continue;
+		}
+		lo = 0x80;
+		hi = 0xbf;
+		if (c < 0xc2)
+			return 0;
+		if (c < 0xe0)
+			n = 2;
+		else if (c < 0xf0) {
+			n = 3;
+			if (c == 0xe0)
+				lo = 0xa0; /* overlong */
+			else if (c == 0xed)
+				hi = 0x9f; /* surrogates */
+		} else if (c < 0xf5) {
+			n = 4;
+			if (c == 0xf0)
+				lo = 0x90; /* overlong */
+			else if (c == 0xf4)
+				hi = 0x8f; /* above U+10FFFF */
+		} else
+			return 0;
+		if (size < n || text[1] < lo || text[1] > hi)
+			return 0;
+		for (i = 2 ; i < n ; i++)
+			if ((text[i] & 0xc0) != 0x80)
+				return 0;
+		text += n;
+		size -= n;
+	}
+	return 1;
+}
+
+#if WITH_X86
+
+/*************************************************************************
+ * SSE2 implementation
+ ************************************************************************/
+
+__attribute__((target("sse2")))
+static uint32_t mask_sse2(uint8_t *buffer, size_t size, uint32_t mask)
+{
+	__m128i m, a, b, c, d;
+	size_t i;
+
+	m = _mm_set1_epi32((int)mask);
+	for (i = 0 ; i + 64 <= size ; i += 64) {
+		a = _mm_loadu_si128((const __m128i*)(buffer + i));
+		b = _mm_loadu_si128((const __m128i*)(buffer + i + 16));
+		c = _mm_loadu_si128((const __m128i*)(buffer + i + 32));
+		d = _mm_loadu_si128((const __m128i*)(buffer + i + 48));
+		_mm_storeu_si128((__m128i*)(buffer + i), _mm_xor_si128(a, m));
+		_mm_storeu_si128((__m128i*)(buffer + i + 16), _mm_xor_si128(b, m));
+		_mm_storeu_si128((__m128i*)(buffer + i + 32), _mm_xor_si128(c, m));
+		_mm_storeu_si128((__m128i*)(buffer + i + 48), _mm_xor_si128(d, m));
+	}
+	for ( ; i + 16 <= size ; i += 16) {
+		a = _mm_loadu_si128((const __m128i*)(buffer + i));
+		_mm_storeu_si128((__m128i*)(buffer + i), _mm_xor_si128(a, m));
+	}
+	return mask_generic(buffer + i, size - i, mask);
+}
+
+/*************************************************************************
+ * AVX2 implementation
+ ************************************************************************/
+
+__attribute__((target("avx2")))
+static uint32_t mask_avx2(uint8_t *buffer, size_t size, uint32_t mask)
+{
+	__m256i m, a, b, c, d;
+	__m128i h;
+	size_t i;
+
+	m = _mm256_set1_epi32((int)mask);
+	for (i = 0 ; i + 128 <= size ; i += 128) {
+		a = _mm256_loadu_si256((const __m256i*)(buffer + i));
+		b = _mm256_loadu_si256((const __m256i*)(buffer + i + 32));
+		c = _mm256_loadu_si256((const __m256i*)(buffer + i + 64));
+		d = _mm256_loadu_si256((const __m256i*)(buffer + i + 96));
+		_mm256_storeu_si256((__m256i*)(buffer + i), _mm256_xor_si256(a, m));
+		_mm256_storeu_si256((__m256i*)(buffer + i + 32), _mm256_xor_si256(b, m));
+		_mm256_storeu_si256((__m256i*)(buffer + i + 64), _mm256_xor_si256(c, m));
+		_mm256_storeu_si256((__m256i*)(buffer + i + 96), _mm256_xor_si256(d, m));
+	}
+	for ( ; i + 32 <= size ; i += 32) {
+		a = _mm256_loadu_si256((const __m256i*)(buffer + i));
+		_mm256_storeu_si256((__m256i*)(buffer + i), _mm256_xor_si256(a, m));
+	}
+	if (i + 16 <= size) {
+		h = _mm_loadu_si128((const __m128i*)(buffer + i));
+		_mm_storeu_si128((__m128i*)(buffer + i), _mm_xor_si128(h, _mm256_castsi256_si128(m)));
+		i += 16;
+	}
+	/* avoid the penalty of transition to legacy SSE */
+	_mm256_zeroupper();
+	return mask_generic(buffer + i, size - i, mask);
+}
+
+/*
+ * The validation of UTF-8 below is the lookup algorithm of
+ * John Keiser and Daniel Lemire ("Validating UTF-8 In Less Than One
+ * Instruction Per Byte", 2020): the errors are detected by looking up
+ * the high nibble of each byte and both nibbles of the byte before it
+ * in tables whose bits are the possible errors.
+ */
+#define TOO_SHORT	(1 << 0)	/* lead byte not followed by a continuation */
+#define TOO_LONG	(1 << 1)	/* continuation after an ascii byte */
+#define OVERLONG_3	(1 << 2)	/* E0 followed by 80..9F */
+#define TOO_LARGE	(1 << 3)	/* above U+10FFFF */
+#define SURROGATE	(1 << 4)	/* ED followed by A0..BF */
+#define OVERLONG_2	(1 << 5)	/* C0 or C1 */
+#define TOO_LARGE_1000	(1 << 6)	/* F5..FF or F4 followed by 90..BF */
+#define OVERLONG_4	(1 << 6)	/* F0 followed by 80..8F */
+#define TWO_CONTS	(1 << 7)	/* continuation after a continuation */
+#define CARRY		(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define TABLE(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p) \
+	_mm256_setr_epi8( \
+		(char)(a),(char)(b),(char)(c),(char)(d),(char)(e),(char)(f),(char)(g),(char)(h), \
+		(char)(i),(char)(j),(char)(k),(char)(l),(char)(m),(char)(n),(char)(o),(char)(p), \
+		(char)(a),(char)(b),(char)(c),(char)(d),(char)(e),(char)(f),(char)(g),(char)(h), \
+		(char)(i),(char)(j),(char)(k),(char)(l),(char)(m),(char)(n),(char)(o),(char)(p))
+
+/* bytes of 'input' shifted of 'n' with the last bytes of 'prev' entering */
+#define PREV(input,prev,n) \
+	_mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static inline __m256i high_nibbles(__m256i v)
+{
+	return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+}
+
+/*
+ * Returns the errors of the block 'input' preceded by the block 'prev'
+ */
+__attribute__((target("avx2")))
+static __m256i utf8_errors_avx2(__m256i input, __m256i prev)
+{
+	__m256i prev1, prev2, prev3, b1h, b1l, b2h, special, must23;
+
+	prev1 = PREV(input, prev, 1);
+	b1h = _mm256_shuffle_epi8(TABLE(
+			TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+			TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+			TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+			TOO_SHORT | OVERLONG_2,
+			TOO_SHORT,
+			TOO_SHORT | OVERLONG_3 | SURROGATE,
+			TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+		high_nibbles(prev1));
+	b1l = _mm256_shuffle_epi8(TABLE(
+			CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+			CARRY | OVERLONG_2,
+			CARRY,
+			CARRY,
+			CARRY | TOO_LARGE,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000),
+		_mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)));
+	b2h = _mm256_shuffle_epi8(TABLE(
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+		high_nibbles(input));
+	special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+	/* third and fourth bytes of sequences must be continuations */
+	prev2 = PREV(input, prev, 2);
+	prev3 = PREV(input, prev, 3);
+	must23 = _mm256_or_si256(
+			_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80))),
+			_mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80))));
+	must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+	return _mm256_xor_si256(must23, special);
+}
+
+/*
+ * Returns not zero where the end of 'input' is an incomplete sequence
+ */
+__attribute__((target("avx2")))
+static __m256i utf8_incomplete_avx2(__m256i input)
+{
+	return _mm256_subs_epu8(input, _mm256_setr_epi8(
+			-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1,
+			(char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1)));
+}
+
+__attribute__((target("avx2")))
+static int utf8_valid_avx2(const uint8_t *text, size_t size)
+{
+	__m256i input, prev, error, incomplete;
+	uint8_t last[32];
+	size_t i;
+
+	prev = error = incomplete = _mm256_setzero_si256();
+	for (i = 0 ; i < size ; i += 32) {
+		if (i + 32 <= size)
+			input = _mm256_loadu_si256((const __m256i*)(text + i));
+		else {
+			/* zeros are ascii */
+			memset(last, 0, sizeof last);
+			memcpy(last, text + i, size - i);
+			input = _mm256_loadu_si256((const __m256i*)last);
+		}
+		if (!_mm256_movemask_epi8(input)) {
+			error = _mm256_or_si256(error, incomplete);
+			incomplete = _mm256_setzero_si256();
+		} else {
+			error = _mm256_or_si256(error, utf8_errors_avx2(input, prev));
+			incomplete = utf8_incomplete_avx2(input);
+		}
+		prev = input;
+	}
+	error = _mm256_or_si256(error, incomplete);
+	return _mm256_testz_si256(error, error);
+}
+
+#endif
+
+/*************************************************************************
+ * dispatch
+ ************************************************************************/
+
+static int detect()
+{
+#if WITH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return WEBSOCK_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return WEBSOCK_SIMD_SSE2;
+#endif
+	return WEBSOCK_SIMD_GENERIC;
+}
+
+int websock_simd_level()
+{
+	if (level < 0)
+		level = detect();
+	return level;
+}
+
+int websock_simd_set_level(int lvl)
+{
+	int best = detect();
+
+	level = lvl < best ? (lvl < 0 ? WEBSOCK_SIMD_GENERIC : lvl) : best;
+	return level;
+}
+
+uint32_t websock_simd_mask(void *buffer, size_t size, uint32_t mask)
+{
+	/* vectors don't pay for small sizes */
+	if (size < 64)
+		return mask_generic(buffer, size, mask);
+
+	switch (websock_simd_level()) {
+#if WITH_X86
+	case WEBSOCK_SIMD_AVX2:
+		return mask_avx2(buffer, size, mask);
+	case WEBSOCK_SIMD_SSE2:
+		return mask_sse2(buffer, size, mask);
+#endif
+	default:
+		return mask_generic(buffer, size, mask);
+	}
+}
+
+int websock_simd_utf8_valid(const void *text, size_t size)
+{
+	switch (websock_simd_level()) {
+#if WITH_X86
+	case WEBSOCK_SIMD_AVX2:
+		return utf8_valid_avx2(text, size);
+#endif
+	default:
+		return utf8_valid_generic(text, size);
+	}
+}
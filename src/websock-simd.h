@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018 "IoT.bzh"
+ * Author José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Levels of implementation of the functions below. The best level
+ * supported by the processor is selected at the first use.
+ */
+#define WEBSOCK_SIMD_GENERIC	0
+#define WEBSOCK_SIMD_SSE2	1
+#define WEBSOCK_SIMD_AVX2	2
+
+/*
+ * XORs in place the 'size' bytes of 'buffer' with the 'mask' of the
+ * frame. The first byte of 'mask' in memory applies to the first byte
+ * of 'buffer'. Returns the mask to use for the bytes that follow.
+ */
+extern uint32_t websock_simd_mask(void *buffer, size_t size, uint32_t mask);
+
+/*
+ * Returns 1 if the 'size' bytes of 'text' are valid UTF-8 or 0 otherwise.
+ */
+extern int websock_simd_utf8_valid(const void *text, size_t size);
+
+/*
+ * Returns the level of implementation in use.
+ */
+extern int websock_simd_level();
+
+/*
+ * Restricts the level of implementation to at most 'level' and returns
+ * the level in use. Intended for tests and benchmarks.
+ */
+extern int websock_simd_set_level(int level);
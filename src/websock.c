@@ -28,6 +28,7 @@
 #include <sys/uio.h>
 
 #include "websock.h"
+#include "websock-simd.h"
 
 #if !defined(WEBSOCKET_DEFAULT_MAXLENGTH)
 #  define WEBSOCKET_DEFAULT_MAXLENGTH 1048500  /* 76 less than 1M, probably enougth for headers */
@@ -49,13 +50,6 @@
 #define FRAME_SET_MASK(BYTE)        (((BYTE) & 0x01) << 7)
 #define FRAME_SET_LENGTH(X64, IDX)  (unsigned char)((sizeof(X64)) <= (IDX) ? 0 : (((X64) >> ((IDX)*8)) & 0xFF))
 
-#define OPCODE_CONTINUATION 0x0
-#define OPCODE_TEXT         0x1
-#define OPCODE_BINARY       0x2
-#define OPCODE_CLOSE        0x8
-#define OPCODE_PING         0x9
-#define OPCODE_PONG         0xA
-
 #define STATE_INIT    0
 #define STATE_START   1
 #define STATE_LENGTH  2
@@ -162,8 +156,8 @@ static inline int websock_send_v(struct websock *ws, int last, int rsv1, int rsv
 {
 	unsigned char first = (unsigned char)(FRAME_SET_FIN(last)
 				| FRAME_SET_RSV1(rsv1)
-				| FRAME_SET_RSV1(rsv2)
-				| FRAME_SET_RSV1(rsv3)
+				| FRAME_SET_RSV2(rsv2)
+				| FRAME_SET_RSV3(rsv3)
 				| FRAME_SET_OPCODE(opcode));
 	return websock_send_internal_v(ws, first, iovec, count);
 }
@@ -172,8 +166,8 @@ static inline int websock_send(struct websock *ws, int last, int rsv1, int rsv2,
 {
 	unsigned char first = (unsigned char)(FRAME_SET_FIN(last)
 				| FRAME_SET_RSV1(rsv1)
-				| FRAME_SET_RSV1(rsv2)
-				| FRAME_SET_RSV1(rsv3)
+				| FRAME_SET_RSV2(rsv2)
+				| FRAME_SET_RSV3(rsv3)
 				| FRAME_SET_OPCODE(opcode));
 	return websock_send_internal(ws, first, buffer, size);
 }
@@ -189,7 +183,7 @@ int websock_close(struct websock *ws, uint16_t code, const void *data, size_t le
 	struct iovec iov[2];
 
 	if (code == WEBSOCKET_CODE_NOT_SET && length == 0)
-		return websock_send(ws, 1, 0, 0, 0, OPCODE_CLOSE, NULL, 0);
+		return websock_send(ws, 1, 0, 0, 0, WEBSOCKET_OPCODE_CLOSE, NULL, 0);
 
 	/* checks the length */
 	if (length > 123) {
@@ -206,7 +200,7 @@ int websock_close(struct websock *ws, uint16_t code, const void *data, size_t le
 	iov[0].iov_len = 2;
 	iov[1].iov_base = (void *)data;
 	iov[1].iov_len = length;
-	return websock_send_v(ws, 1, 0, 0, 0, OPCODE_CLOSE, iov, 2);
+	return websock_send_v(ws, 1, 0, 0, 0, WEBSOCKET_OPCODE_CLOSE, iov, 2);
 }
 
 int websock_ping(struct websock *ws, const void *data, size_t length)
@@ -217,7 +211,7 @@ int websock_ping(struct websock *ws, const void *data, size_t length)
 		return -1;
 	}
 
-	return websock_send(ws, 1, 0, 0, 0, OPCODE_PING, data, length);
+	return websock_send(ws, 1, 0, 0, 0, WEBSOCKET_OPCODE_PING, data, length);
 }
 
 int websock_pong(struct websock *ws, const void *data, size_t length)
@@ -228,37 +222,47 @@ int websock_pong(struct websock *ws, const void *data, size_t length)
 		return -1;
 	}
 
-	return websock_send(ws, 1, 0, 0, 0, OPCODE_PONG, data, length);
+	return websock_send(ws, 1, 0, 0, 0, WEBSOCKET_OPCODE_PONG, data, length);
 }
 
 int websock_text(struct websock *ws, int last, const void *text, size_t length)
 {
-	return websock_send(ws, last, 0, 0, 0, OPCODE_TEXT, text, length);
+	return websock_send(ws, last, 0, 0, 0, WEBSOCKET_OPCODE_TEXT, text, length);
 }
 
 int websock_text_v(struct websock *ws, int last, const struct iovec *iovec, int count)
 {
-	return websock_send_v(ws, last, 0, 0, 0, OPCODE_TEXT, iovec, count);
+	return websock_send_v(ws, last, 0, 0, 0, WEBSOCKET_OPCODE_TEXT, iovec, count);
 }
 
 int websock_binary(struct websock *ws, int last, const void *data, size_t length)
 {
-	return websock_send(ws, last, 0, 0, 0, OPCODE_BINARY, data, length);
+	return websock_send(ws, last, 0, 0, 0, WEBSOCKET_OPCODE_BINARY, data, length);
 }
 
 int websock_binary_v(struct websock *ws, int last, const struct iovec *iovec, int count)
 {
-	return websock_send_v(ws, last, 0, 0, 0, OPCODE_BINARY, iovec, count);
+	return websock_send_v(ws, last, 0, 0, 0, WEBSOCKET_OPCODE_BINARY, iovec, count);
+}
+
+int websock_text_compressed(struct websock *ws, int last, const void *data, size_t length)
+{
+	return websock_send(ws, last, 1, 0, 0, WEBSOCKET_OPCODE_TEXT, data, length);
+}
+
+int websock_binary_compressed(struct websock *ws, int last, const void *data, size_t length)
+{
+	return websock_send(ws, last, 1, 0, 0, WEBSOCKET_OPCODE_BINARY, data, length);
 }
 
 int websock_continue(struct websock *ws, int last, const void *data, size_t length)
 {
-	return websock_send(ws, last, 0, 0, 0, OPCODE_CONTINUATION, data, length);
+	return websock_send(ws, last, 0, 0, 0, WEBSOCKET_OPCODE_CONTINUATION, data, length);
 }
 
 int websock_continue_v(struct websock *ws, int last, const struct iovec *iovec, int count)
 {
-	return websock_send_v(ws, last, 0, 0, 0, OPCODE_CONTINUATION, iovec, count);
+	return websock_send_v(ws, last, 0, 0, 0, WEBSOCKET_OPCODE_CONTINUATION, iovec, count);
 }
 
 int websock_error(struct websock *ws, uint16_t code, const void *data, size_t size)
@@ -292,7 +296,7 @@ static int check_control_header(struct websock *ws)
 		return 0;
 	if (FRAME_GET_PAYLOAD_LEN(ws->header[1]) > 125)
 		return 0;
-	if (FRAME_GET_OPCODE(ws->header[0]) == OPCODE_CLOSE)
+	if (FRAME_GET_OPCODE(ws->header[0]) == WEBSOCKET_OPCODE_CLOSE)
 		return FRAME_GET_PAYLOAD_LEN(ws->header[1]) != 1;
 	return 1;
 }
@@ -316,18 +320,18 @@ loop:
 			return 0;
 		/* fast track */
 		switch (FRAME_GET_OPCODE(ws->header[0])) {
-		case OPCODE_CONTINUATION:
-		case OPCODE_TEXT:
-		case OPCODE_BINARY:
+		case WEBSOCKET_OPCODE_CONTINUATION:
+		case WEBSOCKET_OPCODE_TEXT:
+		case WEBSOCKET_OPCODE_BINARY:
 			break;
-		case OPCODE_CLOSE:
+		case WEBSOCKET_OPCODE_CLOSE:
 			if (!check_control_header(ws))
 				goto protocol_error;
 			if (FRAME_GET_PAYLOAD_LEN(ws->header[1]))
 				ws->szhead += 2;
 			break;
-		case OPCODE_PING:
-		case OPCODE_PONG:
+		case WEBSOCKET_OPCODE_PING:
+		case WEBSOCKET_OPCODE_PONG:
 			if (!check_control_header(ws))
 				goto protocol_error;
 		default:
@@ -374,7 +378,7 @@ loop:
 			ws->length = FRAME_GET_PAYLOAD_LEN(ws->header[1]);
 			break;
 		}
-		if (FRAME_GET_OPCODE(ws->header[0]) == OPCODE_CLOSE && ws->length != 0)
+		if (FRAME_GET_OPCODE(ws->header[0]) == WEBSOCKET_OPCODE_CLOSE && ws->length != 0)
 			ws->length -= 2;
 		if (ws->length > ws->maxlength)
 			goto too_long_error;
@@ -412,28 +416,28 @@ loop:
 
 		/* handle */
 		switch (FRAME_GET_OPCODE(ws->header[0])) {
-		case OPCODE_CONTINUATION:
+		case WEBSOCKET_OPCODE_CONTINUATION:
 			ws->itf->on_continue(ws->closure,
 					     FRAME_GET_FIN(ws->header[0]),
 					     (size_t) ws->length);
 			if (!loop)
 				return 0;
 			break;
-		case OPCODE_TEXT:
+		case WEBSOCKET_OPCODE_TEXT:
 			ws->itf->on_text(ws->closure,
 					 FRAME_GET_FIN(ws->header[0]),
 					 (size_t) ws->length);
 			if (!loop)
 				return 0;
 			break;
-		case OPCODE_BINARY:
+		case WEBSOCKET_OPCODE_BINARY:
 			ws->itf->on_binary(ws->closure,
 					   FRAME_GET_FIN(ws->header[0]),
 					   (size_t) ws->length);
 			if (!loop)
 				return 0;
 			break;
-		case OPCODE_CLOSE:
+		case WEBSOCKET_OPCODE_CLOSE:
 			if (ws->length == 0)
 				code = WEBSOCKET_CODE_NOT_SET;
 			else {
@@ -443,7 +447,7 @@ loop:
 			}
 			ws->itf->on_close(ws->closure, code, (size_t) ws->length);
 			return 0;
-		case OPCODE_PING:
+		case WEBSOCKET_OPCODE_PING:
 			if (ws->itf->on_ping)
 				ws->itf->on_ping(ws->closure, ws->length);
 			else {
@@ -454,7 +458,7 @@ loop:
 			if (!loop)
 				return 0;
 			break;
-		case OPCODE_PONG:
+		case WEBSOCKET_OPCODE_PONG:
 			if (ws->itf->on_pong)
 				ws->itf->on_pong(ws->closure, ws->length);
 			else
@@ -485,40 +489,6 @@ loop:
 	return 0;
 }
 
-static void unmask(struct websock * ws, void *buffer, size_t size)
-{
-	uint32_t mask, *b32;
-	uint8_t m, *b8;
-
-	mask = ws->mask;
-	b8 = buffer;
-	while (size && ((sizeof(uint32_t) - 1) & (uintptr_t) b8)) {
-		m = ((uint8_t *) & mask)[0];
-		((uint8_t *) & mask)[0] = ((uint8_t *) & mask)[1];
-		((uint8_t *) & mask)[1] = ((uint8_t *) & mask)[2];
-		((uint8_t *) & mask)[2] = ((uint8_t *) & mask)[3];
-		((uint8_t *) & mask)[3] = m;
-		*b8++ ^= m;
-		size--;
-	}
-	b32 = (uint32_t *) b8;
-	while (size >= sizeof(uint32_t)) {
-		*b32++ ^= mask;
-		size -= sizeof(uint32_t);
-	}
-	b8 = (uint8_t *) b32;
-	while (size) {
-		m = ((uint8_t *) & mask)[0];
-		((uint8_t *) & mask)[0] = ((uint8_t *) & mask)[1];
-		((uint8_t *) & mask)[1] = ((uint8_t *) & mask)[2];
-		((uint8_t *) & mask)[2] = ((uint8_t *) & mask)[3];
-		((uint8_t *) & mask)[3] = m;
-		*b8++ ^= m;
-		size--;
-	}
-	ws->mask = mask;
-}
-
 ssize_t websock_read(struct websock * ws, void *buffer, size_t size)
 {
 	ssize_t rc;
@@ -535,7 +505,7 @@ ssize_t websock_read(struct websock * ws, void *buffer, size_t size)
 		ws->length -= size;
 
 		if (ws->mask != 0)
-			unmask(ws, buffer, size);
+			ws->mask = websock_simd_mask(buffer, size, ws->mask);
 	}
 	return rc;
 }
@@ -576,6 +546,11 @@ void websock_set_max_length(struct websock *ws, size_t maxlen)
 	ws->maxlength = (uint64_t)maxlen;
 }
 
+size_t websock_get_max_length(struct websock *ws)
+{
+	return (size_t)ws->maxlength;
+}
+
 const char *websocket_explain_error(uint16_t code)
 {
 	static const char *msgs[] = {
@@ -37,6 +37,13 @@ struct iovec;
 #define WEBSOCKET_CODE_MESSAGE_TOO_LARGE 1009
 #define WEBSOCKET_CODE_INTERNAL_ERROR    1011
 
+#define WEBSOCKET_OPCODE_CONTINUATION 0x0
+#define WEBSOCKET_OPCODE_TEXT         0x1
+#define WEBSOCKET_OPCODE_BINARY       0x2
+#define WEBSOCKET_OPCODE_CLOSE        0x8
+#define WEBSOCKET_OPCODE_PING         0x9
+#define WEBSOCKET_OPCODE_PONG         0xA
+
 struct websock_itf {
 	ssize_t (*writev) (void *, const struct iovec *, int);
 	ssize_t (*readv) (void *, const struct iovec *, int);
@@ -64,6 +71,8 @@ extern int websock_text(struct websock *ws, int last, const void *text, size_t l
 extern int websock_text_v(struct websock *ws, int last, const struct iovec *iovec, int count);
 extern int websock_binary(struct websock *ws, int last, const void *data, size_t length);
 extern int websock_binary_v(struct websock *ws, int last, const struct iovec *iovec, int count);
+extern int websock_text_compressed(struct websock *ws, int last, const void *data, size_t length);
+extern int websock_binary_compressed(struct websock *ws, int last, const void *data, size_t length);
 extern int websock_continue(struct websock *ws, int last, const void *data, size_t length);
 extern int websock_continue_v(struct websock *ws, int last, const struct iovec *iovec, int count);
 
@@ -77,5 +86,6 @@ extern void websock_destroy(struct websock *ws);
 
 extern void websock_set_default_max_length(size_t maxlen);
 extern void websock_set_max_length(struct websock *ws, size_t maxlen);
+extern size_t websock_get_max_length(struct websock *ws);
 
 extern const char *websocket_explain_error(uint16_t code);
@@ -852,6 +852,852 @@ int wrap_json_unpack(struct json_object *object, const char *desc, ...)
 	return rc;
 }
 
+/*
+ * Precompiled descriptors
+ *
+ * The descriptors are compiled to programs of operations, one for
+ * packing and one for unpacking, that don't have to parse the
+ * descriptor again. The compilation reports the syntax errors of
+ * the descriptor with the same codes and positions than the
+ * interpreted functions.
+ */
+
+/* operations of the programs */
+enum {
+	op_null,
+	op_bool,
+	op_int,
+	op_int64,
+	op_double,
+	op_double_lax,
+	op_string,
+	op_object,
+	op_bytes,
+	op_array_begin,
+	op_object_begin,
+	op_end,
+	op_key,
+	op_bang
+};
+
+/* flags of the operations */
+#define OPF_REF		1	/* 'O': a reference is taken */
+#define OPF_URL		2	/* 'y': base64 url variant */
+#define OPF_OPT		4	/* '?': nullable value or optional key */
+#define OPF_STAR	8	/* '*': dropped when null or empty (pack) */
+#define OPF_SIZE	16	/* '%': size of the string (unpack) */
+#define OPF_ELEM	32	/* element of an array (unpack) */
+#define OPF_VALUE	64	/* value of a key (unpack) */
+
+#define PROGRAM_BUCKETS	64	/* count of hash buckets, a power of 2 */
+
+struct op
+{
+	uint8_t code;		/**< the operation */
+	uint8_t flags;		/**< the flags OPF_XXX */
+	uint8_t ctx;		/**< context of the value, 0, ']', '}' or ':' (pack) */
+	uint8_t count;		/**< count of concatenated strings (pack) */
+	uint16_t sizes;		/**< kinds of sizes of the strings, 2 bits each (pack) */
+	int fit;		/**< position of the operation in the descriptor */
+	int pos;		/**< position after the operation in the descriptor */
+};
+
+struct code
+{
+	int rc;			/**< result of the compilation */
+	unsigned count;		/**< count of operations */
+	struct op *ops;		/**< the operations */
+};
+
+struct wrap_json_program
+{
+	struct wrap_json_program *next;	/**< next program of the bucket */
+	const char *desc;		/**< the compiled descriptor */
+	struct code pack;		/**< the program for packing */
+	struct code unpack;		/**< the program for unpacking */
+	struct op ops[];		/**< the operations of the programs */
+};
+
+/* the compiled programs keyed by the address of their descriptor */
+static struct wrap_json_program *programs[PROGRAM_BUCKETS];
+
+static int compile_pack(const char *desc, struct code *code)
+{
+	int nstr, depth, rc;
+	char c;
+	const char *d;
+	struct { const char *acc; char type; } stack[STACKCOUNT];
+	struct op *op;
+
+	depth = 0;
+	stack[0].acc = pack_accept_any;
+	stack[0].type = 0;
+	d = skip(desc);
+	for(;;) {
+		c = *d;
+		if (!c)
+			goto truncated;
+		if (!strchr(stack[depth].acc, c))
+			goto invalid_character;
+		op = &code->ops[code->count++];
+		op->flags = 0;
+		op->fit = (int)(d - desc);
+		d = skip(++d);
+		switch(c) {
+		case 's':
+			op->code = op_string;
+			op->sizes = 0;
+			nstr = 0;
+			for (;;) {
+				if (*d == '?') {
+					d = skip(++d);
+					op->flags |= OPF_OPT;
+				}
+				switch(*d) {
+				case '%': op->sizes = (uint16_t)(op->sizes | (1 << (2 * nstr))); d = skip(++d); break;
+				case '#': op->sizes = (uint16_t)(op->sizes | (2 << (2 * nstr))); d = skip(++d); break;
+				default: break;
+				}
+				nstr++;
+				if (*d == '?') {
+					d = skip(++d);
+					op->flags |= OPF_OPT;
+				}
+				if (*d != '+')
+					break;
+				if (nstr >= STRCOUNT)
+					goto too_long;
+				d = skip(++d);
+			}
+			op->count = (uint8_t)nstr;
+			break;
+		case 'n':
+			op->code = op_null;
+			break;
+		case 'b':
+			op->code = op_bool;
+			break;
+		case 'i':
+			op->code = op_int;
+			break;
+		case 'I':
+			op->code = op_int64;
+			break;
+		case 'f':
+			op->code = op_double;
+			break;
+		case 'o':
+		case 'O':
+		case 'y':
+		case 'Y':
+			if (c == 'o' || c == 'O') {
+				op->code = op_object;
+				if (c == 'O')
+					op->flags |= OPF_REF;
+			} else {
+				op->code = op_bytes;
+				if (c == 'y')
+					op->flags |= OPF_URL;
+			}
+			if (*d == '?') {
+				d = skip(++d);
+				op->flags |= OPF_OPT;
+			}
+			break;
+		case '[':
+		case '{':
+			if (++depth >= STACKCOUNT)
+				goto too_deep;
+			if (c == '[') {
+				op->code = op_array_begin;
+				stack[depth].type = ']';
+				stack[depth].acc = pack_accept_arr;
+			} else {
+				op->code = op_object_begin;
+				stack[depth].type = '}';
+				stack[depth].acc = pack_accept_key;
+			}
+			op->pos = (int)(d - desc);
+			continue;
+		case '}':
+		case ']':
+			if (c != stack[depth].type || depth <= 0)
+				goto internal_error;
+			op->code = op_end;
+			depth--;
+			break;
+		default:
+			goto internal_error;
+		}
+		op->pos = (int)(d - desc);
+		op->ctx = (uint8_t)stack[depth].type;
+		switch (stack[depth].type) {
+		case 0:
+			if (*d)
+				goto invalid_character;
+			return 0;
+		case ']':
+			if (*d == '*') {
+				op->flags |= OPF_STAR;
+				d = skip(++d);
+			}
+			break;
+		case '}':
+			stack[depth].acc = pack_accept_any;
+			stack[depth].type = ':';
+			break;
+		case ':':
+			if (*d == '*') {
+				op->flags |= OPF_STAR;
+				d = skip(++d);
+			}
+			stack[depth].acc = pack_accept_key;
+			stack[depth].type = '}';
+			break;
+		default:
+			goto internal_error;
+		}
+	}
+
+truncated:
+	rc = wrap_json_error_truncated;
+	goto error;
+internal_error:
+	rc = wrap_json_error_internal_error;
+	goto error;
+invalid_character:
+	rc = wrap_json_error_invalid_character;
+	goto error;
+too_long:
+	rc = wrap_json_error_too_long;
+	goto error;
+too_deep:
+	rc = wrap_json_error_too_deep;
+	goto error;
+error:
+	rc = rc | (int)((d - desc) << 4);
+	return -rc;
+}
+
+static int compile_unpack(const char *desc, struct code *code)
+{
+	int depth, rc;
+	char c, xacc[2] = { 0, 0 };
+	const char *acc, *d, *fit;
+	struct { const char *acc; char type; } stack[STACKCOUNT];
+	struct op *op;
+
+	depth = -1;
+	acc = unpack_accept_any;
+	d = skip(desc);
+	for(;;) {
+		fit = d;
+		c = *d;
+		if (!c)
+			goto truncated;
+		if (!strchr(acc, c))
+			goto invalid_character;
+		d = skip(++d);
+		if (c == '*') {
+			acc = xacc;
+			continue;
+		}
+		op = &code->ops[code->count++];
+		op->flags = xacc[0] == ']' && strchr(unpack_accept_any, c) ? OPF_ELEM : 0;
+		op->fit = (int)(fit - desc);
+		op->pos = (int)(d - desc);
+		switch(c) {
+		case 's':
+			if (xacc[0] == '}') {
+				op->code = op_key;
+				if (*d == '?') {
+					op->flags |= OPF_OPT;
+					d = skip(++d);
+				}
+				xacc[0] = ':';
+				acc = unpack_accept_any;
+				continue;
+			}
+			op->code = op_string;
+			if (*d == '%') {
+				op->flags |= OPF_SIZE;
+				d = skip(++d);
+			}
+			break;
+		case 'n':
+			op->code = op_null;
+			break;
+		case 'b':
+			op->code = op_bool;
+			break;
+		case 'i':
+			op->code = op_int;
+			break;
+		case 'I':
+			op->code = op_int64;
+			break;
+		case 'f':
+			op->code = op_double;
+			break;
+		case 'F':
+			op->code = op_double_lax;
+			break;
+		case 'o':
+		case 'O':
+			op->code = op_object;
+			if (c == 'O')
+				op->flags |= OPF_REF;
+			break;
+		case 'y':
+		case 'Y':
+			op->code = op_bytes;
+			if (c == 'y')
+				op->flags |= OPF_URL;
+			break;
+		case '[':
+		case '{':
+			if (++depth >= STACKCOUNT)
+				goto too_deep;
+			stack[depth].acc = acc;
+			stack[depth].type = xacc[0];
+			if (c == '[') {
+				op->code = op_array_begin;
+				xacc[0] = ']';
+				acc = unpack_accept_arr;
+			} else {
+				op->code = op_object_begin;
+				xacc[0] = '}';
+				acc = unpack_accept_key;
+				continue;
+			}
+			break;
+		case '}':
+		case ']':
+			if (depth < 0 || c != xacc[0])
+				goto internal_error;
+			op->code = op_end;
+			acc = stack[depth].acc;
+			xacc[0] = stack[depth--].type;
+			break;
+		case '!':
+			if (*d != xacc[0])
+				goto invalid_character;
+			op->code = op_bang;
+			acc = xacc;
+			continue;
+		default:
+			goto internal_error;
+		}
+		switch (xacc[0]) {
+		case 0:
+			if (depth >= 0)
+				goto internal_error;
+			if (*d)
+				goto invalid_character;
+			return 0;
+		case ']':
+			break;
+		case ':':
+			op->flags |= OPF_VALUE;
+			acc = unpack_accept_key;
+			xacc[0] = '}';
+			break;
+		default:
+			goto internal_error;
+		}
+	}
+
+truncated:
+	rc = wrap_json_error_truncated;
+	goto error;
+internal_error:
+	rc = wrap_json_error_internal_error;
+	goto error;
+invalid_character:
+	rc = wrap_json_error_invalid_character;
+	goto error;
+too_deep:
+	rc = wrap_json_error_too_deep;
+	goto error;
+error:
+	rc = rc | (int)((d - desc) << 4);
+	return -rc;
+}
+
+/**
+ * Get the program compiled for the descriptor 'desc'
+ *
+ * The programs are cached using the address of the descriptor as key, so
+ * the descriptor must stay valid and unchanged for the whole life of the
+ * process, as string literals do.
+ *
+ * @param desc the descriptor to compile
+ * @return the compiled program or NULL if desc is NULL or out of memory
+ */
+const struct wrap_json_program *wrap_json_compile(const char *desc)
+{
+	size_t length;
+	uintptr_t hash;
+	struct wrap_json_program *program, *iter, *first, **head;
+
+	if (!desc)
+		return NULL;
+
+	/* search the program */
+	hash = (uintptr_t)desc;
+	hash ^= hash >> 6;
+	head = &programs[(hash ^ (hash >> 12)) & (PROGRAM_BUCKETS - 1)];
+	first = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+	for (iter = first ; iter ; iter = iter->next)
+		if (iter->desc == desc)
+			return iter;
+
+	/* compile it, each character emits at most one operation */
+	length = strlen(desc);
+	program = malloc(sizeof *program + 2 * length * sizeof *program->ops);
+	if (!program)
+		return NULL;
+	program->desc = desc;
+	program->pack.count = 0;
+	program->pack.ops = program->ops;
+	program->pack.rc = compile_pack(desc, &program->pack);
+	program->unpack.count = 0;
+	program->unpack.ops = &program->ops[length];
+	program->unpack.rc = compile_unpack(desc, &program->unpack);
+
+	/* record it unless an other thread did it meanwhile */
+	program->next = first;
+	while (!__atomic_compare_exchange_n(head, &program->next, program, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+		for (iter = program->next ; iter != first ; iter = iter->next) {
+			if (iter->desc == desc) {
+				free(program);
+				return iter;
+			}
+		}
+		first = program->next;
+	}
+	return program;
+}
+
+int wrap_json_vpack_program(struct json_object **result, const struct wrap_json_program *program, va_list args)
+{
+	int nstr, notnull, rc;
+	unsigned sizes;
+	size_t sz, dsz, ssz;
+	char *s;
+	char buffer[256];
+	struct { const uint8_t *in; size_t insz; char *out; size_t outsz; } bytes;
+	struct { const char *str; size_t sz; } strs[STRCOUNT];
+	struct { struct json_object *cont, *key; } stack[STACKCOUNT], *top;
+	struct json_object *obj;
+	const struct op *op;
+
+	*result = NULL;
+	if (!program)
+		return -wrap_json_error_null_spec;
+	if (program->pack.rc)
+		return program->pack.rc;
+
+	ssz = sizeof buffer;
+	s = buffer;
+	top = stack;
+	top->key = NULL;
+	top->cont = NULL;
+	for (op = program->pack.ops ; ; op++) {
+		switch(op->code) {
+		case op_string:
+			notnull = 0;
+			sz = 0;
+			sizes = op->sizes;
+			for (nstr = 0 ; nstr < op->count ; nstr++, sizes >>= 2) {
+				strs[nstr].str = va_arg(args, const char*);
+				if (strs[nstr].str)
+					notnull = 1;
+				switch(sizes & 3) {
+				case 1: strs[nstr].sz = va_arg(args, size_t); break;
+				case 2: strs[nstr].sz = (size_t)va_arg(args, int); break;
+				default: strs[nstr].sz = strs[nstr].str ? strlen(strs[nstr].str) : 0; break;
+				}
+				sz += strs[nstr].sz;
+			}
+			if (nstr == 1 && notnull)
+				obj = json_object_new_string_len(strs[0].str, (int)sz);
+			else if (notnull) {
+				if (sz > ssz) {
+					ssz += ssz;
+					if (ssz < sz)
+						ssz = sz;
+					s = alloca(sz);
+				}
+				dsz = sz;
+				while (nstr) {
+					nstr--;
+					dsz -= strs[nstr].sz;
+					memcpy(&s[dsz], strs[nstr].str, strs[nstr].sz);
+				}
+				obj = json_object_new_string_len(s, (int)sz);
+			} else if (op->flags & (OPF_OPT | OPF_STAR)) {
+				obj = NULL;
+				break;
+			} else
+				goto null_string;
+			if (!obj)
+				goto out_of_memory;
+			break;
+		case op_null:
+			obj = NULL;
+			break;
+		case op_bool:
+			obj = json_object_new_boolean(va_arg(args, int));
+			if (!obj)
+				goto out_of_memory;
+			break;
+		case op_int:
+			obj = json_object_new_int(va_arg(args, int));
+			if (!obj)
+				goto out_of_memory;
+			break;
+		case op_int64:
+			obj = json_object_new_int64(va_arg(args, int64_t));
+			if (!obj)
+				goto out_of_memory;
+			break;
+		case op_double:
+			obj = json_object_new_double(va_arg(args, double));
+			if (!obj)
+				goto out_of_memory;
+			break;
+		case op_object:
+			obj = va_arg(args, struct json_object*);
+			if (!obj && !(op->flags & (OPF_OPT | OPF_STAR)))
+				goto null_object;
+			if (op->flags & OPF_REF)
+				json_object_get(obj);
+			break;
+		case op_bytes:
+			bytes.in = va_arg(args, const uint8_t*);
+			bytes.insz = va_arg(args, size_t);
+			if (bytes.in == NULL || bytes.insz == 0)
+				obj = NULL;
+			else {
+				rc = encode_base64(bytes.in, bytes.insz,
+					&bytes.out, &bytes.outsz, 0, 0, op->flags & OPF_URL);
+				if (rc)
+					goto error;
+				obj = json_object_new_string_len(bytes.out, (int)bytes.outsz);
+				free(bytes.out);
+				if (!obj)
+					goto out_of_memory;
+			}
+			if (!obj && !(op->flags & (OPF_OPT | OPF_STAR))) {
+				obj = json_object_new_string_len("", 0);
+				if (!obj)
+					goto out_of_memory;
+			}
+			break;
+		case op_array_begin:
+		case op_object_begin:
+			top++;
+			top->key = NULL;
+			top->cont = op->code == op_array_begin ? json_object_new_array() : json_object_new_object();
+			if (!top->cont)
+				goto out_of_memory;
+			continue;
+		case op_end:
+			obj = (top--)->cont;
+			if ((op->flags & OPF_STAR) && !(json_object_is_type(obj, json_type_object)
+					? json_object_object_length(obj) : json_object_array_length(obj))) {
+				json_object_put(obj);
+				obj = NULL;
+			}
+			break;
+		default:
+			goto internal_error;
+		}
+		switch (op->ctx) {
+		case 0:
+			*result = obj;
+			return 0;
+		case ']':
+			if (obj || !(op->flags & OPF_STAR))
+				json_object_array_add(top->cont, obj);
+			break;
+		case '}':
+			if (!obj)
+				goto null_key;
+			top->key = obj;
+			break;
+		case ':':
+			if (obj || !(op->flags & OPF_STAR))
+				json_object_object_add(top->cont, json_object_get_string(top->key), obj);
+			json_object_put(top->key);
+			top->key = NULL;
+			break;
+		default:
+			goto internal_error;
+		}
+	}
+
+null_object:
+	rc = wrap_json_error_null_object;
+	goto error;
+internal_error:
+	rc = wrap_json_error_internal_error;
+	goto error;
+out_of_memory:
+	rc = wrap_json_error_out_of_memory;
+	goto error;
+null_key:
+	rc = wrap_json_error_null_key;
+	goto error;
+null_string:
+	rc = wrap_json_error_null_string;
+	goto error;
+error:
+	do {
+		json_object_put(top->key);
+		json_object_put(top->cont);
+	} while (--top >= stack);
+	rc = rc | (op->pos << 4);
+	return -rc;
+}
+
+int wrap_json_pack_program(struct json_object **result, const struct wrap_json_program *program, ...)
+{
+	int rc;
+	va_list args;
+
+	va_start(args, program);
+	rc = wrap_json_vpack_program(result, program, args);
+	va_end(args);
+	return rc;
+}
+
+static int vunpack_program(struct json_object *object, const struct wrap_json_program *program, va_list args, int store)
+{
+	int rc = 0, ignore;
+	const char *key;
+	const char **ps;
+	double *pf;
+	int *pi;
+	int64_t *pI;
+	size_t *pz;
+	uint8_t **py;
+	struct { struct json_object *parent; int index; int count; } stack[STACKCOUNT], *top;
+	struct json_object *obj;
+	struct json_object **po;
+	const struct op *op, *end;
+
+	if (!program)
+		return -wrap_json_error_null_spec;
+	if (program->unpack.rc)
+		return program->unpack.rc;
+
+	ignore = 0;
+	top = NULL;
+	obj = object;
+	op = program->unpack.ops;
+	for (end = &op[program->unpack.count] ; op != end ; op++) {
+		if ((op->flags & OPF_ELEM) && !ignore) {
+			if (top->index >= top->count)
+				goto out_of_range;
+			obj = json_object_array_get_idx(top->parent, top->index++);
+		}
+		switch(op->code) {
+		case op_key:
+			key = va_arg(args, const char *);
+			if (!key)
+				goto null_key;
+			if (ignore)
+				ignore++;
+			else if (json_object_object_get_ex(top->parent, key, &obj))
+				top->index++;
+			else if (!(op->flags & OPF_OPT))
+				goto key_not_found;
+			else {
+				ignore = 1;
+				obj = NULL;
+			}
+			continue;
+		case op_string:
+			ps = store ? va_arg(args, const char **) : NULL;
+			if (!ignore) {
+				if (!json_object_is_type(obj, json_type_string))
+					goto missfit;
+				if (ps)
+					*ps = json_object_get_string(obj);
+			}
+			if (op->flags & OPF_SIZE && store) {
+				pz = va_arg(args, size_t *);
+				if (!ignore && pz)
+					*pz = (size_t)json_object_get_string_len(obj);
+			}
+			break;
+		case op_null:
+			if (!ignore && !json_object_is_type(obj, json_type_null))
+				goto missfit;
+			break;
+		case op_bool:
+			pi = store ? va_arg(args, int *) : NULL;
+			if (!ignore) {
+				if (!json_object_is_type(obj, json_type_boolean))
+					goto missfit;
+				if (pi)
+					*pi = json_object_get_boolean(obj);
+			}
+			break;
+		case op_int:
+			pi = store ? va_arg(args, int *) : NULL;
+			if (!ignore) {
+				if (!json_object_is_type(obj, json_type_int))
+					goto missfit;
+				if (pi)
+					*pi = json_object_get_int(obj);
+			}
+			break;
+		case op_int64:
+			pI = store ? va_arg(args, int64_t *) : NULL;
+			if (!ignore) {
+				if (!json_object_is_type(obj, json_type_int))
+					goto missfit;
+				if (pI)
+					*pI = json_object_get_int64(obj);
+			}
+			break;
+		case op_double:
+		case op_double_lax:
+			pf = store ? va_arg(args, double *) : NULL;
+			if (!ignore) {
+				if (!(json_object_is_type(obj, json_type_double)
+				   || (op->code == op_double_lax && json_object_is_type(obj, json_type_int))))
+					goto missfit;
+				if (pf)
+					*pf = json_object_get_double(obj);
+			}
+			break;
+		case op_object:
+			po = store ? va_arg(args, struct json_object **) : NULL;
+			if (!ignore && po) {
+				if (op->flags & OPF_REF)
+					obj = json_object_get(obj);
+				*po = obj;
+			}
+			break;
+		case op_bytes:
+			py = store ? va_arg(args, uint8_t **) : NULL;
+			pz = store ? va_arg(args, size_t *) : NULL;
+			if (!ignore) {
+				if (obj == NULL) {
+					if (py && pz) {
+						*py = NULL;
+						*pz = 0;
+					}
+				} else {
+					if (!json_object_is_type(obj, json_type_string))
+						goto missfit;
+					if (py && pz) {
+						rc = decode_base64(
+							json_object_get_string(obj),
+							(size_t)json_object_get_string_len(obj),
+							py, pz, op->flags & OPF_URL);
+						if (rc)
+							goto error;
+					}
+				}
+			}
+			break;
+		case op_array_begin:
+		case op_object_begin:
+			top = top ? top + 1 : stack;
+			top->index = 0;
+			top->parent = obj;
+			if (ignore)
+				ignore++;
+			else if (op->code == op_array_begin) {
+				if (!json_object_is_type(obj, json_type_array))
+					goto missfit;
+				top->count = (int)json_object_array_length(obj);
+			} else {
+				if (!json_object_is_type(obj, json_type_object))
+					goto missfit;
+				top->count = json_object_object_length(obj);
+			}
+			break;
+		case op_end:
+			top = top == stack ? NULL : top - 1;
+			if (ignore)
+				ignore--;
+			break;
+		case op_bang:
+			if (!ignore && top->index != top->count)
+				goto incomplete;
+			continue;
+		default:
+			goto internal_error;
+		}
+		if ((op->flags & OPF_VALUE) && ignore)
+			ignore--;
+	}
+	return 0;
+
+internal_error:
+	rc = wrap_json_error_internal_error;
+	goto error;
+null_key:
+	rc = wrap_json_error_null_key;
+	goto error;
+out_of_range:
+	rc = wrap_json_error_out_of_range;
+	goto errorfit;
+incomplete:
+	rc = wrap_json_error_incomplete;
+	goto error;
+missfit:
+	rc = wrap_json_error_missfit_type;
+	goto errorfit;
+key_not_found:
+	rc = wrap_json_error_key_not_found;
+	goto error;
+errorfit:
+	rc = rc | (op->fit << 4);
+	return -rc;
+error:
+	rc = rc | (op->pos << 4);
+	return -rc;
+}
+
+int wrap_json_vcheck_program(struct json_object *object, const struct wrap_json_program *program, va_list args)
+{
+	return vunpack_program(object, program, args, 0);
+}
+
+int wrap_json_check_program(struct json_object *object, const struct wrap_json_program *program, ...)
+{
+	int rc;
+	va_list args;
+
+	va_start(args, program);
+	rc = vunpack_program(object, program, args, 0);
+	va_end(args);
+	return rc;
+}
+
+int wrap_json_vunpack_program(struct json_object *object, const struct wrap_json_program *program, va_list args)
+{
+	return vunpack_program(object, program, args, 1);
+}
+
+int wrap_json_unpack_program(struct json_object *object, const struct wrap_json_program *program, ...)
+{
+	int rc;
+	va_list args;
+
+	va_start(args, program);
+	rc = vunpack_program(object, program, args, 1);
+	va_end(args);
+	return rc;
+}
+
 static void object_for_all(struct json_object *object, void (*callback)(void*,struct json_object*,const char*), void *closure)
 {
 	struct json_object_iterator it = json_object_iter_begin(object);
@@ -1249,6 +2095,93 @@ int wrap_json_contains(struct json_object *x, struct json_object *y)
 	return !jcmp(x, y, 1, 0);
 }
 
+/* mixes the 'value' in the hash 'h' */
+static uint64_t hmix(uint64_t h, uint64_t value)
+{
+	h ^= value;
+	h *= UINT64_C(0x100000001b3);
+	return h ^ (h >> 29);
+}
+
+/* hash of the string 's' */
+static uint64_t hstr(uint64_t h, const char *s)
+{
+	while (*s)
+		h = hmix(h, (uint64_t)(unsigned char)*s++);
+	return hmix(h, 0);
+}
+
+static uint64_t jhash(struct json_object *object)
+{
+	double d;
+	uint64_t h, sum;
+	int i, n;
+	enum json_type type;
+	struct json_object_iterator it, end;
+
+	type = json_object_get_type(object);
+	h = hmix(UINT64_C(0xcbf29ce484222325), (uint64_t)type);
+	switch (type) {
+	default:
+	case json_type_null:
+		break;
+
+	case json_type_boolean:
+		h = hmix(h, (uint64_t)json_object_get_boolean(object));
+		break;
+
+	case json_type_double:
+		d = json_object_get_double(object);
+		if (d == 0)
+			d = 0; /* same hash for -0 and 0 that are equal */
+		memcpy(&sum, &d, sizeof sum);
+		h = hmix(h, sum);
+		break;
+
+	case json_type_int:
+		h = hmix(h, (uint64_t)json_object_get_int64(object));
+		break;
+
+	case json_type_object:
+		/* the sum doesn't depend on the order of the fields */
+		sum = 0;
+		it = json_object_iter_begin(object);
+		end = json_object_iter_end(object);
+		while (!json_object_iter_equal(&it, &end)) {
+			sum += hmix(hstr(h, json_object_iter_peek_name(&it)),
+				    jhash(json_object_iter_peek_value(&it)));
+			json_object_iter_next(&it);
+		}
+		h = hmix(h, sum);
+		break;
+
+	case json_type_array:
+		n = (int)json_object_array_length(object);
+		for (i = 0 ; i < n ; i++)
+			h = hmix(h, jhash(json_object_array_get_idx(object, i)));
+		break;
+
+	case json_type_string:
+		h = hstr(h, json_object_get_string(object));
+		break;
+	}
+	return h;
+}
+
+/**
+ * Computes a hash of 'object' consistent with 'wrap_json_equal':
+ * equal objects have the same hash, whatever is the order of
+ * their fields.
+ *
+ * @param object the object to hash
+ *
+ * @return the hash of the object
+ */
+uint64_t wrap_json_hash(struct json_object *object)
+{
+	return jhash(object);
+}
+
 #if defined(WRAP_JSON_TEST)
 #include <stdio.h>
 #if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
@@ -23,6 +23,7 @@
 #endif
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <json-c/json.h>
 
 extern int wrap_json_get_error_position(int rc);
@@ -39,6 +40,15 @@ extern int wrap_json_check(struct json_object *object, const char *desc, ...);
 extern int wrap_json_vmatch(struct json_object *object, const char *desc, va_list args);
 extern int wrap_json_match(struct json_object *object, const char *desc, ...);
 
+struct wrap_json_program;
+extern const struct wrap_json_program *wrap_json_compile(const char *desc);
+extern int wrap_json_vpack_program(struct json_object **result, const struct wrap_json_program *program, va_list args);
+extern int wrap_json_pack_program(struct json_object **result, const struct wrap_json_program *program, ...);
+extern int wrap_json_vunpack_program(struct json_object *object, const struct wrap_json_program *program, va_list args);
+extern int wrap_json_unpack_program(struct json_object *object, const struct wrap_json_program *program, ...);
+extern int wrap_json_vcheck_program(struct json_object *object, const struct wrap_json_program *program, va_list args);
+extern int wrap_json_check_program(struct json_object *object, const struct wrap_json_program *program, ...);
+
 extern void wrap_json_optarray_for_all(struct json_object *object, void (*callback)(void*,struct json_object*), void *closure);
 extern void wrap_json_array_for_all(struct json_object *object, void (*callback)(void*,struct json_object*), void *closure);
 extern void wrap_json_object_for_all(struct json_object *object, void (*callback)(void*,struct json_object*,const char*), void *closure);
@@ -56,6 +66,7 @@ extern struct json_object *wrap_json_keys(struct json_object *object);
 extern int wrap_json_cmp(struct json_object *x, struct json_object *y);
 extern int wrap_json_equal(struct json_object *x, struct json_object *y);
 extern int wrap_json_contains(struct json_object *x, struct json_object *y);
+extern uint64_t wrap_json_hash(struct json_object *object);
 
 #ifdef __cplusplus
     }